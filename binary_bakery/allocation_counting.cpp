@@ -0,0 +1,27 @@
+#include <cstdlib>
+#include <new>
+
+#include <binary_bakery_lib/metrics.h>
+
+
+// Replaces the global allocation functions of the executable. The array and nothrow forms forward to these.
+// Over-aligned allocations aren't counted.
+auto operator new(const std::size_t size) -> void*
+{
+   bb::count_allocation();
+   if (void* ptr = std::malloc(size == 0 ? 1 : size))
+      return ptr;
+   throw std::bad_alloc{};
+}
+
+
+auto operator delete(void* ptr) noexcept -> void
+{
+   std::free(ptr);
+}
+
+
+auto operator delete(void* ptr, std::size_t) noexcept -> void
+{
+   std::free(ptr);
+}
@@ -1,5 +1,9 @@
+#include <algorithm>
 #include <chrono>
+#include <fstream>
+#include <set>
 
+#include <binary_bakery_lib/cache.h>
 #include <binary_bakery_lib/config.h>
 #include <binary_bakery_lib/file_tools.h>
 #include <binary_bakery_lib/payload.h>
@@ -39,17 +43,22 @@ namespace bb {
 
    // move this to config header?
    [[nodiscard]] auto get_config(
-      const std::vector<abs_file_path>& packing_files
+      const std::vector<abs_file_path>& packing_files,
+      const std::vector<abs_directory_path>& packing_dirs
    ) -> config
    {
-      // First: Try to get the config from the directory of the first file
-      if(packing_files.empty() == false)
+      // First: Try to get the config from the directory of the first file, or the first directory
+      std::optional<abs_directory_path> payload_dir;
+      if (packing_files.empty() == false)
+         payload_dir.emplace(packing_files[0].get_path().parent_path());
+      else if (packing_dirs.empty() == false)
+         payload_dir.emplace(packing_dirs[0]);
+      if (payload_dir.has_value())
       {
-         const abs_directory_path payload_dir{ packing_files[0].get_path().parent_path() };
-         const std::optional<config> target_dir_cfg = get_cfg_from_dir(payload_dir);
+         const std::optional<config> target_dir_cfg = get_cfg_from_dir(payload_dir.value());
          if (target_dir_cfg.has_value())
          {
-            fmt::print("Using config from \"{}\".\n", payload_dir.get_path().string());
+            fmt::print("Using config from \"{}\".\n", payload_dir->get_path().string());
             return target_dir_cfg.value();
          }
       }
@@ -81,36 +90,77 @@ namespace bb {
 #endif
    }
 
-   // From the inputs, filter out all non-files and non-existing files. Also try to find a config
-   // among the parameters
+   // The command line parameters. A parameter "@list.txt" is replaced by the lines of that file, which allows
+   // input lists of any length.
+   [[nodiscard]] auto get_arguments(
+      int argc,
+      char* argv[]
+   ) -> std::vector<std::string>
+   {
+      std::vector<std::string> result;
+      result.reserve(argc - 1);
+      for (int i = 1; i < argc; ++i)
+      {
+         const std::string argument = argv[i];
+         if (argument.starts_with('@') == false)
+         {
+            result.push_back(argument);
+            continue;
+         }
+         std::ifstream response_file(argument.substr(1));
+         if (response_file.is_open() == false)
+         {
+            fmt::print("Couldn't open response file {} -> skipping.\n", argument.substr(1));
+            continue;
+         }
+         std::string line;
+         while (std::getline(response_file, line))
+         {
+            if (line.empty() == false && line.back() == '\r')
+               line.pop_back();
+            if (line.empty() == false)
+               result.push_back(line);
+         }
+      }
+      return result;
+   }
+
+
+   // From the inputs, filter out all non-existing paths. Also try to find a config among the parameters.
+   // Directories are only expanded once the config is known, since it contains the patterns for their files.
    struct input_files {
       std::vector<abs_file_path> m_packing_files;
+      std::vector<abs_directory_path> m_packing_dirs;
       std::optional<config> m_config;
    };
 
 
    [[nodiscard]] auto get_input_files(
-      int argc,
-      char* argv[]
+      const std::vector<std::string>& arguments
    ) -> input_files
    {
       input_files result;
-      result.m_packing_files.reserve(argc - 1);
-      for (int i = 1; i < argc; ++i)
+      result.m_packing_files.reserve(arguments.size());
+      for (const std::string& argument : arguments)
       {
-         // Path must exist and must be a file
-         if (std::filesystem::exists(argv[i]) == false)
+         // Path must exist and must be a file or directory
+         if (std::filesystem::exists(argument) == false)
          {
-            fmt::print("Path doesn't exist: {} -> skipping.\n", argv[i]);
+            fmt::print("Path doesn't exist: {} -> skipping.\n", argument);
             continue;
          }
-         if (std::filesystem::is_regular_file(argv[i]) == false)
+         if (std::filesystem::is_directory(argument))
          {
-            fmt::print("Path is not a file: {} -> skipping.\n", argv[i]);
+            result.m_packing_dirs.emplace_back(argument);
+            continue;
+         }
+         if (std::filesystem::is_regular_file(argument) == false)
+         {
+            fmt::print("Path is not a file: {} -> skipping.\n", argument);
             continue;
          }
 
-         const abs_file_path file{ argv[i] };
+         const abs_file_path file{ argument };
 
          if (file.get_path().extension() == ".toml")
          {
@@ -133,31 +183,158 @@ namespace bb {
    }
 
 
+   // The input files followed by the files in the input directories
+   [[nodiscard]] auto get_packing_files(
+      const input_files& inputs,
+      const config& cfg,
+      const abs_directory_path& working_dir,
+      const bool print_counts
+   ) -> std::vector<abs_file_path>
+   {
+      std::vector<abs_file_path> result = inputs.m_packing_files;
+      for (const abs_directory_path& dir : inputs.m_packing_dirs)
+      {
+         const std::vector<abs_file_path> dir_files = get_directory_inputs(dir, cfg, working_dir);
+         result.insert(result.end(), dir_files.begin(), dir_files.end());
+         if (print_counts)
+            fmt::print("Found {} files in \"{}\".\n", dir_files.size(), dir.get_path().string());
+      }
+      return result;
+   }
+
+
+   auto bake(
+      const std::vector<abs_file_path>& files,
+      const config& cfg,
+      const abs_directory_path& working_dir,
+      const std::shared_ptr<const payload_cache>& cache
+   ) -> void
+   {
+      std::vector<payload> payloads = get_payloads(files, cfg, cache);
+
+      timer t("Time to write");
+      write_payloads_to_file(cfg, std::move(payloads), working_dir);
+   }
+
+
+   // The input directories with their subdirectories, and the directories of the input files. Editors often save by
+   // renaming a new file over the old one, so the directories are watched instead of the files.
+   [[nodiscard]] auto get_watched_directories(
+      const input_files& inputs
+   ) -> std::vector<watched_directory>
+   {
+      std::vector<watched_directory> result;
+      for (const abs_directory_path& dir : inputs.m_packing_dirs)
+         result.push_back(watched_directory{ dir, true });
+      std::set<fs::path> file_dirs;
+      for (const abs_file_path& file : inputs.m_packing_files)
+         file_dirs.insert(file.get_path().parent_path());
+      for (const fs::path& dir : file_dirs)
+         result.push_back(watched_directory{ abs_directory_path{ dir }, false });
+      return result;
+   }
+
+
+   // Changes to other files, ie the outputs or temporary files next to the inputs, are ignored
+   [[nodiscard]] auto is_rebake_needed(
+      const std::vector<fs::path>& changes,
+      const std::vector<abs_file_path>& previous_files,
+      const std::vector<abs_file_path>& files,
+      const std::vector<watched_directory>& watched_dirs
+   ) -> bool
+   {
+      const auto get_paths = [](const std::vector<abs_file_path>& abs_paths) {
+         std::set<fs::path> paths;
+         for (const abs_file_path& abs_path : abs_paths)
+            paths.insert(abs_path.get_path());
+         return paths;
+      };
+      const std::set<fs::path> previous_paths = get_paths(previous_files);
+      if (get_paths(files) != previous_paths)
+         return true;
+      return std::any_of(changes.begin(), changes.end(), [&](const fs::path& change) {
+         const bool is_lost_change = std::any_of(watched_dirs.begin(), watched_dirs.end(), [&](const watched_directory& dir) {
+            return dir.m_dir.get_path() == change;
+         });
+         return is_lost_change || previous_paths.contains(change);
+      });
+   }
+
+
+   // Bakes again whenever an input changes, until the process is stopped. The config, the thread pool with the
+   // compression contexts of its threads and the content hashes of unchanged files stay around between bakes.
+   // Unchanged payloads come from the cache, and only output files whose content changed are written.
+   auto watch(
+      const input_files& inputs,
+      config cfg,
+      const abs_directory_path& working_dir
+   ) -> void
+   {
+      cfg.cache = true;
+      cfg.prompt_for_key = false;
+      const auto cache = std::make_shared<const payload_cache>(get_cache_directory(cfg, working_dir));
+      std::vector<abs_file_path> files = get_packing_files(inputs, cfg, working_dir, true);
+      const std::vector<watched_directory> watched_dirs = get_watched_directories(inputs);
+      file_watcher watcher(watched_dirs);
+      bool needs_bake = true;
+      while (true)
+      {
+         // A failed bake, ie from a half-written file, is repeated with the next change
+         if (needs_bake)
+         {
+            try
+            {
+               bake(files, cfg, working_dir, cache);
+            }
+            catch (const std::exception& e)
+            {
+               fmt::print("Baking failed: {}\n", e.what());
+            }
+            fmt::print("Watching for changes, stop with Ctrl+C.\n");
+         }
+
+         const std::vector<fs::path> changes = watcher.wait_for_changes(std::chrono::milliseconds{ 100 });
+         try
+         {
+            std::vector<abs_file_path> new_files = get_packing_files(inputs, cfg, working_dir, false);
+            needs_bake = is_rebake_needed(changes, files, new_files, watched_dirs);
+            files = std::move(new_files);
+         }
+         catch (const std::exception& e)
+         {
+            fmt::print("Couldn't list the input files: {}\n", e.what());
+            needs_bake = false;
+         }
+      }
+   }
+
+
    auto run(
       int argc,
       char* argv[]
    ) -> void
    {
-      const input_files inputs = get_input_files(argc, argv);
+      std::vector<std::string> arguments = get_arguments(argc, argv);
+      const bool is_watching = std::erase(arguments, std::string{ "--watch" }) > 0;
+      const input_files inputs = get_input_files(arguments);
       const config cfg = [&]() {
          if (inputs.m_config.has_value())
             return inputs.m_config.value();
          else
-            return get_config(inputs.m_packing_files);
+            return get_config(inputs.m_packing_files, inputs.m_packing_dirs);
       }();
 
-      std::vector<payload> payloads;
-      payloads.reserve(inputs.m_packing_files.size());
-      for (const abs_file_path& file : inputs.m_packing_files)
+      const abs_directory_path working_dir{ fs::current_path() };
+      if (is_watching)
       {
-         payloads.emplace_back(get_payload(file, cfg));
+         watch(inputs, cfg, working_dir);
+         return;
       }
 
-      {
-         timer t("Time to write");
-         const abs_directory_path working_dir{ fs::current_path() };
-         write_payloads_to_file(cfg, std::move(payloads), working_dir);
-      }
+      std::shared_ptr<const payload_cache> cache;
+      if (cfg.cache)
+         cache = std::make_shared<const payload_cache>(get_cache_directory(cfg, working_dir));
+      bake(get_packing_files(inputs, cfg, working_dir, true), cfg, working_dir, cache);
 
       if (cfg.prompt_for_key)
          wait_for_keypress();
@@ -0,0 +1,344 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <span>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <binary_bakery_lib/config.h>
+#include <binary_bakery_lib/file_tools.h>
+#include <binary_bakery_lib/payload.h>
+#include <binary_bakery_lib/tools.h>
+#include <binary_bakery_bench_settings.h>
+
+#define BAKERY_PROVIDE_VECTOR
+#define BAKERY_PROVIDE_LZ4
+#define BAKERY_PROVIDE_ZSTD
+#include <binary_bakery_decoder.h>
+
+#include <fmt/format.h>
+
+
+namespace
+{
+
+   struct bench_settings {
+      fs::path m_dataset_dir = bb::benchDatasetDir;
+      fs::path m_output_path = "binary_bakery_bench.json"; // Not stdout, the baking writes its progress there
+      std::string m_compile_command{ bb::benchCompileCommand }; // Empty: No compile time measurements
+      size_t m_max_compile_size = 4 * 1024 * 1024; // Bigger inputs take too long to compile for a quick run
+      int m_repetitions = 5;
+   };
+
+
+   struct encode_result {
+      double m_load_ms = 0.0;
+      double m_compress_ms = 0.0;
+      double m_format_ms = 0.0; // Hex output of the final payload, without compression
+      size_t m_compressed_size = 0;
+      size_t m_header_size = 0;
+   };
+
+
+   struct decode_result {
+      double m_vector_mb_per_s = 0.0;
+      double m_pointer_mb_per_s = 0.0;
+   };
+
+
+   [[nodiscard]] auto get_ms_since(const std::chrono::high_resolution_clock::time_point& t0) -> double
+   {
+      return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+   }
+
+
+   [[nodiscard]] auto get_mode_name(const bb::compression_mode mode) -> std::string
+   {
+      switch (mode) {
+      case bb::compression_mode::none: return "none";
+      case bb::compression_mode::zstd: return "zstd";
+      case bb::compression_mode::lz4: return "lz4";
+      default: return "auto";
+      }
+   }
+
+
+   [[nodiscard]] auto get_settings(const int argc, char* argv[]) -> bench_settings
+   {
+      bench_settings settings;
+      for (int i = 1; i < argc; ++i)
+      {
+         const std::string arg = argv[i];
+         const bool has_value = i + 1 < argc;
+         if (arg == "--datasets" && has_value)
+            settings.m_dataset_dir = argv[++i];
+         else if (arg == "--output" && has_value)
+            settings.m_output_path = argv[++i];
+         else if (arg == "--compiler" && has_value)
+            settings.m_compile_command = argv[++i];
+         else if (arg == "--no-compile")
+            settings.m_compile_command.clear();
+         else if (arg == "--max-compile-size" && has_value)
+            settings.m_max_compile_size = std::stoull(argv[++i]);
+         else if (arg == "--repetitions" && has_value)
+            settings.m_repetitions = std::max(1, std::stoi(argv[++i]));
+         else
+            fmt::print(stderr, "Ignoring unknown argument \"{}\"\n", arg);
+      }
+      return settings;
+   }
+
+
+   // The PNGs of the dataset directory, sorted by name, plus random binaries in the working directory
+   [[nodiscard]] auto get_inputs(
+      const bench_settings& settings,
+      const fs::path& working_dir
+   ) -> std::vector<bb::abs_file_path>
+   {
+      std::vector<fs::path> images;
+      for (const fs::directory_entry& entry : fs::directory_iterator(settings.m_dataset_dir))
+      {
+         if (entry.is_regular_file() && entry.path().extension() == ".png")
+            images.push_back(entry.path());
+      }
+      std::sort(images.begin(), images.end());
+      std::vector<bb::abs_file_path> inputs(images.begin(), images.end());
+
+      std::mt19937_64 rng(42);
+      for (const size_t size : { size_t{ 1024 }, size_t{ 1024 * 1024 }, size_t{ 16 * 1024 * 1024 } })
+      {
+         std::vector<uint64_t> words(size / sizeof(uint64_t));
+         for (uint64_t& word : words)
+            word = rng();
+         const fs::path path = working_dir / fmt::format("random_{}.bin", size);
+         std::ofstream file(path, std::ios::binary);
+         file.write(reinterpret_cast<const char*>(words.data()), static_cast<std::streamsize>(size));
+         file.close();
+         inputs.emplace_back(path);
+      }
+      return inputs;
+   }
+
+
+   [[nodiscard]] auto get_encode_result(
+      const bb::abs_file_path& input,
+      const bb::config& cfg,
+      const int repetitions,
+      std::vector<uint64_t>& payload_words,
+      std::string& header
+   ) -> encode_result
+   {
+      encode_result result{ 1e30, 1e30, 1e30 };
+      const std::string name = input.get_path().filename().string();
+      for (int i = 0; i < repetitions; ++i)
+      {
+         auto t0 = std::chrono::high_resolution_clock::now();
+         bb::payload pl = bb::get_payload(input, cfg);
+         result.m_load_ms = std::min(result.m_load_ms, get_ms_since(t0));
+
+         t0 = std::chrono::high_resolution_clock::now();
+         const bb::detail::final_payload final_pl = bb::detail::get_final_payload(pl, cfg);
+         result.m_compress_ms = std::min(result.m_compress_ms, get_ms_since(t0));
+
+         t0 = std::chrono::high_resolution_clock::now();
+         const std::string payload_str = bb::detail::get_payload_str(final_pl, name, cfg);
+         result.m_format_ms = std::min(result.m_format_ms, get_ms_since(t0));
+
+         const std::span<const uint8_t> data = final_pl.get_data();
+         payload_words.assign((final_pl.m_header.size() + data.size() + sizeof(uint64_t) - 1) / sizeof(uint64_t), 0);
+         std::memcpy(payload_words.data(), final_pl.m_header.data(), final_pl.m_header.size());
+         std::memcpy(reinterpret_cast<uint8_t*>(payload_words.data()) + final_pl.m_header.size(), data.data(), data.size());
+         result.m_compressed_size = bb::get_compressed_size(payload_words.data());
+      }
+
+      // The complete header, for its size and the compile times
+      std::vector<bb::payload> payloads;
+      payloads.push_back(bb::get_payload(input, cfg));
+      std::ostringstream out;
+      bb::write_payloads_to_stream(cfg, std::move(payloads), out);
+      header = std::move(out).str();
+      result.m_header_size = header.size();
+      return result;
+   }
+
+
+   [[nodiscard]] auto get_decode_result(
+      const std::vector<uint64_t>& payload_words,
+      const int repetitions
+   ) -> decode_result
+   {
+      const uint64_t* source = payload_words.data();
+      const double mb = bb::get_decompressed_size(source) / (1024.0 * 1024.0);
+      std::vector<uint8_t> target(bb::get_decompressed_size(source));
+
+      decode_result result;
+      for (int i = 0; i < repetitions; ++i)
+      {
+         auto t0 = std::chrono::high_resolution_clock::now();
+         const std::vector<uint8_t> decoded = bb::decode_to_vector<uint8_t>(source);
+         result.m_vector_mb_per_s = std::max(result.m_vector_mb_per_s, mb / (get_ms_since(t0) / 1000.0));
+
+         t0 = std::chrono::high_resolution_clock::now();
+         bb::decode_into_pointer(source, target.data());
+         result.m_pointer_mb_per_s = std::max(result.m_pointer_mb_per_s, mb / (get_ms_since(t0) / 1000.0));
+      }
+      return result;
+   }
+
+
+   // Time to compile a translation unit that includes the generated header, negative if the compiler failed
+   [[nodiscard]] auto get_compile_ms(
+      const bench_settings& settings,
+      const std::string& header,
+      const fs::path& working_dir
+   ) -> double
+   {
+      const fs::path header_path = working_dir / "payload.h";
+      const fs::path source_path = working_dir / "payload_user.cpp";
+      std::ofstream(header_path, std::ios::binary) << header;
+      std::ofstream(source_path) << "#include \"payload.h\"\nauto main() -> int { return bb::get_payload(bb::payload_id{}) == nullptr; }\n";
+
+      const std::string command = fmt::format("{} \"{}\"", settings.m_compile_command, source_path.string());
+      const auto t0 = std::chrono::high_resolution_clock::now();
+      const int exit_code = std::system(command.c_str());
+      const double ms = get_ms_since(t0);
+      return exit_code == 0 ? ms : -1.0;
+   }
+
+
+   // Compile-time lookups: the time to compile a translation unit with 2'000 repetitions of reading the first 18 bytes
+   // of a payload at compile time, through single get_element() calls or one get_elements() call. Both are checked
+   // against the checksum computed at runtime.
+   struct constexpr_lookup_result {
+      double m_single_ms = -1.0;
+      double m_bulk_ms = -1.0;
+   };
+
+   constexpr int constexpr_lookup_repetitions = 2'000;
+   constexpr int constexpr_lookup_bytes = 18;
+
+
+   [[nodiscard]] auto get_constexpr_lookup_result(
+      const bench_settings& settings,
+      const fs::path& working_dir
+   ) -> constexpr_lookup_result
+   {
+      std::vector<uint8_t> bytes(constexpr_lookup_bytes);
+      for (int i = 0; i < constexpr_lookup_bytes; ++i)
+         bytes[i] = static_cast<uint8_t>(i * 37 + 11);
+      bb::config cfg{};
+      std::vector<bb::payload> payloads;
+      payloads.push_back(bb::get_payload(bytes, bb::generic_binary{}, "lookup.bin"));
+      std::ostringstream header;
+      bb::write_payloads_to_stream(cfg, std::move(payloads), header);
+      std::ofstream(working_dir / "lookup_payload.h", std::ios::binary) << header.str();
+
+      uint64_t expected = 0;
+      for (int i = 0; i < constexpr_lookup_repetitions; ++i)
+         for (const uint8_t byte : bytes)
+            expected = expected * 31 + byte;
+
+      const auto get_ms = [&](const std::string& loop) {
+         const fs::path source_path = working_dir / "lookup_user.cpp";
+         std::ofstream source(source_path);
+         source << "#include \"lookup_payload.h\"\n#include <binary_bakery_decoder.h>\n";
+         source << "constexpr auto get_checksum() -> uint64_t {\n";
+         source << "   constexpr const uint64_t* ptr = bb::get_payload(\"lookup.bin\");\n";
+         source << "   uint64_t checksum = 0;\n";
+         source << fmt::format("   for (int i = 0; i < {}; ++i)\n", constexpr_lookup_repetitions);
+         source << loop;
+         source << "   return checksum;\n}\n";
+         source << fmt::format("static_assert(get_checksum() == {}ull);\n", expected);
+         source.close();
+
+         const std::string command = fmt::format(
+            "{} {} -I\"{}\" \"{}\"",
+            settings.m_compile_command, bb::benchConstexprLimitFlag, bb::benchDecoderIncludeDir.string(), source_path.string()
+         );
+         const auto t0 = std::chrono::high_resolution_clock::now();
+         const int exit_code = std::system(command.c_str());
+         const double ms = get_ms_since(t0);
+         return exit_code == 0 ? ms : -1.0;
+      };
+
+      constexpr_lookup_result result;
+      result.m_single_ms = get_ms(fmt::format(
+         "      for (int j = 0; j < {}; ++j)\n         checksum = checksum * 31 + bb::get_element<uint8_t>(ptr, j);\n",
+         constexpr_lookup_bytes
+      ));
+      result.m_bulk_ms = get_ms(fmt::format(
+         "      for (const uint8_t byte : bb::get_elements<uint8_t, {}>(ptr, 0))\n         checksum = checksum * 31 + byte;\n",
+         constexpr_lookup_bytes
+      ));
+      return result;
+   }
+
+} // namespace {}
+
+
+// Encodes and decodes the sample datasets and a few random binaries with every compression mode and prints the results
+// as JSON. Usage: binary_bakery_bench [--datasets dir] [--output binary_bakery_bench.json] [--compiler "command"] [--no-compile]
+// [--max-compile-size bytes] [--repetitions n]
+auto main(int argc, char* argv[]) -> int
+{
+   const bench_settings settings = get_settings(argc, argv);
+   const fs::path working_dir = fs::temp_directory_path() / "binary_bakery_bench";
+   fs::create_directories(working_dir);
+
+   std::string json = "{\n  \"results\": [";
+   bool first_result = true;
+   for (const bb::abs_file_path& input : get_inputs(settings, working_dir))
+   {
+      for (const bb::compression_mode mode : { bb::compression_mode::none, bb::compression_mode::lz4, bb::compression_mode::zstd })
+      {
+         bb::config cfg{};
+         cfg.compression = mode;
+         cfg.prompt_for_key = false;
+         cfg.thread_count = 1;
+
+         std::vector<uint64_t> payload_words;
+         std::string header;
+         const encode_result encoded = get_encode_result(input, cfg, settings.m_repetitions, payload_words, header);
+         const decode_result decoded = get_decode_result(payload_words, settings.m_repetitions);
+         const size_t input_size = static_cast<size_t>(fs::file_size(input.get_path()));
+         const size_t decompressed_size = static_cast<size_t>(bb::get_decompressed_size(payload_words.data()));
+         const bool measure_compile = settings.m_compile_command.empty() == false && decompressed_size <= settings.m_max_compile_size;
+         const double compile_ms = measure_compile ? get_compile_ms(settings, header, working_dir) : -1.0;
+
+         json += first_result ? "\n" : ",\n";
+         first_result = false;
+         json += fmt::format(
+            "    {{\"input\": \"{}\", \"input_size\": {}, \"decompressed_size\": {}, \"compression\": \"{}\", "
+            "\"compressed_size\": {}, \"header_size\": {}, \"load_ms\": {:.3f}, \"compress_ms\": {:.3f}, "
+            "\"format_ms\": {:.3f}, \"decode_vector_mb_per_s\": {:.1f}, \"decode_pointer_mb_per_s\": {:.1f}",
+            bb::get_json_escaped(input.get_path().filename().string()), input_size, decompressed_size, get_mode_name(mode),
+            encoded.m_compressed_size, encoded.m_header_size, encoded.m_load_ms, encoded.m_compress_ms,
+            encoded.m_format_ms, decoded.m_vector_mb_per_s, decoded.m_pointer_mb_per_s
+         );
+         if (measure_compile)
+            json += fmt::format(", \"compile_ms\": {:.1f}", compile_ms);
+         json += "}";
+      }
+   }
+   json += "\n  ]";
+   if (settings.m_compile_command.empty() == false)
+   {
+      const constexpr_lookup_result lookups = get_constexpr_lookup_result(settings, working_dir);
+      json += fmt::format(
+         ",\n  \"constexpr_lookups\": {{\"repetitions\": {}, \"single_ms\": {:.1f}, \"bulk_ms\": {:.1f}}}",
+         constexpr_lookup_repetitions, lookups.m_single_ms, lookups.m_bulk_ms
+      );
+   }
+   json += "\n}\n";
+
+   std::ofstream(settings.m_output_path, std::ios::binary) << json;
+   fmt::print("Wrote {}\n", settings.m_output_path.string());
+   fs::remove_all(working_dir);
+   return 0;
+}
@@ -0,0 +1,104 @@
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <binary_bakery_lib/tools.h>
+
+#include <fmt/format.h>
+
+
+namespace
+{
+
+   // The nibble-by-nibble encoder that append_ui64_str used to be. Kept as the baseline.
+   auto reference_append_ui64_str(
+      const uint64_t value,
+      std::string& target
+   ) -> void
+   {
+      target += "0x";
+      for (int i = 0; i < 16; ++i)
+      {
+         const int shift_amount = 60 - 4 * i;
+         const uint64_t mask = static_cast<uint64_t>(15) << shift_amount;
+         const uint8_t part = static_cast<uint8_t>((value & mask) >> shift_amount);
+         if (part < 10)
+            target += static_cast<char>('0' + part);
+         else
+            target += static_cast<char>('a' + part - 10);
+      }
+   }
+
+
+   [[nodiscard]] auto get_random_words(const size_t count) -> std::vector<uint64_t>
+   {
+      std::mt19937_64 rng(42);
+      std::vector<uint64_t> result(count);
+      for (uint64_t& word : result)
+         word = rng();
+      return result;
+   }
+
+
+   struct bench_result {
+      double m_mb_per_s = 0.0;
+      size_t m_output_size = 0;
+   };
+
+
+   // Measures input throughput in MB/s, best of a few repetitions
+   template<typename fun_type>
+   [[nodiscard]] auto run_bench(
+      const std::vector<uint64_t>& words,
+      const fun_type& fun
+   ) -> bench_result
+   {
+      bench_result result;
+      for (int repetition = 0; repetition < 5; ++repetition)
+      {
+         std::string target;
+         target.reserve(words.size() * 21);
+         const auto t0 = std::chrono::high_resolution_clock::now();
+         fun(words, target);
+         const auto t1 = std::chrono::high_resolution_clock::now();
+         const double seconds = std::chrono::duration<double>(t1 - t0).count();
+         const double mb = words.size() * sizeof(uint64_t) / (1024.0 * 1024.0);
+         result.m_mb_per_s = std::max(result.m_mb_per_s, mb / seconds);
+         result.m_output_size = target.size();
+      }
+      return result;
+   }
+
+} // namespace {}
+
+
+auto main() -> int
+{
+   constexpr int words_per_line = 4;
+   const std::vector<uint64_t> words = get_random_words(8 * 1024 * 1024); // 64 MB
+
+   const bench_result reference = run_bench(words, [](const std::vector<uint64_t>& in, std::string& target) {
+      for (const uint64_t word : in)
+      {
+         reference_append_ui64_str(word, target);
+         target += ", ";
+      }
+   });
+   const bench_result single = run_bench(words, [](const std::vector<uint64_t>& in, std::string& target) {
+      for (const uint64_t word : in)
+      {
+         bb::append_ui64_str(word, target);
+         target += ", ";
+      }
+   });
+   const bench_result lines = run_bench(words, [](const std::vector<uint64_t>& in, std::string& target) {
+      for (size_t i = 0; i < in.size(); i += words_per_line)
+         bb::append_ui64_line({ in.data() + i, words_per_line }, true, target);
+   });
+
+   fmt::print("reference append_ui64_str: {:8.1f} MB/s\n", reference.m_mb_per_s);
+   fmt::print("append_ui64_str:           {:8.1f} MB/s ({:.1f}x)\n", single.m_mb_per_s, single.m_mb_per_s / reference.m_mb_per_s);
+   fmt::print("append_ui64_line:          {:8.1f} MB/s ({:.1f}x)\n", lines.m_mb_per_s, lines.m_mb_per_s / reference.m_mb_per_s);
+   return 0;
+}
@@ -1,8 +1,13 @@
 #pragma once
 
-#include <bit>             // For std::bit_cast
+#include <array>           // For std::array in get_elements()
+#include <atomic>          // For the registered built-in decompression functions
+#include <bit>             // For std::bit_cast and std::has_single_bit
 #include <cstdint>         // For sized types
 #include <cstring>
+#include <iterator>        // For the iterator tags of view
+#include <memory>          // For std::unique_ptr in decode_range() and zstd_decompression()
+#include <new>             // For placement new in default_init_allocator
 #ifdef __GNUG__
 #include <experimental/source_location> // For source locations of errors
 namespace std{
@@ -13,68 +18,509 @@ using source_location = experimental::source_location;
 #endif
 #include <string>          // For std::memcpy
 #include <type_traits>     // For add_pointer, just to look nice
+#include <utility>         // For std::exchange and std::forward
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BAKERY_UNFILTER_SSE2
+#include <emmintrin.h>     // For the unfilters of version_filtered
+#endif
 
 #ifdef    BAKERY_PROVIDE_VECTOR
 #include <vector>
 #endif // BAKERY_PROVIDE_VECTOR
 
+#ifdef    BAKERY_PROVIDE_DECODE_CACHE
+#include <mutex>
+#include <unordered_map>
+#endif // BAKERY_PROVIDE_DECODE_CACHE
+
+#ifdef    BAKERY_PROVIDE_PAGE_HINTS
+#ifdef __linux__
+#include <sys/mman.h>      // For mmap() and madvise() in decode_to_pages()
+#endif
+#endif // BAKERY_PROVIDE_PAGE_HINTS
+
+#ifdef    BAKERY_PROVIDE_ARCHIVE_LOADER
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>       // For MapViewOfFile() and PrefetchVirtualMemory() in mapped_archive
+#else
+#include <fcntl.h>         // For open()
+#include <sys/mman.h>      // For mmap() and madvise() in mapped_archive
+#include <sys/stat.h>      // For fstat()
+#include <unistd.h>        // For close() and sysconf()
+#endif
+#endif // BAKERY_PROVIDE_ARCHIVE_LOADER
+
+#ifdef    BAKERY_PROVIDE_LZ4
+#if defined(BAKERY_TRUSTED_PAYLOADS) && !defined(LZ4_DISABLE_DEPRECATE_WARNINGS)
+#define LZ4_DISABLE_DEPRECATE_WARNINGS // For LZ4_decompress_fast()
+#endif
+#include <lz4.h>
+#endif // BAKERY_PROVIDE_LZ4
+
+#ifdef    BAKERY_PROVIDE_ZSTD
+#include <zstd.h>
+#endif // BAKERY_PROVIDE_ZSTD
+
 
 namespace bb {
 
    struct header {
       uint8_t  type = 0;        // 0: Generic binary
                                 // 1: Image
+                                // 2: zstd dictionary, to decompress the payloads with compression 3
       
       uint8_t  compression = 0; // Compression mode
                                 // 0: No compression
                                 // 1: zstd
                                 // 2: LZ4
-      uint8_t  version = 0;     // Version of the payload format. If everything goes well, this stays at 0.
+                                // 3: zstd with the dictionary payload
+      uint8_t  version = 0;     // Flags of payload format extensions, see version_chunked. 0 for plain payloads.
       uint8_t  bpp = 0;         // For images: Number of channels [1-4]
-      uint16_t width = 0;       // For images: Width in pixels [0-65535]
+      uint16_t width = 0;       // For images: Width in pixels [0-65535], see version_extended_dimensions for bigger images
       uint16_t height = 0;      // For images: Height in pixels [0-65535]
       
       // Word border
 
       uint32_t decompressed_size = 0; // Size of the data stream (without this header)
       uint32_t compressed_size   = 0; // Without compression, this is equal to the uncompressed_size
-                                      // range: [0-4096 MB]
+                                      // range: [0-4096 MB], see version_extended_sizes for bigger payloads
    };
    static_assert(sizeof(header) == 2 * sizeof(uint64_t));
 
+   // Flags in header::version. Each set flag adds an extension between the header and the data.
+   // Chunked: The data is split into chunks of the same decompressed size (except for the last one), which are
+   // compressed independently. A chunk table follows the header: one word with the uint32 chunk size and uint32 chunk
+   // count, then chunk_count + 1 uint64 offsets of the chunks relative to the data pointer.
+   // header::compressed_size doesn't include the table.
+   inline constexpr uint8_t version_chunked = 1 << 0;
+
+   // Extended sizes: The sizes don't fit into 32 bits. header::decompressed_size and header::compressed_size are 0, and
+   // two uint64 words with the decompressed and compressed size follow the header. This extension comes before the
+   // chunk table.
+   inline constexpr uint8_t version_extended_sizes = 1 << 1;
+
+   // Extended dimensions: The image is wider or taller than 65535 pixels. header::width and header::height are 0, and
+   // one word with the uint32 width and uint32 height follows the header (and the extended sizes).
+   inline constexpr uint8_t version_extended_dimensions = 1 << 2;
+
+   // Texture: The image has mip levels, padded rows or a block compressed format. One word follows the other
+   // extensions: uint8 format (0: Raw pixels with bpp bytes, 1: BC1), uint8 mip level count, uint16 unused and uint32
+   // row alignment in bytes. The levels are stored one after another, starting with the full size. Every row (of 4x4
+   // blocks for BC1) is padded to a multiple of the row alignment. header::decompressed_size includes everything.
+   inline constexpr uint8_t version_texture = 1 << 3;
+
+   // Aligned data: The data starts at a multiple of an alignment above 8 bytes, counted from the start of the payload.
+   // One word follows the other extensions: uint32 alignment in bytes and uint32 number of zero words behind this word
+   // that pad the data start to it. The chunk table comes after the padding.
+   inline constexpr uint8_t version_aligned_data = 1 << 4;
+
+   // Filtered: The data was transformed before the compression so that it compresses better, and the decode functions
+   // transform it back. Only compressed payloads are filtered. One word follows the texture word: uint8 filter
+   // (1: Delta, 2: Byte shuffle, 3: Row prediction), uint8 element size in bytes, uint8 row predictor, uint8 unused and
+   // uint32 row size in bytes.
+   // - Delta: Every element is stored minus the one before it, as wrapping little-endian integers.
+   // - Byte shuffle: The first byte of all elements, then the second byte of all elements and so on.
+   // - Row prediction: Like PNG, every byte is stored minus its prediction from the pixel to the left and the row
+   //   above. The element size is the bytes per pixel. Predictor 1: Left, 2: Above, 3: Average of both, 4: Paeth.
+   // Bytes behind the last whole element stay as they are. Every chunk of chunked payloads is filtered on its own, the
+   // chunk size is a multiple of the element or row size.
+   inline constexpr uint8_t version_filtered = 1 << 5;
+
    // Retrieves the header from a payload.
    [[nodiscard]] constexpr auto get_header(const uint64_t* source) -> header;
 
-   // Retrieves parts of the header. Just for convenience.
+   // Retrieves parts of the header. Just for convenience. get_width() and get_height() also work with
+   // version_extended_dimensions.
    [[nodiscard]] constexpr auto is_image  (const uint64_t* source) -> bool;
    [[nodiscard]] constexpr auto get_width (const uint64_t* source) -> int;
    [[nodiscard]] constexpr auto get_height(const uint64_t* source) -> int;
 
+   // Sizes of the data stream in bytes. Unlike the header fields, these also work with version_extended_sizes.
+   [[nodiscard]] constexpr auto get_decompressed_size(const uint64_t* source) -> uint64_t;
+   [[nodiscard]] constexpr auto get_compressed_size  (const uint64_t* source) -> uint64_t;
+
+   // Layout of one mip level of an image, ready to be copied into a staging buffer
+   struct mip_level {
+      int width = 0;
+      int height = 0;
+      size_t row_pitch = 0;   // Bytes from one row (of blocks) to the next
+      size_t byte_offset = 0; // Relative to get_data_ptr()
+      size_t byte_size = 0;
+   };
+
+   // Images without version_texture are raw and have one tightly packed level
+   [[nodiscard]] constexpr auto get_texture_format(const uint64_t* source) -> uint8_t;
+   [[nodiscard]] constexpr auto get_mip_count     (const uint64_t* source) -> int;
+   [[nodiscard]] constexpr auto get_mip_level     (const uint64_t* source, const int level) -> mip_level;
+
+   // Number of independently compressed chunks and their decompressed size in bytes. Payloads that aren't chunked have
+   // one chunk the size of the data.
+   [[nodiscard]] constexpr auto get_chunk_count(const uint64_t* source) -> int;
+   [[nodiscard]] constexpr auto get_chunk_size (const uint64_t* source) -> size_t;
+
    // These methods provide easy access to the number of elements in the dataset. In images, that is equal to the number
    // of pixels. Therefore this function can be called without template parameter with image payloads.
    // In generic binaries, that's the number of elements of the target type. That needs to be provided as template
    // parameter.
    template<typename user_type>
-   [[nodiscard]] constexpr auto get_element_count(const uint64_t* source) -> int;
-   [[nodiscard]] constexpr auto get_element_count(const uint64_t* source) -> int;
+   [[nodiscard]] constexpr auto get_element_count(const uint64_t* source) -> size_t;
+   [[nodiscard]] constexpr auto get_element_count(const uint64_t* source) -> size_t;
 
    // Compile-time access to the stored elements. For images, provide a color type.
    template<typename user_type>
    [[nodiscard]] constexpr auto get_element(const uint64_t* source, const int index) -> user_type;
 
+   // Bulk version of get_element() for compile-time lookups: the header is checked once and every data word is only
+   // read once, instead of once per byte of every element.
+   template<typename user_type, size_t element_count>
+   [[nodiscard]] constexpr auto get_elements(const uint64_t* source, const size_t first) -> std::array<user_type, element_count>;
+
+   // Zero-copy access to the elements of uncompressed payloads, like a std::span<const user_type>. At runtime, elements
+   // are read in place, so the data needs to be aligned for user_type (see get_data_alignment()). In constant
+   // expressions, they're read like get_element() does. Indexing isn't bounds-checked.
+   template<typename user_type>
+   struct view {
+   private:
+      const uint64_t* m_source = nullptr;
+      const user_type* m_data = nullptr; // Only set by views constructed at runtime
+      size_t m_size = 0;
+
+      [[nodiscard]] static constexpr auto get_element_at(const uint64_t* source, const user_type* data, const size_t index) -> user_type;
+
+   public:
+      // Random access, but elements are returned by value like get_element() does, so it's only an input iterator
+      // for the legacy iterator categories. Stays valid after the view is gone.
+      struct iterator {
+         using iterator_concept = std::random_access_iterator_tag;
+         using iterator_category = std::input_iterator_tag;
+         using value_type = user_type;
+         using difference_type = std::ptrdiff_t;
+         using reference = user_type;
+         using pointer = void;
+
+         const uint64_t* m_source = nullptr;
+         const user_type* m_data = nullptr;
+         difference_type m_index = 0;
+
+         [[nodiscard]] constexpr auto operator*() const -> user_type { return get_element_at(m_source, m_data, static_cast<size_t>(m_index)); }
+         [[nodiscard]] constexpr auto operator[](const difference_type offset) const -> user_type { return *(*this + offset); }
+         constexpr auto operator++() -> iterator& { ++m_index; return *this; }
+         constexpr auto operator++(int) -> iterator { iterator result = *this; ++m_index; return result; }
+         constexpr auto operator--() -> iterator& { --m_index; return *this; }
+         constexpr auto operator--(int) -> iterator { iterator result = *this; --m_index; return result; }
+         constexpr auto operator+=(const difference_type offset) -> iterator& { m_index += offset; return *this; }
+         constexpr auto operator-=(const difference_type offset) -> iterator& { m_index -= offset; return *this; }
+         [[nodiscard]] constexpr auto operator+(const difference_type offset) const -> iterator { iterator result = *this; return result += offset; }
+         [[nodiscard]] constexpr auto operator-(const difference_type offset) const -> iterator { iterator result = *this; return result -= offset; }
+         [[nodiscard]] constexpr auto operator-(const iterator& other) const -> difference_type { return m_index - other.m_index; }
+         [[nodiscard]] friend constexpr auto operator+(const difference_type offset, const iterator& it) -> iterator { return it + offset; }
+         [[nodiscard]] constexpr auto operator==(const iterator& other) const -> bool { return m_index == other.m_index; }
+         [[nodiscard]] constexpr auto operator<=>(const iterator& other) const { return m_index <=> other.m_index; }
+      };
+
+      constexpr view() = default;
+
+      // The data pointer is resolved here once at runtime, not on every access
+      constexpr view(const uint64_t* source, const size_t size);
+
+      [[nodiscard]] constexpr auto size() const -> size_t { return m_size; }
+      [[nodiscard]] constexpr auto empty() const -> bool { return m_size == 0; }
+      [[nodiscard]] constexpr auto operator[](const size_t index) const -> user_type { return get_element_at(m_source, m_data, index); }
+      [[nodiscard]] constexpr auto begin() const -> iterator;
+      [[nodiscard]] constexpr auto end() const -> iterator { return begin() + static_cast<std::ptrdiff_t>(m_size); }
+
+      // Runtime only
+      [[nodiscard]] auto data() const -> const user_type*;
+   };
+
+   // Empty view for compressed payloads. The size is the number of whole user_type objects in the data.
+   template<typename user_type>
+   [[nodiscard]] constexpr auto get_view(const uint64_t* source) -> view<user_type>;
+
+   // Compile-time access to the pixels of uncompressed raw images, for any mip level and with padded rows
+   template<typename user_type>
+   [[nodiscard]] constexpr auto get_pixel(const uint64_t* source, const int x, const int y, const int level = 0) -> user_type;
+
    using decompression_fun_type = std::add_pointer_t<void(const void* src, const size_t src_size, void* dst, const size_t dst_capacity)>;
 
-#ifdef    BAKERY_PROVIDE_VECTOR
-   // Returns an std::vector of provided type.
+   // Decompression functions by codec, for payloads that don't all use the same compression (ie compression_mode =
+   // "auto"). All decode functions have an overload that picks the function from header::compression. Codecs that
+   // aren't used can stay nullptr.
+   struct decompression_table {
+      decompression_fun_type zstd = nullptr;
+      decompression_fun_type lz4 = nullptr;
+      decompression_fun_type zstd_dictionary = nullptr;
+
+      // nullptr for uncompressed payloads and unknown codecs
+      [[nodiscard]] constexpr auto get(const uint8_t compression) const -> decompression_fun_type;
+   };
+
+   // Built-in decompression functions. Translation units that define BAKERY_PROVIDE_LZ4 or BAKERY_PROVIDE_ZSTD register
+   // them when the program starts. From then on, the decode functions of all translation units use them for payloads
+   // of that codec when no decompression function is passed, so liblz4 or libzstd only need to be linked. The macros
+   // don't change any function that all translation units share, so they can differ between them. The zstd one keeps
+   // one ZSTD_DCtx per thread. With BAKERY_TRUSTED_PAYLOADS, LZ4 skips the bounds checks of the compressed input, which
+   // is only safe for data baked by yourself. That's a function of its own. If translation units disagree on the macro,
+   // it's unspecified which of the two is registered, so pass the one you want explicitly.
+#ifdef    BAKERY_PROVIDE_LZ4
+#ifdef    BAKERY_TRUSTED_PAYLOADS
+   inline namespace trusted_payloads {
+#endif // BAKERY_TRUSTED_PAYLOADS
+   inline auto lz4_decompression(const void* src, const size_t src_size, void* dst, const size_t dst_capacity) -> void;
+#ifdef    BAKERY_TRUSTED_PAYLOADS
+   }
+#endif // BAKERY_TRUSTED_PAYLOADS
+#endif // BAKERY_PROVIDE_LZ4
+#ifdef    BAKERY_PROVIDE_ZSTD
+   inline auto zstd_decompression(const void* src, const size_t src_size, void* dst, const size_t dst_capacity) -> void;
+#endif // BAKERY_PROVIDE_ZSTD
+
+#ifdef    BAKERY_PROVIDE_CONSTEXPR_LZ4
+   // Decodes the first element_count elements of uncompressed or LZ4 payloads, chunked ones included, without a
+   // decompression function. Works in constant expressions, so LZ4 tables can stay small in the source and still be
+   // expanded into constexpr arrays. Compile-time decoding is slow, meant for tables and not for big payloads.
+   template<typename user_type, size_t element_count>
+   [[nodiscard]] constexpr auto decode_to_array(const uint64_t* source) -> std::array<user_type, element_count>;
+#endif // BAKERY_PROVIDE_CONSTEXPR_LZ4
+
+   // Allocator that default-initializes instead of value-initializing. With std::vector<T, default_init_allocator<T>>,
+   // resizing doesn't zero memory that gets overwritten by the decompression anyway.
    template<typename user_type>
-   [[nodiscard]] auto decode_to_vector(const uint64_t* source, decompression_fun_type decomp_fun = nullptr) -> std::vector<user_type>;
+   struct default_init_allocator : std::allocator<user_type> {
+      template<typename other_type>
+      struct rebind { using other = default_init_allocator<other_type>; };
+
+      using std::allocator<user_type>::allocator;
+
+      template<typename object_type>
+      auto construct(object_type* ptr) -> void { ::new (static_cast<void*>(ptr)) object_type; }
+      template<typename object_type, typename... arg_types>
+      auto construct(object_type* ptr, arg_types&&... args) -> void { ::new (static_cast<void*>(ptr)) object_type(std::forward<arg_types>(args)...); }
+   };
+
+#ifdef    BAKERY_PROVIDE_VECTOR
+   // Returns an std::vector of provided type. With bb::default_init_allocator, the elements aren't zeroed first.
+   template<typename user_type, typename allocator_type = std::allocator<user_type>>
+   [[nodiscard]] auto decode_to_vector(const uint64_t* source, decompression_fun_type decomp_fun = nullptr) -> std::vector<user_type, allocator_type>;
+   template<typename user_type, typename allocator_type = std::allocator<user_type>>
+   [[nodiscard]] auto decode_to_vector(const uint64_t* source, const decompression_table& decomp_table) -> std::vector<user_type, allocator_type>;
 #endif // BAKERY_PROVIDE_VECTOR
 
+   // Like decode_to_vector(), but into a default-initialized array, so the memory is only written once
+   template<typename user_type>
+   [[nodiscard]] auto decode_to_unique_ptr(const uint64_t* source, decompression_fun_type decomp_fun = nullptr) -> std::unique_ptr<user_type[]>;
+   template<typename user_type>
+   [[nodiscard]] auto decode_to_unique_ptr(const uint64_t* source, const decompression_table& decomp_table) -> std::unique_ptr<user_type[]>;
+
+#ifdef    BAKERY_PROVIDE_PAGE_HINTS
+   // Flags for decode_to_pages(). They only apply to destinations of at least page_hint_threshold bytes, smaller ones
+   // are allocated normally. On platforms other than Linux, they're ignored.
+   // Huge pages: Asks for transparent huge pages with madvise(MADV_HUGEPAGE), which means fewer TLB misses and page
+   // faults for big assets.
+   inline constexpr int page_huge = 1 << 0;
+   // Populate: Faults in all pages before the decompression writes them, like MAP_POPULATE.
+   inline constexpr int page_populate = 1 << 1;
+   inline constexpr size_t page_hint_threshold = 2 * 1024 * 1024;
+
+   // Owns the memory of decode_to_pages()
+   struct page_buffer {
+   private:
+      uint8_t* m_data = nullptr;
+      size_t m_size = 0;
+      bool m_mapped = false;
+
+   public:
+      page_buffer() = default;
+      inline page_buffer(const size_t size, const int page_flags);
+      inline ~page_buffer();
+      page_buffer(const page_buffer&) = delete;
+      page_buffer& operator=(const page_buffer&) = delete;
+      inline page_buffer(page_buffer&& other) noexcept;
+      inline page_buffer& operator=(page_buffer&& other) noexcept;
+
+      [[nodiscard]] auto data() const -> uint8_t* { return m_data; }
+      [[nodiscard]] auto size() const -> size_t { return m_size; }
+      [[nodiscard]] auto is_mapped() const -> bool { return m_mapped; }
+      template<typename user_type>
+      [[nodiscard]] auto get_data() const -> user_type* { return reinterpret_cast<user_type*>(m_data); }
+   };
+
+   // Decodes into memory that is allocated with the page_flags hints
+   [[nodiscard]] inline auto decode_to_pages(const uint64_t* source, const int page_flags, decompression_fun_type decomp_fun = nullptr) -> page_buffer;
+   [[nodiscard]] inline auto decode_to_pages(const uint64_t* source, const int page_flags, const decompression_table& decomp_table) -> page_buffer;
+#endif // BAKERY_PROVIDE_PAGE_HINTS
+
    // This writes into an arbitrary container-pointer. No memory management - needs to be allocated!
    inline auto decode_into_pointer(const uint64_t* source, void* dst, decompression_fun_type decomp_fun = nullptr) -> void;
+   inline auto decode_into_pointer(const uint64_t* source, void* dst, const decompression_table& decomp_table) -> void;
+
+   // Same as decode_into_pointer(), but the chunks of chunked payloads are decompressed in parallel straight into their
+   // place in dst. The executor is called as executor(chunk_count, task) and has to call task(i) for every i in
+   // [0, chunk_count), in any order and on any thread, before it returns. decomp_fun needs to be thread-safe.
+   // Payloads that aren't chunked are decoded on the calling thread.
+   template<typename executor_type>
+   auto decode_into_pointer_parallel(
+      const uint64_t* source,
+      void* dst,
+      const executor_type& executor,
+      decompression_fun_type decomp_fun = nullptr
+   ) -> void;
+   template<typename executor_type>
+   auto decode_into_pointer_parallel(
+      const uint64_t* source,
+      void* dst,
+      const executor_type& executor,
+      const decompression_table& decomp_table
+   ) -> void;
+
+   // Writes byte_count bytes starting at byte_offset of the decoded data into dst. For chunked payloads, only the
+   // chunks overlapping that range are decompressed. Compressed payloads that aren't chunked are decompressed as a
+   // whole into a temporary buffer.
+   inline auto decode_range(
+      const uint64_t* source,
+      const size_t byte_offset,
+      const size_t byte_count,
+      void* dst,
+      decompression_fun_type decomp_fun = nullptr
+   ) -> void;
+   inline auto decode_range(
+      const uint64_t* source,
+      const size_t byte_offset,
+      const size_t byte_count,
+      void* dst,
+      const decompression_table& decomp_table
+   ) -> void;
+
+#ifdef    BAKERY_PROVIDE_DECODE_CACHE
+   // Decoded bytes of a payload, shared and read-only. They stay valid after the cache dropped them, as long as this
+   // object is alive.
+   struct decoded_payload {
+      std::shared_ptr<const uint8_t[]> m_bytes;
+      size_t m_size = 0;
+
+      [[nodiscard]] auto data() const -> const uint8_t* { return m_bytes.get(); }
+      [[nodiscard]] auto size() const -> size_t { return m_size; }
+
+      template<typename user_type>
+      [[nodiscard]] auto get_data() const -> const user_type* { return reinterpret_cast<const user_type*>(m_bytes.get()); }
+      template<typename user_type>
+      [[nodiscard]] auto get_element_count() const -> size_t { return m_size / sizeof(user_type); }
+   };
+
+   // Thread-safe cache that decompresses every payload once, on its first access. Concurrent first requests for the
+   // same payload wait for the one that decodes it. Uncompressed payloads are handed out in place and don't count
+   // against the memory_budget. Whenever the decoded bytes exceed the budget, the least recently requested payloads
+   // are dropped from the cache. A budget of 0 means no limit.
+   struct decode_cache {
+   private:
+      struct entry {
+         std::once_flag m_once;
+         decoded_payload m_payload;
+         bool m_ready = false;    // Guarded by m_mutex, like m_last_use
+         uint64_t m_last_use = 0;
+      };
+      std::mutex m_mutex;
+      std::unordered_map<const uint64_t*, std::shared_ptr<entry>> m_entries;
+      decompression_table m_decomp_table;
+      size_t m_memory_budget = 0;
+      size_t m_memory_use = 0;
+      uint64_t m_use_counter = 0;
+
+      inline auto evict(const entry* keep) -> void;
+
+   public:
+      explicit decode_cache(const size_t memory_budget = 0, const decompression_table& decomp_table = {})
+         : m_decomp_table(decomp_table)
+         , m_memory_budget(memory_budget)
+      { }
+
+      [[nodiscard]] inline auto get(const uint64_t* source) -> decoded_payload;
+      [[nodiscard]] inline auto get_memory_use() -> size_t;
+      inline auto clear() -> void;
+   };
+#endif // BAKERY_PROVIDE_DECODE_CACHE
 
+   // Points to the data behind the header and its extensions. The generated payload arrays are aligned to the
+   // payload_alignment setting, and the data is at a multiple of that into the payload. So the pointer to uncompressed
+   // data can be reinterpret_cast and used in place with SIMD loads or GPU mappings of get_data_alignment() bytes.
    [[nodiscard]] constexpr auto get_data_ptr(const uint64_t* source) -> const void*;
 
+   // 8 for payloads without version_aligned_data
+   [[nodiscard]] constexpr auto get_data_alignment(const uint64_t* source) -> size_t;
+
+   // Archives (output_mode = "archive") hold all payloads in one array of words. Layout:
+   // - archive_magic
+   // - uint32 entry count, uint32 payload alignment in bytes
+   // - Size of the whole archive in bytes
+   // - The index: entry count entries of four words, sorted by name hash. Each has the get_name_hash() of the payload
+   //   name, the byte offset of the payload from the start of the archive and a copy of the payload's header. Payloads
+   //   with several names have one entry per name.
+   // - The payloads, each at an offset that is a multiple of the payload alignment
+   inline constexpr uint64_t archive_magic = 0x3130766863726162; // "barchv01"
+   inline constexpr size_t archive_index_word_offset = 3;
+   inline constexpr size_t archive_entry_word_count = 4;
+
+   // 64-bit FNV-1a hash of the name, as stored in archive indices
+   [[nodiscard]] constexpr auto get_name_hash(std::string_view name) -> uint64_t;
+
+   [[nodiscard]] constexpr auto is_archive(const uint64_t* archive) -> bool;
+   [[nodiscard]] constexpr auto get_archive_entry_count(const uint64_t* archive) -> int;
+
+   // The payload with that name, nullptr if there is none. Payloads found that way work with all other functions.
+   [[nodiscard]] constexpr auto get_archive_payload(const uint64_t* archive, std::string_view name) -> const uint64_t*;
+
+   // The payload of the entry at that position of the index
+   [[nodiscard]] constexpr auto get_archive_payload(const uint64_t* archive, const int entry_index) -> const uint64_t*;
+
+   // Bytes of the whole payload: header, extensions and data
+   [[nodiscard]] constexpr auto get_payload_size(const uint64_t* source) -> uint64_t;
+
+#ifdef    BAKERY_PROVIDE_ARCHIVE_LOADER
+   // Read-only memory mapping of an archive file written with archive_path, for payloads that live outside of the
+   // executable (ie patchable DLC). The payload pointers stay valid as long as this object lives and work with all
+   // other functions. Pages are read from disk when they're first touched. Invalid if the file couldn't be mapped or
+   // isn't an archive, which includes truncated archives, index entries that point outside of the file and payloads
+   // whose sizes or chunk tables don't add up.
+   struct mapped_archive {
+   private:
+      const uint64_t* m_archive = nullptr;
+      size_t m_size = 0;
+
+   public:
+      mapped_archive() = default;
+      inline explicit mapped_archive(const char* path);
+      inline ~mapped_archive();
+      mapped_archive(const mapped_archive&) = delete;
+      mapped_archive& operator=(const mapped_archive&) = delete;
+      inline mapped_archive(mapped_archive&& other) noexcept;
+      inline mapped_archive& operator=(mapped_archive&& other) noexcept;
+
+      [[nodiscard]] auto is_valid() const -> bool { return m_archive != nullptr; }
+      [[nodiscard]] auto data() const -> const uint64_t* { return m_archive; }
+      [[nodiscard]] auto size() const -> size_t { return m_size; }
+      [[nodiscard]] inline auto get_entry_count() const -> int;
+      [[nodiscard]] inline auto get_payload(std::string_view name) const -> const uint64_t*;
+      [[nodiscard]] inline auto get_payload(const int entry_index) const -> const uint64_t*;
+
+      // Asks the OS to read the pages of a payload in the background, because it's about to be used
+      // (madvise(MADV_WILLNEED), PrefetchVirtualMemory() on Windows). Loading several assets together like this turns
+      // many page faults into a few large reads.
+      inline auto prefetch(const uint64_t* payload) const -> void;
+      inline auto prefetch(std::string_view name) const -> void;
+
+      // The payload isn't needed for a while. Its pages can be dropped and are read again on the next access
+      // (madvise(MADV_DONTNEED), nothing on Windows).
+      inline auto release(const uint64_t* payload) const -> void;
+   };
+#endif // BAKERY_PROVIDE_ARCHIVE_LOADER
+
    using error_callback_type = void(*)(std::string_view msg, const std::source_location& location);
    inline error_callback_type error_callback = nullptr;
 
@@ -103,6 +549,129 @@ namespace bb::detail {
       // End padding should be unnecessary because of array alignment
    };
 
+   struct chunk_table {
+      uint32_t chunk_size = 0;
+      uint32_t chunk_count = 0;
+      const uint64_t* offsets = nullptr; // chunk_count + 1 entries
+   };
+   [[nodiscard]] constexpr auto get_chunk_table(const uint64_t* source) -> chunk_table;
+
+   // Word offsets of the header extensions and the data
+   [[nodiscard]] constexpr auto get_dimensions_word_offset(const uint64_t* source) -> size_t;
+   [[nodiscard]] constexpr auto get_texture_word_offset(const uint64_t* source) -> size_t;
+   [[nodiscard]] constexpr auto get_filter_word_offset(const uint64_t* source) -> size_t;
+   [[nodiscard]] constexpr auto get_alignment_word_offset(const uint64_t* source) -> size_t;
+   [[nodiscard]] constexpr auto get_chunk_table_word_offset(const uint64_t* source) -> size_t;
+   [[nodiscard]] constexpr auto get_data_word_offset(const uint64_t* source) -> size_t;
+
+#ifdef    BAKERY_PROVIDE_CONSTEXPR_LZ4
+   // Byte byte_index of the bytes stored in words, in memory order
+   [[nodiscard]] constexpr auto get_word_byte(const uint64_t* words, const size_t byte_index) -> uint8_t;
+
+   // Decodes the LZ4 block of src_size bytes at src_offset of data words into dst, starting at dst_offset. Stops after
+   // dst_size bytes, so blocks can be decoded partially. Returns false for malformed blocks.
+   template<int capacity>
+   [[nodiscard]] constexpr auto lz4_decompress_block(
+      const uint64_t* data,
+      const size_t src_offset,
+      const size_t src_size,
+      better_array<uint8_t, capacity>& dst,
+      const size_t dst_offset,
+      const size_t dst_size
+   ) -> bool;
+#endif // BAKERY_PROVIDE_CONSTEXPR_LZ4
+
+   // The registered built-in decompression functions by header::compression, see lz4_decompression(). They're
+   // registered during static initialization, decoding from static initializers of other translation units might
+   // run before that.
+   inline std::atomic<decompression_fun_type> builtin_decompression_funs[3]{};
+
+   inline auto register_builtin_decompression(const uint8_t compression, decompression_fun_type fun) -> bool;
+
+   // The built-in decompression function for header::compression, nullptr if none is registered
+   [[nodiscard]] inline auto get_builtin_decompression(const uint8_t compression) -> decompression_fun_type;
+
+   // Decompresses one chunk of a chunked payload into dst, which needs room for the decompressed chunk
+   inline auto decompress_chunk(
+      const uint64_t* source,
+      const chunk_table& table,
+      const int chunk_index,
+      void* dst,
+      decompression_fun_type decomp_fun
+   ) -> void;
+
+   // The extension word of version_texture
+   struct texture_info {
+      uint8_t format = 0;
+      uint8_t mip_count = 1;
+      uint16_t unused = 0;
+      uint32_t row_alignment = 1;
+   };
+   static_assert(sizeof(texture_info) == sizeof(uint64_t));
+   [[nodiscard]] constexpr auto get_texture_info(const uint64_t* source) -> texture_info;
+
+   // The extension word of version_filtered
+   inline constexpr uint8_t filter_delta = 1;
+   inline constexpr uint8_t filter_shuffle = 2;
+   inline constexpr uint8_t filter_row = 3;
+   inline constexpr uint8_t predictor_left = 1;
+   inline constexpr uint8_t predictor_above = 2;
+   inline constexpr uint8_t predictor_average = 3;
+   inline constexpr uint8_t predictor_paeth = 4;
+   struct filter_info {
+      uint8_t filter = 0; // 0 for payloads without version_filtered
+      uint8_t element_size = 1;
+      uint8_t predictor = 0;
+      uint8_t unused = 0;
+      uint32_t row_size = 0;
+   };
+   static_assert(sizeof(filter_info) == sizeof(uint64_t));
+   [[nodiscard]] constexpr auto get_filter_info(const uint64_t* source) -> filter_info;
+
+   // The value row prediction expects for a byte. Also used by the encoder, so that both always agree.
+   [[nodiscard]] constexpr auto get_row_prediction(
+      const uint8_t predictor,
+      const uint8_t left,
+      const uint8_t above,
+      const uint8_t above_left
+   ) -> uint8_t;
+
+   // Reverses the filter of size filtered bytes. src and dst can be the same, except for the byte shuffle.
+   inline auto unfilter(const filter_info& info, const uint8_t* src, uint8_t* dst, const size_t size) -> void;
+
+   // The parts of unfilter(). With SSE2, the delta and the byte shuffle of common element sizes are vectorized.
+   template<int element_size>
+   inline auto undelta(uint8_t* bytes, const size_t element_count) -> void;
+   inline auto unshuffle(const uint8_t* src, uint8_t* dst, const size_t element_count, const size_t element_size) -> void;
+   inline auto unpredict_rows(const filter_info& info, uint8_t* bytes, const size_t size) -> void;
+
+   // Decompresses src into dst and reverses the filter, if there is one
+   inline auto decompress_unfiltered(
+      const filter_info& filter,
+      const void* src,
+      const size_t src_size,
+      void* dst,
+      const size_t dst_size,
+      decompression_fun_type decomp_fun
+   ) -> void;
+
+   // The layout of a level. Also used by the encoder, so that both always agree.
+   [[nodiscard]] constexpr auto get_mip_level(
+      const int width,
+      const int height,
+      const int bpp,
+      const texture_info& info,
+      const int level
+   ) -> mip_level;
+
+   // Reads byte_count bytes at byte_offset of the data, in constant expressions as well
+   template<size_t byte_count>
+   [[nodiscard]] constexpr auto get_data_bytes(const uint64_t* source, const size_t byte_offset) -> better_array<uint8_t, byte_count>;
+
+   // Reads sizeof(user_type) bytes at byte_offset of the data, in constant expressions as well
+   template<typename user_type>
+   [[nodiscard]] constexpr auto get_data_object(const uint64_t* source, const size_t byte_offset) -> user_type;
+
    template<int bpp>
    struct color_type {
       uint8_t m_components[bpp];
@@ -136,6 +705,23 @@ constexpr auto bb::detail::better_array<T, size>::operator[](
 }
 
 
+constexpr auto bb::decompression_table::get(
+   const uint8_t compression
+) const -> decompression_fun_type
+{
+   switch (compression) {
+   case 1:
+      return zstd;
+   case 2:
+      return lz4;
+   case 3:
+      return zstd_dictionary;
+   default:
+      return nullptr;
+   }
+}
+
+
 constexpr auto bb::get_header(
    const uint64_t* source
 ) -> header
@@ -205,6 +791,8 @@ constexpr auto bb::get_width(
       return 0;
    }
    const header head = get_header(source);
+   if (head.version & version_extended_dimensions)
+      return static_cast<int>(std::bit_cast<detail::better_array<uint32_t, 2>>(source[detail::get_dimensions_word_offset(source)])[0]);
    return head.width;
 }
 
@@ -224,169 +812,1884 @@ constexpr auto bb::get_height(
       return 0;
    }
    const header head = get_header(source);
+   if (head.version & version_extended_dimensions)
+      return static_cast<int>(std::bit_cast<detail::better_array<uint32_t, 2>>(source[detail::get_dimensions_word_offset(source)])[1]);
    return head.height;
 }
 
 
-template<typename user_type>
-constexpr auto bb::get_element(
-   const uint64_t* source,
-   const int index
-) -> user_type
+constexpr auto bb::get_decompressed_size(
+   const uint64_t* source
+) -> uint64_t
 {
    if (source == nullptr)
    {
       detail::error("Source was nullptr", std::source_location::current());
-      return detail::get_nulled_object<user_type>();
+      return 0;
    }
+   const header head = get_header(source);
+   if (head.version & version_extended_sizes)
+      return source[2];
+   return head.decompressed_size;
+}
 
-   if (bb::get_header(source).compression != 0)
+
+constexpr auto bb::get_compressed_size(
+   const uint64_t* source
+) -> uint64_t
+{
+   if (source == nullptr)
    {
-      detail::error("Payload is compressed. This interface only works with uncompressed payloads", std::source_location::current());
-      return detail::get_nulled_object<user_type>();
+      detail::error("Source was nullptr", std::source_location::current());
+      return 0;
    }
+   const header head = get_header(source);
+   if (head.version & version_extended_sizes)
+      return source[3];
+   return head.compressed_size;
+}
 
-   if (index >= get_element_count<user_type>(source) || index < 0)
+
+constexpr auto bb::get_texture_format(
+   const uint64_t* source
+) -> uint8_t
+{
+   if (source == nullptr)
    {
-      detail::error("Index is out of bounds", std::source_location::current());
-      return detail::get_nulled_object<user_type>();
+      detail::error("Source was nullptr", std::source_location::current());
+      return 0;
    }
+   return detail::get_texture_info(source).format;
+}
 
 
-   // Use intermediate type because user-type might not be default constructible and not have operator[]
-   detail::better_array<uint8_t, sizeof(user_type)> proxy{};
-
-   using word_bytes_type = detail::better_array<uint8_t, 8>;
-   for (int i = 0; i < sizeof(user_type); ++i)
+constexpr auto bb::get_mip_count(
+   const uint64_t* source
+) -> int
+{
+   if (source == nullptr)
    {
-      const int byte_offset = index * sizeof(user_type) + i;
-      const auto [word_index, byte_index] = detail::div(byte_offset, static_cast<int>(sizeof(uint64_t)));
-      const auto word_bytes = std::bit_cast<word_bytes_type>(source[2 + word_index]);
-      proxy[i] = word_bytes[byte_index];
+      detail::error("Source was nullptr", std::source_location::current());
+      return 0;
    }
-   return std::bit_cast<user_type>(proxy);
+   return detail::get_texture_info(source).mip_count;
 }
 
 
-#ifdef BAKERY_PROVIDE_VECTOR
-template<typename user_type>
-auto bb::decode_to_vector(
+constexpr auto bb::get_mip_level(
    const uint64_t* source,
-   decompression_fun_type decomp_fun
-) -> std::vector<user_type>
+   const int level
+) -> mip_level
 {
-   static_assert(std::is_default_constructible_v<user_type>, "decode_to_vector() requires the type to be default constructible. If that's a problem, file an issue. Should be possible (potentially slower).");
    if (source == nullptr)
    {
       detail::error("Source was nullptr", std::source_location::current());
-      return {};
+      return mip_level{};
    }
-
-   const header head = bb::get_header(source);
-   const int element_count = get_element_count<user_type>(source);
-   std::vector<user_type> result(element_count);
-   
-   if (head.compression == 0)
+   if (is_image(source) == false)
    {
-      std::memcpy(result.data(), get_data_ptr(source), head.decompressed_size);
+      detail::error("get_mip_level() called on a non-image payload", std::source_location::current());
+      return mip_level{};
    }
-   else if (head.compression > 0)
+   const detail::texture_info info = detail::get_texture_info(source);
+   if (level < 0 || level >= info.mip_count)
    {
-      if (decomp_fun == nullptr)
-      {
-         detail::error("Payload is compressed, but the decompression_fun parameter is nullptr.", std::source_location::current());
-         return {};
-      }
-      decomp_fun(get_data_ptr(source), head.compressed_size, result.data(), head.decompressed_size);
+      detail::error("Mip level is out of bounds", std::source_location::current());
+      return mip_level{};
    }
-   return result;
+   return detail::get_mip_level(get_width(source), get_height(source), get_header(source).bpp, info, level);
 }
-#endif // BAKERY_PROVIDE_VECTOR
 
 
-auto bb::decode_into_pointer(
-   const uint64_t* source,
-   void* dst,
-   decompression_fun_type decomp_fun
-) -> void
+constexpr auto bb::get_chunk_count(
+   const uint64_t* source
+) -> int
 {
    if (source == nullptr)
    {
-      detail::error("Source is nullptr", std::source_location::current());
-      return;
+      detail::error("Source was nullptr", std::source_location::current());
+      return 0;
    }
-   if (dst == nullptr)
+   const header head = get_header(source);
+   if ((head.version & version_chunked) == 0)
+      return 1;
+   return static_cast<int>(detail::get_chunk_table(source).chunk_count);
+}
+
+
+constexpr auto bb::get_chunk_size(
+   const uint64_t* source
+) -> size_t
+{
+   if (source == nullptr)
    {
-      detail::error("Destination is nullptr", std::source_location::current());
-      return;
+      detail::error("Source was nullptr", std::source_location::current());
+      return 0;
    }
-   const header head = bb::get_header(source);
-   if (head.compression > 0)
+   const header head = get_header(source);
+   if ((head.version & version_chunked) == 0)
+      return get_decompressed_size(source);
+   return detail::get_chunk_table(source).chunk_size;
+}
+
+
+template<typename user_type>
+constexpr auto bb::get_element(
+   const uint64_t* source,
+   const int index
+) -> user_type
+{
+   if (source == nullptr)
    {
-      decomp_fun(get_data_ptr(source), head.compressed_size, dst, head.decompressed_size);
+      detail::error("Source was nullptr", std::source_location::current());
+      return detail::get_nulled_object<user_type>();
    }
-   else
+
+   if (bb::get_header(source).compression != 0)
+   {
+      detail::error("Payload is compressed. This interface only works with uncompressed payloads", std::source_location::current());
+      return detail::get_nulled_object<user_type>();
+   }
+
+   if (index < 0 || static_cast<size_t>(index) >= get_element_count<user_type>(source))
    {
-      const int byte_count = head.decompressed_size;
-      std::memcpy(dst, get_data_ptr(source), byte_count);
+      detail::error("Index is out of bounds", std::source_location::current());
+      return detail::get_nulled_object<user_type>();
    }
+
+   return detail::get_data_object<user_type>(source, static_cast<size_t>(index) * sizeof(user_type));
 }
 
 
-constexpr auto bb::get_element_count(
-   const uint64_t* source
-) -> int
+template<typename user_type, size_t element_count>
+constexpr auto bb::get_elements(
+   const uint64_t* source,
+   const size_t first
+) -> std::array<user_type, element_count>
 {
+   static_assert(element_count > 0, "get_elements() needs at least one element");
+   using result_type = std::array<user_type, element_count>;
    if (source == nullptr)
    {
       detail::error("Source was nullptr", std::source_location::current());
-      return 0;
+      return detail::get_nulled_object<result_type>();
    }
 
-   if (is_image(source) == false)
+   if (bb::get_header(source).compression != 0)
    {
-      detail::error("Can't call get_element_count() without template param for non-images.", std::source_location::current());
-      return 0;
+      detail::error("Payload is compressed. This interface only works with uncompressed payloads", std::source_location::current());
+      return detail::get_nulled_object<result_type>();
    }
-   const header head = get_header(source);
-   return head.width * head.height;
+
+   const size_t available = get_element_count<user_type>(source);
+   if (first > available || element_count > available - first)
+   {
+      detail::error("Range is out of bounds", std::source_location::current());
+      return detail::get_nulled_object<result_type>();
+   }
+
+   // std::bit_cast doesn't need user_type to be default-constructible
+   return std::bit_cast<result_type>(detail::get_data_bytes<sizeof(result_type)>(source, first * sizeof(user_type)));
 }
 
 
 template<typename user_type>
-constexpr auto bb::get_element_count(
+constexpr bb::view<user_type>::view(
+   const uint64_t* source,
+   const size_t size
+)
+   : m_source(source)
+   , m_size(size)
+{
+   if (std::is_constant_evaluated() == false && source != nullptr)
+      m_data = static_cast<const user_type*>(get_data_ptr(source));
+}
+
+
+template<typename user_type>
+constexpr auto bb::view<user_type>::get_element_at(
+   const uint64_t* source,
+   const user_type* data,
+   const size_t index
+) -> user_type
+{
+   if (std::is_constant_evaluated())
+      return detail::get_data_object<user_type>(source, index * sizeof(user_type));
+   // Views from constant expressions are used at runtime too, their pointer couldn't be resolved back then
+   if (data == nullptr)
+      data = static_cast<const user_type*>(get_data_ptr(source));
+   return data[index];
+}
+
+
+template<typename user_type>
+constexpr auto bb::view<user_type>::begin() const -> iterator
+{
+   if (std::is_constant_evaluated())
+      return iterator{ m_source, nullptr, 0 };
+   return iterator{ m_source, data(), 0 };
+}
+
+
+template<typename user_type>
+auto bb::view<user_type>::data() const -> const user_type*
+{
+   if (m_data != nullptr || m_source == nullptr)
+      return m_data;
+   return static_cast<const user_type*>(get_data_ptr(m_source));
+}
+
+
+template<typename user_type>
+constexpr auto bb::get_view(
    const uint64_t* source
-) -> int
+) -> view<user_type>
 {
    if (source == nullptr)
    {
       detail::error("Source was nullptr", std::source_location::current());
-      return 0;
+      return view<user_type>{};
    }
-   const header head = get_header(source);
-   return head.decompressed_size / sizeof(user_type);
+   if (get_header(source).compression != 0)
+   {
+      detail::error("Payload is compressed. Views only work with uncompressed payloads", std::source_location::current());
+      return view<user_type>{};
+   }
+   return view<user_type>{ source, get_element_count<user_type>(source) };
 }
 
 
 template<typename user_type>
-constexpr auto bb::detail::get_nulled_object() -> user_type
+constexpr auto bb::get_pixel(
+   const uint64_t* source,
+   const int x,
+   const int y,
+   const int level
+) -> user_type
 {
-   return std::bit_cast<user_type>(detail::better_array<uint8_t, sizeof(user_type)>{});
+   if (source == nullptr)
+   {
+      detail::error("Source was nullptr", std::source_location::current());
+      return detail::get_nulled_object<user_type>();
+   }
+   const header head = get_header(source);
+   if (head.compression != 0)
+   {
+      detail::error("Payload is compressed. This interface only works with uncompressed payloads", std::source_location::current());
+      return detail::get_nulled_object<user_type>();
+   }
+   if (head.type != 1 || get_texture_format(source) != 0)
+   {
+      detail::error("get_pixel() only works with raw images", std::source_location::current());
+      return detail::get_nulled_object<user_type>();
+   }
+   if (level < 0 || level >= get_mip_count(source))
+   {
+      detail::error("Mip level is out of bounds", std::source_location::current());
+      return detail::get_nulled_object<user_type>();
+   }
+   const mip_level mip = get_mip_level(source, level);
+   if (x < 0 || x >= mip.width || y < 0 || y >= mip.height)
+   {
+      detail::error("Pixel is out of bounds", std::source_location::current());
+      return detail::get_nulled_object<user_type>();
+   }
+   const size_t byte_offset = mip.byte_offset + static_cast<size_t>(y) * mip.row_pitch + static_cast<size_t>(x) * sizeof(user_type);
+   return detail::get_data_object<user_type>(source, byte_offset);
 }
 
 
-constexpr auto bb::get_data_ptr(const uint64_t* source) -> const void*
+#ifdef BAKERY_PROVIDE_DECODE_CACHE
+auto bb::decode_cache::get(
+   const uint64_t* source
+) -> decoded_payload
 {
    if (source == nullptr)
    {
-      detail::error("Source was nullptr", std::source_location::current());
-      return nullptr;
+      detail::error("Source is nullptr", std::source_location::current());
+      return {};
+   }
+   if (get_header(source).compression == 0)
+   {
+      const uint8_t* data = static_cast<const uint8_t*>(get_data_ptr(source));
+      return decoded_payload{ std::shared_ptr<const uint8_t[]>(data, [](const uint8_t*) {}), static_cast<size_t>(get_decompressed_size(source)) };
    }
 
-   constexpr auto header_size = sizeof(header);
-   static_assert(header_size % sizeof(uint64_t) == 0);
+   std::shared_ptr<entry> target;
+   {
+      std::lock_guard lock(m_mutex);
+      std::shared_ptr<entry>& slot = m_entries[source];
+      if (slot == nullptr)
+         slot = std::make_shared<entry>();
+      slot->m_last_use = ++m_use_counter;
+      target = slot;
+   }
 
-   return &source[sizeof(header)/sizeof(uint64_t)];
+   // Decoding happens outside the lock, so that different payloads can be decoded at the same time
+   std::call_once(target->m_once, [&]() {
+      const size_t size = static_cast<size_t>(get_decompressed_size(source));
+      std::shared_ptr<uint8_t[]> bytes(new uint8_t[size]);
+      decode_into_pointer(source, bytes.get(), m_decomp_table);
+      target->m_payload = decoded_payload{ std::move(bytes), size };
+
+      std::lock_guard lock(m_mutex);
+      target->m_ready = true;
+      m_memory_use += size;
+      evict(target.get());
+   });
+   return target->m_payload;
+}
+
+
+auto bb::decode_cache::get_memory_use() -> size_t
+{
+   std::lock_guard lock(m_mutex);
+   return m_memory_use;
+}
+
+
+auto bb::decode_cache::clear() -> void
+{
+   std::lock_guard lock(m_mutex);
+   for (auto it = m_entries.begin(); it != m_entries.end(); )
+   {
+      if (it->second->m_ready)
+      {
+         m_memory_use -= it->second->m_payload.m_size;
+         it = m_entries.erase(it);
+      }
+      else
+      {
+         ++it;
+      }
+   }
+}
+
+
+auto bb::decode_cache::evict(
+   const entry* keep
+) -> void
+{
+   if (m_memory_budget == 0)
+      return;
+   while (m_memory_use > m_memory_budget)
+   {
+      // Payloads that are still being decoded aren't counted yet and can't be dropped
+      auto oldest = m_entries.end();
+      for (auto it = m_entries.begin(); it != m_entries.end(); ++it)
+      {
+         if (it->second.get() == keep || it->second->m_ready == false)
+            continue;
+         if (oldest == m_entries.end() || it->second->m_last_use < oldest->second->m_last_use)
+            oldest = it;
+      }
+      if (oldest == m_entries.end())
+         return;
+      m_memory_use -= oldest->second->m_payload.m_size;
+      m_entries.erase(oldest);
+   }
+}
+#endif // BAKERY_PROVIDE_DECODE_CACHE
+
+
+#ifdef BAKERY_PROVIDE_LZ4
+auto bb::lz4_decompression(
+   const void* src,
+   const size_t src_size,
+   void* dst,
+   const size_t dst_capacity
+) -> void
+{
+#ifdef BAKERY_TRUSTED_PAYLOADS
+   const int read_bytes = LZ4_decompress_fast(
+      static_cast<const char*>(src),
+      static_cast<char*>(dst),
+      static_cast<int>(dst_capacity)
+   );
+   if (read_bytes < 0 || static_cast<size_t>(read_bytes) != src_size)
+      detail::error("LZ4 decompression failed", std::source_location::current());
+#else
+   const int decompressed_bytes = LZ4_decompress_safe(
+      static_cast<const char*>(src),
+      static_cast<char*>(dst),
+      static_cast<int>(src_size),
+      static_cast<int>(dst_capacity)
+   );
+   if (decompressed_bytes < 0 || static_cast<size_t>(decompressed_bytes) != dst_capacity)
+      detail::error("LZ4 decompression failed", std::source_location::current());
+#endif
+}
+#endif // BAKERY_PROVIDE_LZ4
+
+
+#ifdef BAKERY_PROVIDE_ZSTD
+auto bb::zstd_decompression(
+   const void* src,
+   const size_t src_size,
+   void* dst,
+   const size_t dst_capacity
+) -> void
+{
+   // One context per thread, instead of ZSTD_decompress() setting one up for every call
+   struct dctx_deleter {
+      auto operator()(ZSTD_DCtx* context) const -> void { ZSTD_freeDCtx(context); }
+   };
+   thread_local std::unique_ptr<ZSTD_DCtx, dctx_deleter> context;
+   if (context == nullptr)
+      context.reset(ZSTD_createDCtx());
+   if (context == nullptr)
+   {
+      detail::error("zstd decompression context couldn't be created", std::source_location::current());
+      return;
+   }
+
+   const size_t decompressed_bytes = ZSTD_decompressDCtx(context.get(), dst, dst_capacity, src, src_size);
+   if (ZSTD_isError(decompressed_bytes) || decompressed_bytes != dst_capacity)
+      detail::error("zstd decompression failed", std::source_location::current());
+}
+#endif // BAKERY_PROVIDE_ZSTD
+
+
+#ifdef BAKERY_PROVIDE_CONSTEXPR_LZ4
+template<typename user_type, size_t element_count>
+constexpr auto bb::decode_to_array(
+   const uint64_t* source
+) -> std::array<user_type, element_count>
+{
+   static_assert(element_count > 0, "decode_to_array() needs at least one element");
+   using result_type = std::array<user_type, element_count>;
+   if (source == nullptr)
+   {
+      detail::error("Source was nullptr", std::source_location::current());
+      return detail::get_nulled_object<result_type>();
+   }
+
+   const header head = get_header(source);
+   if (head.compression == 0)
+      return get_elements<user_type, element_count>(source, 0);
+   if (head.compression != 2)
+   {
+      detail::error("Only uncompressed and LZ4 payloads can be decoded without a decompression function", std::source_location::current());
+      return detail::get_nulled_object<result_type>();
+   }
+   if (head.version & version_filtered)
+   {
+      detail::error("Filtered payloads can't be decoded at compile time", std::source_location::current());
+      return detail::get_nulled_object<result_type>();
+   }
+   if (element_count > get_element_count<user_type>(source))
+   {
+      detail::error("Range is out of bounds", std::source_location::current());
+      return detail::get_nulled_object<result_type>();
+   }
+
+   constexpr size_t byte_count = sizeof(result_type);
+   detail::better_array<uint8_t, static_cast<int>(byte_count)> bytes{};
+   const uint64_t* data = &source[detail::get_data_word_offset(source)];
+   bool success = true;
+   if ((head.version & version_chunked) == 0)
+   {
+      success = detail::lz4_decompress_block(data, 0, get_compressed_size(source), bytes, 0, byte_count);
+   }
+   else
+   {
+      const detail::chunk_table table = detail::get_chunk_table(source);
+      for (size_t i = 0; success && i < table.chunk_count && i * table.chunk_size < byte_count; ++i)
+      {
+         const size_t chunk_begin = i * table.chunk_size;
+         const size_t remaining_size = byte_count - chunk_begin;
+         const size_t chunk_size = remaining_size < table.chunk_size ? remaining_size : table.chunk_size;
+         const uint64_t chunk_offset = table.offsets[i];
+         success = detail::lz4_decompress_block(data, chunk_offset, table.offsets[i + 1] - chunk_offset, bytes, chunk_begin, chunk_size);
+      }
+   }
+   if (success == false)
+   {
+      detail::error("LZ4 data is malformed", std::source_location::current());
+      return detail::get_nulled_object<result_type>();
+   }
+   return std::bit_cast<result_type>(bytes);
+}
+#endif // BAKERY_PROVIDE_CONSTEXPR_LZ4
+
+
+#ifdef BAKERY_PROVIDE_VECTOR
+template<typename user_type, typename allocator_type>
+auto bb::decode_to_vector(
+   const uint64_t* source,
+   decompression_fun_type decomp_fun
+) -> std::vector<user_type, allocator_type>
+{
+   static_assert(std::is_default_constructible_v<user_type>, "decode_to_vector() requires the type to be default constructible. If that's a problem, file an issue. Should be possible (potentially slower).");
+   if (source == nullptr)
+   {
+      detail::error("Source was nullptr", std::source_location::current());
+      return {};
+   }
+
+   const header head = bb::get_header(source);
+   const size_t element_count = get_element_count<user_type>(source);
+   std::vector<user_type, allocator_type> result(element_count);
+   
+   if (head.compression == 0)
+   {
+      std::memcpy(result.data(), get_data_ptr(source), get_decompressed_size(source));
+   }
+   else if (head.compression > 0)
+   {
+      if (decomp_fun == nullptr)
+         decomp_fun = detail::get_builtin_decompression(head.compression);
+      if (decomp_fun == nullptr)
+      {
+         detail::error("Payload is compressed, but the decompression_fun parameter is nullptr.", std::source_location::current());
+         return {};
+      }
+      decode_into_pointer(source, result.data(), decomp_fun);
+   }
+   return result;
+}
+
+
+template<typename user_type, typename allocator_type>
+auto bb::decode_to_vector(
+   const uint64_t* source,
+   const decompression_table& decomp_table
+) -> std::vector<user_type, allocator_type>
+{
+   if (source == nullptr)
+   {
+      detail::error("Source was nullptr", std::source_location::current());
+      return {};
+   }
+   return decode_to_vector<user_type, allocator_type>(source, decomp_table.get(get_header(source).compression));
+}
+#endif // BAKERY_PROVIDE_VECTOR
+
+
+template<typename user_type>
+auto bb::decode_to_unique_ptr(
+   const uint64_t* source,
+   decompression_fun_type decomp_fun
+) -> std::unique_ptr<user_type[]>
+{
+   static_assert(std::is_default_constructible_v<user_type>, "decode_to_unique_ptr() requires the type to be default constructible.");
+   if (source == nullptr)
+   {
+      detail::error("Source was nullptr", std::source_location::current());
+      return nullptr;
+   }
+
+   const header head = bb::get_header(source);
+   if (head.compression > 0 && decomp_fun == nullptr && detail::get_builtin_decompression(head.compression) == nullptr)
+   {
+      detail::error("Payload is compressed, but the decompression_fun parameter is nullptr.", std::source_location::current());
+      return nullptr;
+   }
+   // Rounded up, decode_into_pointer() writes all decompressed bytes
+   const size_t element_count = (static_cast<size_t>(get_decompressed_size(source)) + sizeof(user_type) - 1) / sizeof(user_type);
+   std::unique_ptr<user_type[]> result(new user_type[element_count]);
+   decode_into_pointer(source, result.get(), decomp_fun);
+   return result;
+}
+
+
+template<typename user_type>
+auto bb::decode_to_unique_ptr(
+   const uint64_t* source,
+   const decompression_table& decomp_table
+) -> std::unique_ptr<user_type[]>
+{
+   if (source == nullptr)
+   {
+      detail::error("Source was nullptr", std::source_location::current());
+      return nullptr;
+   }
+   return decode_to_unique_ptr<user_type>(source, decomp_table.get(get_header(source).compression));
+}
+
+
+#ifdef BAKERY_PROVIDE_PAGE_HINTS
+bb::page_buffer::page_buffer(
+   const size_t size,
+   [[maybe_unused]] const int page_flags
+)
+   : m_size(size)
+{
+#ifdef __linux__
+   if (size >= page_hint_threshold && page_flags != 0)
+   {
+      // Populating before madvise() would fault in small pages, so that only happens in the mmap() call without huge pages
+      const bool populate_in_mmap = (page_flags & page_populate) && (page_flags & page_huge) == 0;
+      void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | (populate_in_mmap ? MAP_POPULATE : 0), -1, 0);
+      if (mapping != MAP_FAILED)
+      {
+         m_data = static_cast<uint8_t*>(mapping);
+         m_mapped = true;
+         if (page_flags & page_huge)
+         {
+            madvise(mapping, size, MADV_HUGEPAGE);
+            if (page_flags & page_populate)
+            {
+#ifdef MADV_POPULATE_WRITE
+               if (madvise(mapping, size, MADV_POPULATE_WRITE) != 0)
+#endif
+               {
+                  // Older kernels: touching one byte per small page faults in the whole range
+                  for (size_t i = 0; i < size; i += 4096)
+                     m_data[i] = 0;
+               }
+            }
+         }
+         return;
+      }
+   }
+#endif
+   m_data = new uint8_t[size];
+}
+
+
+bb::page_buffer::~page_buffer()
+{
+#ifdef __linux__
+   if (m_mapped)
+   {
+      munmap(m_data, m_size);
+      return;
+   }
+#endif
+   delete[] m_data;
+}
+
+
+bb::page_buffer::page_buffer(page_buffer&& other) noexcept
+   : m_data(std::exchange(other.m_data, nullptr))
+   , m_size(std::exchange(other.m_size, 0))
+   , m_mapped(std::exchange(other.m_mapped, false))
+{ }
+
+
+auto bb::page_buffer::operator=(page_buffer&& other) noexcept -> page_buffer&
+{
+   if (this != &other)
+   {
+      page_buffer old(std::move(*this));
+      m_data = std::exchange(other.m_data, nullptr);
+      m_size = std::exchange(other.m_size, 0);
+      m_mapped = std::exchange(other.m_mapped, false);
+   }
+   return *this;
+}
+
+
+auto bb::decode_to_pages(
+   const uint64_t* source,
+   const int page_flags,
+   decompression_fun_type decomp_fun
+) -> page_buffer
+{
+   if (source == nullptr)
+   {
+      detail::error("Source was nullptr", std::source_location::current());
+      return {};
+   }
+   page_buffer result(static_cast<size_t>(get_decompressed_size(source)), page_flags);
+   decode_into_pointer(source, result.data(), decomp_fun);
+   return result;
+}
+
+
+auto bb::decode_to_pages(
+   const uint64_t* source,
+   const int page_flags,
+   const decompression_table& decomp_table
+) -> page_buffer
+{
+   if (source == nullptr)
+   {
+      detail::error("Source was nullptr", std::source_location::current());
+      return {};
+   }
+   return decode_to_pages(source, page_flags, decomp_table.get(get_header(source).compression));
+}
+#endif // BAKERY_PROVIDE_PAGE_HINTS
+
+
+auto bb::decode_into_pointer(
+   const uint64_t* source,
+   void* dst,
+   const decompression_table& decomp_table
+) -> void
+{
+   if (source == nullptr)
+   {
+      detail::error("Source is nullptr", std::source_location::current());
+      return;
+   }
+   decode_into_pointer(source, dst, decomp_table.get(get_header(source).compression));
+}
+
+
+template<typename executor_type>
+auto bb::decode_into_pointer_parallel(
+   const uint64_t* source,
+   void* dst,
+   const executor_type& executor,
+   const decompression_table& decomp_table
+) -> void
+{
+   if (source == nullptr)
+   {
+      detail::error("Source is nullptr", std::source_location::current());
+      return;
+   }
+   decode_into_pointer_parallel(source, dst, executor, decomp_table.get(get_header(source).compression));
+}
+
+
+auto bb::decode_range(
+   const uint64_t* source,
+   const size_t byte_offset,
+   const size_t byte_count,
+   void* dst,
+   const decompression_table& decomp_table
+) -> void
+{
+   if (source == nullptr)
+   {
+      detail::error("Source is nullptr", std::source_location::current());
+      return;
+   }
+   decode_range(source, byte_offset, byte_count, dst, decomp_table.get(get_header(source).compression));
+}
+
+
+auto bb::decode_into_pointer(
+   const uint64_t* source,
+   void* dst,
+   decompression_fun_type decomp_fun
+) -> void
+{
+   if (source == nullptr)
+   {
+      detail::error("Source is nullptr", std::source_location::current());
+      return;
+   }
+   if (dst == nullptr)
+   {
+      detail::error("Destination is nullptr", std::source_location::current());
+      return;
+   }
+   const header head = bb::get_header(source);
+   if (head.compression > 0)
+   {
+      if (decomp_fun == nullptr)
+         decomp_fun = detail::get_builtin_decompression(head.compression);
+      if (decomp_fun == nullptr)
+      {
+         detail::error("Payload is compressed, but the decompression_fun parameter is nullptr.", std::source_location::current());
+         return;
+      }
+      if (head.version & version_chunked)
+      {
+         const detail::chunk_table table = detail::get_chunk_table(source);
+         uint8_t* dst_bytes = static_cast<uint8_t*>(dst);
+         for (int i = 0; i < static_cast<int>(table.chunk_count); ++i)
+            detail::decompress_chunk(source, table, i, dst_bytes + static_cast<size_t>(i) * table.chunk_size, decomp_fun);
+      }
+      else
+      {
+         detail::decompress_unfiltered(
+            detail::get_filter_info(source), get_data_ptr(source), get_compressed_size(source), dst, get_decompressed_size(source), decomp_fun
+         );
+      }
+   }
+   else
+   {
+      std::memcpy(dst, get_data_ptr(source), get_decompressed_size(source));
+   }
+}
+
+
+template<typename executor_type>
+auto bb::decode_into_pointer_parallel(
+   const uint64_t* source,
+   void* dst,
+   const executor_type& executor,
+   decompression_fun_type decomp_fun
+) -> void
+{
+   if (source == nullptr)
+   {
+      detail::error("Source is nullptr", std::source_location::current());
+      return;
+   }
+   if (dst == nullptr)
+   {
+      detail::error("Destination is nullptr", std::source_location::current());
+      return;
+   }
+   const header head = bb::get_header(source);
+   if (head.compression == 0 || (head.version & version_chunked) == 0)
+   {
+      decode_into_pointer(source, dst, decomp_fun);
+      return;
+   }
+   if (decomp_fun == nullptr)
+      decomp_fun = detail::get_builtin_decompression(head.compression);
+   if (decomp_fun == nullptr)
+   {
+      detail::error("Payload is compressed, but the decompression_fun parameter is nullptr.", std::source_location::current());
+      return;
+   }
+
+   const detail::chunk_table table = detail::get_chunk_table(source);
+   uint8_t* dst_bytes = static_cast<uint8_t*>(dst);
+   const auto task = [&](const int chunk_index) {
+      uint8_t* chunk_dst = dst_bytes + static_cast<size_t>(chunk_index) * table.chunk_size;
+      detail::decompress_chunk(source, table, chunk_index, chunk_dst, decomp_fun);
+   };
+   executor(static_cast<int>(table.chunk_count), task);
+}
+
+
+auto bb::decode_range(
+   const uint64_t* source,
+   const size_t byte_offset,
+   const size_t byte_count,
+   void* dst,
+   decompression_fun_type decomp_fun
+) -> void
+{
+   if (source == nullptr)
+   {
+      detail::error("Source is nullptr", std::source_location::current());
+      return;
+   }
+   const header head = bb::get_header(source);
+   const uint64_t decompressed_size = get_decompressed_size(source);
+   if (byte_offset > decompressed_size || byte_count > decompressed_size - byte_offset)
+   {
+      detail::error("Range is out of bounds", std::source_location::current());
+      return;
+   }
+   if (byte_count == 0)
+      return;
+   if (dst == nullptr)
+   {
+      detail::error("Destination is nullptr", std::source_location::current());
+      return;
+   }
+
+   uint8_t* dst_bytes = static_cast<uint8_t*>(dst);
+   if (head.compression == 0)
+   {
+      std::memcpy(dst_bytes, static_cast<const uint8_t*>(get_data_ptr(source)) + byte_offset, byte_count);
+      return;
+   }
+   if (decomp_fun == nullptr)
+      decomp_fun = detail::get_builtin_decompression(head.compression);
+   if (decomp_fun == nullptr)
+   {
+      detail::error("Payload is compressed, but the decompression_fun parameter is nullptr.", std::source_location::current());
+      return;
+   }
+   if ((head.version & version_chunked) == 0)
+   {
+      const auto buffer = std::make_unique_for_overwrite<uint8_t[]>(decompressed_size);
+      detail::decompress_unfiltered(
+         detail::get_filter_info(source), get_data_ptr(source), get_compressed_size(source), buffer.get(), decompressed_size, decomp_fun
+      );
+      std::memcpy(dst_bytes, buffer.get() + byte_offset, byte_count);
+      return;
+   }
+
+   const detail::chunk_table table = detail::get_chunk_table(source);
+   if (table.chunk_size == 0)
+   {
+      detail::error("Chunk table is invalid", std::source_location::current());
+      return;
+   }
+
+   // Chunks that are completely inside the range are decompressed in place, the ones at the borders through a buffer
+   std::unique_ptr<uint8_t[]> chunk_buffer;
+   const size_t range_end = byte_offset + byte_count;
+   for (size_t chunk_begin = byte_offset / table.chunk_size * table.chunk_size; chunk_begin < range_end; chunk_begin += table.chunk_size)
+   {
+      const int chunk_index = static_cast<int>(chunk_begin / table.chunk_size);
+      const size_t chunk_end = chunk_begin + table.chunk_size < decompressed_size ? chunk_begin + table.chunk_size : decompressed_size;
+      const size_t slice_begin = byte_offset > chunk_begin ? byte_offset : chunk_begin;
+      const size_t slice_end = range_end < chunk_end ? range_end : chunk_end;
+      uint8_t* slice_dst = dst_bytes + (slice_begin - byte_offset);
+      if (slice_begin == chunk_begin && slice_end == chunk_end)
+      {
+         detail::decompress_chunk(source, table, chunk_index, slice_dst, decomp_fun);
+         continue;
+      }
+      if (chunk_buffer == nullptr)
+         chunk_buffer = std::make_unique_for_overwrite<uint8_t[]>(table.chunk_size);
+      detail::decompress_chunk(source, table, chunk_index, chunk_buffer.get(), decomp_fun);
+      std::memcpy(slice_dst, chunk_buffer.get() + (slice_begin - chunk_begin), slice_end - slice_begin);
+   }
+}
+
+
+constexpr auto bb::get_element_count(
+   const uint64_t* source
+) -> size_t
+{
+   if (source == nullptr)
+   {
+      detail::error("Source was nullptr", std::source_location::current());
+      return 0;
+   }
+
+   if (is_image(source) == false)
+   {
+      detail::error("Can't call get_element_count() without template param for non-images.", std::source_location::current());
+      return 0;
+   }
+   return static_cast<size_t>(get_width(source)) * get_height(source);
+}
+
+
+template<typename user_type>
+constexpr auto bb::get_element_count(
+   const uint64_t* source
+) -> size_t
+{
+   if (source == nullptr)
+   {
+      detail::error("Source was nullptr", std::source_location::current());
+      return 0;
+   }
+   return get_decompressed_size(source) / sizeof(user_type);
+}
+
+
+template<typename user_type>
+constexpr auto bb::detail::get_nulled_object() -> user_type
+{
+   return std::bit_cast<user_type>(detail::better_array<uint8_t, sizeof(user_type)>{});
+}
+
+
+constexpr auto bb::get_data_ptr(const uint64_t* source) -> const void*
+{
+   if (source == nullptr)
+   {
+      detail::error("Source was nullptr", std::source_location::current());
+      return nullptr;
+   }
+
+   return &source[detail::get_data_word_offset(source)];
+}
+
+
+constexpr auto bb::get_name_hash(
+   std::string_view name
+) -> uint64_t
+{
+   uint64_t hash = 0xcbf29ce484222325;
+   for (const char ch : name)
+   {
+      hash ^= static_cast<uint8_t>(ch);
+      hash *= 0x100000001b3;
+   }
+   return hash;
+}
+
+
+constexpr auto bb::is_archive(
+   const uint64_t* archive
+) -> bool
+{
+   if (archive == nullptr)
+   {
+      detail::error("Archive was nullptr", std::source_location::current());
+      return false;
+   }
+   return archive[0] == archive_magic;
+}
+
+
+constexpr auto bb::get_archive_entry_count(
+   const uint64_t* archive
+) -> int
+{
+   if (is_archive(archive) == false)
+   {
+      detail::error("Not a payload archive", std::source_location::current());
+      return 0;
+   }
+   return static_cast<int>(std::bit_cast<detail::better_array<uint32_t, 2>>(archive[1])[0]);
+}
+
+
+constexpr auto bb::get_archive_payload(
+   const uint64_t* archive,
+   std::string_view name
+) -> const uint64_t*
+{
+   const int entry_count = get_archive_entry_count(archive);
+   const uint64_t name_hash = get_name_hash(name);
+   const auto get_entry_hash = [&](const int i) {
+      return archive[archive_index_word_offset + i * archive_entry_word_count];
+   };
+   int first = 0;
+   int count = entry_count;
+   while (count > 0)
+   {
+      const int half = count / 2;
+      if (get_entry_hash(first + half) < name_hash)
+      {
+         first += half + 1;
+         count -= half + 1;
+      }
+      else
+      {
+         count = half;
+      }
+   }
+   if (first < entry_count && get_entry_hash(first) == name_hash)
+      return get_archive_payload(archive, first);
+   return nullptr;
+}
+
+
+constexpr auto bb::get_archive_payload(
+   const uint64_t* archive,
+   const int entry_index
+) -> const uint64_t*
+{
+   if (entry_index < 0 || entry_index >= get_archive_entry_count(archive))
+   {
+      detail::error("Archive entry index out of range", std::source_location::current());
+      return nullptr;
+   }
+   const uint64_t byte_offset = archive[archive_index_word_offset + entry_index * archive_entry_word_count + 1];
+   return &archive[byte_offset / sizeof(uint64_t)];
+}
+
+
+constexpr auto bb::get_payload_size(
+   const uint64_t* source
+) -> uint64_t
+{
+   if (source == nullptr)
+   {
+      detail::error("Source was nullptr", std::source_location::current());
+      return 0;
+   }
+   return detail::get_data_word_offset(source) * sizeof(uint64_t) + get_compressed_size(source);
+}
+
+
+#ifdef    BAKERY_PROVIDE_ARCHIVE_LOADER
+namespace bb::detail {
+
+   // The page-aligned range around a payload, for the madvise() hints
+   struct page_range {
+      void* begin = nullptr;
+      size_t size = 0;
+   };
+
+   inline auto get_page_range(const uint64_t* payload) -> page_range
+   {
+#if defined(_WIN32)
+      SYSTEM_INFO system_info;
+      GetSystemInfo(&system_info);
+      const uintptr_t page_size = system_info.dwPageSize;
+#else
+      const uintptr_t page_size = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+#endif
+      const uintptr_t begin = reinterpret_cast<uintptr_t>(payload) / page_size * page_size;
+      const uintptr_t end = reinterpret_cast<uintptr_t>(payload) + static_cast<uintptr_t>(get_payload_size(payload));
+      return page_range{ reinterpret_cast<void*>(begin), static_cast<size_t>(end - begin) };
+   }
+
+   // If the header, its extensions and the data of the payload are within the first byte_count bytes behind it, and
+   // the sizes and the chunk table agree with each other. Decoding such a payload only reads from these bytes and
+   // writes get_decompressed_size() bytes. Only reads words that are known to be in there.
+   inline auto is_payload_within(const uint64_t* payload, const uint64_t byte_count) -> bool
+   {
+      const uint64_t word_count = byte_count / sizeof(uint64_t);
+      if (word_count < 2)
+         return false;
+      const uint32_t version = get_header(payload).version;
+      const size_t alignment_word = get_alignment_word_offset(payload);
+      if (alignment_word + ((version & version_aligned_data) ? 1 : 0) > word_count)
+         return false;
+      const size_t chunk_table_word = get_chunk_table_word_offset(payload);
+      if (chunk_table_word + ((version & version_chunked) ? 1 : 0) > word_count)
+         return false;
+      const size_t data_word = get_data_word_offset(payload);
+      if (data_word > word_count)
+         return false;
+      const uint64_t compressed_size = get_compressed_size(payload);
+      if (compressed_size > byte_count - data_word * sizeof(uint64_t))
+         return false;
+
+      // Uncompressed data is copied with the decompressed size, chunks are read between their offsets
+      const uint64_t decompressed_size = get_decompressed_size(payload);
+      if (get_header(payload).compression == 0)
+         return decompressed_size == compressed_size;
+      if ((version & version_chunked) == 0)
+         return true;
+      const chunk_table table = get_chunk_table(payload);
+      if (table.chunk_size == 0 || table.chunk_count != (decompressed_size + table.chunk_size - 1) / table.chunk_size)
+         return false;
+      if (table.offsets[0] != 0 || table.offsets[table.chunk_count] != compressed_size)
+         return false;
+      for (uint32_t i = 0; i < table.chunk_count; ++i)
+      {
+         if (table.offsets[i + 1] < table.offsets[i])
+            return false;
+      }
+      return true;
+   }
+
+}
+
+
+bb::mapped_archive::mapped_archive(
+   const char* path
+)
+{
+   const void* mapping = nullptr;
+   size_t size = 0;
+#if defined(_WIN32)
+   const HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+   if (file != INVALID_HANDLE_VALUE)
+   {
+      LARGE_INTEGER file_size{};
+      if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0)
+      {
+         // The view keeps the mapping object alive, so both handles can be closed right away
+         const HANDLE mapping_handle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+         if (mapping_handle != nullptr)
+         {
+            mapping = MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+            size = static_cast<size_t>(file_size.QuadPart);
+            CloseHandle(mapping_handle);
+         }
+      }
+      CloseHandle(file);
+   }
+#else
+   const int fd = open(path, O_RDONLY);
+   if (fd >= 0)
+   {
+      struct stat file_stat{};
+      if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0)
+      {
+         size = static_cast<size_t>(file_stat.st_size);
+         mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+         if (mapping == MAP_FAILED)
+            mapping = nullptr;
+      }
+      close(fd); // The mapping stays valid
+   }
+#endif
+   if (mapping == nullptr)
+   {
+      detail::error("Archive file couldn't be mapped", std::source_location::current());
+      return;
+   }
+
+   // Every entry is checked once here, so that decoding its payload stays within the mapping. The compressed data
+   // itself isn't checked, that's up to the decompression function.
+   const uint64_t* archive = static_cast<const uint64_t*>(mapping);
+   const auto is_consistent = [&]() {
+      if (size < archive_index_word_offset * sizeof(uint64_t) || archive[0] != archive_magic || archive[2] > size)
+         return false;
+      const uint64_t archive_size = archive[2];
+      const auto counts = std::bit_cast<detail::better_array<uint32_t, 2>>(archive[1]);
+      const uint32_t entry_count = counts[0];
+      const uint32_t alignment = counts[1];
+      if (entry_count > 0x7fffffff || alignment < sizeof(uint64_t) || std::has_single_bit(alignment) == false)
+         return false;
+      const uint64_t index_end = (archive_index_word_offset + uint64_t{ entry_count } * archive_entry_word_count) * sizeof(uint64_t);
+      if (index_end > archive_size)
+         return false;
+      for (uint32_t i = 0; i < entry_count; ++i)
+      {
+         const uint64_t* entry = &archive[archive_index_word_offset + i * archive_entry_word_count];
+         const uint64_t byte_offset = entry[1];
+         if (byte_offset % alignment != 0 || byte_offset < index_end || byte_offset >= archive_size)
+            return false;
+         const uint64_t* payload = &archive[byte_offset / sizeof(uint64_t)];
+         if (detail::is_payload_within(payload, archive_size - byte_offset) == false)
+            return false;
+         if (payload[0] != entry[2] || payload[1] != entry[3])
+            return false;
+      }
+      return true;
+   };
+   if (is_consistent() == false)
+   {
+      detail::error("File isn't a payload archive", std::source_location::current());
+#if defined(_WIN32)
+      UnmapViewOfFile(mapping);
+#else
+      munmap(const_cast<void*>(mapping), size);
+#endif
+      return;
+   }
+   m_archive = archive;
+   m_size = size;
+}
+
+
+bb::mapped_archive::~mapped_archive()
+{
+   if (m_archive == nullptr)
+      return;
+#if defined(_WIN32)
+   UnmapViewOfFile(m_archive);
+#else
+   munmap(const_cast<uint64_t*>(m_archive), m_size);
+#endif
+}
+
+
+bb::mapped_archive::mapped_archive(mapped_archive&& other) noexcept
+   : m_archive(std::exchange(other.m_archive, nullptr))
+   , m_size(std::exchange(other.m_size, 0))
+{ }
+
+
+auto bb::mapped_archive::operator=(mapped_archive&& other) noexcept -> mapped_archive&
+{
+   if (this != &other)
+   {
+      mapped_archive old(std::move(*this));
+      m_archive = std::exchange(other.m_archive, nullptr);
+      m_size = std::exchange(other.m_size, 0);
+   }
+   return *this;
+}
+
+
+auto bb::mapped_archive::get_entry_count() const -> int
+{
+   if (m_archive == nullptr)
+      return 0;
+   return get_archive_entry_count(m_archive);
+}
+
+
+auto bb::mapped_archive::get_payload(
+   std::string_view name
+) const -> const uint64_t*
+{
+   if (m_archive == nullptr)
+   {
+      detail::error("Archive isn't mapped", std::source_location::current());
+      return nullptr;
+   }
+   return get_archive_payload(m_archive, name);
+}
+
+
+auto bb::mapped_archive::get_payload(
+   const int entry_index
+) const -> const uint64_t*
+{
+   if (m_archive == nullptr)
+   {
+      detail::error("Archive isn't mapped", std::source_location::current());
+      return nullptr;
+   }
+   return get_archive_payload(m_archive, entry_index);
+}
+
+
+auto bb::mapped_archive::prefetch(
+   const uint64_t* payload
+) const -> void
+{
+   if (payload == nullptr)
+   {
+      detail::error("Payload was nullptr", std::source_location::current());
+      return;
+   }
+   [[maybe_unused]] const detail::page_range range = detail::get_page_range(payload);
+#if defined(_WIN32)
+#if defined(_WIN32_WINNT) && _WIN32_WINNT >= 0x0602
+   WIN32_MEMORY_RANGE_ENTRY entry{ range.begin, range.size };
+   PrefetchVirtualMemory(GetCurrentProcess(), 1, &entry, 0);
+#endif
+#else
+   madvise(range.begin, range.size, MADV_WILLNEED);
+#endif
+}
+
+
+auto bb::mapped_archive::prefetch(
+   std::string_view name
+) const -> void
+{
+   const uint64_t* payload = get_payload(name);
+   if (payload != nullptr)
+      prefetch(payload);
+}
+
+
+auto bb::mapped_archive::release(
+   [[maybe_unused]] const uint64_t* payload
+) const -> void
+{
+   if (payload == nullptr)
+   {
+      detail::error("Payload was nullptr", std::source_location::current());
+      return;
+   }
+#if !defined(_WIN32)
+   const detail::page_range range = detail::get_page_range(payload);
+   madvise(range.begin, range.size, MADV_DONTNEED);
+#endif
+}
+#endif // BAKERY_PROVIDE_ARCHIVE_LOADER
+
+
+constexpr auto bb::detail::get_dimensions_word_offset(const uint64_t* source) -> size_t
+{
+   constexpr auto header_size = sizeof(header);
+   static_assert(header_size % sizeof(uint64_t) == 0);
+
+   size_t word_offset = header_size / sizeof(uint64_t);
+   if (get_header(source).version & version_extended_sizes)
+      word_offset += 2;
+   return word_offset;
+}
+
+
+constexpr auto bb::detail::get_texture_word_offset(const uint64_t* source) -> size_t
+{
+   size_t word_offset = get_dimensions_word_offset(source);
+   if (get_header(source).version & version_extended_dimensions)
+      word_offset += 1;
+   return word_offset;
+}
+
+
+constexpr auto bb::get_data_alignment(const uint64_t* source) -> size_t
+{
+   if (source == nullptr)
+   {
+      detail::error("Source was nullptr", std::source_location::current());
+      return 0;
+   }
+   if ((get_header(source).version & version_aligned_data) == 0)
+      return sizeof(uint64_t);
+   return std::bit_cast<detail::better_array<uint32_t, 2>>(source[detail::get_alignment_word_offset(source)])[0];
+}
+
+
+constexpr auto bb::detail::get_filter_word_offset(const uint64_t* source) -> size_t
+{
+   size_t word_offset = get_texture_word_offset(source);
+   if (get_header(source).version & version_texture)
+      word_offset += 1;
+   return word_offset;
+}
+
+
+constexpr auto bb::detail::get_alignment_word_offset(const uint64_t* source) -> size_t
+{
+   size_t word_offset = get_filter_word_offset(source);
+   if (get_header(source).version & version_filtered)
+      word_offset += 1;
+   return word_offset;
+}
+
+
+constexpr auto bb::detail::get_chunk_table_word_offset(const uint64_t* source) -> size_t
+{
+   size_t word_offset = get_alignment_word_offset(source);
+   if (get_header(source).version & version_aligned_data)
+   {
+      const auto alignment_word = std::bit_cast<better_array<uint32_t, 2>>(source[word_offset]);
+      word_offset += 1 + alignment_word[1];
+   }
+   return word_offset;
+}
+
+
+constexpr auto bb::detail::get_texture_info(const uint64_t* source) -> texture_info
+{
+   if ((get_header(source).version & version_texture) == 0)
+      return texture_info{};
+   return std::bit_cast<texture_info>(source[get_texture_word_offset(source)]);
+}
+
+
+constexpr auto bb::detail::get_filter_info(const uint64_t* source) -> filter_info
+{
+   if ((get_header(source).version & version_filtered) == 0)
+      return filter_info{};
+   return std::bit_cast<filter_info>(source[get_filter_word_offset(source)]);
+}
+
+
+constexpr auto bb::detail::get_row_prediction(
+   const uint8_t predictor,
+   const uint8_t left,
+   const uint8_t above,
+   const uint8_t above_left
+) -> uint8_t
+{
+   switch (predictor) {
+   case predictor_left:
+      return left;
+   case predictor_above:
+      return above;
+   case predictor_average:
+      return static_cast<uint8_t>((left + above) / 2);
+   case predictor_paeth:
+   {
+      const int estimate = left + above - above_left;
+      const int left_distance = estimate > left ? estimate - left : left - estimate;
+      const int above_distance = estimate > above ? estimate - above : above - estimate;
+      const int above_left_distance = estimate > above_left ? estimate - above_left : above_left - estimate;
+      if (left_distance <= above_distance && left_distance <= above_left_distance)
+         return left;
+      if (above_distance <= above_left_distance)
+         return above;
+      return above_left;
+   }
+   default:
+      return 0;
+   }
+}
+
+
+auto bb::detail::unfilter(
+   const filter_info& info,
+   const uint8_t* src,
+   uint8_t* dst,
+   const size_t size
+) -> void
+{
+   const size_t element_size = info.element_size > 0 ? info.element_size : 1;
+   const size_t element_count = size / element_size;
+   if (info.filter == filter_shuffle)
+   {
+      unshuffle(src, dst, element_count, element_size);
+      const size_t shuffled_size = element_count * element_size;
+      std::memcpy(dst + shuffled_size, src + shuffled_size, size - shuffled_size);
+      return;
+   }
+   if (src != dst)
+      std::memcpy(dst, src, size);
+   if (info.filter == filter_delta)
+   {
+      switch (element_size) {
+      case 1: undelta<1>(dst, element_count); break;
+      case 2: undelta<2>(dst, element_count); break;
+      case 4: undelta<4>(dst, element_count); break;
+      case 8: undelta<8>(dst, element_count); break;
+      default: error("Element size of the delta filter is invalid", std::source_location::current());
+      }
+   }
+   else if (info.filter == filter_row)
+      unpredict_rows(info, dst, size);
+   else
+      error("Filter is unknown", std::source_location::current());
+}
+
+
+template<int element_size>
+auto bb::detail::undelta(
+   uint8_t* bytes,
+   const size_t element_count
+) -> void
+{
+   using element_type = std::conditional_t<element_size == 1, uint8_t,
+      std::conditional_t<element_size == 2, uint16_t,
+      std::conditional_t<element_size == 4, uint32_t, uint64_t>>>;
+   size_t i = 0;
+   element_type previous = 0;
+#ifdef BAKERY_UNFILTER_SSE2
+   const auto add = [](const __m128i a, const __m128i b) {
+      if constexpr (element_size == 1) return _mm_add_epi8(a, b);
+      else if constexpr (element_size == 2) return _mm_add_epi16(a, b);
+      else if constexpr (element_size == 4) return _mm_add_epi32(a, b);
+      else return _mm_add_epi64(a, b);
+   };
+   // The last element of a block in all lanes
+   const auto broadcast_last = [](const __m128i block) {
+      if constexpr (element_size == 1)
+      {
+         const __m128i last = _mm_srli_si128(block, 15);
+         return _mm_shuffle_epi32(_mm_shufflelo_epi16(_mm_unpacklo_epi8(last, last), 0), 0);
+      }
+      else if constexpr (element_size == 2)
+         return _mm_shuffle_epi32(_mm_shufflehi_epi16(block, 0xff), 0xff);
+      else if constexpr (element_size == 4)
+         return _mm_shuffle_epi32(block, 0xff);
+      else
+         return _mm_shuffle_epi32(block, 0xee);
+   };
+
+   // Prefix sums of 16 bytes in log2(lane count) shifted additions, plus the last element of the block before
+   constexpr size_t lane_count = 16 / element_size;
+   __m128i carry = _mm_setzero_si128();
+   for (; i + lane_count <= element_count; i += lane_count)
+   {
+      __m128i* block_ptr = reinterpret_cast<__m128i*>(bytes + i * element_size);
+      __m128i block = _mm_loadu_si128(block_ptr);
+      if constexpr (element_size <= 1)
+         block = add(block, _mm_slli_si128(block, 1));
+      if constexpr (element_size <= 2)
+         block = add(block, _mm_slli_si128(block, 2));
+      if constexpr (element_size <= 4)
+         block = add(block, _mm_slli_si128(block, 4));
+      block = add(block, _mm_slli_si128(block, 8));
+      block = add(block, carry);
+      _mm_storeu_si128(block_ptr, block);
+      carry = broadcast_last(block);
+   }
+   if (i > 0)
+      std::memcpy(&previous, bytes + (i - 1) * element_size, element_size);
+#endif // BAKERY_UNFILTER_SSE2
+   for (; i < element_count; ++i)
+   {
+      element_type value;
+      std::memcpy(&value, bytes + i * element_size, element_size);
+      previous = static_cast<element_type>(previous + value);
+      std::memcpy(bytes + i * element_size, &previous, element_size);
+   }
+}
+
+
+auto bb::detail::unshuffle(
+   const uint8_t* src,
+   uint8_t* dst,
+   const size_t element_count,
+   const size_t element_size
+) -> void
+{
+   size_t i = 0;
+#ifdef BAKERY_UNFILTER_SSE2
+   // 16 elements at a time, interleaving the planes byte by byte (and then pair by pair)
+   const auto load = [&](const size_t plane) {
+      return _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + plane * element_count + i));
+   };
+   const auto store = [&](const size_t block, const __m128i value) {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * element_size + block * 16), value);
+   };
+   if (element_size == 2)
+   {
+      for (; i + 16 <= element_count; i += 16)
+      {
+         const __m128i low_bytes = load(0);
+         const __m128i high_bytes = load(1);
+         store(0, _mm_unpacklo_epi8(low_bytes, high_bytes));
+         store(1, _mm_unpackhi_epi8(low_bytes, high_bytes));
+      }
+   }
+   else if (element_size == 4)
+   {
+      for (; i + 16 <= element_count; i += 16)
+      {
+         const __m128i bytes_0 = load(0);
+         const __m128i bytes_1 = load(1);
+         const __m128i bytes_2 = load(2);
+         const __m128i bytes_3 = load(3);
+         const __m128i bytes_01_low = _mm_unpacklo_epi8(bytes_0, bytes_1);
+         const __m128i bytes_01_high = _mm_unpackhi_epi8(bytes_0, bytes_1);
+         const __m128i bytes_23_low = _mm_unpacklo_epi8(bytes_2, bytes_3);
+         const __m128i bytes_23_high = _mm_unpackhi_epi8(bytes_2, bytes_3);
+         store(0, _mm_unpacklo_epi16(bytes_01_low, bytes_23_low));
+         store(1, _mm_unpackhi_epi16(bytes_01_low, bytes_23_low));
+         store(2, _mm_unpacklo_epi16(bytes_01_high, bytes_23_high));
+         store(3, _mm_unpackhi_epi16(bytes_01_high, bytes_23_high));
+      }
+   }
+#endif // BAKERY_UNFILTER_SSE2
+   for (; i < element_count; ++i)
+   {
+      for (size_t plane = 0; plane < element_size; ++plane)
+         dst[i * element_size + plane] = src[plane * element_count + i];
+   }
+}
+
+
+auto bb::detail::unpredict_rows(
+   const filter_info& info,
+   uint8_t* bytes,
+   const size_t size
+) -> void
+{
+   const size_t bpp = info.element_size;
+   const size_t row_size = info.row_size;
+   if (bpp == 0 || row_size == 0)
+   {
+      error("Row size of the row prediction is invalid", std::source_location::current());
+      return;
+   }
+
+   // The row above the first one is zero
+   const uint8_t* above = nullptr;
+   for (size_t row_begin = 0; row_begin < size; row_begin += row_size)
+   {
+      uint8_t* row = bytes + row_begin;
+      const size_t row_end = size - row_begin < row_size ? size - row_begin : row_size;
+      if (info.predictor == predictor_left)
+      {
+         for (size_t i = bpp; i < row_end; ++i)
+            row[i] = static_cast<uint8_t>(row[i] + row[i - bpp]);
+      }
+      else if (info.predictor == predictor_above)
+      {
+         // The only predictor without a dependency inside the row, compilers vectorize this
+         for (size_t i = 0; above != nullptr && i < row_end; ++i)
+            row[i] = static_cast<uint8_t>(row[i] + above[i]);
+      }
+      else
+      {
+         for (size_t i = 0; i < row_end; ++i)
+         {
+            const uint8_t left = i >= bpp ? row[i - bpp] : 0;
+            const uint8_t up = above != nullptr ? above[i] : 0;
+            const uint8_t up_left = i >= bpp && above != nullptr ? above[i - bpp] : 0;
+            row[i] = static_cast<uint8_t>(row[i] + get_row_prediction(info.predictor, left, up, up_left));
+         }
+      }
+      above = row;
+   }
+}
+
+
+auto bb::detail::decompress_unfiltered(
+   const filter_info& filter,
+   const void* src,
+   const size_t src_size,
+   void* dst,
+   const size_t dst_size,
+   decompression_fun_type decomp_fun
+) -> void
+{
+   uint8_t* dst_bytes = static_cast<uint8_t*>(dst);
+   if (filter.filter == filter_shuffle)
+   {
+      // Unshuffling can't be done in place
+      const auto buffer = std::make_unique_for_overwrite<uint8_t[]>(dst_size);
+      decomp_fun(src, src_size, buffer.get(), dst_size);
+      unfilter(filter, buffer.get(), dst_bytes, dst_size);
+      return;
+   }
+   decomp_fun(src, src_size, dst, dst_size);
+   if (filter.filter != 0)
+      unfilter(filter, dst_bytes, dst_bytes, dst_size);
+}
+
+
+constexpr auto bb::detail::get_mip_level(
+   const int width,
+   const int height,
+   const int bpp,
+   const texture_info& info,
+   const int level
+) -> mip_level
+{
+   const size_t alignment = info.row_alignment > 0 ? info.row_alignment : 1;
+   const auto get_aligned = [&](const size_t size) {
+      return (size + alignment - 1) / alignment * alignment;
+   };
+
+   mip_level result;
+   for (int i = 0; i <= level; ++i)
+   {
+      result.byte_offset += result.byte_size;
+      result.width = (width >> i) > 0 ? (width >> i) : 1;
+      result.height = (height >> i) > 0 ? (height >> i) : 1;
+      size_t row_bytes = static_cast<size_t>(result.width) * bpp;
+      size_t row_count = static_cast<size_t>(result.height);
+      if (info.format == 1) // BC1 has 8 bytes per 4x4 block
+      {
+         row_bytes = (static_cast<size_t>(result.width) + 3) / 4 * 8;
+         row_count = (row_count + 3) / 4;
+      }
+      result.row_pitch = get_aligned(row_bytes);
+      result.byte_size = result.row_pitch * row_count;
+   }
+   return result;
+}
+
+
+template<size_t byte_count>
+constexpr auto bb::detail::get_data_bytes(
+   const uint64_t* source,
+   const size_t byte_offset
+) -> better_array<uint8_t, byte_count>
+{
+   better_array<uint8_t, byte_count> result{};
+
+   // Walk the words instead of the bytes, so that every word is only converted once
+   using word_bytes_type = better_array<uint8_t, 8>;
+   const uint64_t* word = &source[get_data_word_offset(source) + byte_offset / sizeof(uint64_t)];
+   int byte_in_word = static_cast<int>(byte_offset % sizeof(uint64_t));
+   size_t result_byte = 0;
+   while (result_byte < byte_count)
+   {
+      const auto word_bytes = std::bit_cast<word_bytes_type>(*word);
+      for (; byte_in_word < 8 && result_byte < byte_count; ++byte_in_word, ++result_byte)
+         result[static_cast<int>(result_byte)] = word_bytes[byte_in_word];
+      byte_in_word = 0;
+      ++word;
+   }
+   return result;
+}
+
+
+template<typename user_type>
+constexpr auto bb::detail::get_data_object(
+   const uint64_t* source,
+   const size_t byte_offset
+) -> user_type
+{
+   // Use intermediate type because user-type might not be default constructible and not have operator[]
+   return std::bit_cast<user_type>(get_data_bytes<sizeof(user_type)>(source, byte_offset));
+}
+
+
+constexpr auto bb::detail::get_data_word_offset(const uint64_t* source) -> size_t
+{
+   size_t word_offset = get_chunk_table_word_offset(source);
+   if (get_header(source).version & version_chunked)
+      word_offset += 2 + get_chunk_table(source).chunk_count;
+   return word_offset;
+}
+
+
+constexpr auto bb::detail::get_chunk_table(const uint64_t* source) -> chunk_table
+{
+   const size_t table_word = get_chunk_table_word_offset(source);
+   const auto sizes = std::bit_cast<better_array<uint32_t, 2>>(source[table_word]);
+   return chunk_table{ sizes[0], sizes[1], &source[table_word + 1] };
+}
+
+
+#ifdef BAKERY_PROVIDE_CONSTEXPR_LZ4
+constexpr auto bb::detail::get_word_byte(
+   const uint64_t* words,
+   const size_t byte_index
+) -> uint8_t
+{
+   const int byte_in_word = static_cast<int>(byte_index % sizeof(uint64_t));
+   const int shift = 8 * (std::endian::native == std::endian::little ? byte_in_word : 7 - byte_in_word);
+   return static_cast<uint8_t>(words[byte_index / sizeof(uint64_t)] >> shift);
+}
+
+
+template<int capacity>
+constexpr auto bb::detail::lz4_decompress_block(
+   const uint64_t* data,
+   const size_t src_offset,
+   const size_t src_size,
+   better_array<uint8_t, capacity>& dst,
+   const size_t dst_offset,
+   const size_t dst_size
+) -> bool
+{
+   // A block is a series of sequences: a token with the literal and match length, the literals, then a 16 bit offset
+   // and the rest of the match length. The last sequence ends after its literals.
+   size_t src = src_offset;
+   const size_t src_end = src_offset + src_size;
+   size_t pos = dst_offset;
+   const size_t dst_end = dst_offset + dst_size;
+   const auto read_length = [&](size_t length) -> size_t {
+      if (length != 15)
+         return length;
+      uint8_t extra = 255;
+      while (extra == 255 && src < src_end)
+      {
+         extra = get_word_byte(data, src++);
+         length += extra;
+      }
+      return length;
+   };
+
+   while (pos < dst_end)
+   {
+      if (src >= src_end)
+         return false;
+      const uint8_t token = get_word_byte(data, src++);
+
+      const size_t literal_length = read_length(token >> 4);
+      if (literal_length > src_end - src)
+         return false;
+      for (size_t i = 0; i < literal_length && pos < dst_end; ++i)
+         dst[static_cast<int>(pos++)] = get_word_byte(data, src++);
+      if (pos == dst_end || src == src_end)
+         break;
+
+      if (src_end - src < 2)
+         return false;
+      const size_t match_offset = get_word_byte(data, src) | (get_word_byte(data, src + 1) << 8);
+      src += 2;
+      if (match_offset == 0 || match_offset > pos - dst_offset)
+         return false;
+
+      const size_t match_length = read_length(token & 15) + 4;
+      for (size_t i = 0; i < match_length && pos < dst_end; ++i, ++pos)
+         dst[static_cast<int>(pos)] = dst[static_cast<int>(pos - match_offset)];
+   }
+   return pos == dst_end;
+}
+#endif // BAKERY_PROVIDE_CONSTEXPR_LZ4
+
+
+auto bb::detail::register_builtin_decompression(
+   const uint8_t compression,
+   decompression_fun_type fun
+) -> bool
+{
+   builtin_decompression_funs[compression].store(fun, std::memory_order_relaxed);
+   return true;
+}
+
+
+auto bb::detail::get_builtin_decompression(
+   const uint8_t compression
+) -> decompression_fun_type
+{
+   if (compression >= std::size(builtin_decompression_funs))
+      return nullptr;
+   return builtin_decompression_funs[compression].load(std::memory_order_relaxed);
+}
+
+
+// Registered per translation unit, the variables have internal linkage
+#ifdef BAKERY_PROVIDE_ZSTD
+namespace bb::detail {
+   [[maybe_unused]] static const bool is_zstd_registered = register_builtin_decompression(1, zstd_decompression);
+}
+#endif
+#ifdef BAKERY_PROVIDE_LZ4
+namespace bb::detail {
+   [[maybe_unused]] static const bool is_lz4_registered = register_builtin_decompression(2, lz4_decompression);
+}
+#endif
+
+
+auto bb::detail::decompress_chunk(
+   const uint64_t* source,
+   const chunk_table& table,
+   const int chunk_index,
+   void* dst,
+   decompression_fun_type decomp_fun
+) -> void
+{
+   const uint8_t* data = static_cast<const uint8_t*>(get_data_ptr(source));
+   const uint64_t chunk_offset = table.offsets[chunk_index];
+   const uint64_t compressed_chunk_size = table.offsets[chunk_index + 1] - chunk_offset;
+   const size_t chunk_begin = static_cast<size_t>(chunk_index) * table.chunk_size;
+   const size_t remaining_size = get_decompressed_size(source) - chunk_begin;
+   const size_t decompressed_chunk_size = remaining_size < table.chunk_size ? remaining_size : table.chunk_size;
+   decompress_unfiltered(get_filter_info(source), data + chunk_offset, compressed_chunk_size, dst, decompressed_chunk_size, decomp_fun);
 }
 
 
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include <binary_bakery_lib/file_tools.h>
+#include <binary_bakery_lib/payload.h>
+
+
+namespace bb
+{
+   struct config;
+
+   // Persistent cache of final payloads, so that unchanged inputs don't need to be loaded and compressed again. Every
+   // entry is one file in the cache directory, named after its key. Entries are never removed, deleting the directory
+   // is always safe.
+   struct payload_cache {
+   private:
+      // Content hash of a file, valid as long as its modification time and size stay the same
+      struct file_hash {
+         fs::file_time_type m_write_time;
+         uintmax_t m_size = 0;
+         uint64_t m_content_hash = 0;
+      };
+
+      fs::path m_directory;
+      mutable std::mutex m_hash_mutex;
+      mutable std::unordered_map<std::string, file_hash> m_file_hashes; // By path
+
+      [[nodiscard]] auto get_entry_path(const uint64_t key) const -> fs::path;
+
+   public:
+      // Creates the directory if it doesn't exist
+      explicit payload_cache(const fs::path& directory);
+
+      // get_cache_key(), but the content of files that weren't modified since the last call isn't hashed again. That
+      // makes repeated bakes of mostly unchanged files in one process cheap.
+      [[nodiscard]] auto get_key(const abs_file_path& file, const config& cfg) const -> uint64_t;
+
+      [[nodiscard]] auto contains(const uint64_t key) const -> bool;
+      [[nodiscard]] auto load(const uint64_t key) const -> std::optional<detail::final_payload>;
+
+      // Size of the content the entry was made from, read from its header without loading the rest
+      [[nodiscard]] auto get_decompressed_size(const uint64_t key) const -> std::optional<uint64_t>;
+
+      // Written to a temporary file first and then renamed, so that no one ever reads a partial entry
+      auto store(const uint64_t key, const detail::final_payload& final_pl) const -> void;
+   };
+
+   // The .bb_cache directory next to the output file
+   [[nodiscard]] auto get_cache_directory(const config& cfg, const abs_directory_path& working_dir) -> fs::path;
+
+   // Hash of the file content and of all settings that change the final payload of that file
+   [[nodiscard]] auto get_cache_key(const abs_file_path& file, const config& cfg) -> uint64_t;
+
+}
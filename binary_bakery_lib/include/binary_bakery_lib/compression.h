@@ -1,10 +1,67 @@
 #pragma once
 
-#include <vector>
 #include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include <binary_bakery_lib/universal.h>
+
+struct ZSTD_CDict_s;
+struct ZSTD_CCtx_s;
 
 namespace bb
 {
-   auto get_zstd_compressed(const std::vector<uint8_t>& input) -> std::vector<uint8_t>;
-   auto get_lz4_compressed(const std::vector<uint8_t>& input) -> std::vector<uint8_t>;
+   // Trained zstd dictionary. m_cdict is the digested form for compression at m_level, the level it was trained for.
+   struct zstd_dictionary {
+      std::vector<uint8_t> m_bytes;
+      std::shared_ptr<const ZSTD_CDict_s> m_cdict;
+      int m_level = 0;
+   };
+
+   // Holds a zstd context, LZ4 states and an output buffer, which are reused between calls. Results are copied out in
+   // their exact size. Not thread-safe, use get_thread_compressor() for one per thread.
+   struct compressor {
+   private:
+      struct zstd_cctx_deleter {
+         auto operator()(ZSTD_CCtx_s* context) const -> void;
+      };
+      std::unique_ptr<ZSTD_CCtx_s, zstd_cctx_deleter> m_zstd_context;
+      std::vector<uint64_t> m_lz4_state;    // uint64_t for its alignment
+      std::vector<uint64_t> m_lz4_hc_state;
+      std::vector<uint8_t> m_buffer;
+
+      [[nodiscard]] auto get_zstd_context() -> ZSTD_CCtx_s*;
+      [[nodiscard]] auto get_buffer(const size_t min_size) -> std::span<uint8_t>;
+
+   public:
+      [[nodiscard]] auto get_zstd_compressed(std::span<const uint8_t> input, const int level, const bool long_range) -> std::vector<uint8_t>;
+      [[nodiscard]] auto get_zstd_compressed(std::span<const uint8_t> input, const zstd_dictionary& dictionary, const int level, const bool long_range) -> std::vector<uint8_t>;
+      [[nodiscard]] auto get_lz4_compressed(std::span<const uint8_t> input, const int level) -> std::vector<uint8_t>;
+   };
+
+   // thread_local instance. The free compression functions below use it.
+   [[nodiscard]] auto get_thread_compressor() -> compressor&;
+
+   // Levels are clamped to what zstd supports, including the "ultra" levels 20-22. Long range mode uses zstd's default
+   // window of 128 MB, so the data stays decodable with ZSTD_decompress().
+   auto get_zstd_compressed(std::span<const uint8_t> input, const int level = 3, const bool long_range = false) -> std::vector<uint8_t>;
+
+   // Compresses with the dictionary. Its digested form is only used for the level it was trained for without long range
+   // mode, other settings load the dictionary again for every call.
+   auto get_zstd_compressed(std::span<const uint8_t> input, const zstd_dictionary& dictionary, const int level, const bool long_range) -> std::vector<uint8_t>;
+
+   // Returns std::nullopt if zstd can't train a dictionary from the samples, ie if there are too few of them
+   [[nodiscard]] auto get_trained_zstd_dictionary(
+      const std::vector<std::span<const uint8_t>>& samples,
+      const size_t max_size,
+      const int level
+   ) -> std::optional<zstd_dictionary>;
+
+   // Level 0 is LZ4's default fast mode. Higher levels use LZ4HC, which compresses slower but decodes just as fast.
+   auto get_lz4_compressed(std::span<const uint8_t> input, const int level = 0) -> std::vector<uint8_t>;
+
+   // Single-threaded decode time, modeled from rough decompression speeds of a current desktop CPU
+   [[nodiscard]] auto get_modeled_decode_seconds(const compression_mode mode, const size_t decompressed_size) -> double;
 }
@@ -4,6 +4,8 @@
 
 #include <optional>
 #include <string>
+#include <string_view>
+#include <vector>
 
 
 namespace bb
@@ -11,15 +13,60 @@ namespace bb
    struct abs_directory_path;
    struct abs_file_path;
 
+   // Compression settings for the files whose name matches the glob pattern, ie "*.png"
+   struct compression_override {
+      std::string pattern;
+      compression_mode compression = compression_mode::none;
+      int zstd_level = 3;
+      bool zstd_long_range = false;
+      int lz4_level = 0;
+      filter_mode filter = filter_mode::none;
+      int filter_element_size = 4;
+   };
+
    struct config {
       std::string output_filename = "binary_bakery_payload.h";
       int indentation_size = 3;
       int max_columns = 100;
       compression_mode compression = compression_mode::none;
       bool prompt_for_key = true;
+      bool quiet = false; // No line per payload, only warnings and the summary
+      std::string report_path; // Per-payload timings and memory are written there. Empty: No report
+      report_format report_type = report_format::json;
       image_vertical_direction image_loading_direction = image_vertical_direction::bottom_to_top;
+      bool image_extra_formats = false; // Also decode .jpg, .jpeg and .hdr files. Otherwise they're binaries
+      bool image_pad_to_rgba = false; // Images with fewer channels get four. Grey is copied into RGB, alpha is opaque
+      bool image_premultiply_alpha = false;
+      std::string image_swizzle; // Order of the stored channels, ie "bgra". Empty: Unchanged
+      texture_format image_format = texture_format::raw;
+      int image_mip_levels = 1; // 0: Full mip chain down to 1x1
+      int image_row_alignment = 1; // Rows of image payloads are padded to a multiple of this many bytes
+      int thread_count = 0; // 0: One thread per hardware thread
+      bool streaming_output = false;
+      int memory_budget_mb = 0; // Loading waits while more loaded payloads than this wait to be written. 0: No limit
+      output_mode output = output_mode::header;
+      std::string archive_path; // Only for output_mode::archive. The archive is also written to this file. Empty: Only the header
+      int payload_alignment = 8; // Alignment of the payload arrays and the data in them. Power of two, at least 8
+      int shard_size = 0; // Only for output_mode::header. 0: One header. Otherwise bytes of payloads per .cpp shard
+      int chunk_size = 0; // 0: Compressed payloads are one frame. Otherwise decompressed bytes per independent chunk
+      int zstd_level = 3;
+      bool zstd_long_range = false;
+      int lz4_level = 0; // 0: LZ4 default compression. Otherwise the LZ4HC level
+      filter_mode filter = filter_mode::none; // Applied to compressed payloads before the compression
+      int filter_element_size = 4; // Bytes per element for the delta and shuffle filters: 1, 2, 4 or 8
+      bool zstd_dictionary = false; // Train one dictionary over all zstd payloads
+      int zstd_dictionary_size = 112640;
+      bool deduplicate = true; // Payloads with identical final bytes share one array
+      bool cache = false; // Keep final payloads in a .bb_cache directory next to the output, unchanged inputs are skipped
+      double auto_decode_budget_ms = 0.0; // compression_mode::automatic only uses codecs that decode a payload within this. 0: No limit
+      std::vector<compression_override> compression_overrides; // The last matching override wins
+      std::vector<std::string> input_include; // Globs for files in directory inputs. Empty: All files
+      std::vector<std::string> input_exclude; // Globs for files in directory inputs that are skipped
    };
 
+   // The config with the compression settings of the last override that matches the file name
+   [[nodiscard]] auto get_file_config(const config& cfg, std::string_view filename) -> config;
+
    [[nodiscard]] auto get_cfg_from_dir(const abs_directory_path& dir) -> std::optional<config>;
    [[nodiscard]] auto get_cfg_from_file(const abs_file_path& file) -> std::optional<config>;
 
@@ -2,6 +2,7 @@
 
 #include <array>
 #include <variant>
+#include <vector>
 #include <cstdint>
 
 #include <binary_bakery_lib/universal.h>
@@ -15,15 +16,32 @@ namespace bb {
       int m_width = 0;
       int m_height = 0;
       int m_bpp = 0;
+
+      // Texture layout of the baked bytes, see bb::version_texture
+      texture_format m_format = texture_format::raw;
+      int m_mip_count = 1;
+      int m_row_alignment = 1;
    };
 
-   using content_meta = std::variant<generic_binary, naive_image_type>;
+   // The trained zstd dictionary, stored as its own payload
+   struct zstd_dictionary_content {};
+
+   using content_meta = std::variant<generic_binary, naive_image_type, zstd_dictionary_content>;
 
+   // The header, followed by the 64-bit sizes and 32-bit image dimensions if they don't fit into it or version_flags
+   // asks for them, and the texture layout of images that need one. The filter_word follows if version_flags has
+   // bb::version_filtered. With a data_alignment above 8, the padding for it follows. chunk_table_size is the size of
+   // the chunk table between all that and the data. See bb::version_extended_sizes, bb::version_extended_dimensions,
+   // bb::version_texture and bb::version_aligned_data.
    [[nodiscard]] auto get_header_bytes(
        const content_meta& meta,
        const compression_mode compression,
       const byte_count uncompressed_size,
-      const byte_count compressed_size
-   ) -> std::array<uint8_t, 16>;
+      const byte_count compressed_size,
+      const uint8_t version_flags = 0,
+      const size_t data_alignment = sizeof(uint64_t),
+      const size_t chunk_table_size = 0,
+      const uint64_t filter_word = 0
+   ) -> std::vector<uint8_t>;
 
 }
@@ -1,6 +1,12 @@
 #pragma once
 
+#include <chrono>
+#include <cstdint>
 #include <filesystem>
+#include <initializer_list>
+#include <memory>
+#include <span>
+#include <string>
 #include <vector>
 
 namespace fs = std::filesystem;
@@ -36,4 +42,96 @@ namespace bb
 
    [[nodiscard]] auto get_binary_file(const abs_file_path& file) -> std::vector<uint8_t>;
 
+   // All regular files below dir, sorted by path. Their path relative to dir (with '/' separators, ie "textures/a.png")
+   // has to match one of the include globs, or there are none, and none of the exclude globs. Cache directories of
+   // the encoder are skipped.
+   [[nodiscard]] auto get_files_recursively(
+      const abs_directory_path& dir,
+      const std::vector<std::string>& include_patterns,
+      const std::vector<std::string>& exclude_patterns
+   ) -> std::vector<abs_file_path>;
+
+   // Read-only memory mapping of a whole file (mmap on POSIX, MapViewOfFile on Windows). Pages are only read once
+   // they're touched, so there's no upfront read or zero-initialization. Empty if the file couldn't be mapped, which
+   // includes empty files.
+   struct mapped_file {
+   private:
+      const uint8_t* m_data = nullptr;
+      size_t m_size = 0;
+
+   public:
+      explicit mapped_file(const abs_file_path& file);
+      ~mapped_file();
+
+      mapped_file(const mapped_file&) = delete;
+      mapped_file& operator=(const mapped_file&) = delete;
+      mapped_file(mapped_file&&) = delete;
+      mapped_file& operator=(mapped_file&&) = delete;
+
+      [[nodiscard]] auto is_mapped() const -> bool;
+      [[nodiscard]] auto get_bytes() const -> std::span<const uint8_t>;
+   };
+
+   // A directory for file_watcher, with or without its subdirectories
+   struct watched_directory {
+      abs_directory_path m_dir;
+      bool m_recursive = false;
+   };
+
+   // Reports changes to files below a set of directories, with inotify on Linux and ReadDirectoryChangesW on Windows.
+   // Elsewhere, or if those can't watch the directories, it compares modification times and sizes a few times per
+   // second. Cache directories of the encoder are ignored.
+   struct file_watcher {
+   private:
+      struct watcher_state;
+      std::unique_ptr<watcher_state> m_state;
+
+   public:
+      explicit file_watcher(const std::vector<watched_directory>& directories);
+      ~file_watcher();
+
+      file_watcher(const file_watcher&) = delete;
+      file_watcher& operator=(const file_watcher&) = delete;
+      file_watcher(file_watcher&&) = delete;
+      file_watcher& operator=(file_watcher&&) = delete;
+
+      // Blocks until something changed, then collects changes until there were none for quiet_time, so that saving
+      // many files at once is reported once. Returns the changed, created, removed or renamed paths, sorted and
+      // without duplicates. If changes were lost because too many happened, the watched directories themselves are
+      // among them.
+      [[nodiscard]] auto wait_for_changes(const std::chrono::milliseconds quiet_time) -> std::vector<fs::path>;
+   };
+
+   // Writes the bytes and zero-pads the file to a multiple of padding bytes. Throws if the file can't be written.
+   auto write_binary_file(const fs::path& path, std::span<const uint8_t> bytes, const int padding = 1) -> void;
+
+   // Same, with the file content being the concatenation of the parts
+   auto write_binary_file(
+      const fs::path& path,
+      std::initializer_list<std::span<const uint8_t>> parts,
+      const int padding = 1
+   ) -> void;
+
+   // Same, but leaves the file untouched if it already has exactly that content, so that build systems don't see a
+   // change. Otherwise writes a temporary file next to it and renames that over the file. Returns if it was written.
+   auto update_binary_file(
+      const fs::path& path,
+      std::initializer_list<std::span<const uint8_t>> parts,
+      const int padding = 1
+   ) -> bool;
+
+   // Temporary file in the same directory, so that it can be renamed over path
+   [[nodiscard]] auto get_temp_path(const fs::path& path) -> fs::path;
+
+   // Text outputs start with a comment line holding the hash of everything after it. Files are written with this
+   // placeholder first, then replace_if_changed() fills it in.
+   [[nodiscard]] auto get_hash_line_placeholder() -> std::string;
+
+   // If the file starts like the text outputs do, see get_hash_line_placeholder(). Only reads that far.
+   [[nodiscard]] auto has_hash_line(const fs::path& path) -> bool;
+
+   // Renames temp_path over path, unless the hash in the first line of path already matches the content of temp_path.
+   // In that case temp_path is deleted and path stays untouched. Returns if path was replaced.
+   auto replace_if_changed(const fs::path& temp_path, const fs::path& path) -> bool;
+
 }
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include <binary_bakery_lib/content_meta.h>
+
+
+namespace bb
+{
+   struct config;
+
+   // One way to filter a payload before its compression, see bb::version_filtered
+   struct filter_params {
+      filter_mode m_filter = filter_mode::none; // Never filter_mode::automatic
+      int m_element_size = 1; // Bytes per element, or per pixel for row prediction
+      int m_predictor = 0; // Only for row prediction, see bb::detail::predictor_left
+      size_t m_row_size = 0; // Only for row prediction
+   };
+
+   // The filters the config asks for with this payload. Row prediction only applies to raw images without texture
+   // layout and uses the predictor with the smallest residuals. filter_mode::automatic returns no filter first and
+   // then every filter that applies, so that their compressed sizes can be compared.
+   [[nodiscard]] auto get_filter_candidates(
+      const std::span<const uint8_t> bytes,
+      const content_meta& meta,
+      const config& cfg
+   ) -> std::vector<filter_params>;
+
+   // Chunks of filtered payloads are a multiple of this, so that no element or row is split
+   [[nodiscard]] auto get_filter_block_size(const filter_params& params) -> size_t;
+
+   // The extension word of bb::version_filtered
+   [[nodiscard]] auto get_filter_word(const filter_params& params) -> uint64_t;
+
+   // Filters every chunk_size bytes on their own, like the decoder reverses them. 0: All bytes at once
+   [[nodiscard]] auto get_filtered(
+      const std::span<const uint8_t> bytes,
+      const filter_params& params,
+      const size_t chunk_size
+   ) -> std::vector<uint8_t>;
+
+   // Name of the filter in a header, for the diagnostics
+   [[nodiscard]] auto get_filter_name(const uint8_t filter) -> const char*;
+
+}
@@ -1,6 +1,11 @@
 #pragma once
 
 #include <compare>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
 #include <vector>
 #include <cstring> // memcpy
 
@@ -10,6 +15,7 @@
 namespace bb
 {
    struct abs_file_path;
+   struct config;
 
    struct image_dimensions {
       int width = 0;
@@ -39,10 +45,46 @@ namespace bb
       auto operator<=>(const image<bpp>&) const = default;
    };
 
+   // Tightly packed pixel bytes with the channel count of the file
+   struct decoded_image {
+      image_dimensions dimensions;
+      std::vector<uint8_t> bytes;
+   };
+
+   using image_dimensions_fun_type = std::add_pointer_t<std::optional<image_dimensions>(std::span<const uint8_t> file_bytes)>;
+   using image_decode_fun_type = std::add_pointer_t<std::optional<decoded_image>(std::span<const uint8_t> file_bytes)>;
+
+   // Decodes image files of some formats. Both functions get the whole file and return std::nullopt if it isn't valid.
+   // Pixels are 8 bits per channel, tightly packed and with the top row first.
+   struct image_decoder {
+      std::string m_name;
+      std::vector<std::string> m_extensions; // With the dot, ie ".png"
+      image_dimensions_fun_type m_get_dimensions = nullptr; // Should only read the file header
+      image_decode_fun_type m_decode = nullptr;
+      bool m_is_extra_format = false; // Only used with config::image_extra_formats, otherwise the files are binaries
+      std::string m_warning; // Printed for every file it decodes, ie when the pixels lose information
+   };
+
+   // Built in are stb_image for .png, .tga and .bmp, a QOI decoder for .qoi and, when built with BB_USE_SPNG, libspng
+   // for .png. The extra formats .jpg, .jpeg and .hdr (tone mapped to 8 bits) are decoded with stb_image as well. A
+   // registered decoder takes over its extensions from the ones before it. Not thread-safe, register decoders before
+   // loading images.
+   auto register_image_decoder(const image_decoder& decoder) -> void;
+
+   // The decoder for files with this extension, nullptr if there is none.
+   [[nodiscard]] auto get_image_decoder(std::string_view extension) -> const image_decoder*;
+
+   // The decoder for the file with these settings, nullptr if it's baked as a binary
+   [[nodiscard]] auto get_image_decoder(const abs_file_path& file, const config& cfg) -> const image_decoder*;
+
    // To instantiate the templated image type, it's necessary to first find out the images bpp
    // before reading.
    [[nodiscard]] auto get_image_dimensions(const abs_file_path& file) -> image_dimensions;
 
+   // Opens, parses and decodes the file exactly once. Use this instead of get_image_dimensions() + image<bpp> when
+   // only the bytes are needed.
+   [[nodiscard]] auto load_image(const abs_file_path& file, const image_vertical_direction direction) -> decoded_image;
+
    template<int bpp>
    [[nodiscard]] auto get_image_bytestream(const image<bpp>& image) -> std::vector<uint8_t>;
 
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <binary_bakery_lib/universal.h>
+
+
+namespace bb
+{
+   struct abs_directory_path;
+   struct config;
+
+   enum class bake_phase { load, image_decode, cache_read, dictionary_training, compress, format, write };
+
+   // One phase of the work on a payload or output file. Times are relative to the start of the process.
+   struct phase_record {
+      bake_phase m_phase = bake_phase::load;
+      int64_t m_start_us = 0;
+      int64_t m_duration_us = 0;
+      int m_thread = 0; // Small index per thread, in the order threads first measured something
+      uint64_t m_bytes_in = 0;
+      uint64_t m_bytes_out = 0;
+      uint64_t m_allocations = 0; // Heap allocations of the thread during the phase, see count_allocation()
+      uint64_t m_peak_rss = 0; // Peak resident memory of the process at the end of the phase, in bytes
+   };
+
+   // All phases of one payload or output file
+   struct bake_metrics {
+      std::string m_name;
+      std::vector<phase_record> m_phases;
+   };
+
+   // Measures one phase on the calling thread. stop() has to be called on the same thread for the allocation count.
+   struct phase_timer {
+   private:
+      bake_phase m_phase;
+      std::chrono::steady_clock::time_point m_t0;
+      uint64_t m_allocations_before;
+
+   public:
+      explicit phase_timer(const bake_phase phase);
+
+      [[nodiscard]] auto stop(const uint64_t bytes_in, const uint64_t bytes_out) const -> phase_record;
+   };
+
+   [[nodiscard]] auto get_phase_name(const bake_phase phase) -> const char*;
+
+   // Peak resident set size of the process in bytes, 0 if the platform doesn't provide it
+   [[nodiscard]] auto get_peak_rss() -> uint64_t;
+
+   // Counts one heap allocation of the calling thread. The library doesn't replace operator new, programs that want
+   // allocations in the bake report call this from theirs. The binary_bakery executable does with BB_COUNT_ALLOCATIONS.
+   auto count_allocation() noexcept -> void;
+
+   // Number of heap allocations of the calling thread so far, see count_allocation()
+   [[nodiscard]] auto get_thread_allocation_count() -> uint64_t;
+
+   // The metrics as JSON (one object per payload or output with its phases), or in the Chrome trace event format that
+   // chrome://tracing and Perfetto open.
+   [[nodiscard]] auto get_report_str(const std::vector<bake_metrics>& metrics, const report_format format) -> std::string;
+
+   // Writes the report to cfg.report_path, relative to working_dir. Does nothing if that's empty.
+   auto write_report(const config& cfg, const std::vector<bake_metrics>& metrics, const abs_directory_path& working_dir) -> void;
+
+}
@@ -1,44 +1,158 @@
 #pragma once
 
+#include <array>
+#include <functional>
+#include <memory>
+#include <iosfwd>
+#include <optional>
+#include <span>
+#include <string>
 #include <vector>
 
 #include <binary_bakery_lib/content_meta.h>
 #include <binary_bakery_lib/file_tools.h>
+#include <binary_bakery_lib/metrics.h>
 
 
 namespace bb {
 
    struct config;
+   struct zstd_dictionary;
+   struct payload_cache;
 
    // Content bytestream + meta object
    struct payload {
       std::vector<uint8_t> m_content_data;
+      std::unique_ptr<mapped_file> m_mapped_content; // Used instead of m_content_data for memory mapped files
       content_meta m_meta;
-      abs_file_path m_path;
+      std::string m_name; // File name. get_payload() finds it by this, the array is called "bb_" + m_name
+      std::shared_ptr<const zstd_dictionary> m_zstd_dictionary; // zstd compression uses this dictionary if set
+      std::shared_ptr<const payload_cache> m_cache; // If set, the final payload is stored in this cache
+      uint64_t m_cache_key = 0; // Hash of the file and its settings, see get_cache_key(). Also set for deferred files
+      bool m_is_cached = false; // The content wasn't loaded because the final payload is already in m_cache
+      std::optional<abs_file_path> m_deferred_file; // Not loaded yet because of cfg.memory_budget_mb, see get_payloads()
+      std::vector<phase_record> m_phase_records; // Everything done with this payload so far, for the bake report
 
       // Making sure no one is left behind during init
-      payload(std::vector<uint8_t>&& content, const content_meta& meta, const abs_file_path& file)
+      payload(std::vector<uint8_t>&& content, const content_meta& meta, const std::string& name)
          : m_content_data(std::move(content))
          , m_meta(meta)
-         , m_path(file)
+         , m_name(name)
       {
          
       }
+
+      payload(std::unique_ptr<mapped_file>&& mapped_content, const content_meta& meta, const std::string& name)
+         : m_mapped_content(std::move(mapped_content))
+         , m_meta(meta)
+         , m_name(name)
+      {
+
+      }
+
+      [[nodiscard]] auto get_content() const -> std::span<const uint8_t>;
+      auto free_content() -> void;
    };
 
    // TODO maybe make this optional and deal with exception from file opening, parsing errors etc
    [[nodiscard]] auto get_payload(const abs_file_path& path, const config& cfg) -> payload;
 
+   // Payload from memory instead of a file, the content is copied. For images, the content are the tightly packed
+   // pixels of the meta's size, which are turned into its texture layout. Throws if the size doesn't match.
+   [[nodiscard]] auto get_payload(std::span<const uint8_t> content, const content_meta& meta, const std::string& name) -> payload;
+
+   // Loads the files on cfg.thread_count threads. The result has the same order as the input. Throws before loading
+   // anything if two files get the same payload name, which is the file name without its directory. With a cache, files
+   // whose final payload is in there aren't loaded at all. The cache isn't used together with cfg.zstd_dictionary.
+   // With cfg.memory_budget_mb, no file is loaded here. That happens while the payloads are written, and loading waits
+   // while the loaded payloads that aren't written yet exceed the budget. The dictionary needs all payloads at once
+   // and turns that off.
+   [[nodiscard]] auto get_payloads(
+      const std::vector<abs_file_path>& files,
+      const config& cfg,
+      const std::shared_ptr<const payload_cache>& cache = nullptr
+   ) -> std::vector<payload>;
+
+   // If path is one of the files that write_payloads_to_file() writes with cfg into working_dir, or a temporary file of
+   // one: The header, its shards, the assembly and .bin files of the incbin and embed modes, the archive and the report.
+   [[nodiscard]] auto is_output_path(const fs::path& path, const config& cfg, const abs_directory_path& working_dir) -> bool;
+
+   // The files below dir that are inputs with cfg, see get_files_recursively(). Configs and the outputs of cfg are left
+   // out, so that baking into one of the input directories doesn't pick up its own output the next time. So are text
+   // outputs and archives of other configs, which are recognized by their first bytes.
+   [[nodiscard]] auto get_directory_inputs(
+      const abs_directory_path& dir,
+      const config& cfg,
+      const abs_directory_path& working_dir
+   ) -> std::vector<abs_file_path>;
+
+   // With cfg.report_path, also writes the bake report with the phases of every payload and the output files. Throws if
+   // two payloads have the same name, or names that end up as the same array.
    auto write_payloads_to_file(
       const config& cfg,
       std::vector<payload>&& payloads,
       const abs_directory_path& working_dir
    ) -> void;
+
+   // Writes the complete header into out, without touching any files. Always writes what output_mode = "header"
+   // without shards would, the output mode and shard settings are ignored. Throws on names like the above.
+   auto write_payloads_to_stream(
+      const config& cfg,
+      std::vector<payload>&& payloads,
+      std::ostream& out
+   ) -> void;
+
+   // Writes the final bytes of a single payload (header and data, zero-padded to a multiple of 8 bytes) into out.
+   // That's the content of the .bin files of the "incbin" and "embed" output modes, for packing them yourself.
+   auto write_payload_bytes(payload& pl, const config& cfg, std::ostream& out) -> void;
 }
 
 
 namespace bb::detail
 {
+   // The final bytestream in two parts, so that the data never needs to be copied behind the header. m_data is the
+   // compressed data or the moved-in content. Uncompressed mapped content stays mapped in m_mapped_data instead.
+   struct final_payload {
+      std::vector<uint8_t> m_header; // 16 bytes, plus the header extensions of the version flags
+      compression_mode m_compression = compression_mode::none; // Never automatic, that's resolved per payload
+      std::vector<uint8_t> m_data;
+      std::unique_ptr<mapped_file> m_mapped_data;
+
+      [[nodiscard]] auto get_data() const -> std::span<const uint8_t>;
+   };
+
+   // A payload whose final bytes are the same as those of another one. get_payload() returns the array of that one,
+   // and the header declares a pointer with the name the array would have had.
+   struct payload_alias {
+      std::string m_name;
+      int m_target; // Index into the remaining payloads
+      int m_position; // Index among all payloads before the duplicates were removed, payload_id keeps that order
+   };
+
+   // With cfg.deduplicate, removes every payload whose content, meta and compression settings are identical to an
+   // earlier one, and returns it as an alias of that one. Nothing is removed otherwise.
+   [[nodiscard]] auto remove_duplicates(std::vector<payload>& payloads, const config& cfg) -> std::vector<payload_alias>;
+
+   // With cfg.zstd_dictionary, trains a dictionary over all payloads that might be compressed with zstd. Those use it
+   // from then on, and the dictionary is inserted as the first payload. Nothing changes if training fails.
+   auto add_zstd_dictionary(std::vector<payload>& payloads, const config& cfg) -> void;
+
+   // Moves the content out of pl. Payloads in the cache are read from it instead.
+   [[nodiscard]] auto get_final_payload(payload& pl, const config& cfg) -> final_payload;
+
+   // Header and data in one contiguous vector
    [[nodiscard]] auto get_final_bytestream(payload& pl, const config& cfg) -> std::vector<uint8_t>;
 
+   // The array declaration of the final payload, as in the header. Only formats, nothing is compressed.
+   [[nodiscard]] auto get_payload_str(const final_payload& final_pl, const std::string& name, const config& cfg) -> std::string;
+
+   using final_payload_fun = std::function<void(const int index, const final_payload& final_pl)>;
+
+   // Computes the final payloads on all threads and hands them to fun in input order, one at a time. The thread that
+   // finishes the next payload in order calls fun for it and for all finished ones behind it. Loading a payload waits
+   // while the payloads that are loaded but not handed to fun exceed cfg.memory_budget_mb. The next payload in order
+   // never waits, so files larger than the budget still get through, and the waiting can't deadlock. Returns the most
+   // bytes of loaded content and final payloads that were held at once.
+   auto for_each_final_payload_within_budget(std::vector<payload>& payloads, const config& cfg, const final_payload_fun& fun) -> uint64_t;
+
 }
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include <binary_bakery_lib/content_meta.h>
+
+
+namespace bb
+{
+   struct config;
+   struct decoded_image;
+
+   // Applies image_pad_to_rgba, image_premultiply_alpha and image_swizzle of the config. Alpha is premultiplied in the
+   // channels of the file, the swizzle letters refer to the channels after padding. Throws if the swizzle doesn't
+   // have a letter for every channel or uses one that doesn't exist.
+   auto convert_channels(decoded_image& image, const config& cfg) -> void;
+
+   // The image description with the texture settings of the config. The mip count is clamped to the full chain.
+   [[nodiscard]] auto get_texture_meta(const int width, const int height, const int bpp, const config& cfg) -> naive_image_type;
+
+   // If the baked bytes need the layout of bb::version_texture instead of tightly packed pixels
+   [[nodiscard]] auto is_texture(const naive_image_type& meta) -> bool;
+
+   // Number of levels in a mip chain from the full size down to 1x1
+   [[nodiscard]] auto get_full_mip_count(const int width, const int height) -> int;
+
+   // The extension word of bb::version_texture
+   [[nodiscard]] auto get_texture_word(const naive_image_type& meta) -> uint64_t;
+
+   // Size of all levels, including the row padding
+   [[nodiscard]] auto get_texture_byte_count(const naive_image_type& meta) -> size_t;
+
+   // Turns the tightly packed pixels of the full-size level into the layout described by meta. Mip levels are
+   // box-filtered from the level above, padding bytes are zero.
+   [[nodiscard]] auto get_texture_bytes(const std::span<const uint8_t> pixels, const naive_image_type& meta) -> std::vector<uint8_t>;
+
+   // Encodes 4x4 RGB pixels (row by row) into a BC1 block, in four-color mode with the bounding box colors as endpoints
+   [[nodiscard]] auto get_bc1_block(const std::array<std::array<uint8_t, 3>, 16>& pixels) -> uint64_t;
+
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace bb
+{
+
+   // Fixed set of worker threads. The calling thread takes part in the work as well, so a pool with a thread count of
+   // 1 runs everything inline.
+   struct thread_pool {
+   private:
+      std::vector<std::thread> m_workers;
+      std::mutex m_mutex;
+      std::condition_variable m_job_cv;
+      std::condition_variable m_done_cv;
+      const std::function<void(int)>* m_job = nullptr;
+      int m_job_size = 0;
+      std::atomic<int> m_next_index = 0;
+      int m_busy_workers = 0;
+      uint64_t m_generation = 0;
+      bool m_stopping = false;
+      std::exception_ptr m_exception;
+
+      auto worker_loop() -> void;
+      auto work_on(const std::function<void(int)>& job, const int job_size) -> void;
+
+   public:
+      explicit thread_pool(const int thread_count);
+      ~thread_pool();
+
+      thread_pool(const thread_pool&) = delete;
+      thread_pool& operator=(const thread_pool&) = delete;
+      thread_pool(thread_pool&&) = delete;
+      thread_pool& operator=(thread_pool&&) = delete;
+
+      [[nodiscard]] auto get_thread_count() const -> int;
+
+      // Calls fun(i) for every i in [0, count). Blocks until all calls are done. If any call throws, the remaining
+      // indices are skipped and the first exception is rethrown.
+      auto parallel_for(const int count, const std::function<void(int)>& fun) -> void;
+   };
+
+   // Process-wide pool. A thread_count <= 0 means one thread per hardware thread. Recreates the pool if the count
+   // changes, so this is not meant to be called concurrently.
+   [[nodiscard]] auto get_thread_pool(const int thread_count) -> thread_pool&;
+
+}
@@ -1,7 +1,9 @@
 #pragma once
 
 #include <iterator> // std::back_inserter
+#include <span>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include <binary_bakery_lib/universal.h>
@@ -9,7 +11,7 @@
 namespace bb {
 
    template<typename T>
-   [[nodiscard]] constexpr auto get_symbol_count(const byte_count count) -> int;
+   [[nodiscard]] constexpr auto get_symbol_count(const byte_count count) -> size_t;
 
    [[nodiscard]] auto get_replaced_str(
       const std::string& source,
@@ -24,18 +26,32 @@ namespace bb {
    // std::format unfortunately
    auto append_ui64_str(const uint64_t value, std::string& target) -> void;
 
+   // Writes the 18 characters of "0xffffffffffffffff" to dst without a terminator. Returns the end of the written range.
+   // Uses SSE2 or NEON where available, a byte lookup table otherwise.
+   auto write_ui64_str(const uint64_t value, char* dst) -> char*;
+
+   // Appends "0x..., 0x..., 0x..." for all words in one go. A trailing ',' is added if requested.
+   auto append_ui64_line(std::span<const uint64_t> words, const bool trailing_comma, std::string& target) -> void;
+
+   // Quotes, backslashes and control characters escaped for a JSON string
+   [[nodiscard]] auto get_json_escaped(const std::string& str) -> std::string;
+
    [[nodiscard]] auto get_human_readable_size(const byte_count bytes) -> std::string;
+   [[nodiscard]] auto get_human_readable_time(const double seconds) -> std::string;
+
+   // Glob match of the whole text. '*' matches any sequence of characters, '?' matches one character.
+   [[nodiscard]] auto matches_glob(std::string_view pattern, std::string_view text) -> bool;
+
+   // XXH64 hash. Fast enough to hash all inputs on every run, not meant to be cryptographically secure.
+   [[nodiscard]] auto get_xxh64(std::span<const uint8_t> bytes, const uint64_t seed = 0) -> uint64_t;
 
 }
 
 
 template<typename T>
-constexpr auto bb::get_symbol_count(const byte_count count) -> int
+constexpr auto bb::get_symbol_count(const byte_count count) -> size_t
 {
-   const auto [complete_symbols, leftover_bytes] = std::div(count.m_value, sizeof(T));
-
-   if (leftover_bytes == 0) return complete_symbols;
-   else                     return complete_symbols + 1;
+   return (count.m_value + sizeof(T) - 1) / sizeof(T);
 }
 
 
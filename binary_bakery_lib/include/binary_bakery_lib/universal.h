@@ -1,6 +1,7 @@
 #pragma once
 
 #include <compare>
+#include <cstddef>
 #include <variant>
 
 namespace bb::detail
@@ -26,8 +27,15 @@ namespace bb
 
    struct no_init {};
 
-   enum class compression_mode { none, zstd, lz4 };
+   // automatic is only a config value and resolved per payload. zstd_dictionary is only set by the encoder for payloads
+   // compressed with the trained dictionary.
+   enum class compression_mode { none, zstd, lz4, automatic, zstd_dictionary };
    enum class image_vertical_direction { bottom_to_top, top_to_bottom };
+   enum class output_mode { header, incbin, embed, archive };
+   enum class texture_format { raw, bc1 };
+   enum class report_format { json, chrome_trace };
+   // automatic is only a config value, the encoder picks one of the others per payload
+   enum class filter_mode { none, delta, shuffle, row, automatic };
 
    template<typename T>
    concept numerical = (std::integral<T> && !std::is_same_v<T, bool>) || std::floating_point<T>;
@@ -52,11 +60,11 @@ namespace bb
    [[nodiscard]] constexpr auto div(const int x, const int y) -> div_t;
 
    struct byte_count {
-      int m_value;
+      size_t m_value;
 
       template<std::integral integer_type>
       explicit constexpr byte_count(integer_type bytes)
-         : m_value (static_cast<int>(bytes)) {}
+         : m_value (static_cast<size_t>(bytes)) {}
 
       constexpr auto operator<=>(const byte_count&) const = default;
    };
@@ -0,0 +1,246 @@
+#include <binary_bakery_lib/cache.h>
+
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <thread>
+
+#include <binary_bakery_lib/config.h>
+#include <binary_bakery_lib/image.h>
+#include <binary_bakery_lib/tools.h>
+#include <binary_bakery_decoder.h>
+
+#include <fmt/format.h>
+
+
+namespace
+{
+
+   using namespace bb;
+
+   // Needs to be increased whenever the final payload of the same input and settings changes
+   constexpr int cache_format_version = 3;
+
+
+   [[nodiscard]] auto get_compression_mode(
+      const uint8_t compression_int
+   ) -> compression_mode
+   {
+      switch (compression_int) {
+      case 1:
+         return compression_mode::zstd;
+      case 2:
+         return compression_mode::lz4;
+      case 3:
+         return compression_mode::zstd_dictionary;
+      default:
+         return compression_mode::none;
+      }
+   }
+
+
+   // Everything that goes into get_final_payload() besides the content. The dictionary isn't part of this, payloads
+   // compressed with one are never cached.
+   [[nodiscard]] auto get_settings_str(
+      const abs_file_path& file,
+      const config& cfg
+   ) -> std::string
+   {
+      const config file_cfg = get_file_config(cfg, file.get_path().filename().string());
+      // Image decoders can differ in details, ie how they convert 16 bit channels
+      const image_decoder* decoder = get_image_decoder(file, file_cfg);
+      return fmt::format(
+         "{} {} {} {} {} {} {} {} {} {} {} {} {} {} {} {} {} {} {}",
+         cache_format_version,
+         file_cfg.payload_alignment,
+         file.get_path().extension().string(),
+         decoder != nullptr ? decoder->m_name : "",
+         static_cast<int>(file_cfg.image_loading_direction),
+         file_cfg.image_pad_to_rgba,
+         file_cfg.image_premultiply_alpha,
+         file_cfg.image_swizzle,
+         static_cast<int>(file_cfg.image_format),
+         file_cfg.image_mip_levels,
+         file_cfg.image_row_alignment,
+         static_cast<int>(file_cfg.compression),
+         file_cfg.zstd_level,
+         file_cfg.zstd_long_range,
+         file_cfg.lz4_level,
+         static_cast<int>(file_cfg.filter),
+         file_cfg.filter_element_size,
+         file_cfg.chunk_size,
+         file_cfg.auto_decode_budget_ms
+      );
+   }
+
+
+   [[nodiscard]] auto get_content_hash(
+      const abs_file_path& file
+   ) -> uint64_t
+   {
+      const mapped_file mapping(file);
+      return mapping.is_mapped()
+         ? get_xxh64(mapping.get_bytes())
+         : get_xxh64(get_binary_file(file));
+   }
+
+
+   [[nodiscard]] auto get_key_from_content_hash(
+      const abs_file_path& file,
+      const config& cfg,
+      const uint64_t content_hash
+   ) -> uint64_t
+   {
+      const std::string settings_str = get_settings_str(file, cfg);
+      return get_xxh64({ reinterpret_cast<const uint8_t*>(settings_str.data()), settings_str.size() }, content_hash);
+   }
+
+} // namespace {}
+
+
+bb::payload_cache::payload_cache(const fs::path& directory)
+   : m_directory(directory)
+{
+   fs::create_directories(m_directory);
+}
+
+
+auto bb::payload_cache::get_entry_path(
+   const uint64_t key
+) const -> fs::path
+{
+   return m_directory / fmt::format("{:016x}.bin", key);
+}
+
+
+auto bb::payload_cache::get_key(
+   const abs_file_path& file,
+   const config& cfg
+) const -> uint64_t
+{
+   const fs::file_time_type write_time = fs::last_write_time(file.get_path());
+   const uintmax_t size = fs::file_size(file.get_path());
+   const std::string path_str = file.get_path().string();
+   {
+      const std::lock_guard lock(m_hash_mutex);
+      const auto it = m_file_hashes.find(path_str);
+      if (it != m_file_hashes.end() && it->second.m_write_time == write_time && it->second.m_size == size)
+         return get_key_from_content_hash(file, cfg, it->second.m_content_hash);
+   }
+
+   const uint64_t content_hash = get_content_hash(file);
+   {
+      const std::lock_guard lock(m_hash_mutex);
+      m_file_hashes[path_str] = file_hash{ write_time, size, content_hash };
+   }
+   return get_key_from_content_hash(file, cfg, content_hash);
+}
+
+
+auto bb::payload_cache::contains(
+   const uint64_t key
+) const -> bool
+{
+   return fs::is_regular_file(get_entry_path(key));
+}
+
+
+auto bb::payload_cache::load(
+   const uint64_t key
+) const -> std::optional<detail::final_payload>
+{
+   std::ifstream file(get_entry_path(key), std::ios::ate | std::ios::binary);
+   if (file.is_open() == false)
+      return std::nullopt;
+   const size_t file_size = file.tellg();
+   if (file_size < sizeof(header))
+      return std::nullopt;
+
+   detail::final_payload result;
+   result.m_header.resize(sizeof(header));
+   file.seekg(0);
+   file.read(reinterpret_cast<char*>(result.m_header.data()), sizeof(header));
+   const header head = get_header(reinterpret_cast<const uint64_t*>(result.m_header.data()));
+   size_t extension_size = 0;
+   if (head.version & version_extended_sizes)
+      extension_size += 2 * sizeof(uint64_t);
+   if (head.version & version_extended_dimensions)
+      extension_size += sizeof(uint64_t);
+   if (head.version & version_texture)
+      extension_size += sizeof(uint64_t);
+   if (head.version & version_filtered)
+      extension_size += sizeof(uint64_t);
+   if (extension_size > 0)
+   {
+      result.m_header.resize(sizeof(header) + extension_size);
+      file.read(reinterpret_cast<char*>(&result.m_header[sizeof(header)]), static_cast<std::streamsize>(extension_size));
+   }
+   if (head.version & version_aligned_data)
+   {
+      // The alignment word has the number of padding words behind it
+      std::array<uint32_t, 2> alignment_word{};
+      file.read(reinterpret_cast<char*>(alignment_word.data()), sizeof(alignment_word));
+      const size_t alignment_offset = result.m_header.size();
+      result.m_header.resize(alignment_offset + sizeof(alignment_word) + alignment_word[1] * sizeof(uint64_t), 0);
+      std::memcpy(&result.m_header[alignment_offset], alignment_word.data(), sizeof(alignment_word));
+      file.seekg(static_cast<std::streamoff>(result.m_header.size()));
+   }
+   if (file.good() == false || file_size < result.m_header.size())
+      return std::nullopt;
+
+   result.m_data.resize(file_size - result.m_header.size());
+   file.read(reinterpret_cast<char*>(result.m_data.data()), static_cast<std::streamsize>(result.m_data.size()));
+   if (file.good() == false)
+      return std::nullopt;
+
+   result.m_compression = get_compression_mode(head.compression);
+   return result;
+}
+
+
+auto bb::payload_cache::get_decompressed_size(
+   const uint64_t key
+) const -> std::optional<uint64_t>
+{
+   // The header and the extended sizes behind it, if there are any
+   std::array<uint64_t, 4> words{};
+   std::ifstream file(get_entry_path(key), std::ios::binary);
+   file.read(reinterpret_cast<char*>(words.data()), sizeof(words));
+   if (file.gcount() < static_cast<std::streamsize>(sizeof(header)))
+      return std::nullopt;
+   return bb::get_decompressed_size(words.data());
+}
+
+
+auto bb::payload_cache::store(
+   const uint64_t key,
+   const detail::final_payload& final_pl
+) const -> void
+{
+   // Identical inputs can be stored from several threads at once
+   const size_t thread_hash = std::hash<std::thread::id>{}(std::this_thread::get_id());
+   const fs::path entry_path = get_entry_path(key);
+   const fs::path temp_path = fs::path(entry_path).replace_extension(fmt::format(".tmp{:x}", thread_hash));
+   write_binary_file(temp_path, { final_pl.m_header, final_pl.get_data() });
+   fs::rename(temp_path, entry_path);
+}
+
+
+auto bb::get_cache_directory(
+   const config& cfg,
+   const abs_directory_path& working_dir
+) -> fs::path
+{
+   const fs::path output_path = working_dir.get_path() / cfg.output_filename;
+   return output_path.parent_path() / ".bb_cache";
+}
+
+
+auto bb::get_cache_key(
+   const abs_file_path& file,
+   const config& cfg
+) -> uint64_t
+{
+   return get_key_from_content_hash(file, cfg, get_content_hash(file));
+}
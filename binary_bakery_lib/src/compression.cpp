@@ -1,59 +1,285 @@
 #include <binary_bakery_lib/compression.h>
 
 #include <zstd.h>
+#include <zdict.h>
 #include <lz4.h>
+#include <lz4hc.h>
+#include <algorithm>
 #include <bit>
 #include <cstdio>
+#include <memory>
+#include <stdexcept>
 #include <string_view>
 
-auto bb::get_zstd_compressed(
-   const std::vector<uint8_t>& input
+
+namespace
+{
+
+   [[nodiscard]] auto print_if_zstd_error(
+      const size_t result,
+      std::string_view function_name
+   ) -> bool
+   {
+      if (ZSTD_isError(result) == false)
+         return false;
+      std::string_view error_name = ZSTD_getErrorName(result);
+      printf("%s error: %s\n", function_name.data(), error_name.data());
+      return true;
+   }
+
+
+   [[nodiscard]] auto get_copied(
+      const std::span<const uint8_t> bytes
+   ) -> std::vector<uint8_t>
+   {
+      return std::vector<uint8_t>(bytes.begin(), bytes.end());
+   }
+
+} // namespace {}
+
+
+auto bb::compressor::zstd_cctx_deleter::operator()(ZSTD_CCtx* context) const -> void
+{
+   ZSTD_freeCCtx(context);
+}
+
+
+auto bb::compressor::get_zstd_context() -> ZSTD_CCtx*
+{
+   if (m_zstd_context == nullptr)
+      m_zstd_context.reset(ZSTD_createCCtx());
+   else
+      ZSTD_CCtx_reset(m_zstd_context.get(), ZSTD_reset_session_and_parameters);
+   return m_zstd_context.get();
+}
+
+
+auto bb::compressor::get_buffer(
+   const size_t min_size
+) -> std::span<uint8_t>
+{
+   if (m_buffer.size() < min_size)
+      m_buffer.resize(min_size);
+   return m_buffer;
+}
+
+
+auto bb::compressor::get_zstd_compressed(
+   std::span<const uint8_t> input,
+   const int level,
+   const bool long_range
 ) -> std::vector<uint8_t>
 {
-   const auto compress_bound = ZSTD_compressBound(input.size());
+   ZSTD_CCtx* context = get_zstd_context();
+   const int clamped_level = std::clamp(level, ZSTD_minCLevel(), ZSTD_maxCLevel());
+   if (print_if_zstd_error(ZSTD_CCtx_setParameter(context, ZSTD_c_compressionLevel, clamped_level), "ZSTD_CCtx_setParameter()"))
+      return {};
+   if (long_range && print_if_zstd_error(ZSTD_CCtx_setParameter(context, ZSTD_c_enableLongDistanceMatching, 1), "ZSTD_CCtx_setParameter()"))
+      return {};
 
    // "Hint : compression runs faster if `dstCapacity` >=  `ZSTD_compressBound(srcSize)`"
-   std::vector<uint8_t> destination(2 * compress_bound);
-
-   constexpr int compression_level = 3; // default according to documentation
-   const size_t written_comp_size = ZSTD_compress(
+   const std::span<uint8_t> destination = get_buffer(ZSTD_compressBound(input.size()));
+   const size_t written_comp_size = ZSTD_compress2(
+      context,
       destination.data(),
       destination.size(),
       input.data(),
-      input.size(),
-      compression_level
+      input.size()
    );
+   if (print_if_zstd_error(written_comp_size, "ZSTD_compress2()"))
+      return {};
+   return get_copied(destination.first(written_comp_size));
+}
+
 
-   if (ZSTD_isError(written_comp_size))
+auto bb::compressor::get_zstd_compressed(
+   std::span<const uint8_t> input,
+   const zstd_dictionary& dictionary,
+   const int level,
+   const bool long_range
+) -> std::vector<uint8_t>
+{
+   ZSTD_CCtx* context = get_zstd_context();
+   const std::span<uint8_t> destination = get_buffer(ZSTD_compressBound(input.size()));
+   const int clamped_level = std::clamp(level, ZSTD_minCLevel(), ZSTD_maxCLevel());
+   if (clamped_level == dictionary.m_level && long_range == false)
    {
-      std::string_view error_name = ZSTD_getErrorName(written_comp_size);
-      printf("ZSTD_compress() error: %s\n", error_name.data());
-      return {};
+      const size_t written_comp_size = ZSTD_compress_usingCDict(
+         context,
+         destination.data(),
+         destination.size(),
+         input.data(),
+         input.size(),
+         dictionary.m_cdict.get()
+      );
+      if (print_if_zstd_error(written_comp_size, "ZSTD_compress_usingCDict()"))
+         return {};
+      return get_copied(destination.first(written_comp_size));
    }
-   destination.resize(written_comp_size);
-   return destination;
+
+   // A referenced CDict would override the level with its own, so the dictionary is loaded with these parameters
+   if (print_if_zstd_error(ZSTD_CCtx_setParameter(context, ZSTD_c_compressionLevel, clamped_level), "ZSTD_CCtx_setParameter()"))
+      return {};
+   if (long_range && print_if_zstd_error(ZSTD_CCtx_setParameter(context, ZSTD_c_enableLongDistanceMatching, 1), "ZSTD_CCtx_setParameter()"))
+      return {};
+   const size_t load_result = ZSTD_CCtx_loadDictionary(context, dictionary.m_bytes.data(), dictionary.m_bytes.size());
+   if (print_if_zstd_error(load_result, "ZSTD_CCtx_loadDictionary()"))
+      return {};
+   const size_t written_comp_size = ZSTD_compress2(
+      context,
+      destination.data(),
+      destination.size(),
+      input.data(),
+      input.size()
+   );
+   if (print_if_zstd_error(written_comp_size, "ZSTD_compress2()"))
+      return {};
+   return get_copied(destination.first(written_comp_size));
 }
 
 
-auto bb::get_lz4_compressed(
-   const std::vector<uint8_t>& input
+auto bb::compressor::get_lz4_compressed(
+   std::span<const uint8_t> input,
+   const int level
 ) -> std::vector<uint8_t>
 {
-   const int target_size_bount = LZ4_compressBound(static_cast<int>(input.size()));
-   std::vector<uint8_t> result(target_size_bount);
-   
-   const int compressed_size = LZ4_compress_default(
-      std::bit_cast<const char*>(input.data()),
-      std::bit_cast<char*>(result.data()),
-      static_cast<int>(input.size()),
-      static_cast<int>(result.size())
-   );
+   // The LZ4 block format has int sizes. Chunked payloads only need that for each chunk
+   if (input.size() > LZ4_MAX_INPUT_SIZE)
+      throw std::runtime_error("LZ4 can't compress more than 2 GB at once. Set a chunk_size to compress it in chunks.");
+   const int target_size_bound = LZ4_compressBound(static_cast<int>(input.size()));
+   const std::span<uint8_t> destination = get_buffer(target_size_bound);
+
+   int compressed_size = 0;
+   if (level > 0)
+   {
+      if (m_lz4_hc_state.empty())
+         m_lz4_hc_state.resize(LZ4_sizeofStateHC() / sizeof(uint64_t) + 1);
+      compressed_size = LZ4_compress_HC_extStateHC(
+         m_lz4_hc_state.data(),
+         std::bit_cast<const char*>(input.data()),
+         std::bit_cast<char*>(destination.data()),
+         static_cast<int>(input.size()),
+         static_cast<int>(destination.size()),
+         std::min(level, LZ4HC_CLEVEL_MAX)
+      );
+   }
+   else
+   {
+      if (m_lz4_state.empty())
+         m_lz4_state.resize(LZ4_sizeofState() / sizeof(uint64_t) + 1);
+      compressed_size = LZ4_compress_fast_extState(
+         m_lz4_state.data(),
+         std::bit_cast<const char*>(input.data()),
+         std::bit_cast<char*>(destination.data()),
+         static_cast<int>(input.size()),
+         static_cast<int>(destination.size()),
+         1
+      );
+   }
    if (compressed_size == 0)
    {
       printf("Error occured during LZ4 compression.\n");
       return {};
    }
+   return get_copied(destination.first(compressed_size));
+}
+
+
+auto bb::get_thread_compressor() -> compressor&
+{
+   thread_local compressor instance;
+   return instance;
+}
+
+
+auto bb::get_zstd_compressed(
+   std::span<const uint8_t> input,
+   const int level,
+   const bool long_range
+) -> std::vector<uint8_t>
+{
+   return get_thread_compressor().get_zstd_compressed(input, level, long_range);
+}
+
+
+auto bb::get_zstd_compressed(
+   std::span<const uint8_t> input,
+   const zstd_dictionary& dictionary,
+   const int level,
+   const bool long_range
+) -> std::vector<uint8_t>
+{
+   return get_thread_compressor().get_zstd_compressed(input, dictionary, level, long_range);
+}
+
+
+auto bb::get_trained_zstd_dictionary(
+   const std::vector<std::span<const uint8_t>>& samples,
+   const size_t max_size,
+   const int level
+) -> std::optional<zstd_dictionary>
+{
+   // The trainer wants the samples back to back
+   std::vector<uint8_t> sample_bytes;
+   std::vector<size_t> sample_sizes;
+   sample_sizes.reserve(samples.size());
+   for (const std::span<const uint8_t> sample : samples)
+   {
+      sample_bytes.insert(sample_bytes.end(), sample.begin(), sample.end());
+      sample_sizes.push_back(sample.size());
+   }
 
-   result.resize(compressed_size);
+   zstd_dictionary result;
+   result.m_bytes.resize(max_size);
+   const size_t dictionary_size = ZDICT_trainFromBuffer(
+      result.m_bytes.data(),
+      result.m_bytes.size(),
+      sample_bytes.data(),
+      sample_sizes.data(),
+      static_cast<unsigned int>(sample_sizes.size())
+   );
+   if (ZDICT_isError(dictionary_size))
+      return std::nullopt;
+   result.m_bytes.resize(dictionary_size);
+
+   const int clamped_level = std::clamp(level, ZSTD_minCLevel(), ZSTD_maxCLevel());
+   ZSTD_CDict* cdict = ZSTD_createCDict(result.m_bytes.data(), result.m_bytes.size(), clamped_level);
+   if (cdict == nullptr)
+      return std::nullopt;
+   result.m_level = clamped_level;
+   result.m_cdict = std::shared_ptr<const ZSTD_CDict>(cdict, [](const ZSTD_CDict* ptr) {
+      ZSTD_freeCDict(const_cast<ZSTD_CDict*>(ptr));
+   });
    return result;
 }
+
+
+auto bb::get_lz4_compressed(
+   std::span<const uint8_t> input,
+   const int level
+) -> std::vector<uint8_t>
+{
+   return get_thread_compressor().get_lz4_compressed(input, level);
+}
+
+
+auto bb::get_modeled_decode_seconds(
+   const compression_mode mode,
+   const size_t decompressed_size
+) -> double
+{
+   // lzbench numbers. Uncompressed data only needs to be copied. LZ4HC output decodes as fast as LZ4, and zstd's
+   // decode speed hardly depends on the level.
+   constexpr double copy_bytes_per_second = 10.0e9;
+   constexpr double lz4_bytes_per_second = 4.5e9;
+   constexpr double zstd_bytes_per_second = 1.5e9;
+   switch (mode) {
+   case compression_mode::zstd:
+   case compression_mode::zstd_dictionary:
+      return decompressed_size / zstd_bytes_per_second;
+   case compression_mode::lz4:
+      return decompressed_size / lz4_bytes_per_second;
+   default:
+      return decompressed_size / copy_bytes_per_second;
+   }
+}
@@ -1,9 +1,11 @@
 #include <binary_bakery_lib/config.h>
 
 #include <algorithm>
+#include <bit>
 #include <fstream>
 
 #include <binary_bakery_lib/file_tools.h>
+#include <binary_bakery_lib/tools.h>
 
 #include <toml++/toml.h>
 #include <fmt/format.h>
@@ -93,6 +95,8 @@ namespace
          return compression_mode::zstd;
       else if (value == "lz4")
          return compression_mode::lz4;
+      else if (value == "auto")
+         return compression_mode::automatic;
       else
          return std::nullopt;
    }
@@ -110,6 +114,151 @@ namespace
          return std::nullopt;
    }
 
+   [[nodiscard]] constexpr auto get_payload_alignment(
+      const int value
+   ) -> std::optional<int>
+   {
+      if (value < 8 || value > 4096 || std::has_single_bit(static_cast<unsigned int>(value)) == false)
+         return std::nullopt;
+      return value;
+   }
+
+   // One letter of r, g, b and a per stored channel. Empty keeps the order
+   [[nodiscard]] auto get_image_swizzle(
+      const std::string& value
+   ) -> std::optional<std::string>
+   {
+      if (value.size() > 4)
+         return std::nullopt;
+      if (value.find_first_not_of("rgba") != std::string::npos)
+         return std::nullopt;
+      return value;
+   }
+
+   [[nodiscard]] constexpr auto get_image_format(
+      std::string_view const value
+   ) -> std::optional<texture_format>
+   {
+      if (value == "raw")
+         return texture_format::raw;
+      else if (value == "bc1")
+         return texture_format::bc1;
+      else
+         return std::nullopt;
+   }
+
+   [[nodiscard]] constexpr auto get_output_mode(
+      std::string_view const value
+   ) -> std::optional<output_mode>
+   {
+      if (value == "header")
+         return output_mode::header;
+      else if (value == "incbin")
+         return output_mode::incbin;
+      else if (value == "embed")
+         return output_mode::embed;
+      else if (value == "archive")
+         return output_mode::archive;
+      else
+         return std::nullopt;
+   }
+
+   [[nodiscard]] constexpr auto get_filter_mode(
+      std::string_view const value
+   ) -> std::optional<filter_mode>
+   {
+      if (value == "none")
+         return filter_mode::none;
+      else if (value == "delta")
+         return filter_mode::delta;
+      else if (value == "shuffle")
+         return filter_mode::shuffle;
+      else if (value == "row")
+         return filter_mode::row;
+      else if (value == "auto")
+         return filter_mode::automatic;
+      else
+         return std::nullopt;
+   }
+
+   [[nodiscard]] constexpr auto get_filter_element_size(
+      const int value
+   ) -> std::optional<int>
+   {
+      if (value != 1 && value != 2 && value != 4 && value != 8)
+         return std::nullopt;
+      return value;
+   }
+
+   [[nodiscard]] constexpr auto get_report_format(
+      std::string_view const value
+   ) -> std::optional<report_format>
+   {
+      if (value == "json")
+         return report_format::json;
+      else if (value == "chrome_trace")
+         return report_format::chrome_trace;
+      else
+         return std::nullopt;
+   }
+
+   // Overrides start with the general settings, so that they only need to contain what's different
+   [[nodiscard]] auto get_compression_overrides(
+      const toml::table& tbl,
+      const config& cfg
+   ) -> std::vector<compression_override>
+   {
+      std::vector<compression_override> result;
+      const toml::array* override_array = tbl["compression_override"].as_array();
+      if (override_array == nullptr)
+         return result;
+      for (const toml::node& override_node : *override_array)
+      {
+         const toml::table* override_tbl = override_node.as_table();
+         if (override_tbl == nullptr)
+            continue;
+         compression_override comp_override{
+            "", cfg.compression, cfg.zstd_level, cfg.zstd_long_range, cfg.lz4_level, cfg.filter, cfg.filter_element_size
+         };
+         // Not lowercased like the other strings, file names can be case sensitive
+         comp_override.pattern = (*override_tbl)["pattern"].value<std::string>().value_or("");
+         if (comp_override.pattern.empty())
+         {
+            fmt::print("A compression_override without pattern is ignored.\n");
+            continue;
+         }
+         set_value(comp_override.compression, *override_tbl, "compression_mode", get_compression_mode);
+         set_value(comp_override.zstd_level, *override_tbl, "zstd_level");
+         set_value(comp_override.zstd_long_range, *override_tbl, "zstd_long_range");
+         set_value(comp_override.lz4_level, *override_tbl, "lz4_level");
+         set_value(comp_override.filter, *override_tbl, "filter", get_filter_mode);
+         set_value<int>(comp_override.filter_element_size, *override_tbl, "filter_element_size", get_filter_element_size);
+         result.emplace_back(comp_override);
+      }
+      return result;
+   }
+
+   // Not lowercased like the other strings, these are file name patterns
+   [[nodiscard]] auto get_string_array(
+      const toml::table& tbl,
+      std::string_view key
+   ) -> std::vector<std::string>
+   {
+      std::vector<std::string> result;
+      const toml::array* arr = tbl[key].as_array();
+      if (arr == nullptr)
+         return result;
+      for (const toml::node& element : *arr)
+      {
+         const std::optional<std::string> value = element.value<std::string>();
+         if (value.has_value())
+            result.emplace_back(value.value());
+         else
+            fmt::print("A value in \"{}\" isn't a string. Skipping.\n", key);
+      }
+      return result;
+   }
+
    const std::string default_config_filename = "binary_bakery.toml";
 
 } // namespace {}
@@ -146,6 +295,58 @@ auto bb::get_cfg_from_file(
    set_value(cfg.max_columns, tbl, "max_columns");
    set_value(cfg.compression, tbl, "compression_mode", get_compression_mode);
    set_value(cfg.prompt_for_key, tbl, "prompt_for_key");
+   set_value(cfg.quiet, tbl, "quiet");
+   cfg.report_path = tbl["report_path"].value<std::string>().value_or(""); // Not lowercased, it's a path
+   set_value(cfg.report_type, tbl, "report_format", get_report_format);
    set_value(cfg.image_loading_direction, tbl, "image_loading_direction", get_image_write_direction);
+   set_value(cfg.image_extra_formats, tbl, "image_extra_formats");
+   set_value(cfg.image_pad_to_rgba, tbl, "image_pad_to_rgba");
+   set_value(cfg.image_premultiply_alpha, tbl, "image_premultiply_alpha");
+   set_value(cfg.image_swizzle, tbl, "image_swizzle", get_image_swizzle);
+   set_value(cfg.image_format, tbl, "image_format", get_image_format);
+   set_value(cfg.image_mip_levels, tbl, "image_mip_levels");
+   set_value(cfg.image_row_alignment, tbl, "image_row_alignment");
+   set_value(cfg.thread_count, tbl, "thread_count");
+   set_value(cfg.streaming_output, tbl, "streaming_output");
+   set_value(cfg.memory_budget_mb, tbl, "memory_budget_mb");
+   set_value(cfg.output, tbl, "output_mode", get_output_mode);
+   cfg.archive_path = tbl["archive_path"].value<std::string>().value_or(""); // Not lowercased, it's a path
+   set_value<int>(cfg.payload_alignment, tbl, "payload_alignment", get_payload_alignment);
+   set_value(cfg.shard_size, tbl, "shard_size");
+   set_value(cfg.chunk_size, tbl, "chunk_size");
+   set_value(cfg.zstd_level, tbl, "zstd_level");
+   set_value(cfg.zstd_long_range, tbl, "zstd_long_range");
+   set_value(cfg.lz4_level, tbl, "lz4_level");
+   set_value(cfg.filter, tbl, "filter", get_filter_mode);
+   set_value<int>(cfg.filter_element_size, tbl, "filter_element_size", get_filter_element_size);
+   set_value(cfg.auto_decode_budget_ms, tbl, "auto_decode_budget_ms");
+   set_value(cfg.zstd_dictionary, tbl, "zstd_dictionary");
+   set_value(cfg.zstd_dictionary_size, tbl, "zstd_dictionary_size");
+   set_value(cfg.cache, tbl, "cache");
+   set_value(cfg.deduplicate, tbl, "deduplicate");
+   cfg.input_include = get_string_array(tbl, "input_include");
+   cfg.input_exclude = get_string_array(tbl, "input_exclude");
+   cfg.compression_overrides = get_compression_overrides(tbl, cfg);
    return cfg;
 }
+
+
+auto bb::get_file_config(
+   const config& cfg,
+   std::string_view filename
+) -> config
+{
+   config result = cfg;
+   for (const compression_override& comp_override : cfg.compression_overrides)
+   {
+      if (matches_glob(comp_override.pattern, filename) == false)
+         continue;
+      result.compression = comp_override.compression;
+      result.zstd_level = comp_override.zstd_level;
+      result.zstd_long_range = comp_override.zstd_long_range;
+      result.lz4_level = comp_override.lz4_level;
+      result.filter = comp_override.filter;
+      result.filter_element_size = comp_override.filter_element_size;
+   }
+   return result;
+}
@@ -1,7 +1,10 @@
 #include <binary_bakery_lib/content_meta.h>
 
+#include <binary_bakery_lib/texture.h>
+
 #include <binary_bakery_decoder.h> // for header type
 #include <exception>
+#include <limits>
 
 namespace
 {
@@ -34,6 +37,9 @@ namespace
       case compression_mode::lz4:
          return 2;
          break;
+      case compression_mode::zstd_dictionary:
+         return 3;
+         break;
       default:
          std::terminate();
          break;
@@ -49,6 +55,8 @@ namespace
          return 0;
       else if (std::holds_alternative<naive_image_type>(meta))
          return 1;
+      else if (std::holds_alternative<zstd_dictionary_content>(meta))
+         return 2;
       else
          std::terminate();
    }
@@ -60,20 +68,87 @@ auto bb::get_header_bytes(
     const content_meta& meta,
     const compression_mode compression,
    const byte_count uncompressed_size,
-   const byte_count compressed_size
-) -> std::array<uint8_t, 16>
+   const byte_count compressed_size,
+   const uint8_t version_flags,
+   const size_t data_alignment,
+   const size_t chunk_table_size,
+   const uint64_t filter_word
+) -> std::vector<uint8_t>
 {
+   constexpr size_t max_base_size = std::numeric_limits<uint32_t>::max();
+   const bool has_extended_sizes = (version_flags & version_extended_sizes) != 0
+      || uncompressed_size.m_value > max_base_size
+      || compressed_size.m_value > max_base_size;
+
+   const int width = get_property(meta, [](const naive_image_type& image) {return image.m_width; });
+   const int height = get_property(meta, [](const naive_image_type& image) {return image.m_height; });
+   constexpr int max_base_dimension = std::numeric_limits<uint16_t>::max();
+   const bool has_extended_dimensions = (version_flags & version_extended_dimensions) != 0
+      || width > max_base_dimension
+      || height > max_base_dimension;
+
+   const naive_image_type* image = std::get_if<naive_image_type>(&meta);
+   const bool is_texture_image = image != nullptr && is_texture(*image);
+   const bool has_aligned_data = data_alignment > sizeof(uint64_t);
+
    header head;
    head.type = static_cast<uint8_t>(get_type_index(meta));
    head.compression = get_compression_int(compression);
-   head.version = static_cast<uint8_t>(0);
+   head.version = version_flags;
+   if (has_extended_sizes)
+      head.version |= version_extended_sizes;
+   if (has_extended_dimensions)
+      head.version |= version_extended_dimensions;
+   if (is_texture_image)
+      head.version |= version_texture;
+   if (has_aligned_data)
+      head.version |= version_aligned_data;
    head.bpp = static_cast<uint8_t>(get_property(meta, [](const naive_image_type& image) {return image.m_bpp; }));
-   head.width = static_cast<uint8_t>(get_property(meta, [](const naive_image_type& image) {return image.m_width; }));
-   head.height = static_cast<uint8_t>(get_property(meta, [](const naive_image_type& image) {return image.m_height; }));
-
-   head.decompressed_size = static_cast<uint32_t>(uncompressed_size.m_value);
-   head.compressed_size = static_cast<uint32_t>(compressed_size.m_value);
+   if (has_extended_dimensions == false)
+   {
+      head.width = static_cast<uint16_t>(width);
+      head.height = static_cast<uint16_t>(height);
+   }
+   if (has_extended_sizes == false)
+   {
+      head.decompressed_size = static_cast<uint32_t>(uncompressed_size.m_value);
+      head.compressed_size = static_cast<uint32_t>(compressed_size.m_value);
+   }
 
-   return std::bit_cast<std::array<uint8_t, 16>>(head);
+   const auto head_bytes = std::bit_cast<std::array<uint8_t, sizeof(header)>>(head);
+   std::vector<uint8_t> result(head_bytes.begin(), head_bytes.end());
+   if (has_extended_sizes)
+   {
+      const std::array<uint64_t, 2> sizes{ uncompressed_size.m_value, compressed_size.m_value };
+      const auto size_bytes = std::bit_cast<std::array<uint8_t, sizeof(sizes)>>(sizes);
+      result.insert(result.end(), size_bytes.begin(), size_bytes.end());
+   }
+   if (has_extended_dimensions)
+   {
+      const std::array<uint32_t, 2> dimensions{ static_cast<uint32_t>(width), static_cast<uint32_t>(height) };
+      const auto dimension_bytes = std::bit_cast<std::array<uint8_t, sizeof(dimensions)>>(dimensions);
+      result.insert(result.end(), dimension_bytes.begin(), dimension_bytes.end());
+   }
+   if (is_texture_image)
+   {
+      const auto texture_bytes = std::bit_cast<std::array<uint8_t, sizeof(uint64_t)>>(get_texture_word(*image));
+      result.insert(result.end(), texture_bytes.begin(), texture_bytes.end());
+   }
+   if (version_flags & version_filtered)
+   {
+      const auto filter_bytes = std::bit_cast<std::array<uint8_t, sizeof(uint64_t)>>(filter_word);
+      result.insert(result.end(), filter_bytes.begin(), filter_bytes.end());
+   }
+   if (has_aligned_data)
+   {
+      // Header, extensions, this word, the padding and the chunk table end at the alignment
+      const size_t unpadded_size = result.size() + sizeof(uint64_t) + chunk_table_size;
+      const size_t padding_size = (data_alignment - unpadded_size % data_alignment) % data_alignment;
+      const std::array<uint32_t, 2> alignment_word{ static_cast<uint32_t>(data_alignment), static_cast<uint32_t>(padding_size / sizeof(uint64_t)) };
+      const auto alignment_bytes = std::bit_cast<std::array<uint8_t, sizeof(alignment_word)>>(alignment_word);
+      result.insert(result.end(), alignment_bytes.begin(), alignment_bytes.end());
+      result.resize(result.size() + padding_size, 0);
+   }
+   return result;
 }
 
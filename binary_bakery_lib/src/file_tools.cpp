@@ -1,6 +1,30 @@
 #include <binary_bakery_lib/file_tools.h>
 
+#include <algorithm>
+#include <array>
 #include <fstream>
+#include <map>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+#include <binary_bakery_lib/tools.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
 
 #include <fmt/format.h>
 
@@ -36,6 +60,117 @@ namespace
       return absolute;
    }
 
+
+   constexpr std::string_view hash_line_prefix = "// Content hash: ";
+
+
+   [[nodiscard]] auto get_hash_line(const uint64_t hash) -> std::string
+   {
+      return fmt::format("{}{:016x}", hash_line_prefix, hash);
+   }
+
+
+   [[nodiscard]] auto get_first_line(const fs::path& path) -> std::string
+   {
+      std::ifstream file(path, std::ios::in | std::ios::binary);
+      std::string line;
+      std::getline(file, line);
+      if (line.empty() == false && line.back() == '\r')
+         line.pop_back();
+      return line;
+   }
+
+
+   // Compares without reading more of the file than necessary
+   [[nodiscard]] auto has_content(
+      const fs::path& path,
+      std::initializer_list<std::span<const uint8_t>> parts,
+      const size_t padding_bytes
+   ) -> bool
+   {
+      if (fs::is_regular_file(path) == false)
+         return false;
+      size_t expected_size = padding_bytes;
+      for (const std::span<const uint8_t> part : parts)
+         expected_size += part.size();
+      if (fs::file_size(path) != expected_size)
+         return false;
+      if (expected_size == 0)
+         return true;
+
+      const bb::mapped_file mapping(bb::abs_file_path{ path });
+      if (mapping.is_mapped() == false)
+         return false;
+      std::span<const uint8_t> existing = mapping.get_bytes();
+      for (const std::span<const uint8_t> part : parts)
+      {
+         if (std::equal(part.begin(), part.end(), existing.begin()) == false)
+            return false;
+         existing = existing.subspan(part.size());
+      }
+      return std::all_of(existing.begin(), existing.end(), [](const uint8_t byte) { return byte == 0; });
+   }
+
+
+   // Inside a cache directory of the encoder, which changes with every bake. Polling skips those directories instead.
+   [[nodiscard, maybe_unused]] auto is_cache_path(const fs::path& path) -> bool
+   {
+      return std::find(path.begin(), path.end(), fs::path(".bb_cache")) != path.end();
+   }
+
+
+   // Modification time and size of every file, for watching by polling
+   using directory_snapshot = std::map<fs::path, std::pair<fs::file_time_type, uintmax_t>>;
+
+   [[nodiscard]] auto get_snapshot(const std::vector<bb::watched_directory>& directories) -> directory_snapshot
+   {
+      // Files can disappear at any time, those errors are ignored
+      directory_snapshot result;
+      std::error_code error;
+      const auto add_entry = [&](const fs::directory_entry& entry) {
+         if (entry.is_regular_file(error))
+            result[entry.path()] = { entry.last_write_time(error), entry.file_size(error) };
+      };
+      for (const bb::watched_directory& dir : directories)
+      {
+         if (dir.m_recursive == false)
+         {
+            for (fs::directory_iterator it(dir.m_dir.get_path(), error); !error && it != fs::directory_iterator(); it.increment(error))
+               add_entry(*it);
+            continue;
+         }
+         for (fs::recursive_directory_iterator it(dir.m_dir.get_path(), error); !error && it != fs::recursive_directory_iterator(); it.increment(error))
+         {
+            if (it->path().filename() == ".bb_cache")
+               it.disable_recursion_pending();
+            else
+               add_entry(*it);
+         }
+      }
+      return result;
+   }
+
+
+   [[nodiscard]] auto get_changed_paths(
+      const directory_snapshot& before,
+      const directory_snapshot& after
+   ) -> std::vector<fs::path>
+   {
+      std::vector<fs::path> result;
+      for (const auto& [path, stamp] : after)
+      {
+         const auto it = before.find(path);
+         if (it == before.end() || it->second != stamp)
+            result.push_back(path);
+      }
+      for (const auto& [path, stamp] : before)
+      {
+         if (after.contains(path) == false)
+            result.push_back(path);
+      }
+      return result;
+   }
+
 } // namespace {}
 
 
@@ -61,6 +196,521 @@ auto bb::get_binary_file(const abs_file_path& file_p) -> std::vector<uint8_t>
 }
 
 
+auto bb::get_files_recursively(
+   const abs_directory_path& dir,
+   const std::vector<std::string>& include_patterns,
+   const std::vector<std::string>& exclude_patterns
+) -> std::vector<abs_file_path>
+{
+   const auto matches_any = [](const std::vector<std::string>& patterns, const std::string& text) {
+      return std::any_of(patterns.begin(), patterns.end(), [&](const std::string& pattern) {
+         return matches_glob(pattern, text);
+      });
+   };
+
+   std::vector<fs::path> paths;
+   for (auto it = fs::recursive_directory_iterator(dir.get_path()); it != fs::recursive_directory_iterator(); ++it)
+   {
+      if (it->is_directory() && it->path().filename() == ".bb_cache")
+      {
+         it.disable_recursion_pending();
+         continue;
+      }
+      if (it->is_regular_file() == false)
+         continue;
+      const std::string relative_path = fs::relative(it->path(), dir.get_path()).generic_string();
+      if (include_patterns.empty() == false && matches_any(include_patterns, relative_path) == false)
+         continue;
+      if (matches_any(exclude_patterns, relative_path))
+         continue;
+      paths.push_back(it->path());
+   }
+
+   // The iteration order is unspecified, but the output should be the same on every run
+   std::sort(paths.begin(), paths.end());
+   std::vector<abs_file_path> result;
+   result.reserve(paths.size());
+   for (const fs::path& path : paths)
+      result.emplace_back(path);
+   return result;
+}
+
+
+bb::mapped_file::mapped_file(const abs_file_path& file)
+{
+#if defined(_WIN32)
+   const HANDLE file_handle = CreateFileW(
+      file.get_path().c_str(),
+      GENERIC_READ,
+      FILE_SHARE_READ,
+      nullptr,
+      OPEN_EXISTING,
+      FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+      nullptr
+   );
+   if (file_handle == INVALID_HANDLE_VALUE)
+      return;
+   LARGE_INTEGER file_size{};
+   if (GetFileSizeEx(file_handle, &file_size) == 0 || file_size.QuadPart == 0)
+   {
+      CloseHandle(file_handle);
+      return;
+   }
+   const HANDLE mapping_handle = CreateFileMappingW(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+   CloseHandle(file_handle);
+   if (mapping_handle == nullptr)
+      return;
+
+   // The view keeps the mapping alive, the handles aren't needed anymore
+   void* view = MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+   CloseHandle(mapping_handle);
+   if (view == nullptr)
+      return;
+   m_data = static_cast<const uint8_t*>(view);
+   m_size = static_cast<size_t>(file_size.QuadPart);
+#else
+   const int file_descriptor = open(file.get_path().c_str(), O_RDONLY);
+   if (file_descriptor == -1)
+      return;
+   struct stat file_stat{};
+   if (fstat(file_descriptor, &file_stat) != 0 || file_stat.st_size <= 0)
+   {
+      close(file_descriptor);
+      return;
+   }
+   const size_t file_size = static_cast<size_t>(file_stat.st_size);
+
+   // The mapping stays valid after closing the descriptor
+   void* mapping = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+   close(file_descriptor);
+   if (mapping == MAP_FAILED)
+      return;
+   madvise(mapping, file_size, MADV_SEQUENTIAL);
+   m_data = static_cast<const uint8_t*>(mapping);
+   m_size = file_size;
+#endif
+}
+
+
+bb::mapped_file::~mapped_file()
+{
+   if (m_data == nullptr)
+      return;
+#if defined(_WIN32)
+   UnmapViewOfFile(m_data);
+#else
+   munmap(const_cast<uint8_t*>(m_data), m_size);
+#endif
+}
+
+
+auto bb::mapped_file::is_mapped() const -> bool
+{
+   return m_data != nullptr;
+}
+
+
+auto bb::mapped_file::get_bytes() const -> std::span<const uint8_t>
+{
+   return { m_data, m_size };
+}
+
+
+// Everything the platform needs to watch the directories. Falls back to polling if that's not possible.
+struct bb::file_watcher::watcher_state {
+   static constexpr std::chrono::milliseconds m_poll_interval{ 250 };
+   std::vector<watched_directory> m_directories;
+   bool m_is_polling = true;
+   directory_snapshot m_snapshot; // Only when polling
+
+#if defined(__linux__)
+   struct directory_watch {
+      fs::path m_path;
+      bool m_recursive = false;
+   };
+   int m_inotify_descriptor = -1;
+   std::unordered_map<int, directory_watch> m_watches; // By watch descriptor
+
+   // inotify doesn't watch subdirectories, recursive watches add one watch per directory
+   auto add_watch(
+      const fs::path& path,
+      const bool recursive
+   ) -> bool
+   {
+      constexpr uint32_t event_mask = IN_CLOSE_WRITE | IN_MODIFY | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+      const int watch_descriptor = inotify_add_watch(m_inotify_descriptor, path.c_str(), event_mask);
+      if (watch_descriptor < 0)
+         return false;
+      m_watches[watch_descriptor] = directory_watch{ path, recursive };
+      if (recursive == false)
+         return true;
+      std::error_code error;
+      for (fs::directory_iterator it(path, error); !error && it != fs::directory_iterator(); it.increment(error))
+      {
+         if (it->is_directory(error) && it->path().filename() != ".bb_cache")
+            add_watch(it->path(), true); // Subdirectories that can't be watched are skipped
+      }
+      return true;
+   }
+#elif defined(_WIN32)
+   struct directory_watch {
+      fs::path m_path;
+      bool m_recursive = false;
+      HANDLE m_handle = INVALID_HANDLE_VALUE;
+      HANDLE m_event = nullptr;
+      OVERLAPPED m_overlapped{};
+      alignas(DWORD) std::array<std::byte, 64 * 1024> m_buffer; // More isn't allowed for network drives
+   };
+   std::vector<std::unique_ptr<directory_watch>> m_watches; // Pointers, the pending reads need the addresses
+
+   [[nodiscard]] auto start_read(directory_watch& watch) -> bool
+   {
+      watch.m_overlapped = OVERLAPPED{};
+      watch.m_overlapped.hEvent = watch.m_event;
+      return ReadDirectoryChangesW(
+         watch.m_handle,
+         watch.m_buffer.data(),
+         static_cast<DWORD>(watch.m_buffer.size()),
+         watch.m_recursive ? TRUE : FALSE,
+         FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE,
+         nullptr,
+         &watch.m_overlapped,
+         nullptr
+      ) != 0;
+   }
+
+   auto close_watches() -> void
+   {
+      for (const std::unique_ptr<directory_watch>& watch : m_watches)
+      {
+         if (watch->m_handle != INVALID_HANDLE_VALUE)
+         {
+            // The pending read writes into the buffer until it's cancelled
+            CancelIoEx(watch->m_handle, &watch->m_overlapped);
+            DWORD length = 0;
+            GetOverlappedResult(watch->m_handle, &watch->m_overlapped, &length, TRUE);
+            CloseHandle(watch->m_handle);
+         }
+         if (watch->m_event != nullptr)
+            CloseHandle(watch->m_event);
+      }
+      m_watches.clear();
+   }
+#endif
+
+   explicit watcher_state(const std::vector<watched_directory>& directories)
+      : m_directories(directories)
+   {
+#if defined(__linux__)
+      m_inotify_descriptor = inotify_init1(IN_CLOEXEC);
+      m_is_polling = m_inotify_descriptor < 0;
+      for (const watched_directory& dir : m_directories)
+      {
+         if (m_is_polling == false && add_watch(dir.m_dir.get_path(), dir.m_recursive) == false)
+            m_is_polling = true;
+      }
+#elif defined(_WIN32)
+      m_is_polling = m_directories.size() > MAXIMUM_WAIT_OBJECTS;
+      for (const watched_directory& dir : m_directories)
+      {
+         if (m_is_polling)
+            break;
+         auto watch = std::make_unique<directory_watch>();
+         watch->m_path = dir.m_dir.get_path();
+         watch->m_recursive = dir.m_recursive;
+         watch->m_handle = CreateFileW(
+            watch->m_path.c_str(),
+            FILE_LIST_DIRECTORY,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            nullptr,
+            OPEN_EXISTING,
+            FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED,
+            nullptr
+         );
+         watch->m_event = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+         m_watches.push_back(std::move(watch));
+         directory_watch& added = *m_watches.back();
+         if (added.m_handle == INVALID_HANDLE_VALUE || added.m_event == nullptr || start_read(added) == false)
+            m_is_polling = true;
+      }
+      if (m_is_polling)
+         close_watches();
+#endif
+      if (m_is_polling)
+         m_snapshot = get_snapshot(m_directories);
+   }
+
+   ~watcher_state()
+   {
+#if defined(__linux__)
+      if (m_inotify_descriptor >= 0)
+         close(m_inotify_descriptor);
+#elif defined(_WIN32)
+      close_watches();
+#endif
+   }
+
+   watcher_state(const watcher_state&) = delete;
+   watcher_state& operator=(const watcher_state&) = delete;
+   watcher_state(watcher_state&&) = delete;
+   watcher_state& operator=(watcher_state&&) = delete;
+
+   // Waits up to timeout for changes and appends them. A negative timeout waits until there are changes. Returns if
+   // anything happened, which can be changes that are ignored.
+   auto wait(
+      const std::chrono::milliseconds timeout,
+      std::vector<fs::path>& changes
+   ) -> bool
+   {
+      if (m_is_polling)
+         return poll_changes(timeout, changes);
+#if defined(__linux__)
+      pollfd poll_descriptor{ m_inotify_descriptor, POLLIN, 0 };
+      if (poll(&poll_descriptor, 1, timeout.count() < 0 ? -1 : static_cast<int>(timeout.count())) <= 0)
+         return false;
+      alignas(inotify_event) std::array<char, 64 * 1024> buffer;
+      const ssize_t length = read(m_inotify_descriptor, buffer.data(), buffer.size());
+      if (length <= 0)
+         return false;
+      for (ssize_t offset = 0; offset < length; )
+      {
+         const auto* event = reinterpret_cast<const inotify_event*>(&buffer[offset]);
+         offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+         if (event->mask & IN_Q_OVERFLOW)
+         {
+            for (const watched_directory& dir : m_directories)
+               changes.push_back(dir.m_dir.get_path());
+            continue;
+         }
+         const auto it = m_watches.find(event->wd);
+         if (it == m_watches.end())
+            continue;
+         if (event->mask & IN_IGNORED)
+         {
+            m_watches.erase(it);
+            continue;
+         }
+         const directory_watch watch = it->second; // add_watch() can invalidate it
+         const fs::path path = event->len > 0 ? watch.m_path / event->name : watch.m_path;
+         if (is_cache_path(path))
+            continue;
+         if (watch.m_recursive && (event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO)))
+            add_watch(path, true);
+         changes.push_back(path);
+      }
+      return true;
+#elif defined(_WIN32)
+      std::vector<HANDLE> events;
+      events.reserve(m_watches.size());
+      for (const std::unique_ptr<directory_watch>& watch : m_watches)
+         events.push_back(watch->m_event);
+      const DWORD wait_result = WaitForMultipleObjects(
+         static_cast<DWORD>(events.size()),
+         events.data(),
+         FALSE,
+         timeout.count() < 0 ? INFINITE : static_cast<DWORD>(timeout.count())
+      );
+      if (wait_result >= WAIT_OBJECT_0 + events.size())
+         return false;
+      directory_watch& watch = *m_watches[wait_result - WAIT_OBJECT_0];
+      DWORD length = 0;
+      if (GetOverlappedResult(watch.m_handle, &watch.m_overlapped, &length, FALSE) != 0)
+      {
+         // Nothing in the buffer means it overflowed
+         if (length == 0)
+            changes.push_back(watch.m_path);
+         for (size_t offset = 0; length > 0; )
+         {
+            const auto* info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(&watch.m_buffer[offset]);
+            const fs::path path = watch.m_path / std::wstring(info->FileName, info->FileNameLength / sizeof(WCHAR));
+            if (is_cache_path(path) == false)
+               changes.push_back(path);
+            if (info->NextEntryOffset == 0)
+               break;
+            offset += info->NextEntryOffset;
+         }
+      }
+      if (start_read(watch) == false)
+      {
+         // The directory is gone or can't be watched anymore, the others can only be watched by polling from now on
+         close_watches();
+         m_is_polling = true;
+         m_snapshot = get_snapshot(m_directories);
+         changes.push_back(watch.m_path);
+      }
+      return true;
+#else
+      return false;
+#endif
+   }
+
+   auto poll_changes(
+      const std::chrono::milliseconds timeout,
+      std::vector<fs::path>& changes
+   ) -> bool
+   {
+      std::chrono::milliseconds waited{ 0 };
+      while (true)
+      {
+         std::this_thread::sleep_for(m_poll_interval);
+         waited += m_poll_interval;
+         directory_snapshot snapshot = get_snapshot(m_directories);
+         std::vector<fs::path> changed_paths = get_changed_paths(m_snapshot, snapshot);
+         m_snapshot = std::move(snapshot);
+         if (changed_paths.empty() == false)
+         {
+            changes.insert(changes.end(), changed_paths.begin(), changed_paths.end());
+            return true;
+         }
+         if (timeout.count() >= 0 && waited >= timeout)
+            return false;
+      }
+   }
+};
+
+
+bb::file_watcher::file_watcher(const std::vector<watched_directory>& directories)
+   : m_state(std::make_unique<watcher_state>(directories))
+{
+
+}
+
+
+bb::file_watcher::~file_watcher() = default;
+
+
+auto bb::file_watcher::wait_for_changes(
+   const std::chrono::milliseconds quiet_time
+) -> std::vector<fs::path>
+{
+   std::vector<fs::path> changes;
+   while (changes.empty())
+      m_state->wait(std::chrono::milliseconds{ -1 }, changes);
+   while (m_state->wait(quiet_time, changes))
+   {
+
+   }
+   std::sort(changes.begin(), changes.end());
+   changes.erase(std::unique(changes.begin(), changes.end()), changes.end());
+   return changes;
+}
+
+
+auto bb::write_binary_file(
+   const fs::path& path,
+   std::span<const uint8_t> bytes,
+   const int padding
+) -> void
+{
+   write_binary_file(path, { bytes }, padding);
+}
+
+
+auto bb::write_binary_file(
+   const fs::path& path,
+   std::initializer_list<std::span<const uint8_t>> parts,
+   const int padding
+) -> void
+{
+   std::ofstream file(path, std::ios::out | std::ios::binary);
+   if (file.is_open() == false) {
+      const std::string msg = fmt::format("Couldn't open file {} for writing", path.string());
+      throw std::runtime_error(msg);
+   }
+   size_t written_bytes = 0;
+   for (const std::span<const uint8_t> part : parts)
+   {
+      file.write(
+         reinterpret_cast<const char*>(part.data()),
+         static_cast<std::streamsize>(part.size())
+      );
+      written_bytes += part.size();
+   }
+   const size_t padding_bytes = (padding - written_bytes % padding) % padding;
+   for (size_t i = 0; i < padding_bytes; ++i)
+      file.put('\0');
+   if (file.good() == false) {
+      const std::string msg = fmt::format("Error while writing file {}", path.string());
+      throw std::runtime_error(msg);
+   }
+}
+
+
+auto bb::update_binary_file(
+   const fs::path& path,
+   std::initializer_list<std::span<const uint8_t>> parts,
+   const int padding
+) -> bool
+{
+   size_t byte_count = 0;
+   for (const std::span<const uint8_t> part : parts)
+      byte_count += part.size();
+   const size_t padding_bytes = (padding - byte_count % padding) % padding;
+   if (has_content(path, parts, padding_bytes))
+      return false;
+
+   const fs::path temp_path = get_temp_path(path);
+   write_binary_file(temp_path, parts, padding);
+   fs::rename(temp_path, path);
+   return true;
+}
+
+
+auto bb::get_temp_path(const fs::path& path) -> fs::path
+{
+   fs::path result = path;
+   result += ".tmp";
+   return result;
+}
+
+
+auto bb::get_hash_line_placeholder() -> std::string
+{
+   return get_hash_line(0) + '\n';
+}
+
+
+auto bb::has_hash_line(const fs::path& path) -> bool
+{
+   std::ifstream file(path, std::ios::in | std::ios::binary);
+   std::string start(hash_line_prefix.size(), '\0');
+   file.read(start.data(), static_cast<std::streamsize>(start.size()));
+   return file.gcount() == static_cast<std::streamsize>(start.size()) && start == hash_line_prefix;
+}
+
+
+auto bb::replace_if_changed(
+   const fs::path& temp_path,
+   const fs::path& path
+) -> bool
+{
+   uint64_t hash = 0;
+   {
+      // Scoped, the file can't be renamed while it's mapped on Windows
+      const mapped_file mapping(abs_file_path{ temp_path });
+      const std::span<const uint8_t> bytes = mapping.get_bytes();
+      const auto first_line_end = std::find(bytes.begin(), bytes.end(), '\n');
+      const size_t content_begin = first_line_end == bytes.end() ? bytes.size() : (first_line_end - bytes.begin()) + 1;
+      hash = get_xxh64(bytes.subspan(content_begin));
+   }
+
+   const std::string hash_line = get_hash_line(hash);
+   if (fs::is_regular_file(path) && get_first_line(path) == hash_line)
+   {
+      fs::remove(temp_path);
+      return false;
+   }
+   {
+      std::fstream file(temp_path, std::ios::in | std::ios::out | std::ios::binary);
+      file.write(hash_line.data(), static_cast<std::streamsize>(hash_line.size()));
+      if (file.good() == false)
+         throw std::runtime_error(fmt::format("Error while writing file {}", temp_path.string()));
+   }
+   fs::rename(temp_path, path);
+   return true;
+}
+
+
 bb::path_type::path_type(const fs::path& path)
    : m_path(path)
 {
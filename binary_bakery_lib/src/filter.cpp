@@ -0,0 +1,260 @@
+#include <binary_bakery_lib/filter.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <limits>
+#include <optional>
+
+#include <binary_bakery_lib/config.h>
+#include <binary_bakery_lib/texture.h>
+#include <binary_bakery_decoder.h>
+
+
+namespace
+{
+
+   using namespace bb;
+
+   // Each element minus the one before, as wrapping little-endian integers
+   auto delta_encode(
+      const std::span<const uint8_t> source,
+      const size_t element_size,
+      uint8_t* target
+   ) -> void
+   {
+      const size_t element_count = source.size() / element_size;
+      uint64_t previous = 0;
+      for (size_t i = 0; i < element_count; ++i)
+      {
+         uint64_t value = 0;
+         std::memcpy(&value, &source[i * element_size], element_size);
+         const uint64_t difference = value - previous;
+         std::memcpy(&target[i * element_size], &difference, element_size);
+         previous = value;
+      }
+   }
+
+
+   // First bytes of all elements, then the second bytes and so on
+   auto shuffle(
+      const std::span<const uint8_t> source,
+      const size_t element_size,
+      uint8_t* target
+   ) -> void
+   {
+      const size_t element_count = source.size() / element_size;
+      for (size_t i = 0; i < element_count; ++i)
+      {
+         for (size_t plane = 0; plane < element_size; ++plane)
+            target[plane * element_count + i] = source[i * element_size + plane];
+      }
+   }
+
+
+   // Calls fun(index, byte, prediction) for every byte of the rows
+   template<typename fun_type>
+   auto for_each_prediction(
+      const std::span<const uint8_t> source,
+      const filter_params& params,
+      const fun_type& fun
+   ) -> void
+   {
+      const size_t bpp = static_cast<size_t>(params.m_element_size);
+      const auto predictor = static_cast<uint8_t>(params.m_predictor);
+      for (size_t row_begin = 0; row_begin < source.size(); row_begin += params.m_row_size)
+      {
+         const size_t row_end = std::min(source.size() - row_begin, params.m_row_size);
+         const bool has_above = row_begin > 0;
+         for (size_t i = 0; i < row_end; ++i)
+         {
+            const size_t index = row_begin + i;
+            const uint8_t left = i >= bpp ? source[index - bpp] : 0;
+            const uint8_t above = has_above ? source[index - params.m_row_size] : 0;
+            const uint8_t above_left = i >= bpp && has_above ? source[index - params.m_row_size - bpp] : 0;
+            fun(index, source[index], detail::get_row_prediction(predictor, left, above, above_left));
+         }
+      }
+   }
+
+
+   auto predict_rows(
+      const std::span<const uint8_t> source,
+      const filter_params& params,
+      uint8_t* target
+   ) -> void
+   {
+      for_each_prediction(source, params, [&](const size_t index, const uint8_t byte, const uint8_t prediction) {
+         target[index] = static_cast<uint8_t>(byte - prediction);
+      });
+   }
+
+
+   // Sum of the residuals as signed bytes, like PNG encoders choose their filters
+   [[nodiscard]] auto get_residual_cost(
+      const std::span<const uint8_t> source,
+      const filter_params& params
+   ) -> uint64_t
+   {
+      uint64_t cost = 0;
+      for_each_prediction(source, params, [&](const size_t, const uint8_t byte, const uint8_t prediction) {
+         const auto residual = static_cast<int8_t>(byte - prediction);
+         cost += static_cast<uint64_t>(residual < 0 ? -residual : residual);
+      });
+      return cost;
+   }
+
+
+   // Row prediction with the predictor of the smallest residuals. Only raw images without texture layout have rows.
+   [[nodiscard]] auto get_row_filter(
+      const std::span<const uint8_t> bytes,
+      const content_meta& meta
+   ) -> std::optional<filter_params>
+   {
+      const naive_image_type* image = std::get_if<naive_image_type>(&meta);
+      if (image == nullptr || is_texture(*image) || image->m_width <= 0)
+         return std::nullopt;
+
+      filter_params result{ filter_mode::row, image->m_bpp, 0, static_cast<size_t>(image->m_width) * image->m_bpp };
+      uint64_t best_cost = std::numeric_limits<uint64_t>::max();
+      for (const uint8_t predictor : { detail::predictor_left, detail::predictor_above, detail::predictor_average, detail::predictor_paeth })
+      {
+         filter_params candidate = result;
+         candidate.m_predictor = predictor;
+         const uint64_t cost = get_residual_cost(bytes, candidate);
+         if (cost >= best_cost)
+            continue;
+         best_cost = cost;
+         result.m_predictor = predictor;
+      }
+      return result;
+   }
+
+} // namespace {}
+
+
+auto bb::get_filter_candidates(
+   const std::span<const uint8_t> bytes,
+   const content_meta& meta,
+   const config& cfg
+) -> std::vector<filter_params>
+{
+   // The dictionary is never compressed
+   if (std::holds_alternative<zstd_dictionary_content>(meta))
+      return { filter_params{} };
+
+   const filter_params delta{ filter_mode::delta, cfg.filter_element_size };
+   const filter_params shuffled{ filter_mode::shuffle, cfg.filter_element_size };
+   switch (cfg.filter) {
+   case filter_mode::delta:
+      return { delta };
+   case filter_mode::shuffle:
+      return { shuffled };
+   case filter_mode::row:
+      return { get_row_filter(bytes, meta).value_or(filter_params{}) };
+   case filter_mode::automatic:
+   {
+      std::vector<filter_params> result{ filter_params{} };
+      if (const std::optional<filter_params> row_filter = get_row_filter(bytes, meta); row_filter.has_value())
+      {
+         result.push_back(row_filter.value());
+         return result;
+      }
+      result.push_back(delta);
+      if (cfg.filter_element_size > 1) // Shuffling single bytes changes nothing
+         result.push_back(shuffled);
+      return result;
+   }
+   default:
+      return { filter_params{} };
+   }
+}
+
+
+auto bb::get_filter_block_size(
+   const filter_params& params
+) -> size_t
+{
+   switch (params.m_filter) {
+   case filter_mode::delta:
+   case filter_mode::shuffle:
+      return static_cast<size_t>(params.m_element_size);
+   case filter_mode::row:
+      return params.m_row_size;
+   default:
+      return 1;
+   }
+}
+
+
+auto bb::get_filter_word(
+   const filter_params& params
+) -> uint64_t
+{
+   detail::filter_info info;
+   switch (params.m_filter) {
+   case filter_mode::delta:
+      info.filter = detail::filter_delta;
+      break;
+   case filter_mode::shuffle:
+      info.filter = detail::filter_shuffle;
+      break;
+   case filter_mode::row:
+      info.filter = detail::filter_row;
+      break;
+   default:
+      info.filter = 0;
+   }
+   info.element_size = static_cast<uint8_t>(params.m_element_size);
+   info.predictor = static_cast<uint8_t>(params.m_predictor);
+   info.row_size = static_cast<uint32_t>(params.m_row_size);
+   return std::bit_cast<uint64_t>(info);
+}
+
+
+auto bb::get_filtered(
+   const std::span<const uint8_t> bytes,
+   const filter_params& params,
+   const size_t chunk_size
+) -> std::vector<uint8_t>
+{
+   // Bytes behind the last whole element stay as they are
+   std::vector<uint8_t> result(bytes.begin(), bytes.end());
+   const size_t step = chunk_size > 0 ? chunk_size : std::max<size_t>(bytes.size(), 1);
+   for (size_t chunk_begin = 0; chunk_begin < bytes.size(); chunk_begin += step)
+   {
+      const std::span<const uint8_t> chunk = bytes.subspan(chunk_begin, std::min(step, bytes.size() - chunk_begin));
+      uint8_t* target = &result[chunk_begin];
+      switch (params.m_filter) {
+      case filter_mode::delta:
+         delta_encode(chunk, static_cast<size_t>(params.m_element_size), target);
+         break;
+      case filter_mode::shuffle:
+         shuffle(chunk, static_cast<size_t>(params.m_element_size), target);
+         break;
+      case filter_mode::row:
+         predict_rows(chunk, params, target);
+         break;
+      default:
+         break;
+      }
+   }
+   return result;
+}
+
+
+auto bb::get_filter_name(
+   const uint8_t filter
+) -> const char*
+{
+   switch (filter) {
+   case detail::filter_delta:
+      return "delta";
+   case detail::filter_shuffle:
+      return "byte shuffle";
+   case detail::filter_row:
+      return "row prediction";
+   default:
+      return "none";
+   }
+}
@@ -1,20 +1,347 @@
 #include <binary_bakery_lib/image.h>
 
+#include <binary_bakery_lib/config.h>
 #include <binary_bakery_lib/file_tools.h>
 
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <deque>
+#include <memory>
+
 #include <stb_image.h>
+#if defined(BB_USE_SPNG)
+#include <spng.h>
+#endif
 #include <fmt/format.h>
 
 namespace
 {
 
-   auto setup_stb_load_flipping(
-      const bb::image_vertical_direction direction
+   using namespace bb;
+
+   struct stb_deleter {
+      auto operator()(stbi_uc* data) const -> void
+      {
+         stbi_image_free(data);
+      }
+   };
+   using stb_pixels = std::unique_ptr<stbi_uc, stb_deleter>;
+
+
+   [[nodiscard]] auto get_stb_dimensions(
+      const std::span<const uint8_t> file_bytes
+   ) -> std::optional<image_dimensions>
+   {
+      if (file_bytes.size() > INT_MAX)
+         return std::nullopt;
+      image_dimensions dimensions;
+      const int return_value = stbi_info_from_memory(
+         file_bytes.data(),
+         static_cast<int>(file_bytes.size()),
+         &dimensions.width,
+         &dimensions.height,
+         &dimensions.bpp
+      );
+      if (return_value == 0)
+         return std::nullopt;
+      return dimensions;
+   }
+
+
+   [[nodiscard]] auto decode_stb(
+      const std::span<const uint8_t> file_bytes
+   ) -> std::optional<decoded_image>
+   {
+      if (file_bytes.size() > INT_MAX)
+         return std::nullopt;
+      decoded_image result;
+      const stb_pixels data{ stbi_load_from_memory(
+         file_bytes.data(),
+         static_cast<int>(file_bytes.size()),
+         &result.dimensions.width,
+         &result.dimensions.height,
+         &result.dimensions.bpp,
+         0
+      ) };
+      if (data == nullptr)
+         return std::nullopt;
+      const size_t byte_count = static_cast<size_t>(result.dimensions.width) * result.dimensions.height * result.dimensions.bpp;
+
+      // Range construction copies without zero-filling first
+      result.bytes = std::vector<uint8_t>(data.get(), data.get() + byte_count);
+      return result;
+   }
+
+
+   // See https://qoiformat.org/qoi-specification.pdf
+   constexpr size_t qoi_header_size = 14;
+   constexpr size_t qoi_end_marker_size = 8;
+
+   [[nodiscard]] auto get_qoi_dimensions(
+      const std::span<const uint8_t> file_bytes
+   ) -> std::optional<image_dimensions>
+   {
+      if (file_bytes.size() < qoi_header_size + qoi_end_marker_size)
+         return std::nullopt;
+      if (std::equal(file_bytes.begin(), file_bytes.begin() + 4, "qoif") == false)
+         return std::nullopt;
+      const auto read_big_endian = [&](const size_t offset) {
+         return static_cast<uint32_t>(file_bytes[offset]) << 24 | static_cast<uint32_t>(file_bytes[offset + 1]) << 16
+            | static_cast<uint32_t>(file_bytes[offset + 2]) << 8 | static_cast<uint32_t>(file_bytes[offset + 3]);
+      };
+      const uint32_t width = read_big_endian(4);
+      const uint32_t height = read_big_endian(8);
+      const int channels = file_bytes[12];
+      if (width == 0 || height == 0 || width > INT_MAX || height > INT_MAX || (channels != 3 && channels != 4))
+         return std::nullopt;
+      return image_dimensions{ static_cast<int>(width), static_cast<int>(height), channels };
+   }
+
+
+   [[nodiscard]] auto decode_qoi(
+      const std::span<const uint8_t> file_bytes
+   ) -> std::optional<decoded_image>
+   {
+      const std::optional<image_dimensions> dimensions = get_qoi_dimensions(file_bytes);
+      if (dimensions.has_value() == false)
+         return std::nullopt;
+      const size_t pixel_count = static_cast<size_t>(dimensions->width) * static_cast<size_t>(dimensions->height);
+      const size_t channels = static_cast<size_t>(dimensions->bpp);
+
+      // Every pixel takes at least a bit, runs have up to 62 pixels in a byte
+      const size_t chunks_end = file_bytes.size() - qoi_end_marker_size;
+      if (pixel_count / 62 > chunks_end)
+         return std::nullopt;
+
+      decoded_image result;
+      result.dimensions = dimensions.value();
+      result.bytes.resize(pixel_count * channels);
+      std::array<std::array<uint8_t, 4>, 64> index{};
+      std::array<uint8_t, 4> pixel{ 0, 0, 0, 255 };
+      size_t pos = qoi_header_size;
+      int run = 0;
+      for (size_t i = 0; i < pixel_count; ++i)
+      {
+         if (run > 0)
+         {
+            --run;
+         }
+         else
+         {
+            if (pos >= chunks_end)
+               return std::nullopt;
+            const uint8_t tag = file_bytes[pos++];
+            if (tag == 0xfe) // RGB
+            {
+               if (chunks_end - pos < 3)
+                  return std::nullopt;
+               std::copy_n(&file_bytes[pos], 3, pixel.begin());
+               pos += 3;
+            }
+            else if (tag == 0xff) // RGBA
+            {
+               if (chunks_end - pos < 4)
+                  return std::nullopt;
+               std::copy_n(&file_bytes[pos], 4, pixel.begin());
+               pos += 4;
+            }
+            else if ((tag & 0xc0) == 0x00) // Index
+            {
+               pixel = index[tag];
+            }
+            else if ((tag & 0xc0) == 0x40) // Diff
+            {
+               pixel[0] = static_cast<uint8_t>(pixel[0] + ((tag >> 4) & 3) - 2);
+               pixel[1] = static_cast<uint8_t>(pixel[1] + ((tag >> 2) & 3) - 2);
+               pixel[2] = static_cast<uint8_t>(pixel[2] + (tag & 3) - 2);
+            }
+            else if ((tag & 0xc0) == 0x80) // Luma
+            {
+               if (pos >= chunks_end)
+                  return std::nullopt;
+               const uint8_t second = file_bytes[pos++];
+               const int green_diff = (tag & 0x3f) - 32;
+               pixel[0] = static_cast<uint8_t>(pixel[0] + green_diff + ((second >> 4) & 0x0f) - 8);
+               pixel[1] = static_cast<uint8_t>(pixel[1] + green_diff);
+               pixel[2] = static_cast<uint8_t>(pixel[2] + green_diff + (second & 0x0f) - 8);
+            }
+            else // Run
+            {
+               run = tag & 0x3f;
+            }
+            index[(pixel[0] * 3 + pixel[1] * 5 + pixel[2] * 7 + pixel[3] * 11) % 64] = pixel;
+         }
+         std::copy_n(pixel.begin(), channels, &result.bytes[i * channels]);
+      }
+      return result;
+   }
+
+
+#if defined(BB_USE_SPNG)
+   struct spng_deleter {
+      auto operator()(spng_ctx* context) const -> void
+      {
+         spng_ctx_free(context);
+      }
+   };
+   using spng_context = std::unique_ptr<spng_ctx, spng_deleter>;
+
+
+   [[nodiscard]] auto get_spng_context(
+      const std::span<const uint8_t> file_bytes
+   ) -> spng_context
+   {
+      spng_context context{ spng_ctx_new(0) };
+      if (context == nullptr || spng_set_png_buffer(context.get(), file_bytes.data(), file_bytes.size()) != 0)
+         return nullptr;
+      return context;
+   }
+
+
+   // The channels stb_image would return, so that both backends bake the same bytes. Transparency chunks add alpha.
+   [[nodiscard]] auto get_spng_dimensions(
+      spng_ctx* context
+   ) -> std::optional<image_dimensions>
+   {
+      spng_ihdr ihdr{};
+      if (spng_get_ihdr(context, &ihdr) != 0 || ihdr.width > INT_MAX || ihdr.height > INT_MAX)
+         return std::nullopt;
+      spng_trns trns{};
+      const bool has_transparency = spng_get_trns(context, &trns) == 0;
+      int bpp = 4;
+      switch (ihdr.color_type) {
+      case SPNG_COLOR_TYPE_GRAYSCALE:
+         bpp = has_transparency ? 2 : 1;
+         break;
+      case SPNG_COLOR_TYPE_GRAYSCALE_ALPHA:
+         bpp = 2;
+         break;
+      case SPNG_COLOR_TYPE_TRUECOLOR:
+      case SPNG_COLOR_TYPE_INDEXED:
+         bpp = has_transparency ? 4 : 3;
+         break;
+      default:
+         bpp = 4;
+      }
+      return image_dimensions{ static_cast<int>(ihdr.width), static_cast<int>(ihdr.height), bpp };
+   }
+
+
+   [[nodiscard]] auto get_spng_dimensions(
+      const std::span<const uint8_t> file_bytes
+   ) -> std::optional<image_dimensions>
+   {
+      const spng_context context = get_spng_context(file_bytes);
+      if (context == nullptr)
+         return std::nullopt;
+      return get_spng_dimensions(context.get());
+   }
+
+
+   [[nodiscard]] auto decode_spng(
+      const std::span<const uint8_t> file_bytes
+   ) -> std::optional<decoded_image>
+   {
+      const spng_context context = get_spng_context(file_bytes);
+      if (context == nullptr)
+         return std::nullopt;
+      const std::optional<image_dimensions> dimensions = get_spng_dimensions(context.get());
+      if (dimensions.has_value() == false)
+         return std::nullopt;
+
+      spng_ihdr ihdr{};
+      spng_get_ihdr(context.get(), &ihdr);
+      int format = SPNG_FMT_RGBA8;
+      if (dimensions->bpp == 3)
+         format = SPNG_FMT_RGB8;
+      else if (dimensions->bpp < 3)
+      {
+         // libspng only has grey formats for up to 8 bits
+         if (ihdr.bit_depth > 8)
+            return decode_stb(file_bytes);
+         format = dimensions->bpp == 1 ? SPNG_FMT_G8 : SPNG_FMT_GA8;
+      }
+
+      size_t byte_count = 0;
+      if (spng_decoded_image_size(context.get(), format, &byte_count) != 0)
+         return std::nullopt;
+      decoded_image result;
+      result.dimensions = dimensions.value();
+      result.bytes.resize(byte_count);
+      if (spng_decode_image(context.get(), result.bytes.data(), byte_count, format, SPNG_DECODE_TRNS) != 0)
+         return std::nullopt;
+      return result;
+   }
+#endif
+
+
+   [[nodiscard]] auto get_builtin_decoders() -> std::deque<image_decoder>
+   {
+      std::deque<image_decoder> result;
+      result.push_back(image_decoder{ "stb_image", { ".png", ".tga", ".bmp" }, get_stb_dimensions, decode_stb });
+      result.push_back(image_decoder{ "stb_image", { ".jpg", ".jpeg" }, get_stb_dimensions, decode_stb, true });
+      result.push_back(image_decoder{
+         "stb_image", { ".hdr" }, get_stb_dimensions, decode_stb, true,
+         "HDR images are tone mapped to 8 bits per channel, the high dynamic range is lost."
+      });
+      result.push_back(image_decoder{ "qoi", { ".qoi" }, get_qoi_dimensions, decode_qoi });
+#if defined(BB_USE_SPNG)
+      result.push_back(image_decoder{ "libspng", { ".png" }, get_spng_dimensions, decode_spng });
+#endif
+      return result;
+   }
+
+
+   // A deque, so that the pointers of get_image_decoder() stay valid
+   [[nodiscard]] auto get_decoders() -> std::deque<image_decoder>&
+   {
+      static std::deque<image_decoder> decoders = get_builtin_decoders();
+      return decoders;
+   }
+
+
+   [[nodiscard]] auto get_file_decoder(
+      const abs_file_path& file
+   ) -> const image_decoder&
+   {
+      const image_decoder* decoder = get_image_decoder(file.get_path().extension().string());
+      if (decoder == nullptr)
+      {
+         const std::string msg = fmt::format("There's no image decoder for file {}", file.get_path().string());
+         throw std::runtime_error(msg);
+      }
+      return *decoder;
+   }
+
+
+   // Calls fun with the bytes of the file. They're memory mapped, so that headers can be read without reading it all.
+   template<typename fun_type>
+   [[nodiscard]] auto with_file_bytes(
+      const abs_file_path& file,
+      const fun_type& fun
+   ) -> auto
+   {
+      const mapped_file mapping(file);
+      if (mapping.is_mapped())
+         return fun(mapping.get_bytes());
+      const std::vector<uint8_t> file_bytes = get_binary_file(file);
+      return fun(std::span<const uint8_t>(file_bytes));
+   }
+
+
+   auto flip_rows(
+      decoded_image& image
    ) -> void
    {
-      // For STB, flip=true means bottom to top
-      const bool flip = direction == bb::image_vertical_direction::bottom_to_top;
-      stbi_set_flip_vertically_on_load(flip);
+      const size_t row_size = static_cast<size_t>(image.dimensions.width) * image.dimensions.bpp;
+      const size_t height = static_cast<size_t>(image.dimensions.height);
+      for (size_t y = 0; y < height / 2; ++y)
+      {
+         uint8_t* top_row = &image.bytes[y * row_size];
+         uint8_t* bottom_row = &image.bytes[(height - 1 - y) * row_size];
+         std::swap_ranges(top_row, top_row + row_size, bottom_row);
+      }
    }
 
 } // namespace {}
@@ -26,38 +353,13 @@ bb::image<bpp>::image(
    const image_dimensions& image_dim,
    const image_vertical_direction direction
 )
-   : m_width(image_dim.width)
-   , m_height(image_dim.height)
-   , m_pixels(this->get_byte_count(), color<bpp>{ no_init{} })
+   : image<bpp>(file, direction)
 {
-   setup_stb_load_flipping(direction);
-
-   image_dimensions redundand_dim;
-   unsigned char* data = stbi_load(
-      file.get_path().string().c_str(),
-      &redundand_dim.width,
-      &redundand_dim.height,
-      &redundand_dim.bpp,
-      0
-   );
-   if (data == nullptr)
-   {
-      const std::string msg = fmt::format("stb_image couldn't load file {}", file.get_path().string());
-      throw std::runtime_error(msg);
-   }
-   if (redundand_dim != image_dim)
-   {
-      const std::string msg = fmt::format("Second image read returned different dimensions. File: {}", file.get_path().string());
-      throw std::runtime_error(msg);
-   }
-   if (image_dim.bpp != bpp)
+   if (image_dimensions{ m_width, m_height, bpp } != image_dim)
    {
-      const std::string msg = fmt::format("Explicit bpp parameter is different from file bpp. File: {}.", file.get_path().string());
+      const std::string msg = fmt::format("Image has different dimensions than expected. File: {}", file.get_path().string());
       throw std::runtime_error(msg);
    }
-
-   std::memcpy(m_pixels.data(), data, get_byte_count());
-   stbi_image_free(data);
 }
 template bb::image<1>::image(const abs_file_path&, const image_dimensions&, const image_vertical_direction);
 template bb::image<2>::image(const abs_file_path&, const image_dimensions&, const image_vertical_direction);
@@ -70,9 +372,17 @@ bb::image<bpp>::image(
    const abs_file_path& file,
    const image_vertical_direction direction
 )
-   : image<bpp>(file, get_image_dimensions(file), direction)
 {
-   
+   const decoded_image decoded = load_image(file, direction);
+   if (decoded.dimensions.bpp != bpp)
+   {
+      const std::string msg = fmt::format("Explicit bpp parameter is different from file bpp. File: {}.", file.get_path().string());
+      throw std::runtime_error(msg);
+   }
+   m_width = decoded.dimensions.width;
+   m_height = decoded.dimensions.height;
+   m_pixels.resize(get_element_count(), color<bpp>{ no_init{} });
+   std::memcpy(m_pixels.data(), decoded.bytes.data(), get_byte_count());
 }
 template bb::image<1>::image(const abs_file_path&, const image_vertical_direction);
 template bb::image<2>::image(const abs_file_path&, const image_vertical_direction);
@@ -80,21 +390,68 @@ template bb::image<3>::image(const abs_file_path&, const image_vertical_directio
 template bb::image<4>::image(const abs_file_path&, const image_vertical_direction);
 
 
+auto bb::register_image_decoder(
+   const image_decoder& decoder
+) -> void
+{
+   get_decoders().push_back(decoder);
+}
+
+
+auto bb::get_image_decoder(
+   std::string_view extension
+) -> const image_decoder*
+{
+   const std::deque<image_decoder>& decoders = get_decoders();
+   for (auto it = decoders.rbegin(); it != decoders.rend(); ++it)
+   {
+      if (std::find(it->m_extensions.begin(), it->m_extensions.end(), extension) != it->m_extensions.end())
+         return &*it;
+   }
+   return nullptr;
+}
+
+
+auto bb::get_image_decoder(
+   const abs_file_path& file,
+   const config& cfg
+) -> const image_decoder*
+{
+   const image_decoder* decoder = get_image_decoder(file.get_path().extension().string());
+   if (decoder != nullptr && decoder->m_is_extra_format && cfg.image_extra_formats == false)
+      return nullptr;
+   return decoder;
+}
+
+
 auto bb::get_image_dimensions(
    const abs_file_path& file
 ) -> image_dimensions
 {
-   image_dimensions dimensions;
-   const int return_value = stbi_info(
-      file.get_path().string().c_str(),
-      &dimensions.width,
-      &dimensions.height,
-      &dimensions.bpp
-   );
-   if (return_value == 0)
-   {
-      const std::string msg = fmt::format("stb_info couldn't load file {}", file.get_path().string());
+   const image_decoder& decoder = get_file_decoder(file);
+   const std::optional<image_dimensions> dimensions = with_file_bytes(file, decoder.m_get_dimensions);
+   if (dimensions.has_value() == false)
+   {
+      const std::string msg = fmt::format("{} couldn't read the dimensions of file {}", decoder.m_name, file.get_path().string());
+      throw std::runtime_error(msg);
+   }
+   return dimensions.value();
+}
+
+
+auto bb::load_image(
+   const abs_file_path& file,
+   const image_vertical_direction direction
+) -> decoded_image
+{
+   const image_decoder& decoder = get_file_decoder(file);
+   std::optional<decoded_image> result = with_file_bytes(file, decoder.m_decode);
+   if (result.has_value() == false)
+   {
+      const std::string msg = fmt::format("{} couldn't load file {}", decoder.m_name, file.get_path().string());
       throw std::runtime_error(msg);
    }
-   return dimensions;
+   if (direction == image_vertical_direction::bottom_to_top)
+      flip_rows(result.value());
+   return std::move(result.value());
 }
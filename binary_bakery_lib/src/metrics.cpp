@@ -0,0 +1,226 @@
+#include <binary_bakery_lib/metrics.h>
+
+#include <atomic>
+#include <fstream>
+
+#include <binary_bakery_lib/config.h>
+#include <binary_bakery_lib/file_tools.h>
+#include <binary_bakery_lib/tools.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include <fmt/format.h>
+
+
+namespace
+{
+
+   using namespace bb;
+
+   thread_local uint64_t thread_allocation_count = 0;
+
+
+   // Start of the process, all records are relative to this
+   const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+
+   [[nodiscard]] auto get_thread_index() -> int
+   {
+      static std::atomic<int> next_index = 0;
+      thread_local const int index = next_index++;
+      return index;
+   }
+
+
+   [[nodiscard]] auto get_microseconds(
+      const std::chrono::steady_clock::duration duration
+   ) -> int64_t
+   {
+      return std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+   }
+
+
+   // Payload names are file names, which can contain anything, so they're escaped
+   [[nodiscard]] auto get_json_report(
+      const std::vector<bake_metrics>& metrics
+   ) -> std::string
+   {
+      std::string json = fmt::format("{{\n  \"peak_rss\": {},\n  \"payloads\": [", get_peak_rss());
+      bool first_metrics = true;
+      for (const bake_metrics& entry : metrics)
+      {
+         json += first_metrics ? "\n" : ",\n";
+         first_metrics = false;
+         json += fmt::format("    {{\"name\": \"{}\", \"phases\": [", get_json_escaped(entry.m_name));
+         bool first_phase = true;
+         for (const phase_record& record : entry.m_phases)
+         {
+            json += first_phase ? "\n" : ",\n";
+            first_phase = false;
+            json += fmt::format(
+               "      {{\"phase\": \"{}\", \"start_us\": {}, \"duration_us\": {}, \"thread\": {}, \"bytes_in\": {}, "
+               "\"bytes_out\": {}, \"allocations\": {}, \"peak_rss\": {}}}",
+               get_phase_name(record.m_phase), record.m_start_us, record.m_duration_us, record.m_thread,
+               record.m_bytes_in, record.m_bytes_out, record.m_allocations, record.m_peak_rss
+            );
+         }
+         json += "]}";
+      }
+      json += "\n  ]\n}\n";
+      return json;
+   }
+
+
+   // Complete events ("ph": "X") with one track per thread, named after the payload
+   [[nodiscard]] auto get_chrome_trace_report(
+      const std::vector<bake_metrics>& metrics
+   ) -> std::string
+   {
+      std::string json = "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+      bool first_event = true;
+      for (const bake_metrics& entry : metrics)
+      {
+         const std::string name = get_json_escaped(entry.m_name);
+         for (const phase_record& record : entry.m_phases)
+         {
+            json += first_event ? "\n" : ",\n";
+            first_event = false;
+            json += fmt::format(
+               "  {{\"name\": \"{} {}\", \"cat\": \"{}\", \"ph\": \"X\", \"ts\": {}, \"dur\": {}, \"pid\": 0, \"tid\": {}, "
+               "\"args\": {{\"bytes_in\": {}, \"bytes_out\": {}, \"allocations\": {}, \"peak_rss\": {}}}}}",
+               get_phase_name(record.m_phase), name, get_phase_name(record.m_phase), record.m_start_us,
+               record.m_duration_us, record.m_thread, record.m_bytes_in, record.m_bytes_out, record.m_allocations,
+               record.m_peak_rss
+            );
+         }
+      }
+      json += "\n]}\n";
+      return json;
+   }
+
+} // namespace {}
+
+
+bb::phase_timer::phase_timer(
+   const bake_phase phase
+)
+   : m_phase(phase)
+   , m_t0(std::chrono::steady_clock::now())
+   , m_allocations_before(get_thread_allocation_count())
+{
+
+}
+
+
+auto bb::phase_timer::stop(
+   const uint64_t bytes_in,
+   const uint64_t bytes_out
+) const -> phase_record
+{
+   const auto t1 = std::chrono::steady_clock::now();
+   phase_record result;
+   result.m_phase = m_phase;
+   result.m_start_us = get_microseconds(m_t0 - epoch);
+   result.m_duration_us = get_microseconds(t1 - m_t0);
+   result.m_thread = get_thread_index();
+   result.m_bytes_in = bytes_in;
+   result.m_bytes_out = bytes_out;
+   result.m_allocations = get_thread_allocation_count() - m_allocations_before;
+   result.m_peak_rss = get_peak_rss();
+   return result;
+}
+
+
+auto bb::get_phase_name(
+   const bake_phase phase
+) -> const char*
+{
+   switch (phase) {
+   case bake_phase::load:
+      return "load";
+   case bake_phase::image_decode:
+      return "image_decode";
+   case bake_phase::cache_read:
+      return "cache_read";
+   case bake_phase::dictionary_training:
+      return "dictionary_training";
+   case bake_phase::compress:
+      return "compress";
+   case bake_phase::format:
+      return "format";
+   case bake_phase::write:
+      return "write";
+   default:
+      return "unknown";
+   }
+}
+
+
+auto bb::get_peak_rss() -> uint64_t
+{
+#if defined(_WIN32)
+   PROCESS_MEMORY_COUNTERS counters{};
+   if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) == 0)
+      return 0;
+   return counters.PeakWorkingSetSize;
+#else
+   rusage usage{};
+   if (getrusage(RUSAGE_SELF, &usage) != 0)
+      return 0;
+#if defined(__APPLE__)
+   return static_cast<uint64_t>(usage.ru_maxrss); // Bytes on macOS, kilobytes everywhere else
+#else
+   return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+
+auto bb::count_allocation() noexcept -> void
+{
+   ++thread_allocation_count;
+}
+
+
+auto bb::get_thread_allocation_count() -> uint64_t
+{
+   return thread_allocation_count;
+}
+
+
+auto bb::get_report_str(
+   const std::vector<bake_metrics>& metrics,
+   const report_format format
+) -> std::string
+{
+   if (format == report_format::chrome_trace)
+      return get_chrome_trace_report(metrics);
+   return get_json_report(metrics);
+}
+
+
+auto bb::write_report(
+   const config& cfg,
+   const std::vector<bake_metrics>& metrics,
+   const abs_directory_path& working_dir
+) -> void
+{
+   if (cfg.report_path.empty())
+      return;
+   const fs::path report_path = working_dir.get_path() / cfg.report_path;
+   std::ofstream report(report_path, std::ios::binary);
+   if (!report.good())
+   {
+      fmt::print("Couldn't open {} for writing\n", report_path.string());
+      return;
+   }
+   report << get_report_str(metrics, cfg.report_type);
+   fmt::print("Wrote the bake report to \"{}\".\n", report_path.string());
+}
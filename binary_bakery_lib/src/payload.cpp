@@ -1,12 +1,25 @@
 #include <binary_bakery_lib/payload.h>
 
+#include <algorithm>
+#include <bit>
+#include <condition_variable>
+#include <cstring>
 #include <fstream>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
 
+#include <binary_bakery_lib/cache.h>
 #include <binary_bakery_lib/config.h>
 #include <binary_bakery_lib/tools.h>
 #include <binary_bakery_lib/file_tools.h>
+#include <binary_bakery_lib/filter.h>
 #include <binary_bakery_lib/image.h>
 #include <binary_bakery_lib/compression.h>
+#include <binary_bakery_lib/texture.h>
+#include <binary_bakery_lib/thread_pool.h>
+#include <binary_bakery_decoder.h>
 
 #include <fmt/format.h>
 
@@ -15,184 +28,466 @@ namespace {
 
    using namespace bb;
 
-   [[nodiscard]] auto is_image_path(const abs_file_path& file) -> bool
+   [[nodiscard]] auto is_image_path(
+      const abs_file_path& file,
+      const config& cfg
+   ) -> bool
    {
-      const std::string ext_string = file.get_path().extension().string();
-      return ext_string == std::string{ ".png" }
-          || ext_string == std::string{ ".tga" }
-          || ext_string == std::string{ ".bmp" };
+      return get_image_decoder(file, cfg) != nullptr;
    }
 
 
    [[nodiscard]] auto get_binary_file_payload(const abs_file_path& file) -> payload
    {
-      return payload{ get_binary_file(file), generic_binary{}, file };
+      auto mapping = std::make_unique<mapped_file>(file);
+      if (mapping->is_mapped())
+         return payload{ std::move(mapping), generic_binary{}, file.get_path().filename().string() };
+
+      // Empty files can't be mapped, and mapping can fail on exotic file systems
+      return payload{ get_binary_file(file), generic_binary{}, file.get_path().filename().string() };
    }
 
 
-   template<int bpp>
-   [[nodiscard]] auto get_image_payload_impl(
+   [[nodiscard]] auto get_image_payload(
       const abs_file_path& file,
-      const image_dimensions& image_dim,
       const config& cfg
    ) -> payload
    {
-      const image<bpp> image{ file, image_dim, cfg.image_loading_direction };
-      const naive_image_type meta{ image.m_width, image.m_height, bpp };
+      const std::string& warning = get_image_decoder(file, cfg)->m_warning;
+      if (warning.empty() == false)
+         fmt::print("{}: {}\n", file.get_path().filename().string(), warning);
+      decoded_image image = load_image(file, cfg.image_loading_direction);
+      convert_channels(image, cfg);
+      const naive_image_type meta = get_texture_meta(image.dimensions.width, image.dimensions.height, image.dimensions.bpp, cfg);
+      if (is_texture(meta))
+         return { get_texture_bytes(image.bytes, meta), meta, file.get_path().filename().string() };
+      return { std::move(image.bytes), meta, file.get_path().filename().string() };
+   }
+
 
-      return { get_image_bytestream(image), meta, file };
+   // Loads the file of a payload that get_payloads() left for later. Does nothing for other payloads.
+   auto load_deferred(
+      payload& pl,
+      const config& cfg
+   ) -> void
+   {
+      if (pl.m_deferred_file.has_value() == false)
+         return;
+      payload loaded = get_payload(pl.m_deferred_file.value(), cfg);
+      pl.m_content_data = std::move(loaded.m_content_data);
+      pl.m_mapped_content = std::move(loaded.m_mapped_content);
+      pl.m_meta = loaded.m_meta;
+      pl.m_phase_records.insert(pl.m_phase_records.end(), loaded.m_phase_records.begin(), loaded.m_phase_records.end());
+      pl.m_deferred_file.reset();
    }
 
 
-   [[nodiscard]] auto get_image_payload(
-      const abs_file_path& file,
+   // Bytes of content once the payload is loaded. Deferred images are estimated from their dimensions, without the
+   // channel conversions and texture layout.
+   [[nodiscard]] auto get_loaded_size(
+      const payload& pl,
       const config& cfg
-   ) -> payload
+   ) -> uint64_t
    {
-      const image_dimensions image_dim = get_image_dimensions(file);
-
-      return [&]() {
-         switch (image_dim.bpp) {
-         case 1:
-            return get_image_payload_impl<1>(file, image_dim, cfg);
-         case 2:
-            return get_image_payload_impl<2>(file, image_dim, cfg);
-         case 3:
-            return get_image_payload_impl<3>(file, image_dim, cfg);
-         case 4:
-            return get_image_payload_impl<4>(file, image_dim, cfg);
-         default:
-            fmt::print("unexpected\n");
-            std::terminate();
-         }
-      }();
+      if (pl.m_deferred_file.has_value() == false)
+         return pl.get_content().size();
+      const abs_file_path& file = pl.m_deferred_file.value();
+      if (is_image_path(file, cfg) == false)
+         return fs::file_size(file.get_path());
+      const image_dimensions dimensions = get_image_dimensions(file);
+      return static_cast<uint64_t>(dimensions.width) * dimensions.height * dimensions.bpp;
    }
 
 
    [[nodiscard]] auto get_variable_name(
-      const abs_file_path& file
+      const std::string& payload_name
    ) -> std::string
    {
-      const std::string var_name = fmt::format("bb_{}", file.get_path().filename().string());
+      const std::string var_name = fmt::format("bb_{}", payload_name);
       return get_replaced_str(var_name, ".", "_");
    }
 
+
+   const std::string zstd_dictionary_payload_name = "zstd_dictionary";
+
+
+   // Throws if two of the names can't be in one output. With arrays per payload, that includes names which only
+   // differ in what get_variable_name() replaces. The sources are what the error calls them, ie the file paths.
+   // With zstd_dictionary, the name of the dictionary payload is reserved.
+   auto check_unique_names(
+      const std::vector<std::string>& names,
+      const std::vector<std::string>& sources,
+      const config& cfg
+   ) -> void
+   {
+      const auto get_key = [&](const std::string& name) {
+         return cfg.output == output_mode::archive ? name : get_variable_name(name);
+      };
+      std::unordered_map<std::string, int> first_indices;
+      for (int i = 0; i < static_cast<int>(names.size()); ++i)
+      {
+         const std::string key = get_key(names[i]);
+         if (cfg.zstd_dictionary && key == get_key(zstd_dictionary_payload_name))
+         {
+            const std::string msg = fmt::format(
+               "\"{}\" can't be a payload with zstd_dictionary, its name is reserved for the dictionary. Rename or exclude it.",
+               sources[i]
+            );
+            throw std::runtime_error(msg);
+         }
+         const auto [it, is_new] = first_indices.emplace(key, i);
+         if (is_new)
+            continue;
+         const std::string msg = fmt::format(
+            "\"{}\" and \"{}\" can't both be payloads, both would be {}. Payload names are file names without their directory, rename or exclude one of them.",
+            sources[it->second], sources[i], key
+         );
+         throw std::runtime_error(msg);
+      }
+   }
+
+
+   auto check_unique_names(
+      const std::vector<payload>& payloads,
+      const config& cfg
+   ) -> void
+   {
+      std::vector<std::string> names;
+      names.reserve(payloads.size());
+      for (const payload& pl : payloads)
+      {
+         if (std::holds_alternative<zstd_dictionary_content>(pl.m_meta) == false)
+            names.push_back(pl.m_name);
+      }
+      check_unique_names(names, names, cfg);
+   }
+
+
+   // In front of array declarations. The arrays are uint64_t, so the default alignment needs no specifier
+   [[nodiscard]] auto get_alignment_specifier(
+      const config& cfg
+   ) -> std::string
+   {
+      if (cfg.payload_alignment <= static_cast<int>(sizeof(uint64_t)))
+         return "";
+      return fmt::format("alignas({}) ", cfg.payload_alignment);
+   }
+
+   const std::string archive_variable_name = "bb_payload_archive";
+
+
+   // A name get_payload() knows, and the pointer it returns for it
+   struct lookup_entry {
+      std::string m_name;
+      std::string m_pointer_expression;
+      bool m_is_alias = false;
+   };
+
+
+   // The payloads and aliases in the order of the payloads before deduplication. archive_offsets are the byte offsets
+   // of the payloads in the archive for output_mode::archive.
+   [[nodiscard]] auto get_lookup_entries(
+      const std::vector<payload>& payloads,
+      const std::vector<detail::payload_alias>& aliases,
+      const config& cfg,
+      const std::vector<size_t>& archive_offsets
+   ) -> std::vector<lookup_entry>
+   {
+      const auto get_pointer_expression = [&](const int i) {
+         if (cfg.output == output_mode::archive)
+            return fmt::format("&{}[{}]", archive_variable_name, archive_offsets[i] / sizeof(uint64_t));
+         const std::string variable_name = get_variable_name(payloads[i].m_name);
+         // #embed arrays are bytes
+         if (cfg.output == output_mode::embed)
+            return fmt::format("reinterpret_cast<const uint64_t*>(&{}[0])", variable_name);
+         return fmt::format("&{}[0]", variable_name);
+      };
+      // The remaining payloads kept their order, they fill the positions between the aliases
+      std::vector<lookup_entry> result(payloads.size() + aliases.size());
+      for (const detail::payload_alias& alias : aliases)
+         result[alias.m_position] = lookup_entry{ alias.m_name, get_pointer_expression(alias.m_target), true };
+      int payload_index = 0;
+      for (lookup_entry& entry : result)
+      {
+         if (entry.m_is_alias)
+            continue;
+         entry = lookup_entry{ payloads[payload_index].m_name, get_pointer_expression(payload_index), false };
+         ++payload_index;
+      }
+      return result;
+   }
+
+
+   // The name overload of get_payload() for output_mode::archive searches the index of the archive. The hash is
+   // bb::get_name_hash(), written out so that the header still doesn't need the decoder.
+   auto write_archive_lookup(
+      std::ostream& out,
+      const size_t entry_count
+   ) -> void
+   {
+      out << "   uint64_t hash = 0xcbf29ce484222325;\n";
+      out << "   for (const char ch : name)\n";
+      out << "   {\n";
+      out << "      hash ^= static_cast<uint8_t>(ch);\n";
+      out << "      hash *= 0x100000001b3;\n";
+      out << "   }\n";
+      out << fmt::format("   constexpr int entry_count = {};\n", entry_count);
+      out << fmt::format(
+         "   const auto get_entry_word = [](const int entry, const int word) {{\n"
+         "      return {}[{} + entry * {} + word];\n"
+         "   }};\n",
+         archive_variable_name, archive_index_word_offset, archive_entry_word_count
+      );
+      out << fmt::format(R"(   int first = 0;
+   int count = entry_count;
+   while (count > 0)
+   {{
+      const int half = count / 2;
+      if (get_entry_word(first + half, 0) < hash)
+      {{
+         first += half + 1;
+         count -= half + 1;
+      }}
+      else
+      {{
+         count = half;
+      }}
+   }}
+   if (first < entry_count && get_entry_word(first, 0) == hash)
+      return &{}[get_entry_word(first, 1) / 8];
+   return nullptr;
+}}
+)", archive_variable_name);
+   }
+
+
+   // Writes the payload_id enum and both get_payload() overloads. The name lookup is a binary search over the sorted
+   // names, which keeps runtime and constant evaluation cost at O(log n) compares.
    auto write_bb_get_fun(
-      std::ofstream& out,
-      const std::vector<payload>& payloads
+      std::ostream& out,
+      const std::vector<lookup_entry>& payloads,
+      const config& cfg
    ) -> void
    {
-      out << R"([[nodiscard]] static constexpr auto get_payload(
+      // #embed arrays are bytes. Getting a uint64_t pointer to them isn't possible in constant expressions
+      const std::string constexpr_str = cfg.output == output_mode::embed ? "" : "constexpr ";
+
+      out << "enum class payload_id : int {\n";
+      for (const lookup_entry& pl : payloads)
+         out << fmt::format("   {},\n", get_variable_name(pl.m_name));
+      out << "};\n";
+      out << fmt::format("static constexpr int payload_count = {};\n\n", payloads.size());
+
+      out << fmt::format(R"([[nodiscard]] static {}auto get_payload(
+   [[maybe_unused]] const payload_id id
+) -> const uint64_t*
+{{
+)", constexpr_str);
+      if (payloads.empty())
+      {
+         out << "   return nullptr;\n}\n\n";
+      }
+      else
+      {
+         out << fmt::format("   {}const uint64_t* const payload_ptrs[]{{\n", constexpr_str);
+         for (const lookup_entry& pl : payloads)
+            out << fmt::format("      {},\n", pl.m_pointer_expression);
+         out << "   };\n";
+         out << "   return payload_ptrs[static_cast<int>(id)];\n}\n\n";
+      }
+
+      out << fmt::format(R"([[nodiscard]] static {}auto get_payload(
    [[maybe_unused]] std::string_view name
 ) -> const uint64_t*
-{
-)";
-      bool first = true;
-      for (const payload& pl : payloads)
+{{
+)", constexpr_str);
+      if (payloads.empty())
       {
-         const std::string conditional_keyword = first ? "if" : "else if";
-         out << fmt::format(
-            "   {}(name == \"{}\")\n      return &{}[0];\n",
-            conditional_keyword, pl.m_path.get_path().filename().string(), get_variable_name(pl.m_path)
-         );
-         first = false;
+         out << "   return nullptr;\n}\n";
+         return;
       }
-      if (payloads.empty() == false)
+      if (cfg.output == output_mode::archive)
+      {
+         write_archive_lookup(out, payloads.size());
+         return;
+      }
+
+      std::vector<int> sorted_indices(payloads.size());
+      for (int i = 0; i < static_cast<int>(payloads.size()); ++i)
+         sorted_indices[i] = i;
+      const auto get_name = [&](const int i) {
+         return payloads[i].m_name;
+      };
+      std::sort(sorted_indices.begin(), sorted_indices.end(), [&](const int a, const int b) {
+         return get_name(a) < get_name(b);
+      });
+
+      out << "   constexpr std::string_view names[]{\n";
+      for (const int i : sorted_indices)
+         out << fmt::format("      \"{}\",\n", get_name(i));
+      out << "   };\n";
+      out << "   constexpr payload_id ids[]{\n";
+      for (const int i : sorted_indices)
+         out << fmt::format("      payload_id::{},\n", get_variable_name(payloads[i].m_name));
+      out << "   };\n";
+      out << R"(   int first = 0;
+   int count = payload_count;
+   while (count > 0)
+   {
+      const int half = count / 2;
+      if (names[first + half] < name)
       {
-         out << "   else\n      return nullptr;\n";
+         first += half + 1;
+         count -= half + 1;
       }
       else
       {
-         out << "   return nullptr;\n";
+         count = half;
       }
-      out << "}\n";
+   }
+   if (first < payload_count && names[first] == name)
+      return get_payload(ids[first]);
+   return nullptr;
+}
+)";
    }
 
 
-   auto report_diagnostics(
-      const config& cfg,
+   // Returned instead of printed so that payloads processed in parallel still report in input order
+   [[nodiscard]] auto get_diagnostics_str(
       const payload& pl,
       const byte_count uncompressed_size,
-      const std::vector<uint8_t>& compressed_bytestream
-   ) -> void
+      const detail::final_payload& final_pl
+   ) -> std::string
    {
-      const byte_count compressed_size{ compressed_bytestream.size() - 16 };
-      fmt::print(
+      if (pl.m_is_cached)
+         return fmt::format("Writing file \"{}\" from cache.\n", pl.m_name);
+      const byte_count compressed_size{ final_pl.get_data().size() };
+      std::string result = fmt::format(
          "Writing file \"{}\". Uncompressed size: {}."
-         , pl.m_path.get_path().filename().string() , get_human_readable_size(uncompressed_size)
+         , pl.m_name , get_human_readable_size(uncompressed_size)
       );
-      if (cfg.compression != compression_mode::none)
+      if (final_pl.m_compression != compression_mode::none)
       {
          const double compression_ratio = compressed_size / uncompressed_size;
-         fmt::print(
+         result += fmt::format(
             " compressed size: {} (compressed to {:.1f}%)"
             , get_human_readable_size(compressed_size), 100.0 * compression_ratio
          );
+         const detail::filter_info filter = detail::get_filter_info(reinterpret_cast<const uint64_t*>(final_pl.m_header.data()));
+         if (filter.filter != 0)
+            result += fmt::format(" Filter: {}.", get_filter_name(filter.filter));
       }
-      printf("\n");
+      const double decode_seconds = get_modeled_decode_seconds(final_pl.m_compression, uncompressed_size.m_value);
+      result += fmt::format(" Modeled decode time: {}.", get_human_readable_time(decode_seconds));
+      result += '\n';
+      return result;
+   }
+
+
+   [[nodiscard]] auto get_final_size(
+      const detail::final_payload& final_pl
+   ) -> size_t
+   {
+      return final_pl.m_header.size() + final_pl.get_data().size();
    }
 
 
-   auto add_word_separator(
+   auto report_diagnostics(
+      const std::vector<std::string>& diagnostic_strings
+   ) -> void
+   {
+      for (const std::string& diagnostic_str : diagnostic_strings)
+         fmt::print("{}", diagnostic_str);
+   }
+
+
+   // Appends the stringified content of the header and data, ie "0xffffffffffffffff, 0xffffffffffffffff, ..." to
+   // the target. Whenever the target grows beyond flush_threshold, flush(target) is called which is expected to empty
+   // it. Lines fully inside the data are formatted straight from it, only the first line with the header and the last
+   // line with an incomplete word go through a small line buffer.
+   template<typename flush_fun_type>
+   auto append_content(
       std::string& target,
-      const bool is_last_word_total,
-      const bool is_last_word_in_line
+      const detail::final_payload& final_pl,
+      const std::string& indentation_str,
+      const int words_per_line,
+      const size_t flush_threshold,
+      const flush_fun_type& flush
    ) -> void
    {
-      if (is_last_word_total)
-         return;
+      const size_t header_word_count = final_pl.m_header.size() / sizeof(uint64_t);
+      const std::span<const uint8_t> data = final_pl.get_data();
+      const uint64_t* data_ptr = reinterpret_cast<const uint64_t*>(data.data());
+      const size_t complete_word_count = header_word_count + data.size() / sizeof(uint64_t);
+      const size_t word_count = header_word_count + get_symbol_count<uint64_t>(byte_count{ data.size() });
+      const size_t line_length = words_per_line > 0 ? words_per_line : word_count;
 
-      if (is_last_word_in_line)
-         target += ",";
-      else
-         target += ", ";
+      const auto get_word = [&](const size_t i) {
+         uint64_t word = 0;
+         if (i < header_word_count)
+            std::memcpy(&word, &final_pl.m_header[i * sizeof(uint64_t)], sizeof(uint64_t));
+         else if (i < complete_word_count)
+            word = data_ptr[i - header_word_count];
+         else // The last word is incomplete. Pad it with zeros instead of reading past the end
+            std::memcpy(&word, &data_ptr[i - header_word_count], data.size() % sizeof(uint64_t));
+         return word;
+      };
+
+      std::vector<uint64_t> line_buffer;
+      for (size_t line_begin = 0; line_begin < word_count; line_begin += line_length)
+      {
+         const size_t line_end = std::min(line_begin + line_length, word_count);
+         const bool is_last_line = line_end == word_count;
+         if (line_begin < header_word_count || line_end > complete_word_count)
+         {
+            line_buffer.clear();
+            for (size_t i = line_begin; i < line_end; ++i)
+               line_buffer.push_back(get_word(i));
+            append_ui64_line(line_buffer, is_last_line == false, target);
+         }
+         else
+         {
+            const uint64_t* line_ptr = data_ptr + (line_begin - header_word_count);
+            append_ui64_line({ line_ptr, line_end - line_begin }, is_last_line == false, target);
+         }
+
+         if (is_last_line == false)
+         {
+            target += '\n';
+            target += indentation_str;
+            if (target.size() >= flush_threshold)
+               flush(target);
+         }
+      }
    }
 
 
-   // Stringified content of the data array, ie "0xffffffffffffffff, 0xffffffffffffffff, ..."
    [[nodiscard]] auto get_content(
-      const std::vector<uint8_t> data_source,
+      const detail::final_payload& final_pl,
       const std::string& indentation_str,
       const int words_per_line
    ) -> std::string
    {
-      const uint64_t* ui64_ptr = reinterpret_cast<const uint64_t*>(data_source.data());
-      
-      const int word_count = get_symbol_count<uint64_t>(byte_count{ data_source.size() });
+      const size_t word_count = get_symbol_count<uint64_t>(byte_count{ final_pl.m_header.size() + final_pl.get_data().size() });
       std::string content;
       content.reserve(word_count * 21);
-      int words_in_line = 0;
-      for (int i = 0; i < word_count; ++i)
-      {
-         const bool is_last_word_total = i == (word_count - 1);
-         const bool is_last_word_in_line = words_in_line == (words_per_line - 1);
-
-         append_ui64_str(ui64_ptr[i], content);
-         add_word_separator(content, is_last_word_total, is_last_word_in_line);
-
-         ++words_in_line;
-
-         if (is_last_word_in_line && is_last_word_total == false)
-         {
-            content += '\n';
-            content += indentation_str;
-            words_in_line = 0;
-         }
-      }
+      constexpr auto never_flush = [](std::string&) {};
+      append_content(content, final_pl, indentation_str, words_per_line, std::string::npos, never_flush);
       return content;
    }
 
 
    [[nodiscard]] auto get_payload_string(
       const config& cfg,
-      const abs_file_path& payload_path,
+      const std::string& payload_name,
       const std::string& content_str
    ) -> std::string
    {
       const std::string indentation_str(cfg.indentation_size, ' ');
 
       std::string payload_str;
-      payload_str += fmt::format("static constexpr uint64_t {}[]{{\n", get_variable_name(payload_path));
+      payload_str += fmt::format("{}static constexpr uint64_t {}[]{{\n", get_alignment_specifier(cfg), get_variable_name(payload_name));
       payload_str += indentation_str;
       payload_str += content_str;
       payload_str += "\n};\n";
@@ -200,64 +495,792 @@ namespace {
    }
 
 
+   [[nodiscard]] auto get_words_per_line(
+      const config& cfg
+   ) -> int
+   {
+      constexpr auto chunk_string_len = std::char_traits<char>::length("0x3f3ffc3f3ffc3f3f, ");
+      return (cfg.max_columns - cfg.indentation_size) / chunk_string_len;
+   }
+
+
    [[nodiscard]] auto get_payload_strings(
       std::vector<payload>& payloads,
       const config& cfg
    ) -> std::vector<std::string>
    {
       const std::string indentation_str(cfg.indentation_size, ' ');
-      constexpr auto chunk_string_len = std::char_traits<char>::length("0x3f3ffc3f3ffc3f3f, ");
-      const int words_per_line = (cfg.max_columns - cfg.indentation_size) / chunk_string_len;
+      const int words_per_line = get_words_per_line(cfg);
 
-      std::vector<std::string> payload_strings;
-      payload_strings.reserve(payloads.size());
-      for (payload& pl : payloads)
-      {
-         const byte_count uncompressed_size{ pl.m_content_data.size() }; // needs to be read here because pl.m_content_data is moved in next line
-         const std::vector<uint8_t> data_source = detail::get_final_bytestream(pl, cfg);
+      std::vector<std::string> payload_strings(payloads.size());
+      std::vector<std::string> diagnostic_strings(payloads.size());
+      const auto process_payload = [&](const int i) {
+         payload& pl = payloads[i];
+         load_deferred(pl, cfg);
+         const byte_count uncompressed_size{ pl.get_content().size() }; // needs to be read here because the content is moved in next line
+         const detail::final_payload final_pl = detail::get_final_payload(pl, cfg);
 
-         report_diagnostics(cfg, pl, uncompressed_size, data_source);
-         std::string payload_str = get_payload_string(
+         if (cfg.quiet == false)
+            diagnostic_strings[i] = get_diagnostics_str(pl, uncompressed_size, final_pl);
+         const phase_timer format_timer(bake_phase::format);
+         payload_strings[i] = get_payload_string(
             cfg,
-            pl.m_path,
-            get_content(data_source, indentation_str, words_per_line)
+            pl.m_name,
+            get_content(final_pl, indentation_str, words_per_line)
          );
-         payload_strings.emplace_back(std::move(payload_str));
-      }
+         pl.m_phase_records.push_back(format_timer.stop(get_final_size(final_pl), payload_strings[i].size()));
+      };
+      get_thread_pool(cfg.thread_count).parallel_for(static_cast<int>(payloads.size()), process_payload);
+
+      report_diagnostics(diagnostic_strings);
       return payload_strings;
    }
 
 
-   [[nodiscard]] auto get_payload_bytes(
-      std::vector<uint8_t>&& uncompressed_payload_bytes,
+   // Computes the final payloads window by window, one payload per worker thread, and hands them to fun(index,
+   // final_payload) in input order. Only one window of final payloads is alive at any time, loaded content is freed as
+   // soon as it's compressed. With cfg.memory_budget_mb, the payloads are limited by their size instead.
+   template<typename fun_type>
+   auto for_each_final_payload(
+      std::vector<payload>& payloads,
+      const config& cfg,
+      const fun_type& fun
+   ) -> void
+   {
+      if (cfg.memory_budget_mb > 0)
+      {
+         detail::for_each_final_payload_within_budget(payloads, cfg, fun);
+         return;
+      }
+      thread_pool& pool = get_thread_pool(cfg.thread_count);
+      const int payload_count = static_cast<int>(payloads.size());
+      const int window_size = pool.get_thread_count();
+      for (int window_begin = 0; window_begin < payload_count; window_begin += window_size)
+      {
+         const int window_count = std::min(window_size, payload_count - window_begin);
+         std::vector<detail::final_payload> final_payloads(window_count);
+         std::vector<std::string> diagnostic_strings(window_count);
+         const auto process_payload = [&](const int i) {
+            payload& pl = payloads[window_begin + i];
+            load_deferred(pl, cfg);
+            const byte_count uncompressed_size{ pl.get_content().size() };
+            final_payloads[i] = detail::get_final_payload(pl, cfg);
+            pl.free_content();
+            if (cfg.quiet == false)
+               diagnostic_strings[i] = get_diagnostics_str(pl, uncompressed_size, final_payloads[i]);
+         };
+         pool.parallel_for(window_count, process_payload);
+         report_diagnostics(diagnostic_strings);
+
+         for (int i = 0; i < window_count; ++i)
+         {
+            fun(window_begin + i, final_payloads[i]);
+            final_payloads[i] = detail::final_payload{};
+         }
+      }
+   }
+
+
+   // Formats arrays straight into an output through a fixed-size line buffer
+   struct streamed_array_writer {
+   private:
+      static constexpr size_t m_buffer_size = 64 * 1024;
+      std::string m_indentation_str;
+      int m_words_per_line;
+      std::string m_buffer;
+
+   public:
+      explicit streamed_array_writer(const config& cfg)
+         : m_indentation_str(cfg.indentation_size, ' ')
+         , m_words_per_line(get_words_per_line(cfg))
+      {
+         m_buffer.reserve(m_buffer_size + cfg.max_columns + m_indentation_str.size());
+      }
+
+      // declaration is everything in front of the braces, ie "static constexpr uint64_t bb_name[]". Returns the number
+      // of characters written.
+      auto write(
+         std::ostream& out,
+         const std::string& declaration,
+         const detail::final_payload& final_pl
+      ) -> size_t
+      {
+         size_t written = 0;
+         const auto flush = [&](std::string& buffer) {
+            out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            written += buffer.size();
+            buffer.clear();
+         };
+         m_buffer += fmt::format("{}{{\n", declaration);
+         m_buffer += m_indentation_str;
+         append_content(m_buffer, final_pl, m_indentation_str, m_words_per_line, m_buffer_size, flush);
+         m_buffer += "\n};\n";
+         flush(m_buffer);
+         return written;
+      }
+   };
+
+
+   auto write_payloads_streamed(
+      std::ostream& out,
+      std::vector<payload>& payloads,
+      const config& cfg
+   ) -> void
+   {
+      streamed_array_writer writer(cfg);
+      for_each_final_payload(payloads, cfg, [&](const int i, const detail::final_payload& final_pl) {
+         const std::string declaration = fmt::format("{}static constexpr uint64_t {}[]", get_alignment_specifier(cfg), get_variable_name(payloads[i].m_name));
+         const phase_timer format_timer(bake_phase::format);
+         const size_t char_count = writer.write(out, declaration, final_pl);
+         payloads[i].m_phase_records.push_back(format_timer.stop(get_final_size(final_pl), char_count));
+      });
+   }
+
+
+   // Deduplicated payloads keep their symbol, as a pointer to the array they share. Archives have no symbols per
+   // payload.
+   auto write_alias_declarations(
+      std::ostream& out,
+      const std::vector<lookup_entry>& lookup_entries,
       const config& cfg
+   ) -> void
+   {
+      if (cfg.output == output_mode::archive)
+         return;
+      for (const lookup_entry& entry : lookup_entries)
+      {
+         if (entry.m_is_alias == false)
+            continue;
+         const std::string variable_name = get_variable_name(entry.m_name);
+         // #embed arrays are bytes, the cast to uint64_t isn't possible in constant expressions
+         if (cfg.output == output_mode::embed)
+            out << fmt::format("static const uint64_t* const {} = {};\n", variable_name, entry.m_pointer_expression);
+         else
+            out << fmt::format("static constexpr const uint64_t* {} = {};\n", variable_name, entry.m_pointer_expression);
+      }
+   }
+
+
+   // Writes the header around the payload arrays or declarations, which are written by write_payload_section(out)
+   template<typename fun_type>
+   auto write_header(
+      std::ostream& out,
+      const std::vector<lookup_entry>& lookup_entries,
+      const config& cfg,
+      const fun_type& write_payload_section
+   ) -> void
+   {
+      out << "#include <cstdint>\n";
+      out << "#include <cstring>\n";
+      out << "#include <string_view> // std::string_view\n\n";
+      out << "#include <type_traits> // std::is_constant_evaluated\n\n";
+      out << "namespace bb{\n";
+      write_payload_section(out);
+      write_alias_declarations(out, lookup_entries, cfg);
+      out << '\n';
+      write_bb_get_fun(out, lookup_entries, cfg);
+      out << "\n} // namespace bb\n";
+   }
+
+
+   [[nodiscard]] auto get_shard_path(
+      const fs::path& output_path,
+      const int shard_index
+   ) -> fs::path
+   {
+      const std::string filename = fmt::format("{}_shard{}.cpp", output_path.stem().string(), shard_index);
+      return output_path.parent_path() / filename;
+   }
+
+
+   // Distributes the payloads in order over .cpp files with about cfg.shard_size bytes of final payloads each. Every
+   // shard is only replaced if its content changed, and shards left over from earlier runs with more of them are
+   // removed. Returns the paths of the shards.
+   [[nodiscard]] auto write_shard_files(
+      const config& cfg,
+      std::vector<payload>& payloads,
+      const fs::path& output_path
+   ) -> std::vector<fs::path>
+   {
+      std::vector<fs::path> shard_paths;
+      std::ofstream shard;
+      size_t shard_bytes = 0;
+      const auto close_shard = [&]() {
+         shard << "\n} // namespace bb\n";
+         shard.close();
+         replace_if_changed(get_temp_path(shard_paths.back()), shard_paths.back());
+      };
+      const auto open_shard = [&]() {
+         shard_paths.push_back(get_shard_path(output_path, static_cast<int>(shard_paths.size())));
+         shard.open(get_temp_path(shard_paths.back()), std::ios::out);
+         if (!shard.good())
+            throw std::runtime_error(fmt::format("Couldn't open {} for writing", shard_paths.back().string()));
+         shard << get_hash_line_placeholder();
+         shard << fmt::format("// Payload data of \"{}\". Compile and link this file.\n", output_path.filename().string());
+         shard << "#include <cstdint>\n\n";
+         shard << "namespace bb{\n";
+         shard_bytes = 0;
+      };
+
+      streamed_array_writer writer(cfg);
+      for_each_final_payload(payloads, cfg, [&](const int i, const detail::final_payload& final_pl) {
+         const size_t payload_bytes = get_final_size(final_pl);
+         if (shard.is_open() && shard_bytes + payload_bytes > static_cast<size_t>(cfg.shard_size))
+            close_shard();
+         if (shard.is_open() == false)
+            open_shard();
+
+         // extern for external linkage, const variables at namespace scope would be internal otherwise
+         const std::string declaration = fmt::format("{}extern const uint64_t {}[]", get_alignment_specifier(cfg), get_variable_name(payloads[i].m_name));
+         const phase_timer format_timer(bake_phase::format);
+         const size_t char_count = writer.write(shard, declaration, final_pl);
+         payloads[i].m_phase_records.push_back(format_timer.stop(payload_bytes, char_count));
+         shard_bytes += payload_bytes;
+      });
+      if (shard.is_open())
+         close_shard();
+
+      for (int i = static_cast<int>(shard_paths.size()); fs::exists(get_shard_path(output_path, i)); ++i)
+         fs::remove(get_shard_path(output_path, i));
+      return shard_paths;
+   }
+
+
+   // Packs all final payloads behind the index of their names, see bb::archive_magic. The byte offsets of the
+   // payloads in the archive are written into payload_offsets. The archive header and index are m_header, the
+   // payloads m_data.
+   [[nodiscard]] auto get_archive(
+      std::vector<payload>& payloads,
+      const std::vector<detail::payload_alias>& aliases,
+      const config& cfg,
+      std::vector<size_t>& payload_offsets
+   ) -> detail::final_payload
+   {
+      const size_t alignment = static_cast<size_t>(cfg.payload_alignment);
+      const auto get_aligned = [&](const size_t offset) {
+         return (offset + alignment - 1) / alignment * alignment;
+      };
+      const size_t entry_count = payloads.size() + aliases.size();
+      const size_t index_end = (archive_index_word_offset + entry_count * archive_entry_word_count) * sizeof(uint64_t);
+      const size_t data_begin = get_aligned(index_end);
+
+      detail::final_payload result;
+      std::vector<std::array<uint64_t, 2>> headers(payloads.size());
+      payload_offsets.resize(payloads.size());
+      for_each_final_payload(payloads, cfg, [&](const int i, const detail::final_payload& final_pl) {
+         result.m_data.resize(get_aligned(result.m_data.size()), 0);
+         payload_offsets[i] = data_begin + result.m_data.size();
+         std::memcpy(headers[i].data(), final_pl.m_header.data(), sizeof(headers[i]));
+         const std::span<const uint8_t> data = final_pl.get_data();
+         result.m_data.insert(result.m_data.end(), final_pl.m_header.begin(), final_pl.m_header.end());
+         result.m_data.insert(result.m_data.end(), data.begin(), data.end());
+      });
+
+      struct index_entry {
+         uint64_t m_name_hash;
+         int m_payload;
+         const std::string* m_name;
+      };
+      std::vector<index_entry> entries;
+      entries.reserve(entry_count);
+      for (int i = 0; i < static_cast<int>(payloads.size()); ++i)
+         entries.push_back(index_entry{ get_name_hash(payloads[i].m_name), i, &payloads[i].m_name });
+      for (const detail::payload_alias& alias : aliases)
+         entries.push_back(index_entry{ get_name_hash(alias.m_name), alias.m_target, &alias.m_name });
+      std::sort(entries.begin(), entries.end(), [](const index_entry& a, const index_entry& b) {
+         return a.m_name_hash < b.m_name_hash;
+      });
+      for (size_t i = 1; i < entries.size(); ++i)
+      {
+         if (entries[i].m_name_hash == entries[i - 1].m_name_hash && *entries[i].m_name != *entries[i - 1].m_name)
+         {
+            const std::string msg = fmt::format(
+               "The names {} and {} have the same hash and can't be in one archive", *entries[i - 1].m_name, *entries[i].m_name
+            );
+            throw std::runtime_error(msg);
+         }
+      }
+
+      const uint64_t archive_size = data_begin + get_symbol_count<uint64_t>(byte_count{ result.m_data.size() }) * sizeof(uint64_t);
+      std::vector<uint64_t> words{
+         archive_magic,
+         std::bit_cast<uint64_t>(std::array<uint32_t, 2>{ static_cast<uint32_t>(entry_count), static_cast<uint32_t>(alignment) }),
+         archive_size
+      };
+      for (const index_entry& entry : entries)
+      {
+         const std::array<uint64_t, 2>& header = headers[entry.m_payload];
+         words.insert(words.end(), { entry.m_name_hash, payload_offsets[entry.m_payload], header[0], header[1] });
+      }
+      words.resize(data_begin / sizeof(uint64_t), 0);
+      result.m_header.resize(words.size() * sizeof(uint64_t));
+      std::memcpy(result.m_header.data(), words.data(), result.m_header.size());
+      return result;
+   }
+
+
+   [[nodiscard]] auto get_sidecar_path(
+      const abs_directory_path& working_dir,
+      const std::string& payload_name
+   ) -> fs::path
+   {
+      return working_dir.get_path() / (get_variable_name(payload_name) + ".bin");
+   }
+
+
+   // Writes every final payload into its own .bin file next to the output
+   auto write_sidecar_files(
+      const config& cfg,
+      std::vector<payload>& payloads,
+      const abs_directory_path& working_dir
+   ) -> void
+   {
+      for_each_final_payload(payloads, cfg, [&](const int i, const detail::final_payload& final_pl) {
+         const fs::path sidecar_path = get_sidecar_path(working_dir, payloads[i].m_name);
+         const phase_timer write_timer(bake_phase::write);
+         update_binary_file(sidecar_path, { final_pl.m_header, final_pl.get_data() }, sizeof(uint64_t));
+         payloads[i].m_phase_records.push_back(write_timer.stop(get_final_size(final_pl), get_final_size(final_pl)));
+      });
+   }
+
+
+   // The sidecar files are next to the header, #embed finds them relative to it like #include would
+   auto write_embed_declarations(
+      std::ostream& out,
+      const std::vector<payload>& payloads,
+      const config& cfg,
+      const abs_directory_path& working_dir
+   ) -> void
+   {
+      out << "#if !defined(__has_embed)\n";
+      out << "#error \"This payload header needs a compiler with #embed support. Use output_mode = \\\"header\\\" instead.\"\n";
+      out << "#endif\n";
+      for (const payload& pl : payloads)
+      {
+         const std::string variable_name = get_variable_name(pl.m_name);
+         out << fmt::format("alignas({}) static constexpr unsigned char {}[] = {{\n", cfg.payload_alignment, variable_name);
+         out << fmt::format("#embed \"{}\"\n", get_sidecar_path(working_dir, pl.m_name).filename().string());
+         out << "};\n";
+      }
+   }
+
+
+   // Writes every final payload into its own .bin file next to the output and an assembly file that pulls them
+   // in with .incbin. The compiler never sees the data, so compile time doesn't depend on payload size. Like with
+   // #embed, the .bin files are named relative to the assembly file, so that the output can be moved or checked in.
+   // The assembler searches include directories for them, not the directory of the file.
+   auto write_incbin_files(
+      const config& cfg,
+      std::vector<payload>& payloads,
+      const abs_directory_path& working_dir
+   ) -> void
+   {
+      const fs::path assembly_path = fs::path(working_dir.get_path() / cfg.output_filename).replace_extension(".S");
+      const fs::path temp_path = get_temp_path(assembly_path);
+      std::ofstream assembly(temp_path, std::ios::out);
+      if (!assembly.good())
+      {
+         fmt::print("Couldn't open {} for writing\n", assembly_path.string());
+         return;
+      }
+
+      assembly << get_hash_line_placeholder();
+      assembly << fmt::format("// Assemble and link this file. The payload declarations are in \"{}\".\n", cfg.output_filename);
+      assembly << "// The .bin files are next to it, add its directory to the assembler include paths (-Wa,-I<dir>).\n";
+      assembly << "#if defined(__APPLE__)\n";
+      assembly << "#define BB_SYMBOL(name) _##name\n";
+      assembly << "   .section __TEXT,__const\n";
+      assembly << "#else\n";
+      assembly << "#define BB_SYMBOL(name) name\n";
+      assembly << "   .section .rodata\n";
+      assembly << "#endif\n";
+
+      for_each_final_payload(payloads, cfg, [&](const int i, const detail::final_payload& final_pl) {
+         const fs::path sidecar_path = get_sidecar_path(working_dir, payloads[i].m_name);
+         const phase_timer write_timer(bake_phase::write);
+         update_binary_file(sidecar_path, { final_pl.m_header, final_pl.get_data() }, sizeof(uint64_t));
+         payloads[i].m_phase_records.push_back(write_timer.stop(get_final_size(final_pl), get_final_size(final_pl)));
+
+         const std::string variable_name = get_variable_name(payloads[i].m_name);
+         assembly << fmt::format("\n   .balign {}\n", cfg.payload_alignment);
+         assembly << fmt::format("   .globl BB_SYMBOL({})\n", variable_name);
+         assembly << fmt::format("BB_SYMBOL({}):\n", variable_name);
+         assembly << fmt::format("   .incbin \"{}\"\n", sidecar_path.filename().string());
+      });
+
+      assembly << "\n#if defined(__ELF__)\n";
+      assembly << "   .section .note.GNU-stack,\"\",%progbits\n";
+      assembly << "#endif\n";
+      assembly.close();
+      replace_if_changed(temp_path, assembly_path);
+   }
+
+
+   // The dictionary is only used for compression_mode::zstd_dictionary
+   [[nodiscard]] auto get_compressed_bytes(
+      const std::span<const uint8_t> uncompressed_payload_bytes,
+      const config& cfg,
+      const compression_mode compression,
+      const zstd_dictionary* dictionary
    ) -> std::vector<uint8_t>
    {
-      switch (cfg.compression) {
-      case compression_mode::none:
-         return std::move(uncompressed_payload_bytes);
+      switch (compression) {
       case compression_mode::zstd:
-         return get_zstd_compressed(uncompressed_payload_bytes);
+         return get_zstd_compressed(uncompressed_payload_bytes, cfg.zstd_level, cfg.zstd_long_range);
+      case compression_mode::zstd_dictionary:
+         return get_zstd_compressed(uncompressed_payload_bytes, *dictionary, cfg.zstd_level, cfg.zstd_long_range);
       case compression_mode::lz4:
-         return get_lz4_compressed(uncompressed_payload_bytes);
+         return get_lz4_compressed(uncompressed_payload_bytes, cfg.lz4_level);
       default:
          std::terminate();
       }
    }
 
 
+   [[nodiscard]] auto get_chunk_table_word_count(
+      const size_t uncompressed_size,
+      const config& cfg
+   ) -> size_t
+   {
+      const size_t chunk_count = (uncompressed_size + cfg.chunk_size - 1) / cfg.chunk_size;
+      return 2 + chunk_count;
+   }
+
+
+   // Compresses every chunk_size bytes on their own, behind the chunk table. See bb::version_chunked for the layout.
+   [[nodiscard]] auto get_chunked_bytes(
+      const std::span<const uint8_t> uncompressed_payload_bytes,
+      const config& cfg,
+      const compression_mode compression,
+      const zstd_dictionary* dictionary
+   ) -> std::vector<uint8_t>
+   {
+      const size_t chunk_size = static_cast<size_t>(cfg.chunk_size);
+      std::vector<uint64_t> table_words(get_chunk_table_word_count(uncompressed_payload_bytes.size(), cfg));
+      const size_t chunk_count = table_words.size() - 2;
+      const std::array<uint32_t, 2> sizes{ static_cast<uint32_t>(chunk_size), static_cast<uint32_t>(chunk_count) };
+      table_words[0] = std::bit_cast<uint64_t>(sizes);
+
+      std::vector<uint8_t> result(table_words.size() * sizeof(uint64_t));
+      for (size_t i = 0; i < chunk_count; ++i)
+      {
+         const std::span<const uint8_t> chunk = uncompressed_payload_bytes.subspan(
+            i * chunk_size,
+            std::min(chunk_size, uncompressed_payload_bytes.size() - i * chunk_size)
+         );
+         const std::vector<uint8_t> compressed_chunk = get_compressed_bytes(chunk, cfg, compression, dictionary);
+         result.insert(result.end(), compressed_chunk.begin(), compressed_chunk.end());
+         table_words[2 + i] = result.size() - table_words.size() * sizeof(uint64_t);
+      }
+      // First offset is 0, each entry after that is the end of a chunk
+      std::memcpy(result.data(), table_words.data(), table_words.size() * sizeof(uint64_t));
+      return result;
+   }
+
+
+   // Including the chunk table for chunked payloads
+   [[nodiscard]] auto get_encoded_bytes(
+      const std::span<const uint8_t> uncompressed_payload_bytes,
+      const config& cfg,
+      const compression_mode compression,
+      const zstd_dictionary* dictionary
+   ) -> std::vector<uint8_t>
+   {
+      if (cfg.chunk_size > 0)
+         return get_chunked_bytes(uncompressed_payload_bytes, cfg, compression, dictionary);
+      return get_compressed_bytes(uncompressed_payload_bytes, cfg, compression, dictionary);
+   }
+
+
+   struct encoding_choice {
+      compression_mode m_compression = compression_mode::none;
+      std::vector<uint8_t> m_bytes; // Empty for compression_mode::none
+      filter_params m_filter;
+   };
+
+   // Tries the codecs that decode within the budget and keeps the smallest result. Compression has to actually make
+   // the payload smaller, otherwise it stays uncompressed. On equal size, the faster decoding codec wins.
+   [[nodiscard]] auto get_automatic_choice(
+      const std::span<const uint8_t> uncompressed_payload_bytes,
+      const config& cfg,
+      const zstd_dictionary* dictionary
+   ) -> encoding_choice
+   {
+      encoding_choice best;
+      size_t best_size = uncompressed_payload_bytes.size();
+      const compression_mode zstd_mode = dictionary != nullptr ? compression_mode::zstd_dictionary : compression_mode::zstd;
+      for (const compression_mode candidate : { compression_mode::lz4, zstd_mode })
+      {
+         const double decode_ms = 1.0e3 * get_modeled_decode_seconds(candidate, uncompressed_payload_bytes.size());
+         if (cfg.auto_decode_budget_ms > 0.0 && decode_ms > cfg.auto_decode_budget_ms)
+            continue;
+         std::vector<uint8_t> candidate_bytes = get_encoded_bytes(uncompressed_payload_bytes, cfg, candidate, dictionary);
+         if (candidate_bytes.size() >= best_size)
+            continue;
+         best_size = candidate_bytes.size();
+         best = encoding_choice{ candidate, std::move(candidate_bytes), filter_params{} };
+      }
+      return best;
+   }
+
+
+   // Chunks of filtered payloads are rounded up to a multiple of the filter's element or row size
+   [[nodiscard]] auto get_filtered_config(
+      const config& cfg,
+      const filter_params& filter
+   ) -> config
+   {
+      config result = cfg;
+      const size_t block_size = get_filter_block_size(filter);
+      const size_t chunk_size = (static_cast<size_t>(cfg.chunk_size) + block_size - 1) / block_size * block_size;
+      result.chunk_size = static_cast<int>(chunk_size);
+      return result;
+   }
+
+
+   // Compresses the payload with every filter candidate of the config and keeps the smallest result. Filtered data has
+   // to end up compressed, compression_mode::automatic choosing none only counts for the unfiltered candidate.
+   [[nodiscard]] auto get_filtered_choice(
+      const payload& pl,
+      const config& cfg,
+      const compression_mode compression,
+      const zstd_dictionary* dictionary
+   ) -> encoding_choice
+   {
+      const std::span<const uint8_t> content = pl.get_content();
+      std::optional<encoding_choice> best;
+      for (const filter_params& filter : get_filter_candidates(content, pl.m_meta, cfg))
+      {
+         const config filtered_cfg = get_filtered_config(cfg, filter);
+         std::vector<uint8_t> filtered;
+         if (filter.m_filter != filter_mode::none)
+            filtered = get_filtered(content, filter, static_cast<size_t>(filtered_cfg.chunk_size));
+         const std::span<const uint8_t> input = filter.m_filter == filter_mode::none ? content : filtered;
+
+         encoding_choice candidate;
+         if (compression == compression_mode::automatic)
+            candidate = get_automatic_choice(input, filtered_cfg, dictionary);
+         else
+            candidate = encoding_choice{ compression, get_encoded_bytes(input, filtered_cfg, compression, dictionary), filter_params{} };
+         if (candidate.m_compression == compression_mode::none)
+         {
+            if (best.has_value() == false && filter.m_filter == filter_mode::none)
+               best = std::move(candidate);
+            continue;
+         }
+         candidate.m_filter = filter;
+         const bool is_smaller = best.has_value() == false
+            || best->m_compression == compression_mode::none
+            || candidate.m_bytes.size() < best->m_bytes.size();
+         if (is_smaller)
+            best = std::move(candidate);
+      }
+      return std::move(best).value_or(encoding_choice{});
+   }
+
+
+   // Two payloads with the same content have the same final payload if this is the same. The size and meta are part
+   // of the header, the compression settings can differ by name.
+   [[nodiscard]] auto get_encoding_str(
+      const payload& pl,
+      const config& cfg
+   ) -> std::string
+   {
+      const config file_cfg = get_file_config(cfg, pl.m_name);
+      const byte_count size{ pl.get_content().size() };
+      const std::vector<uint8_t> header = get_header_bytes(pl.m_meta, compression_mode::none, size, size);
+      return fmt::format(
+         "{} {} {} {} {} {} {} {}",
+         get_xxh64(header),
+         static_cast<int>(file_cfg.compression),
+         file_cfg.zstd_level,
+         file_cfg.zstd_long_range,
+         file_cfg.lz4_level,
+         static_cast<int>(file_cfg.filter),
+         file_cfg.filter_element_size,
+         static_cast<const void*>(pl.m_zstd_dictionary.get())
+      );
+   }
+
+   // Only the beginning of large payloads is used, they would just add training time
+   constexpr size_t max_dictionary_sample_size = 128 * 1024;
+
 } // namespace {}
 
 
+auto bb::payload::get_content() const -> std::span<const uint8_t>
+{
+   if (m_mapped_content != nullptr)
+      return m_mapped_content->get_bytes();
+   return m_content_data;
+}
+
+
+auto bb::payload::free_content() -> void
+{
+   m_content_data = std::vector<uint8_t>{};
+   m_mapped_content.reset();
+}
+
+
 auto bb::get_payload(
    const abs_file_path& file,
    const config& cfg
 ) -> payload
 {
-   if (is_image_path(file))
-      return get_image_payload(file, cfg);
-   else
-      return get_binary_file_payload(file);
+   const bool is_image = is_image_path(file, cfg);
+   const phase_timer load_timer(is_image ? bake_phase::image_decode : bake_phase::load);
+   payload result = is_image ? get_image_payload(file, cfg) : get_binary_file_payload(file);
+   const uint64_t content_size = result.get_content().size();
+   result.m_phase_records.push_back(load_timer.stop(is_image ? fs::file_size(file.get_path()) : content_size, content_size));
+   return result;
+}
+
+
+auto bb::get_payload(
+   std::span<const uint8_t> content,
+   const content_meta& meta,
+   const std::string& name
+) -> payload
+{
+   if (const naive_image_type* image = std::get_if<naive_image_type>(&meta))
+   {
+      const size_t expected_size = static_cast<size_t>(image->m_width) * image->m_height * image->m_bpp;
+      if (content.size() != expected_size)
+      {
+         const std::string msg = fmt::format(
+            "Image payload {} has {} bytes, but {}x{} pixels with {} channels need {}",
+            name, content.size(), image->m_width, image->m_height, image->m_bpp, expected_size
+         );
+         throw std::runtime_error(msg);
+      }
+      if (image->m_mip_count < 1 || image->m_mip_count > get_full_mip_count(image->m_width, image->m_height))
+         throw std::runtime_error(fmt::format("Image payload {} has an invalid mip count of {}", name, image->m_mip_count));
+      if (is_texture(*image))
+         return payload{ get_texture_bytes(content, *image), meta, name };
+   }
+   return payload{ std::vector<uint8_t>(content.begin(), content.end()), meta, name };
+}
+
+
+auto bb::get_payloads(
+   const std::vector<abs_file_path>& files,
+   const config& cfg,
+   const std::shared_ptr<const payload_cache>& cache
+) -> std::vector<payload>
+{
+   const bool use_cache = cache != nullptr && cfg.zstd_dictionary == false;
+   if (cache != nullptr && use_cache == false)
+      fmt::print("The cache isn't used with zstd_dictionary, the dictionary depends on all payloads.\n");
+
+   const bool defer_loading = cfg.memory_budget_mb > 0 && cfg.zstd_dictionary == false;
+   if (cfg.memory_budget_mb > 0 && defer_loading == false)
+      fmt::print("The memory budget isn't used with zstd_dictionary, the dictionary depends on all payloads.\n");
+
+   std::vector<std::string> names;
+   std::vector<std::string> paths;
+   names.reserve(files.size());
+   paths.reserve(files.size());
+   for (const abs_file_path& file : files)
+   {
+      names.push_back(file.get_path().filename().string());
+      paths.push_back(file.get_path().string());
+   }
+   check_unique_names(names, paths, cfg);
+
+   // payload isn't default constructible
+   std::vector<std::optional<payload>> loaded(files.size());
+   const auto load = [&](const int i) {
+      // Deferred files are deduplicated by their key like cached ones, their content isn't there to compare
+      const bool needs_key = use_cache || (defer_loading && cfg.deduplicate);
+      uint64_t key = 0;
+      if (use_cache)
+         key = cache->get_key(files[i], cfg);
+      else if (needs_key)
+         key = get_cache_key(files[i], cfg);
+      const bool is_cached = use_cache && cache->contains(key);
+      if (is_cached || defer_loading)
+         loaded[i].emplace(std::vector<uint8_t>{}, generic_binary{}, files[i].get_path().filename().string());
+      else
+         loaded[i].emplace(get_payload(files[i], cfg));
+      if (defer_loading && is_cached == false)
+         loaded[i]->m_deferred_file = files[i];
+      if (use_cache)
+         loaded[i]->m_cache = cache;
+      loaded[i]->m_cache_key = key;
+      loaded[i]->m_is_cached = is_cached;
+   };
+   get_thread_pool(cfg.thread_count).parallel_for(static_cast<int>(files.size()), load);
+
+   std::vector<payload> result;
+   result.reserve(files.size());
+   for (std::optional<payload>& pl : loaded)
+      result.emplace_back(std::move(pl.value()));
+   return result;
+}
+
+
+auto bb::is_output_path(
+   const fs::path& path,
+   const config& cfg,
+   const abs_directory_path& working_dir
+) -> bool
+{
+   fs::path normal_path = path.lexically_normal();
+   if (normal_path.extension() == ".tmp")
+      normal_path.replace_extension();
+   const fs::path output_path = (working_dir.get_path() / cfg.output_filename).lexically_normal();
+   if (normal_path == output_path)
+      return true;
+   if (cfg.report_path.empty() == false && normal_path == (working_dir.get_path() / cfg.report_path).lexically_normal())
+      return true;
+   if (cfg.archive_path.empty() == false && normal_path == (working_dir.get_path() / cfg.archive_path).lexically_normal())
+      return true;
+   if (normal_path == fs::path(output_path).replace_extension(".S"))
+      return true;
+
+   // Shards of earlier runs with a different shard_size are outputs too
+   const std::string filename = normal_path.filename().string();
+   const std::string shard_prefix = output_path.stem().string() + "_shard";
+   if (normal_path.parent_path() == output_path.parent_path() && filename.starts_with(shard_prefix) && filename.ends_with(".cpp"))
+   {
+      const std::string_view index = std::string_view(filename).substr(shard_prefix.size(), filename.size() - shard_prefix.size() - 4);
+      const bool is_index = index.empty() == false && std::all_of(index.begin(), index.end(), [](const char c) {
+         return c >= '0' && c <= '9';
+      });
+      if (is_index)
+         return true;
+   }
+
+   const bool has_sidecars = cfg.output == output_mode::incbin || cfg.output == output_mode::embed;
+   return has_sidecars
+      && normal_path.parent_path() == working_dir.get_path().lexically_normal()
+      && filename.starts_with("bb_")
+      && filename.ends_with(".bin");
+}
+
+
+auto bb::get_directory_inputs(
+   const abs_directory_path& dir,
+   const config& cfg,
+   const abs_directory_path& working_dir
+) -> std::vector<abs_file_path>
+{
+   const auto is_archive = [](const fs::path& path) {
+      std::ifstream file(path, std::ios::in | std::ios::binary);
+      uint64_t magic = 0;
+      file.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+      return file.gcount() == sizeof(magic) && magic == archive_magic;
+   };
+
+   std::vector<abs_file_path> result = get_files_recursively(dir, cfg.input_include, cfg.input_exclude);
+   std::erase_if(result, [&](const abs_file_path& file) {
+      // Configs next to the assets aren't payloads
+      if (file.get_path().filename() == "binary_bakery.toml" || is_output_path(file.get_path(), cfg, working_dir))
+         return true;
+      return has_hash_line(file.get_path()) || is_archive(file.get_path());
+   });
+   return result;
 }
 
 
@@ -267,28 +1290,335 @@ auto bb::write_payloads_to_file(
    const abs_directory_path& working_dir
 ) -> void
 {
-   const std::vector<std::string> payload_strings = get_payload_strings(payloads, cfg);
+   detail::add_zstd_dictionary(payloads, cfg);
+   check_unique_names(payloads, cfg);
+   const std::vector<detail::payload_alias> aliases = detail::remove_duplicates(payloads, cfg);
    const fs::path output_path = working_dir.get_path() / cfg.output_filename;
-   std::ofstream filestream(output_path, std::ios::out);
+   const bool data_in_header = cfg.output == output_mode::header;
+   const bool is_sharded = data_in_header && cfg.shard_size > 0;
+   std::vector<std::string> payload_strings;
+   std::vector<fs::path> shard_paths;
+   detail::final_payload archive;
+   std::vector<size_t> archive_offsets;
+   if (cfg.output == output_mode::archive)
+   {
+      archive = get_archive(payloads, aliases, cfg, archive_offsets);
+      if (cfg.archive_path.empty() == false)
+         update_binary_file(working_dir.get_path() / cfg.archive_path, { archive.m_header, archive.m_data }, sizeof(uint64_t));
+   }
+   else if (is_sharded)
+      shard_paths = write_shard_files(cfg, payloads, output_path);
+   else if (data_in_header && cfg.streaming_output == false)
+      payload_strings = get_payload_strings(payloads, cfg);
+   else if (cfg.output == output_mode::incbin)
+      write_incbin_files(cfg, payloads, working_dir);
+   else if (cfg.output == output_mode::embed)
+      write_sidecar_files(cfg, payloads, working_dir);
+   // Written to a temporary file first. The compiler never sees a partial header, and an unchanged header keeps its
+   // modification time so that nothing including it is rebuilt.
+   const phase_timer write_timer(bake_phase::write); // Includes the formatting of streamed payloads
+   const fs::path temp_path = get_temp_path(output_path);
+   std::ofstream filestream(temp_path, std::ios::out);
    if (!filestream.good())
    {
       fmt::print("Couldn't open {} for writing\n", cfg.output_filename);
       return;
    }
 
-   filestream << "#include <cstdint>\n";
-   filestream << "#include <cstring>\n";
-   filestream << "#include <string_view> // std::string_view\n\n";
-   filestream << "#include <type_traits> // std::is_constant_evaluated\n\n";
-   filestream << "namespace bb{\n";
-   for(const std::string& payload_string : payload_strings)
+   filestream << get_hash_line_placeholder();
+   if (is_sharded)
    {
-      filestream << payload_string;
+      filestream << "// The payload data is in these files, compile and link them:\n";
+      for (const fs::path& shard_path : shard_paths)
+         filestream << fmt::format("//    {}\n", shard_path.filename().string());
    }
+   write_header(filestream, get_lookup_entries(payloads, aliases, cfg, archive_offsets), cfg, [&](std::ostream& out) {
+      if (cfg.output == output_mode::incbin)
+      {
+         for (const payload& pl : payloads)
+            out << fmt::format("extern \"C\" {}const uint64_t {}[];\n", get_alignment_specifier(cfg), get_variable_name(pl.m_name));
+      }
+      else if (cfg.output == output_mode::embed)
+      {
+         write_embed_declarations(out, payloads, cfg, working_dir);
+      }
+      else if (cfg.output == output_mode::archive)
+      {
+         const std::string declaration = fmt::format("{}static constexpr uint64_t {}[]", get_alignment_specifier(cfg), archive_variable_name);
+         streamed_array_writer(cfg).write(out, declaration, archive);
+      }
+      else if (is_sharded)
+      {
+         for (const payload& pl : payloads)
+            out << fmt::format("{}extern const uint64_t {}[];\n", get_alignment_specifier(cfg), get_variable_name(pl.m_name));
+      }
+      else if (cfg.streaming_output)
+      {
+         write_payloads_streamed(out, payloads, cfg);
+      }
+      else
+      {
+         for (const std::string& payload_string : payload_strings)
+         {
+            out << payload_string;
+         }
+      }
+   });
+   filestream.close();
+   if (replace_if_changed(temp_path, output_path) == false)
+      fmt::print("{} is unchanged, leaving it untouched.\n", cfg.output_filename);
+
+   if (cfg.report_path.empty())
+      return;
+   std::vector<bake_metrics> metrics;
+   metrics.reserve(payloads.size() + 1);
+   for (const payload& pl : payloads)
+      metrics.push_back(bake_metrics{ pl.m_name, pl.m_phase_records });
+   const uint64_t header_size = fs::file_size(output_path);
+   metrics.push_back(bake_metrics{ cfg.output_filename, { write_timer.stop(header_size, header_size) } });
+   write_report(cfg, metrics, working_dir);
+}
+
+
+auto bb::write_payloads_to_stream(
+   const config& cfg,
+   std::vector<payload>&& payloads,
+   std::ostream& out
+) -> void
+{
+   config header_cfg = cfg;
+   header_cfg.output = output_mode::header;
+   detail::add_zstd_dictionary(payloads, header_cfg);
+   check_unique_names(payloads, header_cfg);
+   const std::vector<detail::payload_alias> aliases = detail::remove_duplicates(payloads, header_cfg);
+   write_header(out, get_lookup_entries(payloads, aliases, header_cfg, {}), header_cfg, [&](std::ostream& section_out) {
+      write_payloads_streamed(section_out, payloads, header_cfg);
+   });
+}
+
+
+auto bb::write_payload_bytes(
+   payload& pl,
+   const config& cfg,
+   std::ostream& out
+) -> void
+{
+   const detail::final_payload final_pl = detail::get_final_payload(pl, cfg);
+   const std::span<const uint8_t> data = final_pl.get_data();
+   out.write(reinterpret_cast<const char*>(final_pl.m_header.data()), final_pl.m_header.size());
+   out.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+   const size_t padding_bytes = (sizeof(uint64_t) - data.size() % sizeof(uint64_t)) % sizeof(uint64_t);
+   for (size_t i = 0; i < padding_bytes; ++i)
+      out.put('\0');
+}
+
+
+auto detail::remove_duplicates(
+   std::vector<payload>& payloads,
+   const config& cfg
+) -> std::vector<payload_alias>
+{
+   if (cfg.deduplicate == false)
+      return {};
+
+   // Cached and deferred payloads aren't loaded. Their cache key already is a hash of the content and settings.
+   const auto is_unloaded = [](const payload& pl) {
+      return pl.m_is_cached || pl.m_deferred_file.has_value();
+   };
+   const int payload_count = static_cast<int>(payloads.size());
+   std::vector<std::string> encoding_strs(payload_count);
+   std::vector<uint64_t> keys(payload_count);
+   get_thread_pool(cfg.thread_count).parallel_for(payload_count, [&](const int i) {
+      const payload& pl = payloads[i];
+      if (is_unloaded(pl))
+      {
+         keys[i] = pl.m_cache_key;
+         return;
+      }
+      encoding_strs[i] = get_encoding_str(pl, cfg);
+      const uint64_t encoding_hash = get_xxh64({ reinterpret_cast<const uint8_t*>(encoding_strs[i].data()), encoding_strs[i].size() });
+      keys[i] = get_xxh64(pl.get_content(), encoding_hash);
+   });
+
+   // Loaded payloads with the same hash are compared byte by byte. Unloaded ones are matched by their 64-bit key of
+   // content and settings alone.
+   const auto is_duplicate = [&](const int a, const int b) {
+      if (is_unloaded(payloads[a]) != is_unloaded(payloads[b]))
+         return false;
+      if (is_unloaded(payloads[a]))
+         return true;
+      const std::span<const uint8_t> content_a = payloads[a].get_content();
+      const std::span<const uint8_t> content_b = payloads[b].get_content();
+      return encoding_strs[a] == encoding_strs[b]
+         && std::equal(content_a.begin(), content_a.end(), content_b.begin(), content_b.end());
+   };
+
+   std::unordered_map<uint64_t, std::vector<int>> originals_by_key;
+   std::vector<int> original_of(payload_count, -1);
+   for (int i = 0; i < payload_count; ++i)
+   {
+      std::vector<int>& originals = originals_by_key[keys[i]];
+      const auto original_it = std::find_if(originals.begin(), originals.end(), [&](const int original) {
+         return is_duplicate(original, i);
+      });
+      if (original_it == originals.end())
+         originals.push_back(i);
+      else
+         original_of[i] = *original_it;
+   }
+
+   // Unloaded payloads count with the size of the content they'll have
+   const auto get_content_size = [&](const payload& pl) -> uint64_t {
+      if (pl.m_is_cached)
+         return pl.m_cache->get_decompressed_size(pl.m_cache_key).value_or(0);
+      return get_loaded_size(pl, cfg);
+   };
+
+   std::vector<payload_alias> aliases;
+   std::vector<int> new_index(payload_count, -1);
+   std::vector<payload> remaining;
+   remaining.reserve(payloads.size());
+   size_t saved_bytes = 0;
+   for (int i = 0; i < payload_count; ++i)
+   {
+      if (original_of[i] < 0)
+      {
+         new_index[i] = static_cast<int>(remaining.size());
+         remaining.emplace_back(std::move(payloads[i]));
+         continue;
+      }
+      const int target = new_index[original_of[i]];
+      if (cfg.quiet == false)
+         fmt::print("\"{}\" is identical to \"{}\", sharing its array.\n", payloads[i].m_name, remaining[target].m_name);
+      saved_bytes += get_content_size(payloads[i]);
+      aliases.push_back(payload_alias{ payloads[i].m_name, target, i });
+   }
+   payloads = std::move(remaining);
+   if (aliases.empty() == false)
+   {
+      fmt::print(
+         "Deduplicated {} payloads, saving {} of uncompressed data.\n",
+         aliases.size(),
+         get_human_readable_size(byte_count{ saved_bytes })
+      );
+   }
+   return aliases;
+}
+
 
-   filestream << '\n';
-   write_bb_get_fun(filestream, payloads);
-   filestream << "\n} // namespace bb\n";
+auto detail::add_zstd_dictionary(
+   std::vector<payload>& payloads,
+   const config& cfg
+) -> void
+{
+   if (cfg.zstd_dictionary == false)
+      return;
+
+   const phase_timer training_timer(bake_phase::dictionary_training);
+   std::vector<int> zstd_indices;
+   std::vector<std::span<const uint8_t>> samples;
+   uint64_t sample_bytes = 0;
+   for (int i = 0; i < static_cast<int>(payloads.size()); ++i)
+   {
+      const compression_mode compression = get_file_config(cfg, payloads[i].m_name).compression;
+      if (compression != compression_mode::zstd && compression != compression_mode::automatic)
+         continue;
+      const std::span<const uint8_t> content = payloads[i].get_content();
+      zstd_indices.push_back(i);
+      samples.push_back(content.first(std::min(content.size(), max_dictionary_sample_size)));
+      sample_bytes += samples.back().size();
+   }
+   if (zstd_indices.empty())
+      return;
+
+   std::optional<zstd_dictionary> dictionary = get_trained_zstd_dictionary(samples, cfg.zstd_dictionary_size, cfg.zstd_level);
+   if (dictionary.has_value() == false)
+   {
+      fmt::print("Couldn't train a zstd dictionary from {} payloads, compressing without one.\n", zstd_indices.size());
+      return;
+   }
+   const auto shared_dictionary = std::make_shared<const zstd_dictionary>(std::move(dictionary.value()));
+   for (const int i : zstd_indices)
+      payloads[i].m_zstd_dictionary = shared_dictionary;
+
+   std::vector<uint8_t> dictionary_bytes = shared_dictionary->m_bytes;
+   payloads.insert(
+      payloads.begin(),
+      payload{ std::move(dictionary_bytes), zstd_dictionary_content{}, zstd_dictionary_payload_name }
+   );
+   payloads.front().m_phase_records.push_back(training_timer.stop(sample_bytes, shared_dictionary->m_bytes.size()));
+   fmt::print(
+      "Trained a zstd dictionary of {} from {} payloads.\n",
+      get_human_readable_size(byte_count{ shared_dictionary->m_bytes.size() }),
+      zstd_indices.size()
+   );
+}
+
+
+auto detail::get_final_payload(
+   payload& pl,
+   const config& general_cfg
+) -> final_payload
+{
+   if (pl.m_is_cached)
+   {
+      const phase_timer cache_timer(bake_phase::cache_read);
+      std::optional<final_payload> cached = pl.m_cache->load(pl.m_cache_key);
+      if (cached.has_value() == false)
+         throw std::runtime_error(fmt::format("Cache entry of {} couldn't be read", pl.m_name));
+      pl.m_phase_records.push_back(cache_timer.stop(get_final_size(cached.value()), get_final_size(cached.value())));
+      return std::move(cached.value());
+   }
+
+   load_deferred(pl, general_cfg);
+   const phase_timer compress_timer(bake_phase::compress);
+   const config cfg = get_file_config(general_cfg, pl.m_name);
+   const byte_count uncompressed_size{ pl.get_content().size() };
+   const zstd_dictionary* dictionary = pl.m_zstd_dictionary.get();
+   final_payload result;
+   result.m_compression = cfg.compression;
+   if (std::holds_alternative<zstd_dictionary_content>(pl.m_meta))
+      result.m_compression = compression_mode::none; // Needs to be usable before anything else is decoded
+   else if (cfg.compression == compression_mode::zstd && dictionary != nullptr)
+      result.m_compression = compression_mode::zstd_dictionary;
+
+   filter_params filter;
+   if (result.m_compression != compression_mode::none)
+   {
+      encoding_choice choice = get_filtered_choice(pl, cfg, result.m_compression, dictionary);
+      result.m_compression = choice.m_compression;
+      result.m_data = std::move(choice.m_bytes);
+      filter = choice.m_filter;
+   }
+
+   uint8_t version_flags = 0;
+   size_t extension_size = 0;
+   if (result.m_compression == compression_mode::none)
+   {
+      result.m_data = std::move(pl.m_content_data);
+      result.m_mapped_data = std::move(pl.m_mapped_content);
+   }
+   else
+   {
+      const config filtered_cfg = get_filtered_config(cfg, filter);
+      if (filtered_cfg.chunk_size > 0)
+      {
+         version_flags |= version_chunked;
+         extension_size = get_chunk_table_word_count(uncompressed_size.m_value, filtered_cfg) * sizeof(uint64_t);
+      }
+      if (filter.m_filter != filter_mode::none)
+         version_flags |= version_filtered;
+      pl.free_content();
+   }
+   const byte_count compressed_size{ result.get_data().size() - extension_size };
+   result.m_header = get_header_bytes(
+      pl.m_meta, result.m_compression, uncompressed_size, compressed_size, version_flags, cfg.payload_alignment, extension_size,
+      get_filter_word(filter)
+   );
+   if (pl.m_cache != nullptr)
+      pl.m_cache->store(pl.m_cache_key, result);
+   pl.m_phase_records.push_back(compress_timer.stop(uncompressed_size.m_value, get_final_size(result)));
+   return result;
 }
 
 
@@ -297,17 +1627,113 @@ auto detail::get_final_bytestream(
    const config& cfg
 ) -> std::vector<uint8_t>
 {
-   const byte_count uncompressed_size{ pl.m_content_data.size() };
-   std::vector<uint8_t> payload_bytes = get_payload_bytes(std::move(pl.m_content_data), cfg);
-   const byte_count compressed_size{ payload_bytes.size() };
+   const final_payload final_pl = get_final_payload(pl, cfg);
+   const std::span<const uint8_t> data = final_pl.get_data();
+   std::vector<uint8_t> result;
+   result.reserve(final_pl.m_header.size() + data.size());
+   result.insert(result.end(), final_pl.m_header.begin(), final_pl.m_header.end());
+   result.insert(result.end(), data.begin(), data.end());
+   return result;
+}
+
 
-   const std::array<uint8_t, 16> header_stream = get_header_bytes(pl.m_meta, cfg.compression, uncompressed_size, compressed_size);
+auto detail::get_payload_str(
+   const final_payload& final_pl,
+   const std::string& name,
+   const config& cfg
+) -> std::string
+{
+   const std::string indentation_str(cfg.indentation_size, ' ');
+   return get_payload_string(cfg, name, get_content(final_pl, indentation_str, get_words_per_line(cfg)));
+}
 
-   std::vector<uint8_t> result(16); // for header
-   result.reserve(result.size() + payload_bytes.size());
-   std::copy(header_stream.begin(), header_stream.end(), result.data());
 
-   append_moved(result, std::move(payload_bytes));
+auto detail::for_each_final_payload_within_budget(
+   std::vector<payload>& payloads,
+   const config& cfg,
+   const final_payload_fun& fun
+) -> uint64_t
+{
+   const uint64_t budget = static_cast<uint64_t>(cfg.memory_budget_mb) * 1024 * 1024;
+   const int payload_count = static_cast<int>(payloads.size());
+   std::mutex mutex;
+   std::condition_variable budget_cv;
+   uint64_t held_bytes = 0;
+   int next_index = 0; // The next payload handed to fun
+   bool is_handing_over = false; // A thread is calling fun, and it will pick up everything finished in order
+   bool has_failed = false; // Nothing is handed to fun anymore, waiting threads need to give up
+   std::vector<final_payload> final_payloads(payload_count);
+   std::vector<uint64_t> final_sizes(payload_count, 0);
+   std::vector<char> is_finished(payload_count, 0);
+   std::vector<std::string> diagnostic_strings(payload_count);
+   uint64_t peak_held_bytes = 0;
 
-   return result;
+   const auto hand_over = [&](std::unique_lock<std::mutex>& lock) {
+      is_handing_over = true;
+      while (next_index < payload_count && is_finished[next_index])
+      {
+         const int i = next_index;
+         lock.unlock();
+         if (cfg.quiet == false)
+            fmt::print("{}", diagnostic_strings[i]);
+         fun(i, final_payloads[i]);
+         final_payloads[i] = final_payload{};
+         lock.lock();
+         held_bytes -= final_sizes[i];
+         ++next_index;
+         budget_cv.notify_all();
+      }
+      is_handing_over = false;
+   };
+
+   const auto process_payload = [&](const int i) {
+      payload& pl = payloads[i];
+      try
+      {
+         const uint64_t loaded_size = get_loaded_size(pl, cfg);
+         {
+            std::unique_lock lock(mutex);
+            budget_cv.wait(lock, [&]() {
+               return has_failed || i == next_index || held_bytes + loaded_size <= budget;
+            });
+            if (has_failed)
+               return;
+            held_bytes += loaded_size;
+            peak_held_bytes = std::max(peak_held_bytes, held_bytes);
+         }
+
+         load_deferred(pl, cfg);
+         const byte_count uncompressed_size{ pl.get_content().size() };
+         final_payload final_pl = detail::get_final_payload(pl, cfg);
+         pl.free_content();
+         if (cfg.quiet == false)
+            diagnostic_strings[i] = get_diagnostics_str(pl, uncompressed_size, final_pl);
+
+         std::unique_lock lock(mutex);
+         final_sizes[i] = get_final_size(final_pl);
+         held_bytes = held_bytes - loaded_size + final_sizes[i];
+         peak_held_bytes = std::max(peak_held_bytes, held_bytes);
+         final_payloads[i] = std::move(final_pl);
+         is_finished[i] = 1;
+         if (is_handing_over == false)
+            hand_over(lock);
+      }
+      catch (...)
+      {
+         const std::lock_guard lock(mutex);
+         has_failed = true;
+         budget_cv.notify_all();
+         throw;
+      }
+   };
+   get_thread_pool(cfg.thread_count).parallel_for(payload_count, process_payload);
+   return peak_held_bytes;
+}
+
+
+auto detail::final_payload::get_data() const -> std::span<const uint8_t>
+{
+   if (m_mapped_data != nullptr)
+      return m_mapped_data->get_bytes();
+   return m_data;
 }
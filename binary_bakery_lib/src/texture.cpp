@@ -0,0 +1,427 @@
+#include <binary_bakery_lib/texture.h>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string_view>
+
+#include <binary_bakery_lib/config.h>
+#include <binary_bakery_lib/image.h>
+#include <binary_bakery_decoder.h>
+
+#include <fmt/format.h>
+
+
+namespace
+{
+
+   using namespace bb;
+
+   [[nodiscard]] auto get_texture_info(
+      const naive_image_type& meta
+   ) -> detail::texture_info
+   {
+      detail::texture_info info;
+      info.format = meta.m_format == texture_format::bc1 ? 1 : 0;
+      info.mip_count = static_cast<uint8_t>(meta.m_mip_count);
+      info.row_alignment = static_cast<uint32_t>(std::max(meta.m_row_alignment, 1));
+      return info;
+   }
+
+
+   // A channel map that is known at compile time. The loop over the pixels then has no lookups, which lets compilers
+   // vectorize it with byte shuffles.
+   template<std::array<int, 4> map>
+   struct fixed_channel_map {
+      [[nodiscard]] constexpr auto operator[](const int channel) const -> int
+      {
+         return map[channel];
+      }
+   };
+
+
+   // channel_map has the source channel of every target channel, either a std::array or a fixed_channel_map.
+   // source_bpp stands for an opaque alpha value. The channel counts are template parameters so that the loops over
+   // the channels are unrolled.
+   template<int source_bpp, int target_bpp, bool premultiply_alpha, typename channel_map_type>
+   [[nodiscard]] auto get_converted_pixels(
+      const std::span<const uint8_t> source,
+      const channel_map_type& channel_map
+   ) -> std::vector<uint8_t>
+   {
+      constexpr bool has_alpha = source_bpp == 2 || source_bpp == 4;
+      const size_t pixel_count = source.size() / source_bpp;
+      std::vector<uint8_t> result(pixel_count * target_bpp);
+      const uint8_t* source_data = source.data();
+      uint8_t* target_data = result.data();
+      for (size_t i = 0; i < pixel_count; ++i)
+      {
+         const uint8_t* source_pixel = source_data + i * source_bpp;
+         uint8_t* target_pixel = target_data + i * target_bpp;
+         for (int channel = 0; channel < target_bpp; ++channel)
+         {
+            const int source_channel = channel_map[channel];
+            int value = source_channel == source_bpp ? 255 : source_pixel[source_channel];
+            if (has_alpha && premultiply_alpha && source_channel < source_bpp - 1)
+               value = (value * source_pixel[source_bpp - 1] + 127) / 255;
+            target_pixel[channel] = static_cast<uint8_t>(value);
+         }
+      }
+      return result;
+   }
+
+
+   // The channel maps of the common settings: Unchanged or padded, red and blue swapped, grey padded to four
+   constexpr std::array<std::array<int, 4>, 3> common_channel_maps{ {
+      { 0, 1, 2, 3 },
+      { 2, 1, 0, 3 },
+      { 0, 0, 0, 1 }
+   } };
+
+
+   // Uses a fixed_channel_map if channel_map is one of the common ones, the lookups otherwise
+   template<int source_bpp, int target_bpp, bool premultiply_alpha, size_t map_index = 0>
+   [[nodiscard]] auto get_specialized_pixels(
+      const std::span<const uint8_t> source,
+      const std::array<int, 4>& channel_map
+   ) -> std::vector<uint8_t>
+   {
+      if constexpr (map_index == common_channel_maps.size())
+      {
+         return get_converted_pixels<source_bpp, target_bpp, premultiply_alpha>(source, channel_map);
+      }
+      else
+      {
+         constexpr std::array<int, 4> common_map = common_channel_maps[map_index];
+         constexpr bool fits_source = std::all_of(common_map.begin(), common_map.begin() + target_bpp, [](const int channel) {
+            return channel <= source_bpp;
+         });
+         if constexpr (fits_source)
+         {
+            if (std::equal(common_map.begin(), common_map.begin() + target_bpp, channel_map.begin()))
+               return get_converted_pixels<source_bpp, target_bpp, premultiply_alpha>(source, fixed_channel_map<common_map>{});
+         }
+         return get_specialized_pixels<source_bpp, target_bpp, premultiply_alpha, map_index + 1>(source, channel_map);
+      }
+   }
+
+
+   template<int source_bpp>
+   [[nodiscard]] auto get_converted_pixels(
+      const std::span<const uint8_t> source,
+      const int target_bpp,
+      const std::array<int, 4>& channel_map,
+      const bool premultiply_alpha
+   ) -> std::vector<uint8_t>
+   {
+      if (target_bpp == 4)
+      {
+         if (premultiply_alpha)
+            return get_specialized_pixels<source_bpp, 4, true>(source, channel_map);
+         return get_specialized_pixels<source_bpp, 4, false>(source, channel_map);
+      }
+      if (premultiply_alpha)
+         return get_specialized_pixels<source_bpp, source_bpp, true>(source, channel_map);
+      return get_specialized_pixels<source_bpp, source_bpp, false>(source, channel_map);
+   }
+
+
+   // Source channel of every channel after padding to four. Grey is copied into RGB, the alpha of grey images without
+   // one is the opaque value behind the source channels.
+   [[nodiscard]] auto get_padding_map(
+      const int bpp
+   ) -> std::array<int, 4>
+   {
+      if (bpp < 3)
+         return { 0, 0, 0, 1 };
+      return { 0, 1, 2, 3 };
+   }
+
+
+   // Tightly packed pixels of one level
+   struct level_pixels {
+      int m_width = 0;
+      int m_height = 0;
+      std::span<const uint8_t> m_bytes;
+
+      [[nodiscard]] auto get_pixel(const int x, const int y, const int bpp) const -> const uint8_t*
+      {
+         // Outside of the level, the last row or column is repeated
+         const size_t clamped_x = std::min(x, m_width - 1);
+         const size_t clamped_y = std::min(y, m_height - 1);
+         return &m_bytes[(clamped_y * m_width + clamped_x) * bpp];
+      }
+   };
+
+
+   // 2x2 box filter
+   [[nodiscard]] auto get_next_level(
+      const level_pixels& level,
+      const int bpp
+   ) -> std::vector<uint8_t>
+   {
+      const int width = std::max(level.m_width / 2, 1);
+      const int height = std::max(level.m_height / 2, 1);
+      std::vector<uint8_t> result(static_cast<size_t>(width) * height * bpp);
+      for (int y = 0; y < height; ++y)
+      {
+         for (int x = 0; x < width; ++x)
+         {
+            const uint8_t* top_left = level.get_pixel(2 * x, 2 * y, bpp);
+            const uint8_t* top_right = level.get_pixel(2 * x + 1, 2 * y, bpp);
+            const uint8_t* bottom_left = level.get_pixel(2 * x, 2 * y + 1, bpp);
+            const uint8_t* bottom_right = level.get_pixel(2 * x + 1, 2 * y + 1, bpp);
+            uint8_t* target = &result[(static_cast<size_t>(y) * width + x) * bpp];
+            for (int channel = 0; channel < bpp; ++channel)
+            {
+               const int sum = top_left[channel] + top_right[channel] + bottom_left[channel] + bottom_right[channel];
+               target[channel] = static_cast<uint8_t>((sum + 2) / 4);
+            }
+         }
+      }
+      return result;
+   }
+
+
+   [[nodiscard]] auto get_rgb565(
+      const std::array<uint8_t, 3>& rgb
+   ) -> uint16_t
+   {
+      return static_cast<uint16_t>(((rgb[0] >> 3) << 11) | ((rgb[1] >> 2) << 5) | (rgb[2] >> 3));
+   }
+
+
+   // The color a GPU decodes from a 565 endpoint
+   [[nodiscard]] auto get_expanded_rgb565(
+      const uint16_t color
+   ) -> std::array<int, 3>
+   {
+      const int r = (color >> 11) & 31;
+      const int g = (color >> 5) & 63;
+      const int b = color & 31;
+      return { (r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2) };
+   }
+
+
+   // Pixels with fewer than three channels are grey (and alpha), BC1 stores them as RGB. Alpha is dropped.
+   auto write_bc1_level(
+      const level_pixels& level,
+      const int bpp,
+      const mip_level& layout,
+      uint8_t* target
+   ) -> void
+   {
+      for (int block_y = 0; block_y < (level.m_height + 3) / 4; ++block_y)
+      {
+         for (int block_x = 0; block_x < (level.m_width + 3) / 4; ++block_x)
+         {
+            std::array<std::array<uint8_t, 3>, 16> block_pixels;
+            for (int i = 0; i < 16; ++i)
+            {
+               const uint8_t* pixel = level.get_pixel(4 * block_x + i % 4, 4 * block_y + i / 4, bpp);
+               if (bpp < 3)
+                  block_pixels[i] = { pixel[0], pixel[0], pixel[0] };
+               else
+                  block_pixels[i] = { pixel[0], pixel[1], pixel[2] };
+            }
+            const uint64_t block = get_bc1_block(block_pixels);
+            std::memcpy(target + block_y * layout.row_pitch + block_x * sizeof(block), &block, sizeof(block));
+         }
+      }
+   }
+
+} // namespace {}
+
+
+auto bb::convert_channels(
+   decoded_image& image,
+   const config& cfg
+) -> void
+{
+   if (cfg.image_pad_to_rgba == false && cfg.image_premultiply_alpha == false && cfg.image_swizzle.empty())
+      return;
+
+   const int source_bpp = image.dimensions.bpp;
+   const int target_bpp = cfg.image_pad_to_rgba ? 4 : source_bpp;
+   std::array<int, 4> channel_map{ 0, 1, 2, 3 };
+   if (cfg.image_pad_to_rgba)
+      channel_map = get_padding_map(source_bpp);
+   if (cfg.image_swizzle.empty() == false)
+   {
+      if (static_cast<int>(cfg.image_swizzle.size()) != target_bpp)
+         throw std::runtime_error(fmt::format("image_swizzle \"{}\" doesn't fit images with {} channels", cfg.image_swizzle, target_bpp));
+      const std::array<int, 4> unswizzled_map = channel_map;
+      for (int channel = 0; channel < target_bpp; ++channel)
+      {
+         const size_t swizzled_channel = std::string_view{ "rgba" }.find(cfg.image_swizzle[channel]);
+         if (swizzled_channel >= static_cast<size_t>(target_bpp))
+            throw std::runtime_error(fmt::format("image_swizzle \"{}\" uses a channel that images with {} channels don't have", cfg.image_swizzle, target_bpp));
+         channel_map[channel] = unswizzled_map[swizzled_channel];
+      }
+   }
+
+   switch (source_bpp) {
+   case 1:
+      image.bytes = get_converted_pixels<1>(image.bytes, target_bpp, channel_map, cfg.image_premultiply_alpha);
+      break;
+   case 2:
+      image.bytes = get_converted_pixels<2>(image.bytes, target_bpp, channel_map, cfg.image_premultiply_alpha);
+      break;
+   case 3:
+      image.bytes = get_converted_pixels<3>(image.bytes, target_bpp, channel_map, cfg.image_premultiply_alpha);
+      break;
+   case 4:
+      image.bytes = get_converted_pixels<4>(image.bytes, target_bpp, channel_map, cfg.image_premultiply_alpha);
+      break;
+   default:
+      throw std::runtime_error(fmt::format("Images with {} channels aren't supported", source_bpp));
+   }
+   image.dimensions.bpp = target_bpp;
+}
+
+
+auto bb::get_texture_meta(
+   const int width,
+   const int height,
+   const int bpp,
+   const config& cfg
+) -> naive_image_type
+{
+   naive_image_type result{ width, height, bpp };
+   result.m_format = cfg.image_format;
+   const int full_mip_count = get_full_mip_count(width, height);
+   result.m_mip_count = cfg.image_mip_levels <= 0 ? full_mip_count : std::min(cfg.image_mip_levels, full_mip_count);
+   result.m_row_alignment = std::max(cfg.image_row_alignment, 1);
+   return result;
+}
+
+
+auto bb::is_texture(
+   const naive_image_type& meta
+) -> bool
+{
+   return meta.m_format != texture_format::raw || meta.m_mip_count > 1 || meta.m_row_alignment > 1;
+}
+
+
+auto bb::get_full_mip_count(
+   const int width,
+   const int height
+) -> int
+{
+   const int max_dimension = std::max(width, height);
+   int result = 1;
+   while ((max_dimension >> result) > 0)
+      ++result;
+   return result;
+}
+
+
+auto bb::get_texture_word(
+   const naive_image_type& meta
+) -> uint64_t
+{
+   return std::bit_cast<uint64_t>(get_texture_info(meta));
+}
+
+
+auto bb::get_texture_byte_count(
+   const naive_image_type& meta
+) -> size_t
+{
+   const mip_level last_level = detail::get_mip_level(meta.m_width, meta.m_height, meta.m_bpp, get_texture_info(meta), meta.m_mip_count - 1);
+   return last_level.byte_offset + last_level.byte_size;
+}
+
+
+auto bb::get_texture_bytes(
+   const std::span<const uint8_t> pixels,
+   const naive_image_type& meta
+) -> std::vector<uint8_t>
+{
+   const detail::texture_info info = get_texture_info(meta);
+   std::vector<uint8_t> result(get_texture_byte_count(meta));
+
+   // Each level is filtered from the one above, so only one previous level needs to be kept
+   std::vector<uint8_t> level_storage;
+   level_pixels level{ meta.m_width, meta.m_height, pixels };
+   for (int i = 0; i < meta.m_mip_count; ++i)
+   {
+      const mip_level layout = detail::get_mip_level(meta.m_width, meta.m_height, meta.m_bpp, info, i);
+      if (i > 0)
+      {
+         level_storage = get_next_level(level, meta.m_bpp);
+         level = level_pixels{ layout.width, layout.height, level_storage };
+      }
+
+      uint8_t* level_target = &result[layout.byte_offset];
+      if (meta.m_format == texture_format::bc1)
+      {
+         write_bc1_level(level, meta.m_bpp, layout, level_target);
+         continue;
+      }
+      const size_t row_size = static_cast<size_t>(level.m_width) * meta.m_bpp;
+      for (int y = 0; y < level.m_height; ++y)
+         std::memcpy(level_target + y * layout.row_pitch, &level.m_bytes[y * row_size], row_size);
+   }
+   return result;
+}
+
+
+auto bb::get_bc1_block(
+   const std::array<std::array<uint8_t, 3>, 16>& pixels
+) -> uint64_t
+{
+   std::array<uint8_t, 3> min_color{ 255, 255, 255 };
+   std::array<uint8_t, 3> max_color{ 0, 0, 0 };
+   for (const std::array<uint8_t, 3>& pixel : pixels)
+   {
+      for (int channel = 0; channel < 3; ++channel)
+      {
+         min_color[channel] = std::min(min_color[channel], pixel[channel]);
+         max_color[channel] = std::max(max_color[channel], pixel[channel]);
+      }
+   }
+
+   // Each channel of the max color is >= the min color, so color0 > color1 unless they're equal. That selects the
+   // four-color mode. With equal endpoints, all indices stay 0.
+   const uint16_t color0 = get_rgb565(max_color);
+   const uint16_t color1 = get_rgb565(min_color);
+   uint32_t indices = 0;
+   if (color0 != color1)
+   {
+      const std::array<int, 3> endpoint0 = get_expanded_rgb565(color0);
+      const std::array<int, 3> endpoint1 = get_expanded_rgb565(color1);
+      std::array<std::array<int, 3>, 4> palette{ endpoint0, endpoint1, endpoint0, endpoint0 };
+      for (int channel = 0; channel < 3; ++channel)
+      {
+         palette[2][channel] = (2 * endpoint0[channel] + endpoint1[channel]) / 3;
+         palette[3][channel] = (endpoint0[channel] + 2 * endpoint1[channel]) / 3;
+      }
+
+      for (int i = 0; i < 16; ++i)
+      {
+         uint32_t best_index = 0;
+         int best_distance = std::numeric_limits<int>::max();
+         for (uint32_t index = 0; index < 4; ++index)
+         {
+            int distance = 0;
+            for (int channel = 0; channel < 3; ++channel)
+            {
+               const int difference = pixels[i][channel] - palette[index][channel];
+               distance += difference * difference;
+            }
+            if (distance < best_distance)
+            {
+               best_distance = distance;
+               best_index = index;
+            }
+         }
+         indices |= best_index << (2 * i);
+      }
+   }
+   return color0 | (static_cast<uint64_t>(color1) << 16) | (static_cast<uint64_t>(indices) << 32);
+}
@@ -0,0 +1,147 @@
+#include <binary_bakery_lib/thread_pool.h>
+
+#include <memory>
+
+
+namespace
+{
+
+   [[nodiscard]] auto get_sanitized_thread_count(
+      const int thread_count
+   ) -> int
+   {
+      if (thread_count > 0)
+         return thread_count;
+      const unsigned int hardware_threads = std::thread::hardware_concurrency();
+      return hardware_threads == 0 ? 1 : static_cast<int>(hardware_threads);
+   }
+
+} // namespace {}
+
+
+bb::thread_pool::thread_pool(const int thread_count)
+{
+   const int worker_count = get_sanitized_thread_count(thread_count) - 1;
+   m_workers.reserve(worker_count);
+   for (int i = 0; i < worker_count; ++i)
+      m_workers.emplace_back([this]() { worker_loop(); });
+}
+
+
+bb::thread_pool::~thread_pool()
+{
+   {
+      std::lock_guard lock(m_mutex);
+      m_stopping = true;
+   }
+   m_job_cv.notify_all();
+   for (std::thread& worker : m_workers)
+      worker.join();
+}
+
+
+auto bb::thread_pool::get_thread_count() const -> int
+{
+   return static_cast<int>(m_workers.size()) + 1;
+}
+
+
+auto bb::thread_pool::worker_loop() -> void
+{
+   uint64_t seen_generation = 0;
+   while (true)
+   {
+      std::unique_lock lock(m_mutex);
+      m_job_cv.wait(lock, [&]() { return m_stopping || m_generation != seen_generation; });
+      if (m_stopping)
+         return;
+      seen_generation = m_generation;
+
+      // The job might already be finished by the time this worker wakes up
+      if (m_job == nullptr)
+         continue;
+      const std::function<void(int)>& job = *m_job;
+      const int job_size = m_job_size;
+      ++m_busy_workers;
+      lock.unlock();
+
+      work_on(job, job_size);
+
+      lock.lock();
+      --m_busy_workers;
+      if (m_busy_workers == 0)
+         m_done_cv.notify_all();
+   }
+}
+
+
+auto bb::thread_pool::work_on(
+   const std::function<void(int)>& job,
+   const int job_size
+) -> void
+{
+   for (int i = m_next_index++; i < job_size; i = m_next_index++)
+   {
+      try
+      {
+         job(i);
+      }
+      catch (...)
+      {
+         std::lock_guard lock(m_mutex);
+         if (m_exception == nullptr)
+            m_exception = std::current_exception();
+         m_next_index = job_size;
+      }
+   }
+}
+
+
+auto bb::thread_pool::parallel_for(
+   const int count,
+   const std::function<void(int)>& fun
+) -> void
+{
+   if (count <= 0)
+      return;
+   if (m_workers.empty() || count == 1)
+   {
+      for (int i = 0; i < count; ++i)
+         fun(i);
+      return;
+   }
+
+   {
+      std::lock_guard lock(m_mutex);
+      m_job = &fun;
+      m_job_size = count;
+      m_next_index = 0;
+      m_exception = nullptr;
+      ++m_generation;
+      ++m_busy_workers; // The calling thread
+   }
+   m_job_cv.notify_all();
+
+   work_on(fun, count);
+
+   std::exception_ptr exception;
+   {
+      std::unique_lock lock(m_mutex);
+      --m_busy_workers;
+      m_done_cv.wait(lock, [&]() { return m_busy_workers == 0; });
+      m_job = nullptr;
+      exception = m_exception;
+   }
+   if (exception != nullptr)
+      std::rethrow_exception(exception);
+}
+
+
+auto bb::get_thread_pool(const int thread_count) -> thread_pool&
+{
+   static std::unique_ptr<thread_pool> pool;
+   const int sanitized_count = get_sanitized_thread_count(thread_count);
+   if (pool == nullptr || pool->get_thread_count() != sanitized_count)
+      pool = std::make_unique<thread_pool>(sanitized_count);
+   return *pool;
+}
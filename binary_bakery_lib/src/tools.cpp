@@ -1,8 +1,85 @@
 #include <binary_bakery_lib/tools.h>
 
-#include <stb_image.h>
+#include <array>
+#include <bit>
+#include <cstring>
+
 #include <fmt/format.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BB_HEX_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define BB_HEX_NEON
+#include <arm_neon.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <stdlib.h> // _byteswap_uint64
+#endif
+
+
+namespace
+{
+
+   constexpr int ui64_str_len = 18; // "0x" + 16 digits
+
+   [[nodiscard]] constexpr auto get_hex_table() -> std::array<std::array<char, 2>, 256>
+   {
+      constexpr char digits[] = "0123456789abcdef";
+      std::array<std::array<char, 2>, 256> result{};
+      for (int i = 0; i < 256; ++i)
+         result[i] = { digits[i >> 4], digits[i & 15] };
+      return result;
+   }
+   [[maybe_unused]] constexpr std::array<std::array<char, 2>, 256> hex_table = get_hex_table();
+
+
+   [[maybe_unused]] [[nodiscard]] auto get_byteswapped(const uint64_t value) -> uint64_t
+   {
+#if defined(_MSC_VER)
+      return _byteswap_uint64(value);
+#else
+      return __builtin_bswap64(value);
+#endif
+   }
+
+
+   constexpr uint64_t xxh_prime_1 = 0x9E3779B185EBCA87ull;
+   constexpr uint64_t xxh_prime_2 = 0xC2B2AE3D27D4EB4Full;
+   constexpr uint64_t xxh_prime_3 = 0x165667B19E3779F9ull;
+   constexpr uint64_t xxh_prime_4 = 0x85EBCA77C2B2AE63ull;
+   constexpr uint64_t xxh_prime_5 = 0x27D4EB2F165667C5ull;
+
+   // Little endian reads, like the reference implementation
+   template<typename T>
+   [[nodiscard]] auto read_le(const uint8_t* ptr) -> T
+   {
+      T value;
+      std::memcpy(&value, ptr, sizeof(T));
+      if constexpr (std::endian::native == std::endian::big)
+      {
+         T swapped = 0;
+         for (int i = 0; i < static_cast<int>(sizeof(T)); ++i)
+            swapped |= static_cast<T>(ptr[i]) << (8 * i);
+         value = swapped;
+      }
+      return value;
+   }
+
+   [[nodiscard]] constexpr auto xxh64_round(const uint64_t acc, const uint64_t input) -> uint64_t
+   {
+      return std::rotl(acc + input * xxh_prime_2, 31) * xxh_prime_1;
+   }
+
+   [[nodiscard]] constexpr auto xxh64_merge_round(const uint64_t acc, const uint64_t value) -> uint64_t
+   {
+      return (acc ^ xxh64_round(0, value)) * xxh_prime_1 + xxh_prime_4;
+   }
+
+} // namespace {}
+
+
 
 auto bb::get_replaced_str(
    const std::string& source,
@@ -36,17 +113,104 @@ auto bb::append_ui64_str(
    std::string& target
 ) -> void
 {
-   target += "0x";
-   for (int i = 0; i < 16; ++i)
-   {
-      const int shift_amount = 60 - 4 * i;
-      const uint64_t mask = static_cast<uint64_t>(15) << shift_amount;
-      const uint8_t part = static_cast<uint8_t>((value & mask) >> shift_amount);
-      if (part < 10)
-         target += static_cast<char>('0' + part);
+   char buffer[ui64_str_len];
+   write_ui64_str(value, buffer);
+   target.append(buffer, ui64_str_len);
+}
+
+
+auto bb::write_ui64_str(
+   const uint64_t value,
+   char* dst
+) -> char*
+{
+   dst[0] = '0';
+   dst[1] = 'x';
+
+#if defined(BB_HEX_SSE2) || defined(BB_HEX_NEON)
+   // Most significant byte first in memory, that's the order of the digits
+   const uint64_t msb_first = std::endian::native == std::endian::little ? get_byteswapped(value) : value;
+#endif
+#if defined(BB_HEX_SSE2)
+   const __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(&msb_first));
+   const __m128i low_mask = _mm_set1_epi8(0x0f);
+   const __m128i high_nibbles = _mm_and_si128(_mm_srli_epi16(bytes, 4), low_mask);
+   const __m128i low_nibbles = _mm_and_si128(bytes, low_mask);
+   const __m128i nibbles = _mm_unpacklo_epi8(high_nibbles, low_nibbles);
+
+   // '0' + nibble, plus the distance from '9'+1 to 'a' for the letters
+   const __m128i is_letter = _mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9));
+   const __m128i letter_offset = _mm_and_si128(is_letter, _mm_set1_epi8('a' - '0' - 10));
+   const __m128i chars = _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')), letter_offset);
+   _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 2), chars);
+#elif defined(BB_HEX_NEON)
+   const uint8x8_t bytes = vcreate_u8(msb_first);
+   const uint8x8_t high_nibbles = vshr_n_u8(bytes, 4);
+   const uint8x8_t low_nibbles = vand_u8(bytes, vdup_n_u8(0x0f));
+   const uint8x8x2_t zipped = vzip_u8(high_nibbles, low_nibbles);
+   const uint8x16_t nibbles = vcombine_u8(zipped.val[0], zipped.val[1]);
+   const uint8x16_t digits = vld1q_u8(reinterpret_cast<const uint8_t*>("0123456789abcdef"));
+   vst1q_u8(reinterpret_cast<uint8_t*>(dst + 2), vqtbl1q_u8(digits, nibbles));
+#else
+   for (int i = 0; i < 8; ++i)
+   {
+      const auto byte = static_cast<uint8_t>(value >> (56 - 8 * i));
+      dst[2 + 2 * i] = hex_table[byte][0];
+      dst[3 + 2 * i] = hex_table[byte][1];
+   }
+#endif
+   return dst + ui64_str_len;
+}
+
+
+auto bb::append_ui64_line(
+   std::span<const uint64_t> words,
+   const bool trailing_comma,
+   std::string& target
+) -> void
+{
+   if (words.empty())
+      return;
+
+   // Every word but the last is followed by ", "
+   const size_t old_size = target.size();
+   target.resize(old_size + words.size() * (ui64_str_len + 2));
+   char* cursor = target.data() + old_size;
+   for (size_t i = 0; i < words.size(); ++i)
+   {
+      cursor = write_ui64_str(words[i], cursor);
+      if (i + 1 < words.size())
+      {
+         cursor[0] = ',';
+         cursor[1] = ' ';
+         cursor += 2;
+      }
+   }
+   if (trailing_comma)
+      *cursor++ = ',';
+   target.resize(static_cast<size_t>(cursor - target.data()));
+}
+
+
+auto bb::get_json_escaped(
+   const std::string& str
+) -> std::string
+{
+   std::string result;
+   result.reserve(str.size());
+   for (const char ch : str)
+   {
+      if (ch == '"' || ch == '\\')
+      {
+         result += '\\';
+         result += ch;
+      }
+      else if (static_cast<unsigned char>(ch) < 0x20)
+         result += fmt::format("\\u{:04x}", static_cast<int>(ch));
       else
-         target += static_cast<char>('a' + part - 10);
+         result += ch;
    }
+   return result;
 }
 
 
@@ -67,3 +231,104 @@ auto bb::get_human_readable_size(const byte_count bytes) -> std::string
       return fmt::format("{} bytes", bytes.m_value);
    }
 }
+
+
+auto bb::get_human_readable_time(const double seconds) -> std::string
+{
+   if (seconds >= 1.0)
+      return fmt::format("{:.2f} s", seconds);
+   else if (seconds >= 1.0e-3)
+      return fmt::format("{:.2f} ms", seconds * 1.0e3);
+   else
+      return fmt::format("{:.2f} us", seconds * 1.0e6);
+}
+
+
+auto bb::matches_glob(
+   std::string_view pattern,
+   std::string_view text
+) -> bool
+{
+   // Greedy matching with backtracking to the last star, linear in practice
+   size_t pattern_pos = 0;
+   size_t text_pos = 0;
+   size_t star_pos = std::string_view::npos;
+   size_t star_text_pos = 0;
+   while (text_pos < text.size())
+   {
+      if (pattern_pos < pattern.size() && (pattern[pattern_pos] == '?' || pattern[pattern_pos] == text[text_pos]))
+      {
+         ++pattern_pos;
+         ++text_pos;
+      }
+      else if (pattern_pos < pattern.size() && pattern[pattern_pos] == '*')
+      {
+         star_pos = pattern_pos++;
+         star_text_pos = text_pos;
+      }
+      else if (star_pos != std::string_view::npos)
+      {
+         pattern_pos = star_pos + 1;
+         text_pos = ++star_text_pos;
+      }
+      else
+      {
+         return false;
+      }
+   }
+   while (pattern_pos < pattern.size() && pattern[pattern_pos] == '*')
+      ++pattern_pos;
+   return pattern_pos == pattern.size();
+}
+
+
+auto bb::get_xxh64(
+   std::span<const uint8_t> bytes,
+   const uint64_t seed
+) -> uint64_t
+{
+   const uint8_t* ptr = bytes.data();
+   const uint8_t* const end = ptr + bytes.size();
+   uint64_t hash = 0;
+   if (bytes.size() >= 32)
+   {
+      uint64_t v1 = seed + xxh_prime_1 + xxh_prime_2;
+      uint64_t v2 = seed + xxh_prime_2;
+      uint64_t v3 = seed;
+      uint64_t v4 = seed - xxh_prime_1;
+      for (; end - ptr >= 32; ptr += 32)
+      {
+         v1 = xxh64_round(v1, read_le<uint64_t>(ptr));
+         v2 = xxh64_round(v2, read_le<uint64_t>(ptr + 8));
+         v3 = xxh64_round(v3, read_le<uint64_t>(ptr + 16));
+         v4 = xxh64_round(v4, read_le<uint64_t>(ptr + 24));
+      }
+      hash = std::rotl(v1, 1) + std::rotl(v2, 7) + std::rotl(v3, 12) + std::rotl(v4, 18);
+      hash = xxh64_merge_round(hash, v1);
+      hash = xxh64_merge_round(hash, v2);
+      hash = xxh64_merge_round(hash, v3);
+      hash = xxh64_merge_round(hash, v4);
+   }
+   else
+   {
+      hash = seed + xxh_prime_5;
+   }
+   hash += bytes.size();
+
+   for (; end - ptr >= 8; ptr += 8)
+      hash = std::rotl(hash ^ xxh64_round(0, read_le<uint64_t>(ptr)), 27) * xxh_prime_1 + xxh_prime_4;
+   if (end - ptr >= 4)
+   {
+      hash = std::rotl(hash ^ (read_le<uint32_t>(ptr) * xxh_prime_1), 23) * xxh_prime_2 + xxh_prime_3;
+      ptr += 4;
+   }
+   for (; ptr < end; ++ptr)
+      hash = std::rotl(hash ^ (*ptr * xxh_prime_5), 11) * xxh_prime_1;
+
+   hash ^= hash >> 33;
+   hash *= xxh_prime_2;
+   hash ^= hash >> 29;
+   hash *= xxh_prime_3;
+   hash ^= hash >> 32;
+   return hash;
+}
@@ -0,0 +1,96 @@
+#include <doctest/doctest.h>
+
+#include <binary_bakery_lib/cache.h>
+#include <binary_bakery_lib/config.h>
+#include <binary_bakery_lib/payload.h>
+#include <binary_bakery_testpaths.h>
+
+using namespace bb;
+
+
+TEST_CASE("get_cache_key()")
+{
+   const abs_file_path tga_file{ testRoot / "test_images/tga_image.tga" };
+   const abs_file_path bmp_file{ testRoot / "test_images/bmp_image.bmp" };
+   config cfg{};
+   const uint64_t key = get_cache_key(tga_file, cfg);
+   CHECK_EQ(get_cache_key(tga_file, cfg), key);
+   CHECK_NE(get_cache_key(bmp_file, cfg), key);
+
+   // Settings that don't change the final payload don't change the key either
+   cfg.max_columns = 50;
+   CHECK_EQ(get_cache_key(tga_file, cfg), key);
+
+   cfg.compression = compression_mode::zstd;
+   CHECK_NE(get_cache_key(tga_file, cfg), key);
+   const uint64_t zstd_key = get_cache_key(tga_file, cfg);
+   cfg.compression_overrides.push_back({ "*.tga", compression_mode::zstd, 19, false, 0 });
+   CHECK_NE(get_cache_key(tga_file, cfg), zstd_key);
+}
+
+
+TEST_CASE("payload_cache::get_key()")
+{
+   const fs::path cache_dir = fs::temp_directory_path() / "bb_cache_key_tests";
+   const fs::path path = fs::temp_directory_path() / "bb_cache_key_test.bin";
+   const std::vector<uint8_t> bytes{ 1, 2, 3, 4 };
+   write_binary_file(path, bytes);
+   const abs_file_path file{ path };
+   const payload_cache cache(cache_dir);
+   config cfg{};
+   CHECK_EQ(cache.get_key(file, cfg), get_cache_key(file, cfg));
+   CHECK_EQ(cache.get_key(file, cfg), get_cache_key(file, cfg));
+
+   // The remembered hash doesn't hide settings or content changes
+   cfg.compression = compression_mode::zstd;
+   CHECK_EQ(cache.get_key(file, cfg), get_cache_key(file, cfg));
+   write_binary_file(path, std::vector<uint8_t>{ 1, 2, 3, 4, 5 });
+   CHECK_EQ(cache.get_key(file, cfg), get_cache_key(file, cfg));
+
+   fs::remove(path);
+   fs::remove_all(cache_dir);
+}
+
+
+TEST_CASE("payload_cache")
+{
+   const fs::path cache_dir = fs::temp_directory_path() / "bb_cache_tests";
+   fs::remove_all(cache_dir);
+   const auto cache = std::make_shared<const payload_cache>(cache_dir);
+
+   const std::vector<abs_file_path> files{
+      abs_file_path{ testRoot / "test_images/tga_image.tga" },
+      abs_file_path{ testRoot / "test_images/binary0.bin" }
+   };
+   config cfg{};
+   cfg.compression = compression_mode::lz4;
+   cfg.chunk_size = 1024;
+
+   std::vector<payload> first_run = get_payloads(files, cfg, cache);
+   REQUIRE_EQ(first_run.size(), 2);
+   CHECK_FALSE(first_run[0].m_is_cached);
+   const std::vector<uint8_t> expected = detail::get_final_bytestream(first_run[0], cfg);
+   CHECK(cache->contains(first_run[0].m_cache_key));
+
+   // Only the first file was written to the cache
+   std::vector<payload> second_run = get_payloads(files, cfg, cache);
+   CHECK(second_run[0].m_is_cached);
+   CHECK(second_run[0].get_content().empty());
+   CHECK_FALSE(second_run[1].m_is_cached);
+   CHECK_EQ(detail::get_final_bytestream(second_run[0], cfg), expected);
+
+   // Different settings are different entries
+   cfg.lz4_level = 9;
+   std::vector<payload> hc_run = get_payloads(files, cfg, cache);
+   CHECK_FALSE(hc_run[0].m_is_cached);
+
+   // Entries with a padded header
+   cfg.payload_alignment = 64;
+   std::vector<payload> aligned_run = get_payloads(files, cfg, cache);
+   const std::vector<uint8_t> aligned_expected = detail::get_final_bytestream(aligned_run[0], cfg);
+   std::vector<payload> aligned_cached_run = get_payloads(files, cfg, cache);
+   CHECK(aligned_cached_run[0].m_is_cached);
+   CHECK_EQ(detail::get_final_bytestream(aligned_cached_run[0], cfg), aligned_expected);
+
+   fs::remove_all(cache_dir);
+}
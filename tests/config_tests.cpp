@@ -22,4 +22,40 @@ TEST_CASE("get_cfg_from_file()")
    CHECK_EQ(cfg.output_filename, "123.h");
    CHECK_EQ(cfg.compression, compression_mode::zstd);
    CHECK_EQ(cfg.image_loading_direction, image_vertical_direction::top_to_bottom);
+   CHECK_EQ(cfg.image_format, texture_format::bc1);
+   CHECK_EQ(cfg.image_mip_levels, 0);
+   CHECK_EQ(cfg.image_row_alignment, 256);
+   CHECK_EQ(cfg.thread_count, 2);
+   CHECK_EQ(cfg.output, output_mode::incbin);
+   CHECK_EQ(cfg.chunk_size, 4096);
+   CHECK_EQ(cfg.zstd_level, 19);
+   CHECK_EQ(cfg.input_include, std::vector<std::string>{ "*.png", "*.Tga" });
+   CHECK_EQ(cfg.input_exclude, std::vector<std::string>{ "red.png" });
+
+   REQUIRE_EQ(cfg.compression_overrides.size(), 1);
+   const compression_override& comp_override = cfg.compression_overrides[0];
+   CHECK_EQ(comp_override.pattern, "*.PNG");
+   CHECK_EQ(comp_override.compression, compression_mode::lz4);
+   CHECK_EQ(comp_override.lz4_level, 9);
+   CHECK_EQ(comp_override.zstd_level, 19); // Inherited
+}
+
+
+TEST_CASE("get_file_config()")
+{
+   config cfg;
+   cfg.compression = compression_mode::zstd;
+   cfg.compression_overrides.push_back({ "*.png", compression_mode::lz4, 3, false, 9 });
+   cfg.compression_overrides.push_back({ "test_image_*.png", compression_mode::none, 3, false, 0 });
+
+   const config bin_cfg = get_file_config(cfg, "binary0.bin");
+   CHECK_EQ(bin_cfg.compression, compression_mode::zstd);
+
+   const config png_cfg = get_file_config(cfg, "green.png");
+   CHECK_EQ(png_cfg.compression, compression_mode::lz4);
+   CHECK_EQ(png_cfg.lz4_level, 9);
+
+   // The last match wins
+   const config rgb_cfg = get_file_config(cfg, "test_image_rgb.png");
+   CHECK_EQ(rgb_cfg.compression, compression_mode::none);
 }
@@ -0,0 +1,176 @@
+#include <doctest/doctest.h>
+
+#define BAKERY_PROVIDE_ARCHIVE_LOADER
+#include "decoding_tools.h"
+#include <binary_bakery_testpaths.h>
+
+#include <binary_bakery_lib/config.h>
+#include <binary_bakery_lib/file_tools.h>
+#include <binary_bakery_lib/payload.h>
+
+
+using namespace bb;
+
+
+namespace
+{
+
+   // Words of an archive with the single binary0.bin payload
+   auto get_archive_words(
+      config cfg,
+      const std::string& name
+   ) -> std::vector<uint64_t>
+   {
+      cfg.output = output_mode::archive;
+      cfg.output_filename = name + ".h";
+      cfg.archive_path = name + ".bba";
+      const abs_directory_path output_dir{ fs::temp_directory_path() };
+      write_payloads_to_file(cfg, get_payloads({ abs_file_path{ testRoot / "test_images/binary0.bin" } }, cfg), output_dir);
+      const std::vector<uint8_t> bytes = get_binary_file(abs_file_path{ output_dir.get_path() / cfg.archive_path });
+      std::vector<uint64_t> words(bytes.size() / sizeof(uint64_t));
+      std::memcpy(words.data(), bytes.data(), words.size() * sizeof(uint64_t));
+      return words;
+   }
+
+
+   auto is_valid_archive(
+      const std::vector<uint64_t>& words
+   ) -> bool
+   {
+      const fs::path path = fs::temp_directory_path() / "bb_broken_archive_test.bba";
+      write_binary_file(path, std::span(reinterpret_cast<const uint8_t*>(words.data()), words.size() * sizeof(uint64_t)));
+      const bool result = mapped_archive(path.string().c_str()).is_valid();
+      fs::remove(path);
+      return result;
+   }
+
+
+   // Changes the second header word of the first payload, together with its copy in the index
+   auto set_size_word(
+      std::vector<uint64_t>& words,
+      const uint64_t size_word
+   ) -> void
+   {
+      words[words[archive_index_word_offset + 1] / sizeof(uint64_t) + 1] = size_word;
+      words[archive_index_word_offset + 3] = size_word;
+   }
+
+} // namespace {}
+
+
+namespace tests {
+
+   TEST_CASE("mapped archive")
+   {
+      bb::error_callback = nullptr;
+      config cfg;
+      cfg.output = output_mode::archive;
+      cfg.output_filename = "bb_mapped_archive_test.h";
+      cfg.archive_path = "bb_mapped_archive_test.bba";
+      cfg.compression = compression_mode::lz4;
+      const abs_file_path binary_file{ testRoot / "test_images/binary0.bin" };
+      const abs_directory_path output_dir{ fs::temp_directory_path() };
+      write_payloads_to_file(cfg, get_payloads({ binary_file }, cfg), output_dir);
+
+      const mapped_archive archive((output_dir.get_path() / cfg.archive_path).string().c_str());
+      REQUIRE(archive.is_valid());
+      CHECK_EQ(archive.get_entry_count(), 1);
+      CHECK_EQ(archive.get_payload("missing.bin"), nullptr);
+      const uint64_t* payload_ptr = archive.get_payload("binary0.bin");
+      REQUIRE_NE(payload_ptr, nullptr);
+      CHECK_EQ(payload_ptr, archive.get_payload(0));
+      CHECK_LE(get_payload_size(payload_ptr), archive.size());
+
+      archive.prefetch("binary0.bin");
+      CHECK_EQ(decode_to_vector<uint8_t>(payload_ptr, lz4_decompression), get_binary_file(binary_file));
+      archive.release(payload_ptr);
+      CHECK_EQ(get_header(payload_ptr).compression, 2);
+
+      const mapped_archive not_an_archive((testRoot / "test_images/binary0.bin").string().c_str());
+      CHECK_FALSE(not_an_archive.is_valid());
+   }
+
+
+   TEST_CASE("truncated archive")
+   {
+      bb::error_callback = nullptr;
+      const std::vector<uint64_t> words = get_archive_words(config{}, "bb_truncated_archive_test");
+      CHECK(is_valid_archive(words));
+
+      // Cut off in the middle of the payload, with and without the archive size matching the file
+      std::vector<uint64_t> truncated(words.begin(), words.end() - 2);
+      CHECK_FALSE(is_valid_archive(truncated));
+      truncated[2] = truncated.size() * sizeof(uint64_t);
+      CHECK_FALSE(is_valid_archive(truncated));
+
+      // Only the index is left
+      const size_t payload_offset = words[archive_index_word_offset + 1];
+      truncated.assign(words.begin(), words.begin() + payload_offset / sizeof(uint64_t) + 1);
+      truncated[2] = truncated.size() * sizeof(uint64_t);
+      CHECK_FALSE(is_valid_archive(truncated));
+
+      // Offsets that aren't aligned or point into the index or beyond the end
+      for (const uint64_t offset : { payload_offset + 4, uint64_t{ 0 }, uint64_t{ words.size() * sizeof(uint64_t) } })
+      {
+         std::vector<uint64_t> corrupt = words;
+         corrupt[archive_index_word_offset + 1] = offset;
+         CHECK_FALSE(is_valid_archive(corrupt));
+      }
+   }
+
+
+   TEST_CASE("corrupt archive sizes")
+   {
+      bb::error_callback = nullptr;
+      const auto get_size_word = [](const uint32_t decompressed_size, const uint32_t compressed_size) {
+         return std::bit_cast<uint64_t>(std::array<uint32_t, 2>{ decompressed_size, compressed_size });
+      };
+
+      // Uncompressed payloads are copied with their decompressed size, which has to be the stored size
+      const std::vector<uint64_t> words = get_archive_words(config{}, "bb_corrupt_archive_test");
+      REQUIRE(is_valid_archive(words));
+      const uint64_t* payload = &words[words[archive_index_word_offset + 1] / sizeof(uint64_t)];
+      REQUIRE_EQ(get_header(payload).compression, 0);
+      const uint32_t size = static_cast<uint32_t>(get_compressed_size(payload));
+      std::vector<uint64_t> corrupt = words;
+      set_size_word(corrupt, get_size_word(size + 8, size));
+      CHECK_FALSE(is_valid_archive(corrupt));
+      set_size_word(corrupt, get_size_word(size - 8, size));
+      CHECK_FALSE(is_valid_archive(corrupt));
+   }
+
+
+   TEST_CASE("corrupt archive chunk tables")
+   {
+      bb::error_callback = nullptr;
+      config cfg;
+      cfg.compression = compression_mode::lz4;
+      cfg.chunk_size = 100;
+      const std::vector<uint64_t> words = get_archive_words(cfg, "bb_chunked_archive_test");
+      REQUIRE(is_valid_archive(words));
+      const size_t payload_word = words[archive_index_word_offset + 1] / sizeof(uint64_t);
+      REQUIRE_EQ(get_chunk_count(&words[payload_word]), 3);
+      const size_t table_word = payload_word + detail::get_chunk_table_word_offset(&words[payload_word]);
+      const auto get_corrupted = [&](const size_t word_offset, const uint64_t value) {
+         std::vector<uint64_t> corrupt = words;
+         corrupt[table_word + word_offset] = value;
+         return corrupt;
+      };
+      const auto get_sizes_word = [](const uint32_t chunk_size, const uint32_t chunk_count) {
+         return std::bit_cast<uint64_t>(std::array<uint32_t, 2>{ chunk_size, chunk_count });
+      };
+
+      // Chunk size of zero, and chunk counts that don't match the decompressed size
+      CHECK_FALSE(is_valid_archive(get_corrupted(0, get_sizes_word(0, 3))));
+      CHECK_FALSE(is_valid_archive(get_corrupted(0, get_sizes_word(100, 2))));
+      CHECK_FALSE(is_valid_archive(get_corrupted(0, get_sizes_word(200, 3))));
+
+      // Offsets that don't start at zero, go backwards or don't end at the compressed size
+      const uint64_t compressed_size = get_compressed_size(&words[payload_word]);
+      CHECK_FALSE(is_valid_archive(get_corrupted(1, 8)));
+      CHECK_FALSE(is_valid_archive(get_corrupted(2, compressed_size + 8)));
+      CHECK_FALSE(is_valid_archive(get_corrupted(4, compressed_size - 1)));
+      CHECK_FALSE(is_valid_archive(get_corrupted(4, compressed_size + 1)));
+   }
+
+}
@@ -0,0 +1,99 @@
+#include <doctest/doctest.h>
+
+#include <thread>
+
+#define BAKERY_PROVIDE_DECODE_CACHE
+#include "decoding_tools.h"
+#include <binary_bakery_testpaths.h>
+
+#include <binary_bakery_lib/config.h>
+#include <binary_bakery_lib/file_tools.h>
+#include <binary_bakery_lib/payload.h>
+
+
+using namespace bb;
+
+namespace {
+
+   auto get_baked_payload(
+      const abs_file_path& source_file,
+      const compression_mode compression
+   ) -> std::vector<uint64_t>
+   {
+      config cfg{};
+      cfg.compression = compression;
+      return tests::get_baked_words(get_payload(source_file, cfg), cfg);
+   }
+
+
+   auto get_bytes(const decoded_payload& decoded) -> std::vector<uint8_t>
+   {
+      return std::vector<uint8_t>(decoded.data(), decoded.data() + decoded.size());
+   }
+
+} // namespace {}
+
+
+namespace tests {
+
+   TEST_CASE("decode_cache")
+   {
+      const abs_file_path source_file{ testRoot / "test_images/binary0.bin" };
+      const std::vector<uint8_t> expected = get_binary_file(source_file);
+      const std::vector<uint64_t> zstd_payload = get_baked_payload(source_file, compression_mode::zstd);
+      const std::vector<uint64_t> lz4_payload = get_baked_payload(source_file, compression_mode::lz4);
+      const std::vector<uint64_t> uncompressed_payload = get_baked_payload(source_file, compression_mode::none);
+
+      SUBCASE("decodes once")
+      {
+         decode_cache cache;
+         const decoded_payload first = cache.get(zstd_payload.data());
+         const decoded_payload second = cache.get(zstd_payload.data());
+         CHECK_EQ(get_bytes(first), expected);
+         CHECK_EQ(first.data(), second.data());
+         CHECK_EQ(first.get_element_count<uint32_t>(), 64);
+         CHECK_EQ(cache.get_memory_use(), 256);
+
+         cache.clear();
+         CHECK_EQ(cache.get_memory_use(), 0);
+         CHECK_EQ(get_bytes(first), expected);
+      }
+
+      SUBCASE("uncompressed payloads stay in place")
+      {
+         decode_cache cache;
+         const decoded_payload decoded = cache.get(uncompressed_payload.data());
+         CHECK_EQ(static_cast<const void*>(decoded.data()), get_data_ptr(uncompressed_payload.data()));
+         CHECK_EQ(decoded.size(), 256);
+         CHECK_EQ(cache.get_memory_use(), 0);
+      }
+
+      SUBCASE("memory budget")
+      {
+         decode_cache cache(300);
+         const decoded_payload zstd_decoded = cache.get(zstd_payload.data());
+         const decoded_payload lz4_decoded = cache.get(lz4_payload.data());
+         CHECK_EQ(cache.get_memory_use(), 256);
+
+         // The zstd payload was dropped from the cache, but its bytes are still alive
+         CHECK_EQ(get_bytes(zstd_decoded), expected);
+         CHECK_EQ(cache.get(lz4_payload.data()).data(), lz4_decoded.data());
+         CHECK_NE(cache.get(zstd_payload.data()).data(), zstd_decoded.data());
+      }
+
+      SUBCASE("concurrent first access")
+      {
+         decode_cache cache;
+         std::vector<const uint8_t*> pointers(8);
+         std::vector<std::thread> threads;
+         for (int i = 0; i < 8; ++i)
+            threads.emplace_back([&, i]() { pointers[i] = cache.get(lz4_payload.data()).data(); });
+         for (std::thread& thread : threads)
+            thread.join();
+         for (const uint8_t* pointer : pointers)
+            CHECK_EQ(pointer, pointers[0]);
+         CHECK_EQ(cache.get_memory_use(), 256);
+      }
+   }
+
+}
@@ -0,0 +1,136 @@
+#include <doctest/doctest.h>
+
+#include <atomic>
+#include <thread>
+
+#define BAKERY_PROVIDE_CONSTEXPR_LZ4
+#include "decoding_tools.h"
+#include <binary_bakery_testpaths.h>
+
+#include <binary_bakery_lib/config.h>
+#include <binary_bakery_lib/file_tools.h>
+#include <binary_bakery_lib/payload.h>
+
+
+using namespace bb;
+
+namespace {
+
+   // Copied into words, the decoder wants an uint64_t aligned payload
+   auto get_chunked_payload(
+      const abs_file_path& source_file,
+      const compression_mode compression,
+      const int chunk_size
+   ) -> std::vector<uint64_t>
+   {
+      config cfg{};
+      cfg.compression = compression;
+      cfg.chunk_size = chunk_size;
+      return tests::get_baked_words(get_payload(source_file, cfg), cfg);
+   }
+
+
+   auto get_range(
+      const uint64_t* source,
+      const size_t byte_offset,
+      const size_t byte_count,
+      decompression_fun_type decomp_fun
+   ) -> std::vector<uint8_t>
+   {
+      std::vector<uint8_t> result(byte_count);
+      decode_range(source, byte_offset, byte_count, result.data(), decomp_fun);
+      return result;
+   }
+
+} // namespace {}
+
+
+namespace tests {
+
+   TEST_CASE("chunked payloads")
+   {
+      const abs_file_path source_file{ testRoot / "test_images/binary0.bin" };
+      const std::vector<uint8_t> expected = get_binary_file(source_file);
+      REQUIRE_EQ(expected.size(), 256);
+
+      const auto test_compression = [&](const compression_mode compression, decompression_fun_type decomp_fun) {
+         const std::vector<uint64_t> payload = get_chunked_payload(source_file, compression, 100);
+         const uint64_t* source = payload.data();
+         CHECK(get_header(source).version & version_chunked);
+         CHECK_EQ(get_chunk_count(source), 3);
+         CHECK_EQ(get_chunk_size(source), 100);
+         CHECK_EQ(get_decode_into_pointer_result(source, decomp_fun), expected);
+         CHECK_EQ(decode_to_vector<uint8_t>(source, decomp_fun), expected);
+
+         // Inside one chunk, across chunk borders, whole chunks and the short last chunk
+         const std::pair<size_t, size_t> ranges[]{ {0, 256}, {10, 20}, {90, 20}, {100, 100}, {50, 200}, {200, 56}, {255, 1}, {7, 0} };
+         for (const auto& [offset, count] : ranges)
+         {
+            const std::vector<uint8_t> slice(expected.begin() + offset, expected.begin() + offset + count);
+            CHECK_EQ(get_range(source, offset, count, decomp_fun), slice);
+         }
+      };
+      SUBCASE("zstd") { test_compression(compression_mode::zstd, zstd_decompression); }
+      SUBCASE("lz4") { test_compression(compression_mode::lz4, lz4_decompression); }
+   }
+
+
+   TEST_CASE("decode_to_array() with LZ4 chunks")
+   {
+      const abs_file_path source_file{ testRoot / "test_images/binary0.bin" };
+      const std::vector<uint8_t> expected = get_binary_file(source_file);
+      const std::vector<uint64_t> payload = get_chunked_payload(source_file, compression_mode::lz4, 100);
+      REQUIRE_EQ(get_chunk_count(payload.data()), 3);
+
+      const std::array<uint8_t, 256> bytes = decode_to_array<uint8_t, 256>(payload.data());
+      CHECK_EQ(std::vector<uint8_t>(bytes.begin(), bytes.end()), expected);
+
+      // Stops inside the second chunk
+      const std::array<uint8_t, 150> prefix = decode_to_array<uint8_t, 150>(payload.data());
+      CHECK_EQ(std::vector<uint8_t>(prefix.begin(), prefix.end()), std::vector<uint8_t>(expected.begin(), expected.begin() + 150));
+   }
+
+
+   TEST_CASE("decode_range() without chunks")
+   {
+      const abs_file_path source_file{ testRoot / "test_images/binary0.bin" };
+      const std::vector<uint8_t> expected = get_binary_file(source_file);
+      const std::vector<uint8_t> slice(expected.begin() + 30, expected.begin() + 70);
+
+      const std::vector<uint64_t> uncompressed = get_chunked_payload(source_file, compression_mode::none, 100);
+      CHECK_EQ(get_header(uncompressed.data()).version, 0);
+      CHECK_EQ(get_chunk_count(uncompressed.data()), 1);
+      CHECK_EQ(get_range(uncompressed.data(), 30, 40, nullptr), slice);
+
+      const std::vector<uint64_t> single_frame = get_chunked_payload(source_file, compression_mode::zstd, 0);
+      CHECK_EQ(get_chunk_count(single_frame.data()), 1);
+      CHECK_EQ(get_range(single_frame.data(), 30, 40, zstd_decompression), slice);
+   }
+
+}
+
+
+namespace tests {
+
+   TEST_CASE("decode_into_pointer_parallel()")
+   {
+      const abs_file_path source_file{ testRoot / "test_images/tga_image.tga" };
+      const std::vector<uint8_t> expected = get_image_bytes(source_file);
+      const std::vector<uint64_t> payload = get_chunked_payload(source_file, compression_mode::lz4, 4096);
+      REQUIRE_GT(get_chunk_count(payload.data()), 1);
+
+      std::atomic<int> task_count = 0;
+      const auto executor = [&](const int chunk_count, const auto& task) {
+         std::vector<std::thread> threads;
+         for (int i = 0; i < chunk_count; ++i)
+            threads.emplace_back([&, i]() { task(i); ++task_count; });
+         for (std::thread& thread : threads)
+            thread.join();
+      };
+      std::vector<uint8_t> result(get_decompressed_size(payload.data()));
+      decode_into_pointer_parallel(payload.data(), result.data(), executor, lz4_decompression);
+      CHECK_EQ(result, expected);
+      CHECK_EQ(task_count.load(), get_chunk_count(payload.data()));
+   }
+
+}
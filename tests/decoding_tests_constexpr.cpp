@@ -19,4 +19,64 @@ namespace tests {
       static_assert(bb::get_element<nc_test_rgb>(ptr, 3) == nc_test_rgb{ 0, 0, 0 });
    }
 
+
+   TEST_CASE("get_elements()")
+   {
+      constexpr const uint64_t* ptr = bb::get_payload("test_image_rgb.png");
+      constexpr std::array<nc_test_rgb, 6> pixels = bb::get_elements<nc_test_rgb, 6>(ptr, 0);
+      static_assert(pixels[0] == nc_test_rgb{ 255, 0, 0 });
+      static_assert(pixels[5] == bb::get_element<nc_test_rgb>(ptr, 5));
+      static_assert(bb::get_elements<nc_test_rgb, 2>(ptr, 1)[1] == nc_test_rgb{ 0, 0, 255 });
+      static_assert(bb::get_elements<uint8_t, 18>(ptr, 0)[17] == bb::get_element<uint8_t>(ptr, 17));
+   }
+
+
+   // Both accessors build the same checksum over repeated queries. The repetitions stay within the default constexpr
+   // step limits of all compilers, the bench target times this with many more.
+   template<int repetitions>
+   constexpr auto get_single_checksum(const uint64_t* ptr) -> uint64_t
+   {
+      uint64_t checksum = 0;
+      for (int i = 0; i < repetitions; ++i)
+         for (int j = 0; j < 18; ++j)
+            checksum = checksum * 31 + bb::get_element<uint8_t>(ptr, j);
+      return checksum;
+   }
+
+   template<int repetitions>
+   constexpr auto get_bulk_checksum(const uint64_t* ptr) -> uint64_t
+   {
+      uint64_t checksum = 0;
+      for (int i = 0; i < repetitions; ++i)
+         for (const uint8_t byte : bb::get_elements<uint8_t, 18>(ptr, 0))
+            checksum = checksum * 31 + byte;
+      return checksum;
+   }
+
+   TEST_CASE("repeated constexpr lookups")
+   {
+      constexpr const uint64_t* ptr = bb::get_payload("test_image_rgb.png");
+      static_assert(get_bulk_checksum<50>(ptr) == get_single_checksum<50>(ptr));
+   }
+
+
+   TEST_CASE("get_view(), constexpr")
+   {
+      constexpr const uint64_t* ptr = bb::get_payload("test_image_rgb.png");
+      constexpr bb::view<nc_test_rgb> pixels = bb::get_view<nc_test_rgb>(ptr);
+      static_assert(pixels.size() == 6);
+      static_assert(pixels[0] == nc_test_rgb{ 255, 0, 0 });
+      static_assert(pixels[2] == nc_test_rgb{ 0, 0, 255 });
+      static_assert(*pixels.begin() == pixels[0]);
+   }
+
+
+   TEST_CASE("get_payload()")
+   {
+      static_assert(bb::get_payload("test_image_rgb.png") == bb::get_payload(payload_id::bb_test_image_rgb_png));
+      static_assert(bb::get_payload("doesnt_exist.png") == nullptr);
+      static_assert(bb::get_payload("") == nullptr);
+      static_assert(payload_count == 1);
+   }
+
 }
@@ -0,0 +1,91 @@
+#include <doctest/doctest.h>
+
+#define BAKERY_PROVIDE_PAGE_HINTS
+#include "decoding_tools.h"
+#include <binary_bakery_testpaths.h>
+
+#include <binary_bakery_lib/config.h>
+#include <binary_bakery_lib/content_meta.h>
+#include <binary_bakery_lib/file_tools.h>
+#include <binary_bakery_lib/payload.h>
+
+
+using namespace bb;
+
+namespace {
+
+   auto get_baked_payload(
+      const abs_file_path& source_file,
+      const compression_mode compression
+   ) -> std::vector<uint64_t>
+   {
+      config cfg{};
+      cfg.compression = compression;
+      return tests::get_baked_words(get_payload(source_file, cfg), cfg);
+   }
+
+
+   // Uncompressed payload above page_hint_threshold
+   auto get_big_payload(const size_t size) -> std::vector<uint64_t>
+   {
+      const std::vector<uint8_t> header_bytes = get_header_bytes(generic_binary{}, compression_mode::none, byte_count{ size }, byte_count{ size });
+      std::vector<uint64_t> words((header_bytes.size() + size) / sizeof(uint64_t));
+      std::memcpy(words.data(), header_bytes.data(), header_bytes.size());
+      uint8_t* data = reinterpret_cast<uint8_t*>(words.data()) + header_bytes.size();
+      for (size_t i = 0; i < size; ++i)
+         data[i] = static_cast<uint8_t>(i * 7);
+      return words;
+   }
+
+} // namespace {}
+
+
+namespace tests {
+
+   TEST_CASE("decode without value-initialization")
+   {
+      const abs_file_path source_file{ testRoot / "test_images/binary0.bin" };
+      const std::vector<uint8_t> expected = get_binary_file(source_file);
+      const std::vector<uint64_t> zstd_payload = get_baked_payload(source_file, compression_mode::zstd);
+      const std::vector<uint64_t> uncompressed_payload = get_baked_payload(source_file, compression_mode::none);
+
+      const std::vector<uint8_t, default_init_allocator<uint8_t>> decoded = decode_to_vector<uint8_t, default_init_allocator<uint8_t>>(zstd_payload.data());
+      CHECK(std::equal(decoded.begin(), decoded.end(), expected.begin(), expected.end()));
+
+      const std::unique_ptr<uint8_t[]> from_zstd = decode_to_unique_ptr<uint8_t>(zstd_payload.data());
+      REQUIRE(from_zstd != nullptr);
+      CHECK(std::equal(from_zstd.get(), from_zstd.get() + expected.size(), expected.begin()));
+
+      const std::unique_ptr<uint32_t[]> from_uncompressed = decode_to_unique_ptr<uint32_t>(uncompressed_payload.data(), decompression_table{});
+      REQUIRE(from_uncompressed != nullptr);
+      CHECK_EQ(std::memcmp(from_uncompressed.get(), expected.data(), expected.size()), 0);
+   }
+
+
+   TEST_CASE("decode_to_pages()")
+   {
+      // Small destinations are allocated normally
+      const abs_file_path source_file{ testRoot / "test_images/binary0.bin" };
+      const std::vector<uint8_t> expected = get_binary_file(source_file);
+      const page_buffer small = decode_to_pages(get_baked_payload(source_file, compression_mode::lz4).data(), page_huge | page_populate);
+      CHECK_FALSE(small.is_mapped());
+      REQUIRE_EQ(small.size(), expected.size());
+      CHECK(std::equal(small.data(), small.data() + small.size(), expected.begin()));
+
+      const size_t big_size = 3 * page_hint_threshold;
+      const std::vector<uint64_t> big_payload = get_big_payload(big_size);
+      const uint8_t* big_data = static_cast<const uint8_t*>(get_data_ptr(big_payload.data()));
+      for (const int page_flags : { 0, page_huge, page_populate, page_huge | page_populate })
+      {
+         page_buffer big = decode_to_pages(big_payload.data(), page_flags);
+         REQUIRE_EQ(big.size(), big_size);
+         CHECK_EQ(std::memcmp(big.data(), big_data, big_size), 0);
+
+         // Moves hand over the memory
+         const page_buffer moved = std::move(big);
+         CHECK_EQ(big.data(), nullptr);
+         CHECK_EQ(std::memcmp(moved.data(), big_data, big_size), 0);
+      }
+   }
+
+}
@@ -0,0 +1,171 @@
+#include <doctest/doctest.h>
+
+#include "decoding_tools.h"
+#include <binary_bakery_testpaths.h>
+
+#include <binary_bakery_lib/config.h>
+#include <binary_bakery_lib/content_meta.h>
+#include <binary_bakery_lib/file_tools.h>
+#include <binary_bakery_lib/payload.h>
+
+
+using namespace bb;
+
+namespace {
+
+   auto get_header_words(const std::vector<uint8_t>& header_bytes) -> std::vector<uint64_t>
+   {
+      std::vector<uint64_t> words(header_bytes.size() / sizeof(uint64_t));
+      std::memcpy(words.data(), header_bytes.data(), header_bytes.size());
+      return words;
+   }
+
+
+   // Bakes the file and swaps the header for one with version_extended_sizes, like a payload over 4 GB would have
+   auto get_extended_payload(
+      const abs_file_path& source_file,
+      const compression_mode compression,
+      const int chunk_size
+   ) -> std::vector<uint64_t>
+   {
+      config cfg{};
+      cfg.compression = compression;
+      cfg.chunk_size = chunk_size;
+      payload pl = get_payload(source_file, cfg);
+      const detail::final_payload final_pl = detail::get_final_payload(pl, cfg);
+      const header head = get_header(reinterpret_cast<const uint64_t*>(final_pl.m_header.data()));
+      const std::vector<uint8_t> extended_header = get_header_bytes(
+         generic_binary{},
+         compression,
+         byte_count{ head.decompressed_size },
+         byte_count{ head.compressed_size },
+         head.version | version_extended_sizes
+      );
+
+      const std::span<const uint8_t> data = final_pl.get_data();
+      std::vector<uint64_t> words((extended_header.size() + data.size() + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+      std::memcpy(words.data(), extended_header.data(), extended_header.size());
+      std::memcpy(reinterpret_cast<uint8_t*>(words.data()) + extended_header.size(), data.data(), data.size());
+      return words;
+   }
+
+} // namespace {}
+
+
+namespace tests {
+
+   TEST_CASE("extended header sizes")
+   {
+      const std::vector<uint8_t> base_header = get_header_bytes(generic_binary{}, compression_mode::none, byte_count{ 100 }, byte_count{ 100 });
+      CHECK_EQ(base_header.size(), 16);
+
+      constexpr size_t decompressed_size = 5'000'000'000;
+      constexpr size_t compressed_size = 4'300'000'000;
+      const std::vector<uint8_t> extended_header = get_header_bytes(
+         generic_binary{}, compression_mode::zstd, byte_count{ decompressed_size }, byte_count{ compressed_size }
+      );
+      REQUIRE_EQ(extended_header.size(), 32);
+      const std::vector<uint64_t> words = get_header_words(extended_header);
+      const header head = get_header(words.data());
+      CHECK(head.version & version_extended_sizes);
+      CHECK_EQ(head.decompressed_size, 0);
+      CHECK_EQ(head.compressed_size, 0);
+      CHECK_EQ(get_decompressed_size(words.data()), decompressed_size);
+      CHECK_EQ(get_compressed_size(words.data()), compressed_size);
+      CHECK_EQ(get_element_count<uint32_t>(words.data()), decompressed_size / 4);
+   }
+
+
+   TEST_CASE("extended payloads")
+   {
+      const abs_file_path source_file{ testRoot / "test_images/binary0.bin" };
+      const std::vector<uint8_t> expected = get_binary_file(source_file);
+
+      const std::vector<uint64_t> uncompressed = get_extended_payload(source_file, compression_mode::none, 0);
+      CHECK_EQ(get_decompressed_size(uncompressed.data()), expected.size());
+      CHECK_EQ(decode_to_vector<uint8_t>(uncompressed.data()), expected);
+      CHECK_EQ(get_element<uint8_t>(uncompressed.data(), 100), expected[100]);
+
+      const std::vector<uint64_t> zstd = get_extended_payload(source_file, compression_mode::zstd, 0);
+      CHECK_EQ(get_decode_into_pointer_result(zstd.data(), zstd_decompression), expected);
+
+      // The chunk table comes after the extended sizes
+      const std::vector<uint64_t> chunked = get_extended_payload(source_file, compression_mode::lz4, 100);
+      CHECK_EQ(get_chunk_count(chunked.data()), 3);
+      CHECK_EQ(get_chunk_size(chunked.data()), 100);
+      CHECK_EQ(get_decode_into_pointer_result(chunked.data(), lz4_decompression), expected);
+      std::vector<uint8_t> slice(20);
+      decode_range(chunked.data(), 90, slice.size(), slice.data(), lz4_decompression);
+      CHECK(std::equal(slice.begin(), slice.end(), expected.begin() + 90));
+   }
+
+
+   TEST_CASE("image dimensions")
+   {
+      const abs_file_path source_file{ testRoot / "../sample_datasets/240000.png" };
+      config cfg{};
+      const std::vector<uint64_t> words = get_baked_words(get_payload(source_file, cfg), cfg);
+      CHECK_EQ(get_header(words.data()).version, 0);
+      CHECK_EQ(get_width(words.data()), 400);
+      CHECK_EQ(get_height(words.data()), 200);
+      CHECK_EQ(get_element_count(words.data()), 80'000);
+
+      // Wider than the 16 bit header fields
+      const std::vector<uint64_t> wide = get_header_words(
+         get_header_bytes(naive_image_type{ 70'000, 2, 1 }, compression_mode::none, byte_count{ 140'000 }, byte_count{ 140'000 })
+      );
+      REQUIRE_EQ(wide.size(), 3);
+      CHECK(get_header(wide.data()).version & version_extended_dimensions);
+      CHECK_EQ(get_header(wide.data()).width, 0);
+      CHECK_EQ(get_width(wide.data()), 70'000);
+      CHECK_EQ(get_height(wide.data()), 2);
+      CHECK_EQ(get_element_count(wide.data()), 140'000);
+      CHECK_EQ(get_decompressed_size(wide.data()), 140'000);
+
+      // Both extensions, the dimensions come after the sizes
+      constexpr size_t size = 3ull * 100'000 * 20'000;
+      const std::vector<uint64_t> both = get_header_words(
+         get_header_bytes(naive_image_type{ 100'000, 20'000, 3 }, compression_mode::none, byte_count{ size }, byte_count{ size })
+      );
+      REQUIRE_EQ(both.size(), 5);
+      CHECK_EQ(get_decompressed_size(both.data()), size);
+      CHECK_EQ(get_width(both.data()), 100'000);
+      CHECK_EQ(get_height(both.data()), 20'000);
+      CHECK_EQ(get_element_count(both.data()), 2'000'000'000);
+   }
+
+
+   TEST_CASE("aligned data")
+   {
+      const abs_file_path source_file{ testRoot / "test_images/binary0.bin" };
+      const std::vector<uint8_t> expected = get_binary_file(source_file);
+
+      const auto get_aligned_payload = [&](const compression_mode compression, const int chunk_size) {
+         config cfg{};
+         cfg.compression = compression;
+         cfg.chunk_size = chunk_size;
+         cfg.payload_alignment = 64;
+         return get_baked_words(get_payload(source_file, cfg), cfg);
+      };
+      const auto get_data_offset = [](const std::vector<uint64_t>& payload) {
+         return static_cast<const uint8_t*>(get_data_ptr(payload.data())) - reinterpret_cast<const uint8_t*>(payload.data());
+      };
+
+      const std::vector<uint64_t> uncompressed = get_aligned_payload(compression_mode::none, 0);
+      CHECK(get_header(uncompressed.data()).version & version_aligned_data);
+      CHECK_EQ(get_data_alignment(uncompressed.data()), 64);
+      CHECK_EQ(get_data_offset(uncompressed), 64);
+      CHECK_EQ(decode_to_vector<uint8_t>(uncompressed.data()), expected);
+      CHECK_EQ(get_element<uint8_t>(uncompressed.data(), 200), expected[200]);
+
+      // The chunk table is in front of the data and part of the padded area
+      const std::vector<uint64_t> chunked = get_aligned_payload(compression_mode::lz4, 100);
+      CHECK_EQ(get_data_offset(chunked) % 64, 0);
+      CHECK_EQ(get_chunk_count(chunked.data()), 3);
+      CHECK_EQ(get_decode_into_pointer_result(chunked.data(), lz4_decompression), expected);
+
+      const std::vector<uint64_t> unaligned = get_extended_payload(source_file, compression_mode::none, 0);
+      CHECK_EQ(get_data_alignment(unaligned.data()), 8);
+   }
+
+}
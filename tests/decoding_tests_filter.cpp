@@ -0,0 +1,155 @@
+#include <doctest/doctest.h>
+
+#include <cmath>
+
+#include "decoding_tools.h"
+#include <binary_bakery_testpaths.h>
+
+#include <binary_bakery_lib/config.h>
+#include <binary_bakery_lib/file_tools.h>
+#include <binary_bakery_lib/filter.h>
+#include <binary_bakery_lib/payload.h>
+
+
+using namespace bb;
+
+namespace {
+
+   // Slowly rising integers and a smooth float curve, with a few bytes that aren't a whole element
+   auto get_table_bytes() -> std::vector<uint8_t>
+   {
+      std::vector<uint8_t> result;
+      for (uint32_t i = 0; i < 1000; ++i)
+      {
+         const uint32_t value = 1000 + 3 * i + i % 7;
+         const float sample = std::sin(static_cast<float>(i) * 0.01f);
+         const auto value_bytes = std::bit_cast<std::array<uint8_t, 4>>(value);
+         const auto sample_bytes = std::bit_cast<std::array<uint8_t, 4>>(sample);
+         result.insert(result.end(), value_bytes.begin(), value_bytes.end());
+         result.insert(result.end(), sample_bytes.begin(), sample_bytes.end());
+      }
+      result.insert(result.end(), { 1, 2, 3 });
+      return result;
+   }
+
+
+   auto get_unfiltered(const std::vector<uint8_t>& filtered, const filter_params& params) -> std::vector<uint8_t>
+   {
+      std::vector<uint8_t> result(filtered.size());
+      detail::unfilter(std::bit_cast<detail::filter_info>(get_filter_word(params)), filtered.data(), result.data(), result.size());
+      return result;
+   }
+
+} // namespace {}
+
+
+namespace tests {
+
+   TEST_CASE("unfilter")
+   {
+      const std::vector<uint8_t> bytes = get_table_bytes();
+      for (const filter_mode filter : { filter_mode::delta, filter_mode::shuffle })
+      {
+         for (const int element_size : { 1, 2, 4, 8 })
+         {
+            const filter_params params{ filter, element_size };
+            const std::vector<uint8_t> filtered = get_filtered(bytes, params, 0);
+            CHECK_EQ(get_unfiltered(filtered, params), bytes);
+         }
+      }
+
+      // Delta in place, across a chunk border that isn't a multiple of the SSE2 block
+      const filter_params delta{ filter_mode::delta, 4 };
+      std::vector<uint8_t> in_place = get_filtered(bytes, delta, 0);
+      detail::unfilter(std::bit_cast<detail::filter_info>(get_filter_word(delta)), in_place.data(), in_place.data(), in_place.size());
+      CHECK_EQ(in_place, bytes);
+
+      // Rows of 3 bytes per pixel, with a last row that is cut short
+      for (const int predictor : { 1, 2, 3, 4 })
+      {
+         const filter_params params{ filter_mode::row, 3, predictor, 30 };
+         const std::vector<uint8_t> filtered = get_filtered(bytes, params, 0);
+         CHECK_NE(filtered, bytes);
+         CHECK_EQ(get_unfiltered(filtered, params), bytes);
+      }
+   }
+
+
+   TEST_CASE("filtered payloads")
+   {
+      const std::vector<uint8_t> bytes = get_table_bytes();
+      const auto test_filter = [&](const filter_mode filter, const compression_mode compression, const int chunk_size) {
+         config cfg{};
+         cfg.compression = compression;
+         cfg.filter = filter;
+         cfg.chunk_size = chunk_size;
+         const std::vector<uint64_t> words = get_baked_words(payload{ std::vector<uint8_t>(bytes), generic_binary{}, "table.bin" }, cfg);
+         const uint64_t* source = words.data();
+         CHECK(get_header(source).version & version_filtered);
+         CHECK_EQ(get_decompressed_size(source), bytes.size());
+         CHECK_EQ(decode_to_vector<uint8_t>(source), bytes);
+         CHECK_EQ(get_decode_into_pointer_result(source, nullptr), bytes);
+
+         std::vector<uint8_t> slice(100);
+         decode_range(source, 1001, slice.size(), slice.data());
+         CHECK(std::equal(slice.begin(), slice.end(), bytes.begin() + 1001));
+      };
+      SUBCASE("delta zstd") { test_filter(filter_mode::delta, compression_mode::zstd, 0); }
+      SUBCASE("shuffle lz4") { test_filter(filter_mode::shuffle, compression_mode::lz4, 0); }
+      SUBCASE("shuffle chunked") { test_filter(filter_mode::shuffle, compression_mode::zstd, 1001); }
+      SUBCASE("delta chunked") { test_filter(filter_mode::delta, compression_mode::lz4, 999); }
+
+      SUBCASE("chunk size is a multiple of the element size")
+      {
+         config cfg{};
+         cfg.compression = compression_mode::zstd;
+         cfg.filter = filter_mode::shuffle;
+         cfg.chunk_size = 1001;
+         const std::vector<uint64_t> words = get_baked_words(payload{ std::vector<uint8_t>(bytes), generic_binary{}, "table.bin" }, cfg);
+         CHECK_EQ(get_chunk_size(words.data()), 1004);
+      }
+
+      SUBCASE("uncompressed payloads aren't filtered")
+      {
+         config cfg{};
+         cfg.filter = filter_mode::delta;
+         const std::vector<uint64_t> words = get_baked_words(payload{ std::vector<uint8_t>(bytes), generic_binary{}, "table.bin" }, cfg);
+         CHECK_EQ(get_header(words.data()).version & version_filtered, 0);
+         CHECK_EQ(decode_to_vector<uint8_t>(words.data()), bytes);
+      }
+
+      SUBCASE("auto keeps the smallest result")
+      {
+         config cfg{};
+         cfg.compression = compression_mode::zstd;
+         const std::vector<uint64_t> plain = get_baked_words(payload{ std::vector<uint8_t>(bytes), generic_binary{}, "table.bin" }, cfg);
+         cfg.filter = filter_mode::automatic;
+         const std::vector<uint64_t> filtered = get_baked_words(payload{ std::vector<uint8_t>(bytes), generic_binary{}, "table.bin" }, cfg);
+         CHECK_LE(get_compressed_size(filtered.data()), get_compressed_size(plain.data()));
+         CHECK_EQ(decode_to_vector<uint8_t>(filtered.data()), bytes);
+      }
+   }
+
+
+   TEST_CASE("row filtered images")
+   {
+      const abs_file_path source_file{ testRoot / "test_images/test_image_rgb.png" };
+      const std::vector<uint8_t> expected = get_image_bytes(source_file);
+      for (const int chunk_size : { 0, 100 })
+      {
+         config cfg{};
+         cfg.compression = compression_mode::zstd;
+         cfg.filter = filter_mode::row;
+         cfg.chunk_size = chunk_size;
+         const std::vector<uint64_t> words = get_baked_words(get_payload(source_file, cfg), cfg);
+         const uint64_t* source = words.data();
+         REQUIRE(get_header(source).version & version_filtered);
+         const detail::filter_info info = detail::get_filter_info(source);
+         CHECK_EQ(info.filter, detail::filter_row);
+         CHECK_EQ(info.element_size, 3);
+         CHECK_EQ(info.row_size, static_cast<uint32_t>(get_width(source) * 3));
+         CHECK_EQ(decode_to_vector<uint8_t>(source), expected);
+      }
+   }
+
+}
@@ -1,6 +1,7 @@
 #include <doctest/doctest.h>
 
 #include "test_types.h"
+#define BAKERY_PROVIDE_CONSTEXPR_LZ4
 #include "decoding_tools.h"
 #include <binary_bakery_testpaths.h>
 
@@ -51,4 +52,30 @@ namespace tests {
       CHECK_EQ(bytes_from_file, bytes_from_payload);
    }
 
+
+   TEST_CASE("decode_to_array()")
+   {
+      constexpr std::array<test_rgb, 6> pixels = decode_to_array<test_rgb, 6>(get_payload("blue.png"));
+      static_assert(pixels[0] == test_rgb{ 0, 0, 255 });
+      static_assert(pixels[5] == test_rgb{ 0, 0, 255 });
+      static_assert(decode_to_array<test_rgb, 2>(get_payload("blue.png"))[1] == test_rgb{ 0, 0, 255 });
+
+      const std::vector<uint8_t> expected = get_binary_file(
+         abs_file_path{testRoot / "test_images/binary0.bin"});
+      constexpr std::array<uint8_t, 256> bytes = decode_to_array<uint8_t, 256>(get_payload("binary0.bin"));
+      CHECK_EQ(std::vector<uint8_t>(bytes.begin(), bytes.end()), expected);
+   }
+
+
+   TEST_CASE("built-in decompression")
+   {
+      const std::vector<uint8_t> expected = get_binary_file(
+         abs_file_path{testRoot / "test_images/binary0.bin"});
+      CHECK_EQ(decode_to_vector<uint8_t>(get_payload("binary0.bin")), expected);
+      CHECK_EQ(get_decode_into_pointer_result(get_payload("binary0.bin"), nullptr), expected);
+
+      const std::vector<uint8_t> image_bytes = get_image_bytes(abs_file_path{testRoot / "test_images/blue.png"});
+      CHECK_EQ(get_decode_to_vector_result<test_rgb>(get_payload("blue.png"), nullptr), image_bytes);
+   }
+
 }
@@ -50,4 +50,31 @@ namespace tests {
       CHECK_EQ(bytes_from_file, bytes_from_payload);
    }
 
+
+   TEST_CASE("get_view()")
+   {
+      const std::vector<uint8_t> bytes_from_file = get_binary_file(
+         abs_file_path{testRoot / "test_images/binary0.bin"});
+      const bb::view<uint8_t> bytes = get_view<uint8_t>(get_payload("binary0.bin"));
+      REQUIRE_EQ(bytes.size(), bytes_from_file.size());
+      CHECK_EQ(static_cast<const void*>(bytes.data()), get_data_ptr(get_payload("binary0.bin")));
+      CHECK_EQ(bytes[bytes.size() - 1], bytes_from_file.back());
+
+      std::vector<uint8_t> bytes_from_view;
+      for (const uint8_t byte : bytes)
+         bytes_from_view.push_back(byte);
+      CHECK_EQ(bytes_from_view, bytes_from_file);
+
+      // The iterator works with the standard algorithms and doesn't need the view to stay around
+      static_assert(std::random_access_iterator<bb::view<uint8_t>::iterator>);
+      CHECK_EQ(std::vector<uint8_t>(bytes.begin(), bytes.end()), bytes_from_file);
+      CHECK_EQ(bytes.end() - bytes.begin(), static_cast<std::ptrdiff_t>(bytes_from_file.size()));
+      const auto last = get_view<uint8_t>(get_payload("binary0.bin")).begin() + static_cast<std::ptrdiff_t>(bytes.size() - 1);
+      CHECK_EQ(*last, bytes_from_file.back());
+
+      const bb::view<test_rgb> pixels = get_view<test_rgb>(get_payload("red.png"));
+      CHECK_EQ(pixels.size(), get_element_count(get_payload("red.png")));
+      CHECK_EQ(pixels[0], test_rgb{ 255, 0, 0 });
+   }
+
 }
@@ -50,4 +50,16 @@ namespace tests {
       CHECK_EQ(bytes_from_file, bytes_from_payload);
    }
 
+
+   TEST_CASE("built-in decompression")
+   {
+      const std::vector<uint8_t> expected = get_binary_file(
+         abs_file_path{testRoot / "test_images/binary0.bin"});
+      CHECK_EQ(decode_to_vector<uint8_t>(get_payload("binary0.bin")), expected);
+      CHECK_EQ(get_decode_into_pointer_result(get_payload("binary0.bin"), nullptr), expected);
+
+      const std::vector<uint8_t> image_bytes = get_image_bytes(abs_file_path{testRoot / "test_images/green.png"});
+      CHECK_EQ(get_decode_to_vector_result<test_rgb>(get_payload("green.png"), nullptr), image_bytes);
+   }
+
 }
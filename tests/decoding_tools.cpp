@@ -1,11 +1,10 @@
 #include "decoding_tools.h"
 
-#include <exception>
-
+#include <binary_bakery_lib/config.h>
 #include <binary_bakery_lib/image.h>
+#include <binary_bakery_lib/payload.h>
 
-#include <zstd.h>
-#include <lz4.h>
+#include <cstring>
 
 
 using namespace bb;
@@ -19,38 +18,34 @@ auto tests::get_image_bytes(
 }
 
 
-auto tests::get_decode_into_pointer_result(
-   const uint64_t* source,
-   decompression_fun_type decomp_fun
-) -> std::vector<uint8_t>
+auto tests::get_baked_words(
+   payload& pl,
+   const config& cfg
+) -> std::vector<uint64_t>
 {
-   const auto header = get_header(source);
-   const std::vector<uint8_t> bytes_from_payload(header.decompressed_size);
-   decode_into_pointer(source, (void*)(bytes_from_payload.data()), decomp_fun);
-   return bytes_from_payload;
+   const std::vector<uint8_t> bytestream = detail::get_final_bytestream(pl, cfg);
+   std::vector<uint64_t> words((bytestream.size() + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+   std::memcpy(words.data(), bytestream.data(), bytestream.size());
+   return words;
 }
 
 
-auto tests::lz4_decompression(const void* src, const size_t src_size, void* dst, const size_t dst_size) -> void
+auto tests::get_baked_words(
+   payload&& pl,
+   const config& cfg
+) -> std::vector<uint64_t>
 {
-   const int decompressed_bytes = LZ4_decompress_safe(
-      static_cast<const char*>(src),
-      static_cast<char*>(dst),
-      static_cast<int>(src_size),
-      static_cast<int>(dst_size)
-   );
-   if (decompressed_bytes != dst_size)
-   {
-      std::terminate();
-   }
+   return get_baked_words(pl, cfg);
 }
 
 
-auto tests::zstd_decompression(const void* src, const size_t srcSize, void* dst, const size_t dst_capacity) -> void
+auto tests::get_decode_into_pointer_result(
+   const uint64_t* source,
+   decompression_fun_type decomp_fun
+) -> std::vector<uint8_t>
 {
-   const size_t decompressed_bytes = ZSTD_decompress(dst, dst_capacity, src, srcSize);
-   if (decompressed_bytes != dst_capacity)
-   {
-      std::terminate();
-   }
+   const std::vector<uint8_t> bytes_from_payload(get_decompressed_size(source));
+   decode_into_pointer(source, (void*)(bytes_from_payload.data()), decomp_fun);
+   return bytes_from_payload;
 }
+
@@ -3,10 +3,14 @@
 #include <vector>
 
 #define BAKERY_PROVIDE_VECTOR
+#define BAKERY_PROVIDE_LZ4
+#define BAKERY_PROVIDE_ZSTD
 #include <binary_bakery_decoder.h>
 
 namespace bb {
    struct abs_file_path;
+   struct config;
+   struct payload;
 }
 
 namespace tests
@@ -14,14 +18,15 @@ namespace tests
 
    auto get_image_bytes(const bb::abs_file_path& file) -> std::vector<uint8_t>;
 
+   // The final bytestream of the payload, copied into words like a baked array. The decoder wants them uint64_t aligned.
+   auto get_baked_words(bb::payload& pl, const bb::config& cfg) -> std::vector<uint64_t>;
+   auto get_baked_words(bb::payload&& pl, const bb::config& cfg) -> std::vector<uint64_t>;
+
    template<typename T>
    auto get_decode_to_vector_result(const uint64_t*, bb::decompression_fun_type decomp_fun) -> std::vector<uint8_t>;
 
    auto get_decode_into_pointer_result(const uint64_t* source, bb::decompression_fun_type decomp_fun) -> std::vector<uint8_t>;
 
-   auto lz4_decompression(const void* src, const size_t src_size, void* dst, const size_t dst_size) -> void;
-   auto zstd_decompression(const void* src, const size_t srcSize, void* dst, const size_t dst_capacity) -> void;
-
 }
 
 template<typename T>
@@ -1,5 +1,10 @@
 #include <doctest/doctest.h>
 
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <thread>
+
 #include <binary_bakery_lib/file_tools.h>
 #include <binary_bakery_testpaths.h>
 using namespace bb;
@@ -25,3 +30,110 @@ TEST_CASE("abs_file_path")
     CHECK_NOTHROW(abs_file_path{testRoot / "tests.cpp"});
    }
 }
+
+
+TEST_CASE("mapped_file")
+{
+   const abs_file_path file{ testRoot / "test_images/binary0.bin" };
+   const mapped_file mapping{ file };
+   REQUIRE(mapping.is_mapped());
+
+   const std::vector<uint8_t> expected = get_binary_file(file);
+   const std::span<const uint8_t> mapped_bytes = mapping.get_bytes();
+   CHECK(std::equal(mapped_bytes.begin(), mapped_bytes.end(), expected.begin(), expected.end()));
+}
+
+
+TEST_CASE("update_binary_file()")
+{
+   const fs::path path = fs::temp_directory_path() / "bb_update_test.bin";
+   fs::remove(path);
+   const std::vector<uint8_t> bytes{ 1, 2, 3 };
+   CHECK(update_binary_file(path, { bytes }, 8));
+   CHECK_EQ(fs::file_size(path), 8);
+   CHECK_FALSE(update_binary_file(path, { bytes }, 8));
+
+   const std::vector<uint8_t> other_bytes{ 1, 2, 4 };
+   CHECK(update_binary_file(path, { other_bytes }, 8));
+   CHECK_FALSE(fs::exists(get_temp_path(path)));
+   fs::remove(path);
+}
+
+
+TEST_CASE("replace_if_changed()")
+{
+   const fs::path path = fs::temp_directory_path() / "bb_replace_test.h";
+   fs::remove(path);
+   const auto write_temp = [&](const std::string& content) {
+      std::ofstream file(get_temp_path(path), std::ios::out);
+      file << get_hash_line_placeholder() << content;
+   };
+   const auto get_file_content = [&]() {
+      std::ifstream file(path);
+      return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+   };
+
+   write_temp("first\n");
+   CHECK(replace_if_changed(get_temp_path(path), path));
+   const std::string first_content = get_file_content();
+   CHECK_NE(first_content.find("first"), std::string::npos);
+   CHECK_NE(first_content.rfind("// Content hash: ", 0), std::string::npos);
+
+   write_temp("first\n");
+   CHECK_FALSE(replace_if_changed(get_temp_path(path), path));
+   CHECK_FALSE(fs::exists(get_temp_path(path)));
+
+   write_temp("second\n");
+   CHECK(replace_if_changed(get_temp_path(path), path));
+   CHECK_NE(get_file_content(), first_content);
+   fs::remove(path);
+}
+
+
+TEST_CASE("get_files_recursively()")
+{
+   const abs_directory_path dir{ testRoot };
+   const auto get_names = [&](const std::vector<std::string>& include, const std::vector<std::string>& exclude) {
+      std::vector<std::string> names;
+      for (const abs_file_path& file : get_files_recursively(dir, include, exclude))
+         names.push_back(fs::relative(file.get_path(), dir.get_path()).generic_string());
+      return names;
+   };
+
+   const std::vector<std::string> pngs = get_names({ "*.png" }, {});
+   CHECK_EQ(pngs, std::vector<std::string>{
+      "test_images/blue.png", "test_images/green.png", "test_images/red.png", "test_images/test_image_rgb.png"
+   });
+   CHECK_EQ(get_names({ "*.png", "*.tga" }, { "*/test_*", "*/red.png" }), std::vector<std::string>{
+      "test_images/blue.png", "test_images/green.png", "test_images/tga_image.tga"
+   });
+
+   // No include patterns means everything
+   const std::vector<std::string> all = get_names({}, {});
+   CHECK(std::find(all.begin(), all.end(), "test_configs/c0.toml") != all.end());
+   CHECK(std::is_sorted(all.begin(), all.end()));
+}
+
+
+TEST_CASE("file_watcher")
+{
+   const fs::path dir = fs::temp_directory_path() / "bb_watcher_test";
+   fs::remove_all(dir);
+   fs::create_directories(dir / "sub");
+   fs::create_directories(dir / ".bb_cache");
+   file_watcher watcher({ watched_directory{ abs_directory_path{ dir }, true } });
+
+   std::thread writer([&]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds{ 100 });
+      write_binary_file(dir / ".bb_cache" / "entry.bin", std::vector<uint8_t>{ 1 });
+      write_binary_file(dir / "sub" / "texture.png", std::vector<uint8_t>{ 1, 2, 3 });
+   });
+   const std::vector<fs::path> changes = watcher.wait_for_changes(std::chrono::milliseconds{ 300 });
+   writer.join();
+   CHECK(std::find(changes.begin(), changes.end(), dir / "sub" / "texture.png") != changes.end());
+   CHECK(std::none_of(changes.begin(), changes.end(), [](const fs::path& path) {
+      return path.filename() == "entry.bin";
+   }));
+
+   fs::remove_all(dir);
+}
@@ -1,9 +1,13 @@
 #include <doctest/doctest.h>
 
 #include <binary_bakery_lib/image.h>
+#include <binary_bakery_lib/config.h>
 #include <binary_bakery_lib/file_tools.h>
 #include <binary_bakery_testpaths.h>
 
+#include <fstream>
+#include <optional>
+
 using namespace bb;
 
 const abs_file_path test_image_file{ testRoot / "test_images/test_image_rgb.png" };
@@ -38,3 +42,90 @@ TEST_CASE("flipping")
    CHECK_EQ(top_first[0], color{ 0, 0, 0 });
    CHECK_EQ(top_first[3], color{ 255, 0, 0 });
 }
+
+
+TEST_CASE("load_image()")
+{
+   const decoded_image decoded = load_image(test_image_file, image_vertical_direction::bottom_to_top);
+   CHECK_EQ(decoded.dimensions, image_dimensions{ 3, 2, 3 });
+   CHECK_EQ(decoded.dimensions, get_image_dimensions(test_image_file));
+
+   const image<3> image_3x3(test_image_file, image_vertical_direction::bottom_to_top);
+   CHECK_EQ(image_3x3.m_pixels.size(), 6);
+   CHECK_EQ(decoded.bytes, get_image_bytestream(image_3x3));
+}
+
+
+TEST_CASE("qoi images")
+{
+   // 3x2 RGBA: An RGBA op, an RGB op, a diff, a luma, an index and a run
+   const std::vector<uint8_t> qoi_bytes{
+      'q', 'o', 'i', 'f', 0, 0, 0, 3, 0, 0, 0, 2, 4, 0,
+      0xff, 255, 0, 0, 255,
+      0xfe, 0, 255, 0,
+      0x76,
+      0xaa, 0xb6,
+      0x32,
+      0xc0,
+      0, 0, 0, 0, 0, 0, 0, 1
+   };
+   const fs::path qoi_path = fs::temp_directory_path() / "bb_test_image.qoi";
+   write_binary_file(qoi_path, qoi_bytes);
+   const abs_file_path qoi_file{ qoi_path };
+
+   CHECK_EQ(get_image_dimensions(qoi_file), image_dimensions{ 3, 2, 4 });
+   const decoded_image top_first = load_image(qoi_file, image_vertical_direction::top_to_bottom);
+   const std::vector<uint8_t> expected{
+      255, 0, 0, 255,   0, 255, 0, 255,   1, 254, 0, 255,
+      14, 8, 8, 255,    255, 0, 0, 255,   255, 0, 0, 255
+   };
+   CHECK_EQ(top_first.bytes, expected);
+
+   const image<4> bottom_first(qoi_file, image_vertical_direction::bottom_to_top);
+   CHECK_EQ(bottom_first[0], color{ 14, 8, 8, 255 });
+   CHECK_EQ(bottom_first[3], color{ 255, 0, 0, 255 });
+   fs::remove(qoi_path);
+}
+
+
+TEST_CASE("image decoders")
+{
+   CHECK_NE(get_image_decoder(".qoi"), nullptr);
+   CHECK_NE(get_image_decoder(".jpg"), nullptr);
+   CHECK_EQ(get_image_decoder(".txt"), nullptr);
+
+   SUBCASE("extra formats are opt-in")
+   {
+      const fs::path jpg_path = fs::temp_directory_path() / "bb_test_image.jpg";
+      std::ofstream(jpg_path, std::ios::binary) << "not decoded";
+      const abs_file_path jpg_file{ jpg_path };
+      config cfg;
+      CHECK_EQ(get_image_decoder(jpg_file, cfg), nullptr);
+      CHECK_NE(get_image_decoder(test_image_file, cfg), nullptr);
+      cfg.image_extra_formats = true;
+      CHECK_NE(get_image_decoder(jpg_file, cfg), nullptr);
+      CHECK(get_image_decoder(".hdr")->m_warning.empty() == false);
+      fs::remove(jpg_path);
+   }
+
+   SUBCASE("registered decoders take precedence over the built-in ones")
+   {
+      const image_decoder original = *get_image_decoder(".png");
+      register_image_decoder(image_decoder{
+         "test",
+         { ".png" },
+         [](std::span<const uint8_t>) -> std::optional<image_dimensions> { return image_dimensions{ 1, 1, 1 }; },
+         [](std::span<const uint8_t>) -> std::optional<decoded_image> { return decoded_image{ { 1, 1, 1 }, { 42 } }; }
+      });
+      const image_decoder* decoder = get_image_decoder(".png");
+      REQUIRE_NE(decoder, nullptr);
+      CHECK_EQ(decoder->m_name, "test");
+      const decoded_image decoded = load_image(test_image_file, image_vertical_direction::top_to_bottom);
+      CHECK_EQ(decoded.bytes, std::vector<uint8_t>{ 42 });
+
+      // Registering the previous decoder again hands .png back to it, for the other tests
+      register_image_decoder(original);
+      CHECK_EQ(get_image_decoder(".png")->m_name, original.m_name);
+      CHECK_EQ(get_image_dimensions(test_image_file), image_dimensions{ 3, 2, 3 });
+   }
+}
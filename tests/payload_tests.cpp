@@ -1,9 +1,13 @@
+#include <algorithm>
 #include <fstream>
+#include <sstream>
 #include <string>
+#include <thread>
 
 #include <binary_bakery_lib/payload.h>
 #include <binary_bakery_lib/tools.h>
 #include <binary_bakery_lib/config.h>
+#include <binary_bakery_testpaths.h>
 
 #include <doctest/doctest.h>
 
@@ -17,6 +21,21 @@ namespace
       append_ui64_str(value, result);
       return result;
    }
+
+
+   auto get_written_header(const config& cfg) -> std::string
+   {
+      const std::vector<abs_file_path> files{
+         abs_file_path{ testRoot / "test_images/binary0.bin" },
+         abs_file_path{ testRoot / "test_images/test_image_rgb.png" },
+         abs_file_path{ testRoot / "test_images/tga_image.tga" }
+      };
+      const abs_directory_path output_dir{ fs::temp_directory_path() };
+      write_payloads_to_file(cfg, get_payloads(files, cfg), output_dir);
+
+      std::ifstream file(output_dir.get_path() / cfg.output_filename);
+      return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+   }
 }
 
 TEST_CASE("hex strings")
@@ -24,4 +43,379 @@ TEST_CASE("hex strings")
    CHECK_EQ(get_ui64_str(0), "0x0000000000000000");
    CHECK_EQ(get_ui64_str(15), "0x000000000000000f");
    CHECK_EQ(get_ui64_str(std::numeric_limits<uint64_t>::max()), "0xffffffffffffffff");
+   CHECK_EQ(get_ui64_str(0x0123456789abcdef), "0x0123456789abcdef");
+}
+
+
+TEST_CASE("hex lines")
+{
+   const std::vector<uint64_t> words{ 1, 0xfedcba9876543210, 2 };
+   std::string line;
+   append_ui64_line(words, false, line);
+   CHECK_EQ(line, "0x0000000000000001, 0xfedcba9876543210, 0x0000000000000002");
+
+   line.clear();
+   append_ui64_line({ words.data(), 1 }, true, line);
+   CHECK_EQ(line, "0x0000000000000001,");
+}
+
+
+TEST_CASE("streaming output")
+{
+   config cfg;
+   cfg.output_filename = "bb_streaming_test.h";
+   cfg.compression = compression_mode::zstd;
+   const std::string buffered = get_written_header(cfg);
+
+   cfg.streaming_output = true;
+   const std::string streamed = get_written_header(cfg);
+   CHECK_EQ(buffered, streamed);
+   CHECK(buffered.empty() == false);
+}
+
+
+TEST_CASE("memory budget")
+{
+   config cfg;
+   cfg.output_filename = "bb_budget_test.h";
+   cfg.compression = compression_mode::zstd;
+   cfg.streaming_output = true;
+   const std::string unlimited = get_written_header(cfg);
+
+   // Files are only loaded while they're written, the output is the same
+   cfg.memory_budget_mb = 1;
+   const std::vector<payload> deferred = get_payloads({ abs_file_path{ testRoot / "test_images/test_image_rgb.png" } }, cfg);
+   REQUIRE_EQ(deferred.size(), 1);
+   CHECK(deferred[0].m_deferred_file.has_value());
+   CHECK(deferred[0].get_content().empty());
+   CHECK_EQ(get_written_header(cfg), unlimited);
+
+   cfg.thread_count = 1;
+   CHECK_EQ(get_written_header(cfg), unlimited);
+
+   cfg.streaming_output = false;
+   CHECK_EQ(get_written_header(cfg), unlimited);
+
+   // Many inputs above the budget on several threads. At most one file is loaded beyond it.
+   const fs::path dir = fs::temp_directory_path() / "bb_budget_test";
+   fs::remove_all(dir);
+   fs::create_directories(dir);
+   constexpr size_t file_size = 400 * 1024;
+   std::vector<abs_file_path> files;
+   for (int i = 0; i < 12; ++i)
+   {
+      std::vector<uint8_t> bytes(file_size);
+      for (size_t j = 0; j < bytes.size(); ++j)
+         bytes[j] = static_cast<uint8_t>(j * 7 + i);
+      const fs::path path = dir / ("file" + std::to_string(i) + ".bin");
+      write_binary_file(path, bytes);
+      files.emplace_back(path);
+   }
+   config many_cfg;
+   many_cfg.thread_count = 4;
+   std::ostringstream unlimited_stream;
+   write_payloads_to_stream(many_cfg, get_payloads(files, many_cfg), unlimited_stream);
+
+   many_cfg.memory_budget_mb = 1;
+   std::ostringstream budget_stream;
+   write_payloads_to_stream(many_cfg, get_payloads(files, many_cfg), budget_stream);
+   CHECK_EQ(budget_stream.str(), unlimited_stream.str());
+
+   std::vector<payload> payloads = get_payloads(files, many_cfg);
+   int handed_count = 0;
+   const uint64_t peak_held_bytes = detail::for_each_final_payload_within_budget(payloads, many_cfg, [&](const int i, const detail::final_payload&) {
+      CHECK_EQ(i, handed_count);
+      ++handed_count;
+   });
+   CHECK_EQ(handed_count, 12);
+   CHECK_GT(peak_held_bytes, 0);
+   CHECK_LE(peak_held_bytes, 1024 * 1024 + file_size);
+   fs::remove_all(dir);
+}
+
+
+TEST_CASE("final payload")
+{
+   config cfg;
+   const abs_file_path file{ testRoot / "test_images/binary0.bin" };
+   payload pl = get_payload(file, cfg);
+   const std::span<const uint8_t> content = pl.get_content();
+   const std::vector<uint8_t> content_copy(content.begin(), content.end());
+   const detail::final_payload final_pl = detail::get_final_payload(pl, cfg);
+
+   // Uncompressed content is handed over, not copied
+   CHECK_EQ(final_pl.get_data().data(), content.data());
+   CHECK(std::equal(content_copy.begin(), content_copy.end(), final_pl.get_data().begin(), final_pl.get_data().end()));
+   CHECK(pl.get_content().empty());
+
+   payload pl_again = get_payload(file, cfg);
+   const std::vector<uint8_t> bytestream = detail::get_final_bytestream(pl_again, cfg);
+   REQUIRE_EQ(bytestream.size(), final_pl.m_header.size() + content_copy.size());
+   CHECK(std::equal(final_pl.m_header.begin(), final_pl.m_header.end(), bytestream.begin()));
+   CHECK(std::equal(content_copy.begin(), content_copy.end(), bytestream.begin() + 16));
+}
+
+
+TEST_CASE("sharded output")
+{
+   config cfg;
+   cfg.output_filename = "bb_sharded_test.h";
+   cfg.compression = compression_mode::lz4;
+   const fs::path output_dir = fs::temp_directory_path();
+   const auto get_shard_path = [&](const int i) {
+      return output_dir / ("bb_sharded_test_shard" + std::to_string(i) + ".cpp");
+   };
+
+   // One payload per shard
+   cfg.shard_size = 1;
+   const std::string index = get_written_header(cfg);
+   CHECK(fs::exists(get_shard_path(0)));
+   CHECK(fs::exists(get_shard_path(2)));
+   CHECK_FALSE(fs::exists(get_shard_path(3)));
+   CHECK_NE(index.find("extern const uint64_t bb_tga_image_tga[];"), std::string::npos);
+   CHECK_NE(index.find("bb_sharded_test_shard2.cpp"), std::string::npos);
+   CHECK_EQ(index.find("0x"), std::string::npos);
+
+   std::ifstream shard(get_shard_path(2));
+   const std::string shard_content(std::istreambuf_iterator<char>(shard), std::istreambuf_iterator<char>{});
+   CHECK_NE(shard_content.find("extern const uint64_t bb_tga_image_tga[]{"), std::string::npos);
+
+   // Everything fits into one shard, the others are removed
+   cfg.shard_size = 1024 * 1024;
+   get_written_header(cfg);
+   CHECK(fs::exists(get_shard_path(0)));
+   CHECK_FALSE(fs::exists(get_shard_path(1)));
+   fs::remove(get_shard_path(0));
+}
+
+
+TEST_CASE("in-memory baking")
+{
+   config cfg;
+   cfg.output_filename = "bb_in_memory_test.h";
+   cfg.compression = compression_mode::zstd;
+   const std::string written = get_written_header(cfg);
+
+   const std::vector<abs_file_path> files{
+      abs_file_path{ testRoot / "test_images/binary0.bin" },
+      abs_file_path{ testRoot / "test_images/test_image_rgb.png" },
+      abs_file_path{ testRoot / "test_images/tga_image.tga" }
+   };
+   std::ostringstream stream;
+   write_payloads_to_stream(cfg, get_payloads(files, cfg), stream);
+
+   // Same, without the content hash line of files
+   CHECK_EQ(written.substr(written.find('\n') + 1), stream.str());
+
+   // Inputs from memory
+   const std::vector<uint8_t> pixels{ 255, 0, 0, 0, 255, 0 };
+   payload image_pl = get_payload(pixels, naive_image_type{ 2, 1, 3 }, "pixels");
+   CHECK_EQ(image_pl.m_name, "pixels");
+   CHECK_THROWS(get_payload(pixels, naive_image_type{ 2, 2, 3 }, "pixels"));
+
+   std::ostringstream bytes_stream;
+   write_payload_bytes(image_pl, cfg, bytes_stream);
+   const std::string bytes = bytes_stream.str();
+   CHECK_EQ(bytes.size() % 8, 0);
+   payload image_pl_again = get_payload(pixels, naive_image_type{ 2, 1, 3 }, "pixels");
+   const std::vector<uint8_t> expected = detail::get_final_bytestream(image_pl_again, cfg);
+   REQUIRE_GE(bytes.size(), expected.size());
+   CHECK(std::equal(expected.begin(), expected.end(), reinterpret_cast<const uint8_t*>(bytes.data())));
+}
+
+
+TEST_CASE("bake report")
+{
+   config cfg;
+   cfg.output_filename = "bb_report_test.h";
+   cfg.compression = compression_mode::lz4;
+   cfg.quiet = true;
+   cfg.report_path = "bb_report_test.json";
+   get_written_header(cfg);
+
+   const fs::path report_path = fs::temp_directory_path() / cfg.report_path;
+   std::ifstream report_file(report_path);
+   const std::string report(std::istreambuf_iterator<char>(report_file), std::istreambuf_iterator<char>{});
+   CHECK_NE(report.find("\"name\": \"binary0.bin\""), std::string::npos);
+   CHECK_NE(report.find("\"phase\": \"image_decode\""), std::string::npos);
+   CHECK_NE(report.find("\"phase\": \"compress\""), std::string::npos);
+   CHECK_NE(report.find("\"phase\": \"format\""), std::string::npos);
+   CHECK_NE(report.find("\"name\": \"bb_report_test.h\""), std::string::npos);
+   report_file.close();
+   fs::remove(report_path);
+
+   bake_metrics metrics{ "a\"b", {} };
+   phase_timer timer(bake_phase::compress);
+   metrics.m_phases.push_back(timer.stop(100, 50));
+   CHECK_EQ(metrics.m_phases[0].m_bytes_in, uint64_t{ 100 });
+   CHECK_GE(metrics.m_phases[0].m_duration_us, 0);
+   const std::string trace = get_report_str({ metrics }, report_format::chrome_trace);
+   CHECK_NE(trace.find("\"traceEvents\""), std::string::npos);
+   CHECK_NE(trace.find("\"name\": \"compress a\\\"b\""), std::string::npos);
+}
+
+
+TEST_CASE("deduplication")
+{
+   config cfg;
+   cfg.compression = compression_mode::zstd;
+   const std::vector<uint8_t> bytes{ 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+   const std::vector<uint8_t> other_bytes{ 9, 8, 7 };
+   const auto get_test_payloads = [&]() {
+      std::vector<payload> payloads;
+      payloads.push_back(get_payload(bytes, generic_binary{}, "a.bin"));
+      payloads.push_back(get_payload(other_bytes, generic_binary{}, "b.bin"));
+      payloads.push_back(get_payload(bytes, generic_binary{}, "c.bin"));
+      return payloads;
+   };
+
+   std::vector<payload> payloads = get_test_payloads();
+   const std::vector<detail::payload_alias> aliases = detail::remove_duplicates(payloads, cfg);
+   REQUIRE_EQ(payloads.size(), 2);
+   REQUIRE_EQ(aliases.size(), 1);
+   CHECK_EQ(aliases[0].m_name, "c.bin");
+   CHECK_EQ(payloads[aliases[0].m_target].m_name, "a.bin");
+
+   std::ostringstream stream;
+   write_payloads_to_stream(cfg, get_test_payloads(), stream);
+   const std::string header = stream.str();
+   CHECK_EQ(header.find("bb_c_bin[]"), std::string::npos);
+   CHECK_NE(header.find("\"c.bin\""), std::string::npos);
+
+   // The symbol stays as a pointer to the shared array, and payload_id keeps the input order
+   CHECK_NE(header.find("static constexpr const uint64_t* bb_c_bin = &bb_a_bin[0];"), std::string::npos);
+   CHECK_NE(header.find("   bb_a_bin,\n   bb_b_bin,\n   bb_c_bin,\n"), std::string::npos);
+
+   // Same content with different compression settings isn't a duplicate
+   cfg.compression_overrides.push_back(compression_override{ "c.bin", compression_mode::lz4 });
+   payloads = get_test_payloads();
+   CHECK(detail::remove_duplicates(payloads, cfg).empty());
+   CHECK_EQ(payloads.size(), 3);
+
+   cfg.deduplicate = false;
+   cfg.compression_overrides.clear();
+   payloads = get_test_payloads();
+   CHECK(detail::remove_duplicates(payloads, cfg).empty());
+}
+
+
+TEST_CASE("outputs in an input directory")
+{
+   // Like baking with --watch from inside the watched directory
+   const fs::path dir = fs::temp_directory_path() / "bb_output_in_input_test";
+   fs::remove_all(dir);
+   fs::create_directories(dir);
+   write_binary_file(dir / "data.bin", std::vector<uint8_t>{ 1, 2, 3 });
+   const abs_directory_path working_dir{ dir };
+   config cfg;
+   cfg.output_filename = "payload.h";
+   cfg.output = output_mode::incbin;
+   cfg.report_path = "report.json";
+
+   // Written earlier with another output_filename
+   config other_cfg;
+   other_cfg.output_filename = "other_payload.h";
+   write_payloads_to_file(other_cfg, get_payloads({ abs_file_path{ dir / "data.bin" } }, other_cfg), working_dir);
+
+   const std::vector<abs_file_path> inputs = get_directory_inputs(working_dir, cfg, working_dir);
+   REQUIRE_EQ(inputs.size(), 1);
+   file_watcher watcher({ watched_directory{ working_dir, true } });
+   std::thread baker([&]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds{ 100 });
+      write_payloads_to_file(cfg, get_payloads(inputs, cfg), working_dir);
+   });
+   const std::vector<fs::path> changes = watcher.wait_for_changes(std::chrono::milliseconds{ 300 });
+   baker.join();
+   CHECK(fs::exists(dir / "payload.S"));
+   CHECK(fs::exists(dir / "bb_data_bin.bin"));
+   CHECK(fs::exists(dir / "report.json"));
+
+   // None of the changes are inputs, and the outputs didn't become inputs
+   const std::vector<abs_file_path> new_inputs = get_directory_inputs(working_dir, cfg, working_dir);
+   REQUIRE_EQ(new_inputs.size(), 1);
+   CHECK_EQ(new_inputs[0].get_path(), inputs[0].get_path());
+   CHECK_FALSE(changes.empty());
+   CHECK(std::none_of(changes.begin(), changes.end(), [&](const fs::path& change) {
+      return change == inputs[0].get_path();
+   }));
+
+   CHECK(is_output_path(dir / "payload.h.tmp", cfg, working_dir));
+   CHECK(is_output_path(dir / "payload_shard12.cpp", cfg, working_dir));
+   CHECK_FALSE(is_output_path(dir / "payload_shard.cpp", cfg, working_dir));
+   CHECK_FALSE(is_output_path(dir / "sub" / "bb_data_bin.bin", cfg, working_dir));
+   cfg.output = output_mode::header;
+   CHECK_FALSE(is_output_path(dir / "bb_data_bin.bin", cfg, working_dir));
+
+   fs::remove_all(dir);
+}
+
+
+TEST_CASE("duplicate payload names")
+{
+   const fs::path dir = fs::temp_directory_path() / "bb_duplicate_name_test";
+   fs::remove_all(dir);
+   fs::create_directories(dir / "a");
+   fs::create_directories(dir / "b");
+   write_binary_file(dir / "a" / "x.bin", std::vector<uint8_t>{ 1 });
+   write_binary_file(dir / "b" / "x.bin", std::vector<uint8_t>{ 2 });
+   write_binary_file(dir / "b" / "x_bin", std::vector<uint8_t>{ 3 });
+   config cfg;
+   CHECK_THROWS(get_payloads({ abs_file_path{ dir / "a" / "x.bin" }, abs_file_path{ dir / "b" / "x.bin" } }, cfg));
+
+   // Different names with the same array name. The archive index only has the names.
+   CHECK_THROWS(get_payloads({ abs_file_path{ dir / "a" / "x.bin" }, abs_file_path{ dir / "b" / "x_bin" } }, cfg));
+   cfg.output = output_mode::archive;
+   CHECK_NOTHROW(get_payloads({ abs_file_path{ dir / "a" / "x.bin" }, abs_file_path{ dir / "b" / "x_bin" } }, cfg));
+
+   std::vector<payload> payloads;
+   payloads.push_back(get_payload(std::vector<uint8_t>{ 1 }, generic_binary{}, "x.bin"));
+   payloads.push_back(get_payload(std::vector<uint8_t>{ 2 }, generic_binary{}, "x.bin"));
+   std::ostringstream stream;
+   CHECK_THROWS(write_payloads_to_stream(cfg, std::move(payloads), stream));
+
+   // The name of the dictionary payload is reserved
+   write_binary_file(dir / "a" / "zstd_dictionary", std::vector<uint8_t>{ 4 });
+   cfg.output = output_mode::header;
+   cfg.zstd_dictionary = true;
+   CHECK_THROWS(get_payloads({ abs_file_path{ dir / "a" / "zstd_dictionary" } }, cfg));
+   cfg.zstd_dictionary = false;
+   CHECK_NOTHROW(get_payloads({ abs_file_path{ dir / "a" / "zstd_dictionary" } }, cfg));
+   fs::remove_all(dir);
+}
+
+
+TEST_CASE("incbin and embed outputs")
+{
+   const fs::path dir = fs::temp_directory_path() / "bb_sidecar_output_test";
+   fs::remove_all(dir);
+   fs::create_directories(dir);
+   write_binary_file(dir / "data.bin", std::vector<uint8_t>{ 1, 2, 3 });
+   const abs_directory_path working_dir{ dir };
+   const auto get_file_str = [&](const std::string& filename) {
+      std::ifstream file(dir / filename);
+      return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+   };
+   config cfg;
+   cfg.output_filename = "payload.h";
+
+   // The .bin files are named relative to the output, so that it can be moved or checked in
+   cfg.output = output_mode::incbin;
+   write_payloads_to_file(cfg, get_payloads({ abs_file_path{ dir / "data.bin" } }, cfg), working_dir);
+   const std::string assembly = get_file_str("payload.S");
+   CHECK_NE(assembly.find("   .incbin \"bb_data_bin.bin\"\n"), std::string::npos);
+   CHECK_EQ(assembly.find(dir.generic_string()), std::string::npos);
+   CHECK_NE(get_file_str("payload.h").find("bb_data_bin"), std::string::npos);
+   const std::vector<uint8_t> sidecar_bytes = get_binary_file(abs_file_path{ dir / "bb_data_bin.bin" });
+   REQUIRE_EQ(sidecar_bytes.size(), 24);
+   CHECK_EQ(std::vector<uint8_t>(sidecar_bytes.begin() + 16, sidecar_bytes.begin() + 19), std::vector<uint8_t>{ 1, 2, 3 });
+
+   cfg.output = output_mode::embed;
+   fs::remove(dir / "bb_data_bin.bin");
+   write_payloads_to_file(cfg, get_payloads({ abs_file_path{ dir / "data.bin" } }, cfg), working_dir);
+   const std::string header = get_file_str("payload.h");
+   CHECK_NE(header.find("#embed \"bb_data_bin.bin\"\n"), std::string::npos);
+   CHECK_EQ(header.find(dir.generic_string()), std::string::npos);
+   CHECK_EQ(get_binary_file(abs_file_path{ dir / "bb_data_bin.bin" }), sidecar_bytes);
+
+   fs::remove_all(dir);
 }
@@ -1,7 +1,9 @@
 #pragma once
 #include <cstdint>
 #include <cstring>
-#include <string_view>
+#include <string_view> // std::string_view
+
+#include <type_traits> // std::is_constant_evaluated
 
 namespace bb{
 static constexpr uint64_t bb_test_image_rgb_png[]{
@@ -9,14 +11,49 @@ static constexpr uint64_t bb_test_image_rgb_png[]{
    0x0000000000000000
 };
 
+enum class payload_id : int {
+   bb_test_image_rgb_png,
+};
+static constexpr int payload_count = 1;
+
+[[nodiscard]] static constexpr auto get_payload(
+   [[maybe_unused]] const payload_id id
+) -> const uint64_t*
+{
+   constexpr const uint64_t* const payload_ptrs[]{
+      &bb_test_image_rgb_png[0],
+   };
+   return payload_ptrs[static_cast<int>(id)];
+}
+
 [[nodiscard]] static constexpr auto get_payload(
    [[maybe_unused]] std::string_view name
 ) -> const uint64_t*
 {
-   if(name == "test_image_rgb.png")
-      return &bb_test_image_rgb_png[0];
-   else
-      return nullptr;
+   constexpr std::string_view names[]{
+      "test_image_rgb.png",
+   };
+   constexpr payload_id ids[]{
+      payload_id::bb_test_image_rgb_png,
+   };
+   int first = 0;
+   int count = payload_count;
+   while (count > 0)
+   {
+      const int half = count / 2;
+      if (names[first + half] < name)
+      {
+         first += half + 1;
+         count -= half + 1;
+      }
+      else
+      {
+         count = half;
+      }
+   }
+   if (first < payload_count && names[first] == name)
+      return get_payload(ids[first]);
+   return nullptr;
 }
 
 } // namespace bb
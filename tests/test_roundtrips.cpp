@@ -1,13 +1,20 @@
 #include <doctest/doctest.h>
 
 #include "test_types.h"
+#include "decoding_tools.h"
 
+#include <binary_bakery_lib/compression.h>
 #include <binary_bakery_lib/file_tools.h>
 #include <binary_bakery_lib/image.h>
 #include <binary_bakery_lib/payload.h>
 #include <binary_bakery_lib/config.h>
 #include <binary_bakery_testpaths.h>
 
+#include <zstd.h>
+
+#include <cstring>
+#include <fstream>
+
 #define BAKERY_PROVIDE_VECTOR
 #include <binary_bakery_decoder.h>
 
@@ -25,6 +32,17 @@ namespace {
       return decode_to_vector<uint8_t>(ptr);
    }
 
+
+   // Decompression functions don't get any context, so the dictionary has to be global
+   std::vector<uint8_t> test_zstd_dictionary;
+
+   auto dictionary_decompression(const void* src, const size_t src_size, void* dst, const size_t dst_capacity) -> void
+   {
+      ZSTD_DCtx* dctx = ZSTD_createDCtx();
+      ZSTD_decompress_usingDict(dctx, dst, dst_capacity, src, src_size, test_zstd_dictionary.data(), test_zstd_dictionary.size());
+      ZSTD_freeDCtx(dctx);
+   }
+
 } // namespace {}
 
 
@@ -65,4 +83,194 @@ namespace tests {
       CHECK_EQ(result, expected);
    }
 
+
+   TEST_CASE("compression settings roundtrip")
+   {
+      const abs_file_path source_file{ testRoot / "test_images/tga_image.tga" };
+      const std::vector<uint8_t> expected = get_image_bytes(source_file);
+      const auto get_roundtrip_bytes = [&](const config& cfg, decompression_fun_type decomp_fun) {
+         payload pl = get_payload(source_file, cfg);
+         const std::vector<uint8_t> bytestream = detail::get_final_bytestream(pl, cfg);
+         return decode_to_vector<uint8_t>(reinterpret_cast<const uint64_t*>(bytestream.data()), decomp_fun);
+      };
+
+      config cfg{};
+      cfg.compression = compression_mode::zstd;
+      cfg.zstd_level = 22;
+      cfg.zstd_long_range = true;
+      CHECK_EQ(get_roundtrip_bytes(cfg, zstd_decompression), expected);
+
+      cfg.compression = compression_mode::lz4;
+      cfg.lz4_level = 12;
+      CHECK_EQ(get_roundtrip_bytes(cfg, lz4_decompression), expected);
+
+      // Override switches this file back to zstd
+      cfg.compression_overrides.push_back({ "*.tga", compression_mode::zstd, 19, false, 0 });
+      payload pl = get_payload(source_file, cfg);
+      const std::vector<uint8_t> bytestream = detail::get_final_bytestream(pl, cfg);
+      CHECK_EQ(get_header(reinterpret_cast<const uint64_t*>(bytestream.data())).compression, 1);
+      CHECK_EQ(get_roundtrip_bytes(cfg, zstd_decompression), expected);
+   }
+
+
+   TEST_CASE("compressor reuse")
+   {
+      const std::vector<uint8_t> image_bytes = get_image_bytes(abs_file_path{ testRoot / "test_images/tga_image.tga" });
+      const std::vector<uint8_t> binary_bytes = get_binary_file(abs_file_path{ testRoot / "test_images/binary0.bin" });
+
+      // Settings of earlier calls must not leak into later ones
+      compressor reused;
+      CHECK_EQ(reused.get_zstd_compressed(image_bytes, 19, true), compressor{}.get_zstd_compressed(image_bytes, 19, true));
+      CHECK_EQ(reused.get_zstd_compressed(binary_bytes, 1, false), compressor{}.get_zstd_compressed(binary_bytes, 1, false));
+      CHECK_EQ(reused.get_lz4_compressed(image_bytes, 9), compressor{}.get_lz4_compressed(image_bytes, 9));
+      CHECK_EQ(reused.get_lz4_compressed(binary_bytes, 0), compressor{}.get_lz4_compressed(binary_bytes, 0));
+
+      // Results have their exact size, even after larger ones
+      const std::vector<uint8_t> compressed = reused.get_zstd_compressed(image_bytes, 3, false);
+      CHECK_EQ(compressed.size(), compressed.capacity());
+      std::vector<uint8_t> decompressed(image_bytes.size());
+      zstd_decompression(compressed.data(), compressed.size(), decompressed.data(), decompressed.size());
+      CHECK_EQ(decompressed, image_bytes);
+   }
+
+
+   TEST_CASE("automatic compression")
+   {
+      const abs_file_path tga_file{ testRoot / "test_images/tga_image.tga" };
+      const abs_file_path random_file{ testRoot / "test_images/binary0.bin" };
+      const decompression_table decomp_table{ .zstd = zstd_decompression, .lz4 = lz4_decompression };
+      const auto get_bytestream = [](const abs_file_path& file, const config& cfg) {
+         payload pl = get_payload(file, cfg);
+         return detail::get_final_bytestream(pl, cfg);
+      };
+
+      config cfg{};
+      cfg.compression = compression_mode::automatic;
+
+      // Compresses very well
+      const std::vector<uint8_t> tga_stream = get_bytestream(tga_file, cfg);
+      const uint64_t* tga_ptr = reinterpret_cast<const uint64_t*>(tga_stream.data());
+      CHECK_NE(get_header(tga_ptr).compression, 0);
+      CHECK_EQ(decode_to_vector<uint8_t>(tga_ptr, decomp_table), get_image_bytes(tga_file));
+
+      // Random data stays uncompressed
+      const std::vector<uint8_t> random_stream = get_bytestream(random_file, cfg);
+      const uint64_t* random_ptr = reinterpret_cast<const uint64_t*>(random_stream.data());
+      CHECK_EQ(get_header(random_ptr).compression, 0);
+      CHECK_EQ(decode_to_vector<uint8_t>(random_ptr, decomp_table), get_binary_file(random_file));
+
+      // No codec decodes that fast
+      cfg.auto_decode_budget_ms = 1.0e-9;
+      const std::vector<uint8_t> budget_stream = get_bytestream(tga_file, cfg);
+      CHECK_EQ(get_header(reinterpret_cast<const uint64_t*>(budget_stream.data())).compression, 0);
+   }
+
+
+   TEST_CASE("zstd dictionary")
+   {
+      // Many small and similar payloads, where every single one is too small to compress well on its own
+      const auto get_small_payloads = []() {
+         std::vector<payload> payloads;
+         for (int i = 0; i < 300; ++i)
+         {
+            const std::string text = R"({"id": )" + std::to_string(i)
+               + R"(, "name": "entity_)" + std::to_string(i * 7)
+               + R"(", "position": [)" + std::to_string(i % 13) + ", " + std::to_string(i % 17) + ", " + std::to_string(i % 19)
+               + R"(], "visible": )" + (i % 2 == 0 ? "true" : "false")
+               + R"(, "tags": ["static", "mesh"]})";
+            std::vector<uint8_t> bytes(text.begin(), text.end());
+            payloads.emplace_back(std::move(bytes), generic_binary{}, "entity_" + std::to_string(i) + ".json");
+         }
+         return payloads;
+      };
+      const auto get_total_size = [](std::vector<payload>& payloads, const config& cfg) {
+         size_t total = 0;
+         for (payload& pl : payloads)
+            total += detail::get_final_bytestream(pl, cfg).size();
+         return total;
+      };
+
+      config cfg{};
+      cfg.compression = compression_mode::zstd;
+      std::vector<payload> plain_payloads = get_small_payloads();
+      detail::add_zstd_dictionary(plain_payloads, cfg);
+      REQUIRE_EQ(plain_payloads.size(), 300);
+      const size_t plain_size = get_total_size(plain_payloads, cfg);
+
+      cfg.zstd_dictionary = true;
+      std::vector<payload> payloads = get_small_payloads();
+      const std::vector<uint8_t> expected(payloads[42].get_content().begin(), payloads[42].get_content().end());
+      const std::vector<uint8_t> override_expected(payloads[43].get_content().begin(), payloads[43].get_content().end());
+      detail::add_zstd_dictionary(payloads, cfg);
+      REQUIRE_EQ(payloads.size(), 301);
+      CHECK_EQ(payloads.front().m_name, "zstd_dictionary");
+
+      // The dictionary itself stays uncompressed
+      const std::vector<uint8_t> dictionary_stream = detail::get_final_bytestream(payloads.front(), cfg);
+      const uint64_t* dictionary_ptr = reinterpret_cast<const uint64_t*>(dictionary_stream.data());
+      CHECK_EQ(get_header(dictionary_ptr).type, 2);
+      CHECK_EQ(get_header(dictionary_ptr).compression, 0);
+      test_zstd_dictionary = decode_to_vector<uint8_t>(dictionary_ptr);
+
+      const std::vector<uint8_t> stream = detail::get_final_bytestream(payloads[43], cfg);
+      const uint64_t* ptr = reinterpret_cast<const uint64_t*>(stream.data());
+      CHECK_EQ(get_header(ptr).compression, 3);
+      const decompression_table decomp_table{ .zstd_dictionary = dictionary_decompression };
+      CHECK_EQ(decode_to_vector<uint8_t>(ptr, decomp_table), expected);
+
+      // Overridden levels and long range mode still use the dictionary. Baking consumes the content, so that's another payload.
+      config override_cfg = cfg;
+      override_cfg.compression_overrides.push_back(compression_override{
+         .pattern = "entity_43.json", .compression = compression_mode::zstd, .zstd_level = 19, .zstd_long_range = true
+      });
+      const std::vector<uint8_t> override_stream = detail::get_final_bytestream(payloads[44], override_cfg);
+      const uint64_t* override_ptr = reinterpret_cast<const uint64_t*>(override_stream.data());
+      CHECK_EQ(get_header(override_ptr).compression, 3);
+      CHECK_EQ(decode_to_vector<uint8_t>(override_ptr, decomp_table), override_expected);
+
+      // Including the dictionary, everything together is smaller
+      std::vector<payload> remaining = get_small_payloads();
+      detail::add_zstd_dictionary(remaining, cfg);
+      CHECK_LT(get_total_size(remaining, cfg), plain_size);
+   }
+
+
+   TEST_CASE("archive roundtrip")
+   {
+      config cfg;
+      cfg.output = output_mode::archive;
+      cfg.output_filename = "bb_archive_test.h";
+      cfg.archive_path = "bb_archive_test.bba";
+      cfg.payload_alignment = 64;
+      const abs_file_path binary_file{ testRoot / "test_images/binary0.bin" };
+      const abs_file_path image_file{ testRoot / "test_images/test_image_rgb.png" };
+      const abs_directory_path output_dir{ fs::temp_directory_path() };
+      write_payloads_to_file(cfg, get_payloads({ binary_file, image_file }, cfg), output_dir);
+
+      const std::vector<uint8_t> archive_bytes = get_binary_file(abs_file_path{ output_dir.get_path() / cfg.archive_path });
+      REQUIRE_EQ(archive_bytes.size() % sizeof(uint64_t), 0);
+      std::vector<uint64_t> archive(archive_bytes.size() / sizeof(uint64_t));
+      std::memcpy(archive.data(), archive_bytes.data(), archive_bytes.size());
+
+      REQUIRE(is_archive(archive.data()));
+      CHECK_EQ(get_archive_entry_count(archive.data()), 2);
+      CHECK_EQ(archive[2], archive_bytes.size());
+      CHECK_EQ(get_archive_payload(archive.data(), "missing.bin"), nullptr);
+
+      const uint64_t* binary_ptr = get_archive_payload(archive.data(), "binary0.bin");
+      REQUIRE_NE(binary_ptr, nullptr);
+      CHECK_EQ((binary_ptr - archive.data()) * sizeof(uint64_t) % 64, 0);
+      CHECK_EQ(decode_to_vector<uint8_t>(binary_ptr), get_binary_file(binary_file));
+
+      const uint64_t* image_ptr = get_archive_payload(archive.data(), "test_image_rgb.png");
+      REQUIRE_NE(image_ptr, nullptr);
+      CHECK(is_image(image_ptr));
+      CHECK_EQ(get_width(image_ptr), image<3>(image_file, image_vertical_direction::bottom_to_top).m_width);
+
+      std::ifstream header_file(output_dir.get_path() / cfg.output_filename);
+      const std::string header(std::istreambuf_iterator<char>(header_file), std::istreambuf_iterator<char>{});
+      CHECK_NE(header.find("alignas(64) static constexpr uint64_t bb_payload_archive[]"), std::string::npos);
+      CHECK_EQ(header.find("bb_binary0_bin[]"), std::string::npos);
+   }
+
 }
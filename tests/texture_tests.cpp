@@ -0,0 +1,192 @@
+#include <doctest/doctest.h>
+
+#include "decoding_tools.h"
+#include <binary_bakery_testpaths.h>
+
+#include <binary_bakery_lib/config.h>
+#include <binary_bakery_lib/file_tools.h>
+#include <binary_bakery_lib/image.h>
+#include <binary_bakery_lib/payload.h>
+#include <binary_bakery_lib/texture.h>
+
+
+using namespace bb;
+
+namespace {
+
+   using rgb = std::array<uint8_t, 3>;
+
+} // namespace {}
+
+
+namespace tests {
+
+   TEST_CASE("get_full_mip_count()")
+   {
+      CHECK_EQ(get_full_mip_count(1, 1), 1);
+      CHECK_EQ(get_full_mip_count(3, 2), 2);
+      CHECK_EQ(get_full_mip_count(256, 256), 9);
+      CHECK_EQ(get_full_mip_count(400, 200), 9);
+   }
+
+
+   TEST_CASE("mip chain with row pitch")
+   {
+      const abs_file_path source_file{ testRoot / "test_images/test_image_rgb.png" };
+      const decoded_image image = load_image(source_file, image_vertical_direction::bottom_to_top);
+
+      config cfg{};
+      cfg.image_mip_levels = 0;
+      cfg.image_row_alignment = 256;
+      payload pl = get_payload(source_file, cfg);
+      const std::vector<uint64_t> words = get_baked_words(pl, cfg);
+      const uint64_t* source = words.data();
+
+      CHECK(get_header(source).version & version_texture);
+      CHECK_EQ(get_texture_format(source), 0);
+      REQUIRE_EQ(get_mip_count(source), 2);
+      CHECK_EQ(get_width(source), 3);
+      CHECK_EQ(get_element_count(source), 6);
+
+      const mip_level base = get_mip_level(source, 0);
+      CHECK_EQ(base.width, 3);
+      CHECK_EQ(base.row_pitch, 256);
+      CHECK_EQ(base.byte_offset, 0);
+      CHECK_EQ(base.byte_size, 512);
+      const mip_level small = get_mip_level(source, 1);
+      CHECK_EQ(small.width, 1);
+      CHECK_EQ(small.height, 1);
+      CHECK_EQ(small.byte_offset, 512);
+      CHECK_EQ(get_decompressed_size(source), 768);
+
+      for (int y = 0; y < 2; ++y)
+      {
+         for (int x = 0; x < 3; ++x)
+         {
+            const uint8_t* expected = &image.bytes[(y * 3 + x) * 3];
+            CHECK_EQ(get_pixel<rgb>(source, x, y), rgb{ expected[0], expected[1], expected[2] });
+         }
+      }
+
+      // The 1x1 level is the average of the top left 2x2 pixels
+      rgb expected_average{};
+      for (int channel = 0; channel < 3; ++channel)
+      {
+         const int sum = image.bytes[channel] + image.bytes[3 + channel] + image.bytes[9 + channel] + image.bytes[12 + channel];
+         expected_average[channel] = static_cast<uint8_t>((sum + 2) / 4);
+      }
+      CHECK_EQ(get_pixel<rgb>(source, 0, 0, 1), expected_average);
+   }
+
+
+   TEST_CASE("get_bc1_block()")
+   {
+      std::array<rgb, 16> solid;
+      solid.fill(rgb{ 255, 0, 0 });
+      CHECK_EQ(get_bc1_block(solid), 0x0000'0000'F800'F800ull);
+
+      // Left half white, right half black: index 0 is color0 (white), index 1 color1 (black)
+      std::array<rgb, 16> halves;
+      for (int i = 0; i < 16; ++i)
+         halves[i] = i % 4 < 2 ? rgb{ 255, 255, 255 } : rgb{ 0, 0, 0 };
+      CHECK_EQ(get_bc1_block(halves), 0x5050'5050'0000'FFFFull);
+   }
+
+
+   TEST_CASE("BC1 textures")
+   {
+      // 6x6 has 2x2 blocks, the blocks at the borders repeat the last pixels
+      const std::vector<uint8_t> pixels(6 * 6 * 4, 255);
+      naive_image_type meta{ 6, 6, 4 };
+      meta.m_format = texture_format::bc1;
+      meta.m_mip_count = get_full_mip_count(6, 6);
+      meta.m_row_alignment = 32;
+      payload pl = get_payload(pixels, meta, "white");
+      const std::vector<uint64_t> words = get_baked_words(pl, config{});
+      const uint64_t* source = words.data();
+
+      CHECK_EQ(get_texture_format(source), 1);
+      REQUIRE_EQ(get_mip_count(source), 3);
+      CHECK_EQ(get_mip_level(source, 0).row_pitch, 32);
+      CHECK_EQ(get_mip_level(source, 0).byte_size, 64);
+      CHECK_EQ(get_mip_level(source, 1).byte_size, 32); // 3x3 is still one block
+      CHECK_EQ(get_mip_level(source, 2).byte_offset, 96);
+      CHECK_EQ(get_decompressed_size(source), 128);
+
+      const uint64_t* data = static_cast<const uint64_t*>(get_data_ptr(source));
+      CHECK_EQ(data[0], 0xFFFF'FFFFull);
+      CHECK_EQ(data[1], 0xFFFF'FFFFull);
+      CHECK_EQ(data[2], 0); // Row padding
+      CHECK_EQ(data[4], 0xFFFF'FFFFull);
+      CHECK_EQ(data[12], 0xFFFF'FFFFull);
+   }
+
+
+   TEST_CASE("convert_channels()")
+   {
+      const decoded_image rgb_image{ image_dimensions{ 2, 1, 3 }, { 10, 20, 30, 40, 50, 60 } };
+
+      config cfg{};
+      decoded_image unchanged = rgb_image;
+      convert_channels(unchanged, cfg);
+      CHECK_EQ(unchanged.bytes, rgb_image.bytes);
+
+      cfg.image_pad_to_rgba = true;
+      decoded_image padded = rgb_image;
+      convert_channels(padded, cfg);
+      CHECK_EQ(padded.dimensions.bpp, 4);
+      CHECK_EQ(padded.bytes, std::vector<uint8_t>{ 10, 20, 30, 255, 40, 50, 60, 255 });
+
+      cfg.image_swizzle = "bgra";
+      decoded_image swizzled = rgb_image;
+      convert_channels(swizzled, cfg);
+      CHECK_EQ(swizzled.bytes, std::vector<uint8_t>{ 30, 20, 10, 255, 60, 50, 40, 255 });
+
+      // Common channel maps have their own loops, the others look up the channels. Enough pixels for vector loops.
+      decoded_image large_image{ image_dimensions{ 67, 1, 4 }, std::vector<uint8_t>(67 * 4) };
+      for (size_t i = 0; i < large_image.bytes.size(); ++i)
+         large_image.bytes[i] = static_cast<uint8_t>(i);
+      for (const std::string swizzle : { "bgra", "abgr" })
+      {
+         cfg.image_swizzle = swizzle;
+         decoded_image large_swizzled = large_image;
+         convert_channels(large_swizzled, cfg);
+         REQUIRE_EQ(large_swizzled.bytes.size(), large_image.bytes.size());
+         bool is_swizzled = true;
+         for (size_t i = 0; i < large_image.bytes.size(); ++i)
+         {
+            const size_t source_channel = std::string_view{ "rgba" }.find(swizzle[i % 4]);
+            is_swizzled = is_swizzled && large_swizzled.bytes[i] == large_image.bytes[i - i % 4 + source_channel];
+         }
+         CHECK(is_swizzled);
+      }
+
+      // Grey and alpha
+      cfg.image_swizzle.clear();
+      cfg.image_premultiply_alpha = true;
+      decoded_image grey_alpha{ image_dimensions{ 2, 1, 2 }, { 200, 128, 100, 255 } };
+      convert_channels(grey_alpha, cfg);
+      CHECK_EQ(grey_alpha.bytes, std::vector<uint8_t>{ 100, 100, 100, 128, 100, 100, 100, 255 });
+
+      cfg.image_pad_to_rgba = false;
+      cfg.image_premultiply_alpha = false;
+      cfg.image_swizzle = "rgba";
+      decoded_image wrong_count = rgb_image;
+      CHECK_THROWS(convert_channels(wrong_count, cfg));
+   }
+
+
+   TEST_CASE("padded image payloads")
+   {
+      const abs_file_path source_file{ testRoot / "test_images/test_image_rgb.png" };
+      config cfg{};
+      cfg.image_pad_to_rgba = true;
+      cfg.image_swizzle = "bgra";
+      payload pl = get_payload(source_file, cfg);
+      const std::vector<uint64_t> words = get_baked_words(pl, cfg);
+      CHECK_EQ(get_header(words.data()).bpp, 4);
+      CHECK_EQ(get_decompressed_size(words.data()), 6 * 4);
+      CHECK_EQ(get_element<uint32_t>(words.data(), 0), 0xFFFF'0000); // Red as BGRA bytes: 0, 0, 255, 255
+   }
+
+}
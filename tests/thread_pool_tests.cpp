@@ -0,0 +1,50 @@
+#include <binary_bakery_lib/thread_pool.h>
+
+#include <doctest/doctest.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace bb;
+
+
+TEST_CASE("parallel_for visits every index once")
+{
+   thread_pool pool(4);
+   CHECK_EQ(pool.get_thread_count(), 4);
+
+   for (int repetition = 0; repetition < 10; ++repetition)
+   {
+      std::vector<int> visits(1000, 0);
+      pool.parallel_for(static_cast<int>(visits.size()), [&](const int i) {
+         ++visits[i];
+      });
+      CHECK_EQ(std::count(visits.begin(), visits.end(), 1), 1000);
+   }
+}
+
+
+TEST_CASE("parallel_for exceptions")
+{
+   thread_pool pool(4);
+   const auto throwing_job = [](const int i) {
+      if (i == 17)
+         throw std::runtime_error("job failed");
+   };
+   CHECK_THROWS_AS(pool.parallel_for(100, throwing_job), std::runtime_error);
+
+   // The pool must still be usable afterwards
+   std::atomic<int> sum = 0;
+   pool.parallel_for(100, [&](const int i) { sum += i; });
+   CHECK_EQ(sum.load(), 4950);
+}
+
+
+TEST_CASE("single-threaded pool")
+{
+   thread_pool pool(1);
+   CHECK_EQ(pool.get_thread_count(), 1);
+   int sum = 0;
+   pool.parallel_for(10, [&](const int i) { sum += i; });
+   CHECK_EQ(sum, 45);
+}
@@ -28,9 +28,42 @@ namespace
 }
 
 
+TEST_CASE("matches_glob()")
+{
+   CHECK(matches_glob("*.png", "image.png"));
+   CHECK(matches_glob("*.png", ".png"));
+   CHECK(matches_glob("im?ge.*", "image.png"));
+   CHECK(matches_glob("*", ""));
+   CHECK(matches_glob("a*b*c", "aXXbYYbc"));
+   CHECK_FALSE(matches_glob("*.png", "image.png.bak"));
+   CHECK_FALSE(matches_glob("*.png", "image.PNG"));
+   CHECK_FALSE(matches_glob("?", ""));
+}
+
+
+TEST_CASE("get_human_readable_time")
+{
+   CHECK_EQ(get_human_readable_time(2.5), "2.50 s");
+   CHECK_EQ(get_human_readable_time(0.0025), "2.50 ms");
+   CHECK_EQ(get_human_readable_time(0.0000025), "2.50 us");
+}
+
+
 TEST_CASE("get_human_readable_size")
 {
    CHECK_EQ(get_human_readable_size(byte_count{ 1024 * 1024 }), "1.00 MB");
    CHECK_EQ(get_human_readable_size(byte_count{ 1024 }), "1.00 KB");
    CHECK_EQ(get_human_readable_size(byte_count{ 1000 }), "1000 bytes");
 }
+
+
+TEST_CASE("get_xxh64()")
+{
+   // Reference values of the xxHash implementation
+   const std::string a = "a";
+   const std::string text = "Nobody inspects the spammish repetition";
+   CHECK_EQ(get_xxh64({}), 0xef46db3751d8e999);
+   CHECK_EQ(get_xxh64(std::span{ reinterpret_cast<const uint8_t*>(a.data()), a.size() }), 0xd24ec4f1a98c6e5b);
+   CHECK_EQ(get_xxh64(std::span{ reinterpret_cast<const uint8_t*>(text.data()), text.size() }), 0xfbcea83c8a378bf1);
+   CHECK_NE(get_xxh64({}, 1), get_xxh64({}));
+}